@@ -85,14 +85,15 @@ namespace qi
      * \brief Copy constructor.
      * \param buffer The buffer to copy.
      *
-     * As data are store as a shared pointer, the different copy
-     * of the same buffer all handle the same data.
+     * The copies of a buffer share the same data until one of them is modified,
+     * at which point it gets its own copy of the data (copy-on-write). Copying
+     * a buffer therefore does not depend on its size.
      */
     Buffer(const Buffer& buffer);
     /**
      * \brief Assignment operator.
-     * As data are store as a shared pointer, the different copy
-     * of the same buffer all handle the same data.
+     * The data is shared until one of the buffers is modified (see the copy
+     * constructor).
      * \param buffer The buffer to copy.
      */
     Buffer& operator = (const Buffer& buffer);
@@ -111,6 +112,8 @@ namespace qi
      */
     Buffer& operator = (Buffer&& buffer);
 
+    ~Buffer();
+
     /**
      * \brief Write data in the buffer.
      * \param data The data to write
@@ -141,6 +144,19 @@ namespace qi
      */
     const  Buffer& subBuffer(size_t offset) const;
 
+    /**
+     * \brief Return a buffer whose content is a range of the content of this
+     * buffer, without copying it.
+     * The returned buffer shares the data of this buffer like a copy does: the
+     * data is copied only when one of them is modified. Sub-buffers are not
+     * part of the slice.
+     * If the range exceeds the size of the buffer, throw a std::runtime_error.
+     * \param offset The offset of the range.
+     * \param length The size of the range.
+     * \return the slice.
+     */
+    Buffer slice(size_t offset, size_t length) const;
+
 
     /**
      * \brief Return the content size of this buffer not counting sub-buffers.
@@ -165,9 +181,12 @@ namespace qi
 
     /**
      * \brief Reserve bytes at the end of current buffer.
+     * If the data is shared with copies of this buffer, all of it is copied
+     * first: the cost of the call then depends on the size of the buffer.
      * \param size number of new bytes to reserve at the end of buffer.
      * \return a pointer to the data.
      * \warning The return value is valid until the next non-const operation.
+     * Writing through it after the buffer has been copied also modifies the copies.
      */
     void* reserve(size_t size);
     /**
@@ -178,7 +197,12 @@ namespace qi
 
     /**
      * \brief Return a pointer to the raw data storage of this buffer.
+     * If the data is shared with copies of this buffer, all of it is copied
+     * first: the cost of the call then depends on the size of the buffer. Use
+     * the const overload to only read the data.
      * \return the pointer to the data.
+     * \warning Writing through the pointer after the buffer has been copied
+     * also modifies the copies.
      */
     void* data();
     /**
@@ -213,6 +237,7 @@ namespace qi
     bool operator==(const Buffer& b) const;
   private:
     friend class BufferReader;
+    friend class BufferPrivate;
     // CS4251
     boost::shared_ptr<BufferPrivate> _p;
   };
@@ -277,6 +302,14 @@ namespace qi
      * \return Return the sub-buffer if any.
      */
     const Buffer& subBuffer();
+    /**
+     * \brief Return the next bytes as a buffer sharing their data (see
+     * Buffer::slice), and move forward the buffer cursor past them.
+     * If there are less than \a length bytes left, throw a std::runtime_error.
+     * \param length Number of bytes to read.
+     * \return the slice of the buffer.
+     */
+    Buffer readSlice(size_t length);
     /**
      * \brief Return the actual position in the buffer.
      * \return The current offset.
@@ -289,6 +322,60 @@ namespace qi
     size_t  _subCursor; // position in sub-buffers
   };
 
+  /**
+   * \brief Statistics of the pool from which buffers allocate the data that
+   * does not fit in their internal storage.
+   * \includename{qi/buffer.hpp}
+   * \see bufferPoolStats
+   */
+  struct BufferPoolStats
+  {
+    /// Bytes currently kept by the pool for later allocations.
+    size_t pooledBytes;
+    /// Highest value reached by pooledBytes.
+    size_t pooledBytesHighWater;
+    /// Number of allocations served by the pool.
+    qi::uint64_t hitCount;
+    /// Number of allocations of a pooled size served by the system allocator.
+    qi::uint64_t missCount;
+
+    /// \return the proportion of allocations of a pooled size served by the pool.
+    double hitRate() const
+    {
+      const qi::uint64_t count = hitCount + missCount;
+      return count ? static_cast<double>(hitCount) / count : 0.;
+    }
+  };
+
+  /**
+   * \brief Return the statistics of the buffer pool.
+   */
+  QI_API BufferPoolStats bufferPoolStats();
+
+  /**
+   * \brief Enable or disable the buffer pool.
+   * The pool is disabled by default, unless the environment variable
+   * QI_BUFFER_POOL is set to 1. When disabled, buffers allocate their data
+   * directly with the system allocator and the blocks kept by the pool are freed,
+   * except the ones cached by threads, which are freed when these threads exit.
+   * \param enabled Whether the pool must be used.
+   */
+  QI_API void setBufferPoolEnabled(bool enabled);
+
+  /**
+   * \brief Return true if the buffer pool is enabled.
+   */
+  QI_API bool isBufferPoolEnabled();
+
+  /**
+   * \brief Set the maximum number of bytes kept by the buffer pool.
+   * Freed blocks that would exceed it are given back to the system.
+   * The default value is 32 MiB, or the value of the environment variable
+   * QI_BUFFER_POOL_MAX_BYTES.
+   * \param maxBytes The maximum number of bytes.
+   */
+  QI_API void setBufferPoolMaxPooledBytes(size_t maxBytes);
+
   namespace detail {
     QI_API void printBuffer(std::ostream& stream, const Buffer& buffer);
   }
@@ -0,0 +1,357 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QI_COROUTINE_HPP_
+#define _QI_COROUTINE_HPP_
+
+/// @file
+/// Makes qi::Future awaitable and usable as the return type of a coroutine,
+/// with compilers supporting C++20 coroutines (QI_HAS_COROUTINES is then 1).
+/// The library itself does not need them: including this header from code
+/// built in an older standard defines nothing but QI_HAS_COROUTINES.
+///
+/// @code
+/// qi::Future<int> sum(qi::Strand& strand, MyServicePtr service)
+/// {
+///   co_await qi::resumeOn(strand);
+///   // Resumed on the strand after each awaited future.
+///   const int a = co_await service->async<int>("value", 1);
+///   const int b = co_await service->async<int>("value", 2);
+///   co_return a + b;
+/// }
+/// @endcode
+///
+/// Canceling the future of a coroutine cancels the future it awaits, so that
+/// the cancel callbacks of the promises it waits for are called. If that
+/// future ends up canceled, the `co_await` throws, and the future of the
+/// coroutine is canceled unless the coroutine catches the exception.
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+# if __has_include(<coroutine>)
+#  define QI_HAS_COROUTINES 1
+# endif
+#endif
+#ifndef QI_HAS_COROUTINES
+# define QI_HAS_COROUTINES 0
+#endif
+
+#if QI_HAS_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <boost/function.hpp>
+#include <qi/detail/executioncontext.hpp>
+#include <qi/future.hpp>
+
+namespace qi
+{
+  namespace detail
+  {
+    // Shared between the coroutine and the cancel callback of its promise,
+    // which may be called once the coroutine is over.
+    struct CoroutineCancelState
+    {
+      std::mutex mutex;
+      bool requested = false;
+      // Cancels the future the coroutine awaits, if any.
+      boost::function<void()> cancelAwaited;
+    };
+
+    inline void cancelCoroutine(CoroutineCancelState& state)
+    {
+      boost::function<void()> cancelAwaited;
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.requested = true;
+        cancelAwaited = state.cancelAwaited;
+      }
+      if (cancelAwaited)
+        cancelAwaited();
+    }
+
+    /// Part of the promise type of the coroutines returning a future which
+    /// does not depend on the type of the value.
+    class FutureCoroutinePromiseBase
+    {
+    public:
+      std::suspend_never initial_suspend() const noexcept
+      {
+        return {};
+      }
+
+      std::suspend_never final_suspend() const noexcept
+      {
+        return {};
+      }
+
+      /// The context resuming the coroutine after an awaited future is set,
+      /// or null to resume it in the thread setting the future.
+      ExecutionContext* executionContext() const
+      {
+        return _executionContext;
+      }
+
+      void setExecutionContext(ExecutionContext* context)
+      {
+        _executionContext = context;
+      }
+
+      /// Called when the coroutine starts awaiting a future, with the function
+      /// canceling it. Cancels it right away if the coroutine was canceled.
+      void setAwaited(boost::function<void()> cancel)
+      {
+        bool requested;
+        {
+          std::lock_guard<std::mutex> lock(_cancelState->mutex);
+          _cancelState->cancelAwaited = cancel;
+          requested = _cancelState->requested;
+        }
+        if (requested)
+          cancel();
+      }
+
+      void clearAwaited()
+      {
+        std::lock_guard<std::mutex> lock(_cancelState->mutex);
+        _cancelState->cancelAwaited.clear();
+      }
+
+    protected:
+      template <typename T>
+      void setFromCurrentException(Promise<T>& promise)
+      {
+        try
+        {
+          throw;
+        }
+        catch (const FutureException& e)
+        {
+          if (e.state() == FutureException::ExceptionState_FutureCanceled)
+            promise.setCanceled();
+          else
+            promise.setError(e.what());
+        }
+        catch (const std::exception& e)
+        {
+          promise.setError(e.what());
+        }
+        catch (...)
+        {
+          promise.setError("unknown exception");
+        }
+      }
+
+      template <typename T>
+      void watchCancel(Promise<T>& promise)
+      {
+        auto cancelState = _cancelState;
+        promise.setOnCancel([cancelState](Promise<T>&) {
+          cancelCoroutine(*cancelState);
+        });
+      }
+
+      ExecutionContext* _executionContext = nullptr;
+      const std::shared_ptr<CoroutineCancelState> _cancelState = std::make_shared<CoroutineCancelState>();
+    };
+
+    template <typename T>
+    class FutureCoroutinePromise : public FutureCoroutinePromiseBase
+    {
+    public:
+      FutureCoroutinePromise()
+      {
+        watchCancel(_promise);
+      }
+
+      Future<T> get_return_object()
+      {
+        return _promise.future();
+      }
+
+      template <typename U>
+      void return_value(U&& value)
+      {
+        _promise.setValue(std::forward<U>(value));
+      }
+
+      void unhandled_exception()
+      {
+        setFromCurrentException(_promise);
+      }
+
+    private:
+      Promise<T> _promise;
+    };
+
+    template <>
+    class FutureCoroutinePromise<void> : public FutureCoroutinePromiseBase
+    {
+    public:
+      FutureCoroutinePromise()
+      {
+        watchCancel(_promise);
+      }
+
+      Future<void> get_return_object()
+      {
+        return _promise.future();
+      }
+
+      void return_void()
+      {
+        _promise.setValue(nullptr);
+      }
+
+      void unhandled_exception()
+      {
+        setFromCurrentException(_promise);
+      }
+
+    private:
+      Promise<void> _promise;
+    };
+
+    template <typename P>
+    FutureCoroutinePromiseBase* futureCoroutinePromise(std::coroutine_handle<P> handle)
+    {
+      if constexpr (std::is_base_of<FutureCoroutinePromiseBase, P>::value)
+        return &handle.promise();
+      else
+        return nullptr;
+    }
+
+    /// Suspends the coroutine until the future is set, unless it already is.
+    template <typename T>
+    class FutureAwaiter
+    {
+    public:
+      explicit FutureAwaiter(Future<T> future)
+        : _future(std::move(future))
+      {
+      }
+
+      bool await_ready() const
+      {
+        return _future.isFinished();
+      }
+
+      template <typename P>
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle)
+      {
+        _promise = futureCoroutinePromise(handle);
+        ExecutionContext* const context = _promise ? _promise->executionContext() : nullptr;
+        if (_promise)
+          _promise->setAwaited(_future.makeCanceler());
+
+        // Whoever comes second, this function or the callback, resumes the
+        // coroutine. The awaiter is destroyed once it is resumed.
+        _future.connect([this, handle, context](const Future<T>&) {
+          if (!_suspended.exchange(true))
+            return;
+          if (context)
+            context->post([handle] { handle.resume(); });
+          else
+            handle.resume();
+        }, FutureCallbackType_Sync);
+        if (!_suspended.exchange(true))
+          return std::noop_coroutine();
+        // Set in the meantime: resume right away, without going through the
+        // context nor growing the stack.
+        return handle;
+      }
+
+      T await_resume()
+      {
+        if (_promise)
+          _promise->clearAwaited();
+        if constexpr (std::is_void<T>::value)
+          _future.value();
+        else
+          return _future.value();
+      }
+
+    private:
+      Future<T> _future;
+      FutureCoroutinePromiseBase* _promise = nullptr;
+      std::atomic<bool> _suspended{false};
+    };
+
+    /// Moves the coroutine to a context, see `resumeOn`.
+    class ResumeOnAwaiter
+    {
+    public:
+      explicit ResumeOnAwaiter(ExecutionContext& context)
+        : _context(&context)
+      {
+      }
+
+      bool await_ready() const
+      {
+        return false;
+      }
+
+      template <typename P>
+      bool await_suspend(std::coroutine_handle<P> handle)
+      {
+        if (auto promise = futureCoroutinePromise(handle))
+          promise->setExecutionContext(_context);
+        if (_context->isInThisContext())
+          return false;
+        _context->post([handle] { handle.resume(); });
+        return true;
+      }
+
+      void await_resume() const
+      {
+      }
+
+    private:
+      ExecutionContext* _context;
+    };
+  }
+
+  /// Awaiting a future suspends the coroutine until the future is set, and
+  /// gives its value. Throws if the future has an error or is canceled.
+  template <typename T>
+  detail::FutureAwaiter<T> operator co_await(Future<T> future)
+  {
+    return detail::FutureAwaiter<T>(std::move(future));
+  }
+
+  template <typename T>
+  detail::FutureAwaiter<T> operator co_await(FutureSync<T> future)
+  {
+    return detail::FutureAwaiter<T>(future.async());
+  }
+
+  /// Awaitable moving the coroutine to `context`, unless it already runs in
+  /// it. The coroutine is then resumed on `context` after each future it
+  /// awaits, if it returns a future. The context must not drop the
+  /// resumption, as a strand being joined does: the coroutine would never
+  /// end.
+  inline detail::ResumeOnAwaiter resumeOn(ExecutionContext& context)
+  {
+    return detail::ResumeOnAwaiter(context);
+  }
+}
+
+namespace std
+{
+  template <typename T, typename... Args>
+  struct coroutine_traits<qi::Future<T>, Args...>
+  {
+    using promise_type = qi::detail::FutureCoroutinePromise<T>;
+  };
+}
+
+#endif  // QI_HAS_COROUTINES
+
+#endif  // _QI_COROUTINE_HPP_
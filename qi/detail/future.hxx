@@ -7,6 +7,8 @@
 #ifndef _QI_DETAIL_FUTURE_HXX_
 #define _QI_DETAIL_FUTURE_HXX_
 
+#include <memory>
+#include <thread>
 #include <vector>
 #include <utility> // pair
 #include <boost/bind.hpp>
@@ -159,17 +161,40 @@ namespace detail {
 
     template <typename T>
     FutureBaseTyped<T>::FutureBaseTyped()
-      : _value()
+      : _firstCallbackState(0)
+      , _nextCallbacks(nullptr)
+      , _value()
       , _async(FutureCallbackType_Auto)
     {
+      _callbacksLock.clear();
     }
 
     template <typename T>
     FutureBaseTyped<T>::~FutureBaseTyped()
     {
-      boost::recursive_mutex::scoped_lock lock(mutex());
       if (_onDestroyed && state() == FutureState_FinishedWithValue)
         _onDestroyed(_value);
+
+      // Callbacks of a future which was never set.
+      CallbackNode* node = _nextCallbacks.load();
+      while (node && node != closedCallbacks())
+      {
+        CallbackNode* next = node->next;
+        delete node;
+        node = next;
+      }
+    }
+
+    template <typename T>
+    AtomicFlagLock FutureBaseTyped<T>::lockCallbacks()
+    {
+      AtomicFlagLock lock{_callbacksLock};
+      while (!lock)
+      {
+        std::this_thread::yield();
+        lock = AtomicFlagLock{_callbacksLock};
+      }
+      return lock;
     }
 
     template <typename T>
@@ -177,7 +202,7 @@ namespace detail {
     {
       CancelCallback onCancel;
       {
-        boost::recursive_mutex::scoped_lock lock(mutex());
+        auto lock = lockCallbacks();
         if (isFinished())
           return;
         requestCancel();
@@ -195,8 +220,8 @@ namespace detail {
     {
       bool doCancel = false;
       {
-        boost::recursive_mutex::scoped_lock lock(mutex());
-        _onCancel = onCancel;
+        auto lock = lockCallbacks();
+        _onCancel = std::move(onCancel);
         doCancel = isCancelRequested();
       }
       qi::Future<T> fut = promise.future();
@@ -205,35 +230,63 @@ namespace detail {
     }
 
     template <typename T>
-    void FutureBaseTyped<T>::executeCallbacks(bool defaultAsync, const Callbacks& callbacks, qi::Future<T>& future)
+    void FutureBaseTyped<T>::executeCallback(bool defaultAsync, const Callback& callback, qi::Future<T>& future)
     {
-      for (const auto& callback : callbacks)
-      {
-        const bool async = [&]{
-          if (callback.callType != FutureCallbackType_Auto)
-            return callback.callType != FutureCallbackType_Sync;
-          else
-            return defaultAsync != FutureCallbackType_Sync;
-        }();
-
-        if (async)
-          getEventLoop()->post(boost::bind(callback.callback, future));
+      const bool async = [&]{
+        if (callback.callType != FutureCallbackType_Auto)
+          return callback.callType != FutureCallbackType_Sync;
         else
-          try
-          {
-            callback.callback(future);
-          }
-          catch (const qi::PointerLockException&)
-          { // do nothing
-          }
-          catch (const std::exception& e)
-          {
-            qiLogError("qi.future") << "Exception caught in future callback " << e.what();
-          }
-          catch (...)
-          {
-            qiLogError("qi.future") << "Unknown exception caught in future callback";
-          }
+          return defaultAsync != FutureCallbackType_Sync;
+      }();
+
+      if (async)
+        getEventLoop()->post(boost::bind(callback.callback, future));
+      else
+        try
+        {
+          callback.callback(future);
+        }
+        catch (const qi::PointerLockException&)
+        { // do nothing
+        }
+        catch (const std::exception& e)
+        {
+          qiLogError("qi.future") << "Exception caught in future callback " << e.what();
+        }
+        catch (...)
+        {
+          qiLogError("qi.future") << "Unknown exception caught in future callback";
+        }
+    }
+
+    template <typename T>
+    void FutureBaseTyped<T>::executeCallbacks(qi::Future<T>& future)
+    {
+      const bool async = (_async != FutureCallbackType_Sync ? true : false);
+
+      // A continuation claiming the slot but not stored yet is run by its
+      // `connect`, which sees the slot closed.
+      if (_firstCallbackState.fetch_or(FirstCallbackState_Closed) & FirstCallbackState_Stored)
+      {
+        const Callback first = std::move(_firstCallback);
+        _firstCallback = Callback();
+        executeCallback(async, first, future);
+      }
+
+      CallbackNode* pushed = _nextCallbacks.exchange(closedCallbacks());
+      CallbackNode* ordered = nullptr;
+      while (pushed)
+      {
+        CallbackNode* next = pushed->next;
+        pushed->next = ordered;
+        ordered = pushed;
+        pushed = next;
+      }
+      while (ordered)
+      {
+        std::unique_ptr<CallbackNode> node(ordered);
+        ordered = node->next;
+        executeCallback(async, node->callback, future);
       }
     }
 
@@ -241,26 +294,35 @@ namespace detail {
     template <typename F> // FunctionObject<R()> F (R unconstrained)
     void FutureBaseTyped<T>::finish(qi::Future<T>& future, F&& finishTask)
     {
-      bool async;
-      Callbacks onResult;
+      if (!startFinish())
+        throw FutureException(FutureException::ExceptionState_PromiseAlreadySet);
+      try
       {
-        // report-ready + onResult() must be Atomic to avoid
-        // missing callbacks/double calls in case connect() is invoked at
-        // the same time
-        boost::recursive_mutex::scoped_lock lock(mutex());
-        if (!isRunning())
-          throw FutureException(FutureException::ExceptionState_PromiseAlreadySet);
+        // Publishes the state once the result is written.
         finishTask();
+      }
+      catch (...)
+      {
+        abortFinish();
+        throw;
+      }
 
-        async = (_async != FutureCallbackType_Sync ? true : false);
-        onResult = takeOutResultCallbacks();
-        clearCancelCallback();
-
-        // wake the waiting threads up
-        notifyFinish();
+      {
+        auto lock = lockCallbacks();
+        _onCancel.clear();
       }
-      // call the callbacks without the mutex
-      executeCallbacks(async, onResult, future);
+
+      // Once woken up, the waiting threads may destroy the promise and the
+      // futures they know of: this copy keeps the state alive until the
+      // callbacks have run.
+      qi::Future<T> keepAlive = future;
+
+      // wake the waiting threads up
+      notifyFinish();
+
+      // A continuation connected concurrently is either taken here or run
+      // by `connect`, never both.
+      executeCallbacks(keepAlive);
     }
 
     template <typename T>
@@ -307,8 +369,8 @@ namespace detail {
     template <typename T>
     void FutureBaseTyped<T>::setOnDestroyed(boost::function<void(ValueType)> f)
     {
-      boost::recursive_mutex::scoped_lock lock(mutex());
-      _onDestroyed = f;
+      auto lock = lockCallbacks();
+      _onDestroyed = std::move(f);
     }
 
     template <typename T>
@@ -319,40 +381,73 @@ namespace detail {
       if (state() == FutureState_None)
         throw FutureException(FutureException::ExceptionState_FutureInvalid);
 
-      bool ready;
+      // The result may be visible before the callbacks are closed: a callback
+      // connected once it is must not be queued for the setting thread.
+      if (isFinished())
       {
-        boost::recursive_mutex::scoped_lock lock(mutex());
-        ready = isFinished();
-        if (!ready)
-          _onResult.push_back(Callback(callback, type));
+        executeReadyCallback(future, callback, type);
+        return;
       }
 
-      // result already ready, notify the callback
-      if (ready)
+      // The first continuation goes to the inline slot.
+      unsigned int firstState = 0;
+      if (_firstCallbackState.compare_exchange_strong(firstState, FirstCallbackState_Claimed))
       {
-        const bool async = [&]{
-          if (type != FutureCallbackType_Auto)
-            return type != FutureCallbackType_Sync;
-          else
-            return _async != FutureCallbackType_Sync;
-        }();
-
-        auto soCalledEventLoop = getEventLoop();
-        if (async && soCalledEventLoop)
-        { // if no event loop was found (for example when exiting), force sync callbacks
-          soCalledEventLoop->post(boost::bind(callback, future));
-        }
-        else
+        _firstCallback = Callback(callback, type);
+        if (!(_firstCallbackState.fetch_or(FirstCallbackState_Stored) & FirstCallbackState_Closed))
+          return;
+        // The result was set in the meantime, without taking the slot.
+        _firstCallback = Callback();
+        executeReadyCallback(future, callback, type);
+        return;
+      }
+
+      if (!(firstState & FirstCallbackState_Closed))
+      {
+        std::unique_ptr<CallbackNode> node(new CallbackNode{Callback(callback, type), nullptr});
+        CallbackNode* head = _nextCallbacks.load();
+        while (head != closedCallbacks())
         {
-          try
+          node->next = head;
+          if (_nextCallbacks.compare_exchange_weak(head, node.get()))
           {
-            callback(future);
-          }
-          catch (const ::qi::PointerLockException&)
-          { /*do nothing*/
+            node.release();
+            return;
           }
         }
       }
+
+      // result already ready, notify the callback
+      executeReadyCallback(future, callback, type);
+    }
+
+    template <typename T>
+    void FutureBaseTyped<T>::executeReadyCallback(qi::Future<T>& future,
+                                                  const CallbackType& callback,
+                                                  FutureCallbackType type)
+    {
+      const bool async = [&]{
+        if (type != FutureCallbackType_Auto)
+          return type != FutureCallbackType_Sync;
+        else
+          return _async != FutureCallbackType_Sync;
+      }();
+
+      auto soCalledEventLoop = getEventLoop();
+      if (async && soCalledEventLoop)
+      { // if no event loop was found (for example when exiting), force sync callbacks
+        soCalledEventLoop->post(boost::bind(callback, future));
+      }
+      else
+      {
+        try
+        {
+          callback(future);
+        }
+        catch (const ::qi::PointerLockException&)
+        { /*do nothing*/
+        }
+      }
     }
 
     template <typename T>
@@ -370,21 +465,6 @@ namespace detail {
       return _value;
     }
 
-    template <typename T>
-    auto FutureBaseTyped<T>::takeOutResultCallbacks() -> Callbacks
-    {
-      Callbacks onResult;
-      using std::swap;
-      swap(onResult, _onResult);
-      return onResult;
-    }
-
-    template <typename T>
-    void FutureBaseTyped<T>::clearCancelCallback()
-    {
-      _onCancel.clear();
-    }
-
     template <typename T>
     void waitForFirstHelper(qi::Promise< qi::Future<T> >& prom,
                             qi::Future<T>& fut,
@@ -7,6 +7,8 @@
 #ifndef _QI_FUTURE_HPP_
 # define _QI_FUTURE_HPP_
 
+# include <atomic>
+# include <cstdint>
 # include <stdexcept>
 # include <type_traits>
 # include <vector>
@@ -966,11 +968,15 @@ namespace qi {
       void reportStart();
 
     protected:
+      /// Claims the right to set the result, which only one caller gets.
+      /// Returns false if the future is not running or is being set.
+      bool startFinish();
+      /// Gives back the right to set the result, if setting it failed.
+      void abortFinish();
       void reportValue();
       void reportError(const std::string &message);
       void requestCancel();
       void reportCanceled();
-      boost::recursive_mutex& mutex();
       void notifyFinish();
 
     public:
@@ -979,6 +985,11 @@ namespace qi {
 
 
     //common state shared between a Promise and multiple Futures
+    //
+    //The result is published by an atomic state, without lock: the first
+    //continuation is stored in an inline slot, the next ones in a lock-free
+    //list, both closed when the result is set. Only the cancel and destruction
+    //callbacks are guarded, by a spin lock held for a few instructions.
     template <typename T>
     class FutureBaseTyped : public FutureBase {
     public:
@@ -1015,29 +1026,59 @@ namespace qi {
         CallbackType callback;
         FutureCallbackType callType;
 
+        Callback()
+          : callType(FutureCallbackType_Auto)
+        {}
+
         Callback(CallbackType callback, FutureCallbackType callType)
           : callback(callback)
           , callType(callType)
         {}
       };
-      using Callbacks = std::vector<Callback>;
-      Callbacks                _onResult;
+      struct CallbackNode
+      {
+        Callback callback;
+        CallbackNode* next;
+      };
+
+      // Bits of `_firstCallbackState`.
+      enum FirstCallbackState : unsigned int
+      {
+        FirstCallbackState_Claimed = 1, ///< A continuation is being stored in the slot.
+        FirstCallbackState_Stored = 2,  ///< The continuation is stored.
+        FirstCallbackState_Closed = 4,  ///< The result is set, the slot is no longer used.
+      };
+
+      Callback                 _firstCallback;
+      std::atomic<unsigned int> _firstCallbackState;
+      // Pushed in reverse order, `closedCallbacks()` once the result is set.
+      std::atomic<CallbackNode*> _nextCallbacks;
       ValueType                _value;
       CancelCallback           _onCancel;
       boost::function<void (ValueType)> _onDestroyed;
+      // Guards `_onCancel` and `_onDestroyed`.
+      std::atomic_flag         _callbacksLock;
       std::atomic<FutureCallbackType> _async;
       qi::Atomic<unsigned int> _promiseCount;
 
       template <typename F> // FunctionObject<R()> F (R unconstrained)
       void finish(qi::Future<T>& future, F&& finishTask);
 
-      /// Take the callbacks set for handling the result and leave the member empty. Not thread-safe.
-      Callbacks takeOutResultCallbacks();
+      /// Closes the continuations to new callbacks and runs those already
+      /// connected, in the order of connection.
+      void executeCallbacks(qi::Future<T>& future);
+
+      static void executeCallback(bool defaultAsync, const Callback& callback, qi::Future<T>& future);
 
-      /// Clear the callback set for handling cancellation. Not thread-safe.
-      void clearCancelCallback();
+      /// Runs a callback connected once the result is set.
+      void executeReadyCallback(qi::Future<T>& future, const CallbackType& callback, FutureCallbackType type);
 
-      static void executeCallbacks(bool defaultAsync, const Callbacks& callbacks, qi::Future<T>& future);
+      AtomicFlagLock lockCallbacks();
+
+      static CallbackNode* closedCallbacks()
+      {
+        return reinterpret_cast<CallbackNode*>(std::uintptr_t(1));
+      }
     };
   }
 
@@ -11,6 +11,9 @@
 #  pragma warning( disable: 4503 ) // decorated name length
 # endif
 
+# include <string>
+# include <vector>
+
 # include <boost/asio/io_service.hpp>
 # include <boost/thread/synchronized_value.hpp>
 # include <boost/function.hpp>
@@ -31,6 +34,27 @@ namespace qi
   template<typename T> class Future;
 
   class EventLoopPrivate;
+
+  /// \brief Statistics of the threads of an event loop.
+  struct EventLoopStats
+  {
+    /// Number of threads running the tasks.
+    int threadCount;
+    /// Bounds of the number of threads, when it adapts to the load.
+    int minThreadCount;
+    int maxThreadCount;
+    /// Number of tasks queued or running.
+    qi::int64_t taskCount;
+    /// Number of tasks running.
+    qi::int64_t activeTaskCount;
+    /// Time the tasks waited in the queue, over the last measurement period.
+    qi::Duration queueLatencyMedian;
+    qi::Duration queueLatencyP99;
+    /// Number of threads spawned and retired since the start.
+    qi::uint64_t spawnedThreadCount;
+    qi::uint64_t retiredThreadCount;
+  };
+
   /**
    * \brief Class to handle eventloop.
    * \includename{qi/eventloop.hpp}
@@ -45,6 +69,26 @@ namespace qi
      *   - the value of the environment variable QI_EVENTLOOP_THREAD_COUNT if it's set,
      *   - the value returned by std::thread::hardware_concurrency() if it's greater than 3,
      *   - the fixed value of 3.
+     *
+     * The tasks are scheduled by the scheduler set with the command line option
+     * `--qi-eventloop-scheduler` or the environment variable QI_EVENTLOOP_SCHEDULER:
+     *   - `asio` (default): all the threads run the tasks from a single shared queue,
+     *   - `workstealing`: each thread has its own queue, the tasks posted from a thread of
+     *     the event loop go to its queue and idle threads steal from the other queues.
+     *
+     * Delayed tasks keep a precise timer each, unless QI_EVENTLOOP_TIMER_WHEEL_TICK_US
+     * is set: they are then kept in a timer wheel with a precision of that many
+     * microseconds, except the ones delayed by less than a tick or than
+     * QI_EVENTLOOP_PRECISE_DELAY_US microseconds (1000 by default).
+     *
+     * If spawnOnOverload is true, the number of threads adapts to the load, between
+     * nthreads and the maximum number of threads (QI_EVENTLOOP_MAX_THREADS, 150 by default):
+     * a thread is spawned when the 99th percentile of the time tasks wait in the queue stays
+     * above QI_EVENTLOOP_TARGET_LATENCY_US microseconds (10000 by default, 0 disables the
+     * adaptation), and one is retired when the threads stay idle for
+     * QI_EVENTLOOP_IDLE_RETIRE_MS milliseconds (5000 by default). Independently, a thread is
+     * spawned when a task does not start within QI_EVENTLOOP_PING_TIMEOUT milliseconds, and
+     * the emergency callback is called when this persists at the maximum number of threads.
      */
     explicit EventLoop(std::string name = "eventloop", int nthreads = 0, bool spawnOnOverload = true);
 
@@ -92,6 +136,12 @@ namespace qi
      */
     void setMaxThreads(unsigned int max);
 
+    /**
+     * \brief Returns the statistics of the threads of the event loop.
+     * \note It is safe to call this method concurrently.
+     */
+    EventLoopStats stats() const;
+
     /// \brief Internal function.
     void *nativeHandle();
 
@@ -165,7 +215,7 @@ namespace qi
 
     void postImpl(boost::function<void()> callback, ExecutionOptions options) override
     {
-      postDelayImpl(callback, qi::Duration(0), options);
+      postDelayImpl(std::move(callback), qi::Duration(0), options);
     }
 
     void postDelayImpl(boost::function<void()> callback, qi::Duration delay
@@ -187,6 +237,47 @@ namespace qi
   /// \brief Returns the global network eventloop, created on demand on first call.
   QI_API EventLoop* getNetworkEventLoop();
 
+  /// \brief Load of a shard of the network event loop.
+  struct EventLoopShardStats
+  {
+    /// Name of the event loop of the shard.
+    std::string name;
+    /// Number of connections currently assigned to the shard.
+    unsigned int connectionCount;
+    /// Number of connections assigned to the shard since its creation.
+    qi::uint64_t totalConnectionCount;
+  };
+
+  /**
+   * \brief Chooses the shard of a new connection.
+   * \param shards The load of every shard, never empty.
+   * \return The index of the chosen shard in `shards`.
+   */
+  using EventLoopShardPolicy = boost::function<std::size_t (const std::vector<EventLoopShardStats>& shards)>;
+
+  /// \brief Returns a policy assigning the connections to the shards in turn.
+  QI_API EventLoopShardPolicy roundRobinShardPolicy();
+
+  /// \brief Returns a policy assigning a connection to the shard with the fewest connections.
+  QI_API EventLoopShardPolicy leastLoadedShardPolicy();
+
+  /**
+   * \brief Sets the policy assigning the accepted connections to the shards of the network
+   * event loop.
+   *
+   * The network event loop is split in QI_NETWORK_EVENTLOOP_SHARDS independent event loops
+   * of one thread each (0 by default, meaning that all the connections use the network event
+   * loop). Each accepted connection is assigned to one shard, which receives, decodes, sends
+   * and dispatches its messages. By default, the shards are pinned to one CPU each, unless
+   * QI_NETWORK_EVENTLOOP_SHARD_AFFINITY is 0, and the policy is the one named by
+   * QI_NETWORK_EVENTLOOP_SHARD_POLICY: `roundrobin` (default) or `leastloaded`.
+   * \note It is safe to call this function concurrently.
+   */
+  QI_API void setNetworkEventLoopShardPolicy(EventLoopShardPolicy policy);
+
+  /// \brief Returns the load of the shards of the network event loop, empty if there is none.
+  QI_API std::vector<EventLoopShardStats> networkEventLoopShardStats();
+
   /**
    * \brief Starts the eventloop with nthread threads. Does nothing if already started.
    * \param nthread Set the minimum number of worker threads in the pool.
@@ -0,0 +1,55 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QI_MESSAGING_CALLADMISSION_HPP_
+#define _QI_MESSAGING_CALLADMISSION_HPP_
+
+#include <qi/api.hpp>
+#include <qi/types.hpp>
+
+namespace qi
+{
+  /**
+   * \brief Statistics on the admission of the calls received by the services
+   * of this process.
+   *
+   * Calls are subject to admission only if a limit is set, with the
+   * QI_MAX_CALLS_PER_SOCKET or QI_MAX_CALLS_PER_SERVICE environment
+   * variables. Over these limits, calls wait for running calls to finish,
+   * and the queue of each socket is served in turn. Calls are rejected when
+   * QI_MAX_QUEUED_CALLS_PER_SOCKET (100 by default) calls of their socket
+   * are already waiting.
+   *
+   * \includename{qi/messaging/calladmission.hpp}
+   * \see callAdmissionStats
+   */
+  struct CallAdmissionStats
+  {
+    /// Number of calls started as soon as they were received.
+    qi::uint64_t startedCount;
+    /// Number of calls which waited before being started.
+    qi::uint64_t queuedCount;
+    /// Number of calls rejected because their socket had too many calls
+    /// waiting.
+    qi::uint64_t rejectedCount;
+    /// Number of waiting calls dropped because their socket was
+    /// disconnected.
+    qi::uint64_t droppedCount;
+    /// Number of waiting calls canceled by their caller.
+    qi::uint64_t canceledCount;
+    /// Number of calls running now.
+    qi::uint64_t runningCalls;
+    /// Number of calls waiting now.
+    qi::uint64_t waitingCalls;
+  };
+
+  /**
+   * \brief Return the statistics on the admission of incoming calls.
+   */
+  QI_API CallAdmissionStats callAdmissionStats();
+}
+
+#endif  // _QI_MESSAGING_CALLADMISSION_HPP_
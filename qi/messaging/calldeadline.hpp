@@ -0,0 +1,80 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _QI_MESSAGING_CALLDEADLINE_HPP_
+#define _QI_MESSAGING_CALLDEADLINE_HPP_
+
+#include <boost/optional.hpp>
+#include <qi/api.hpp>
+#include <qi/clock.hpp>
+#include <qi/types.hpp>
+
+namespace qi
+{
+  /**
+   * \brief Sets the deadline of the remote calls made by the current thread,
+   * for the lifetime of the scope.
+   *
+   * A remote call whose deadline passes before its reply fails with an error,
+   * and is canceled on the remote end. The deadline goes with the call to
+   * remote ends advertising the CallDeadline capability: they do not start
+   * calls whose deadline passed, cancel the ones still running at the
+   * deadline, and apply it to the remote calls made synchronously by the
+   * called method.
+   *
+   * Scopes can be nested, the earliest deadline applies.
+   *
+   * \includename{qi/messaging/calldeadline.hpp}
+   */
+  class QI_API CallDeadlineScope
+  {
+  public:
+    explicit CallDeadlineScope(SteadyClockTimePoint deadline);
+    /// The deadline is `timeout` from now.
+    explicit CallDeadlineScope(Duration timeout);
+    ~CallDeadlineScope();
+
+    CallDeadlineScope(const CallDeadlineScope&) = delete;
+    CallDeadlineScope& operator=(const CallDeadlineScope&) = delete;
+
+  private:
+    boost::optional<SteadyClockTimePoint> _previous;
+  };
+
+  /**
+   * \brief Returns the deadline of a remote call made now by the current
+   * thread: the one of the innermost CallDeadlineScope, or else
+   * QI_REMOTE_CALL_TIMEOUT_MS milliseconds from now if this environment
+   * variable is set and not 0. Calls have no deadline otherwise.
+   */
+  QI_API boost::optional<SteadyClockTimePoint> currentCallDeadline();
+
+  /**
+   * \brief Statistics on the deadlines of remote calls, in this process.
+   * \includename{qi/messaging/calldeadline.hpp}
+   * \see callDeadlineStats
+   */
+  struct CallDeadlineStats
+  {
+    /// Number of remote calls made with a deadline.
+    qi::uint64_t callCount;
+    /// Number of these calls which failed because their deadline passed.
+    qi::uint64_t exceededCount;
+    /// Number of calls received with a deadline that had passed when they
+    /// were about to start, and which were not started.
+    qi::uint64_t skippedCount;
+    /// Number of calls received which were still running when their deadline
+    /// passed, and whose cancelation was requested.
+    qi::uint64_t canceledCount;
+  };
+
+  /**
+   * \brief Return the statistics on the deadlines of remote calls.
+   */
+  QI_API CallDeadlineStats callDeadlineStats();
+}
+
+#endif  // _QI_MESSAGING_CALLDEADLINE_HPP_
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <boost/shared_ptr.hpp>
 #include <boost/optional.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <ka/functional.hpp>
 #include <qi/trackable.hpp>
 #include <ka/typetraits.hpp>
@@ -32,6 +33,27 @@ namespace qi { namespace sock {
       ep.port()};
   }
 
+  /// The address of the endpoint, for logging purpose.
+  /// NetEndpoint E
+  template<typename E>
+  std::string addressString(const E& ep)
+  {
+    return ep.address().to_string();
+  }
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+  /// The URL of a local (unix domain) endpoint.
+  inline Url url(const boost::asio::local::stream_protocol::endpoint& ep, SslEnabled)
+  {
+    return Url{"unix://" + ep.path()};
+  }
+
+  inline std::string addressString(const boost::asio::local::stream_protocol::endpoint& ep)
+  {
+    return ep.path();
+  }
+#endif
+
   /// A polymorphic transformation that takes a procedure and returns a
   /// "stranded" equivalent.
   ///
@@ -302,6 +302,8 @@ namespace qi { namespace sock {
 ///         (ConstBufferSequence only constrained by the following)
 ///     && N::async_read(sslSocketLValue, mutable_bufs, transferHandler)
 ///     && N::async_read(sslSocketLValue.next_layer(), mutable_bufs, transferHandler)
+///     && N::async_read_some(sslSocketLValue, mutable_bufs, transferHandler)
+///     && N::async_read_some(sslSocketLValue.next_layer(), mutable_bufs, transferHandler)
 ///     && N::async_write(sslSocketLValue, const_bufs, transferHandler)
 ///     && N::async_write(sslSocketLValue.next_layer(), const_bufs, transferHandler)
 /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -311,6 +313,9 @@ namespace qi { namespace sock {
 /// - buffer creation
 /// - ...
 ///
+/// `async_read` completes when the whole buffer has been filled, whereas
+/// `async_read_some` completes as soon as at least one byte has been read.
+///
 /// Allows you to change the low-level network implementation.
 /// It has been designed to closely fit Boost.Asio, so as to incur no performance
 /// overhead.
@@ -91,6 +91,21 @@ namespace qi
 
     boost::optional<qi::int64_t> getSocketTimeWarnThresholdFromEnv();
 
+    /// Size of the buffer in which bytes are received before being parsed into
+    /// messages (see `receiveMessageBuffered`). Zero means that messages are
+    /// received one by one without intermediate buffer.
+    ///
+    /// Set with the environment variable QI_MESSAGE_RECEIVE_BUFFER_SIZE
+    /// (64 KiB by default).
+    std::size_t getReceiveBufferSizeFromEnv();
+
+    /// Bounds on the data gathered into a single write by the send queue (see
+    /// `SendMessageEnqueue`).
+    ///
+    /// Set with the environment variables QI_MESSAGE_SEND_BATCH_MAX_BYTES and
+    /// QI_MESSAGE_SEND_BATCH_MAX_BUFFERS.
+    SendBatchLimits getSendBatchLimitsFromEnv();
+
     /// Connected state of the socket.
     /// Allow to send and receive messages.
     ///
@@ -145,7 +160,8 @@ namespace qi
         ReceiveMessageContinuous<N> _receiveMsg;
         SendMessageEnqueue<N, SocketPtr<S>> _sendMsg;
 
-        Impl(const SocketPtr<S>& socket);
+        Impl(const SocketPtr<S>& socket, std::size_t receiveBufferSize,
+          SendBatchLimits sendBatchLimits);
         ~Impl();
 
         template<typename Proc>
@@ -205,15 +221,20 @@ namespace qi
     public:
       /// If `onReceive` returns `false`, this stops the message receiving.
       ///
+      /// A non-zero `receiveBufferSize` enables buffered reception (see
+      /// `receiveMessageBuffered`).
+      ///
       /// Procedure<bool (ErrorCode<N>, const Message*)> Proc
       template<typename Proc>
       Connected(const SocketPtr<S>&, SslEnabled ssl, size_t maxPayload, const Proc& onReceive,
-        qi::int64_t messageHandlingTimeoutInMus = getSocketTimeWarnThresholdFromEnv().value_or(0));
+        qi::int64_t messageHandlingTimeoutInMus = getSocketTimeWarnThresholdFromEnv().value_or(0),
+        std::size_t receiveBufferSize = getReceiveBufferSizeFromEnv(),
+        SendBatchLimits sendBatchLimits = getSendBatchLimitsFromEnv());
 
       /// If `onSent` returns false, the processing of enqueued messages stops.
       /// By default, we continue sending messages even if an error occurred.
       ///
-      /// Procedure<bool (ErrorCode<N>, std::list<Message>::const_iterator)>
+      /// Procedure<bool (ErrorCode<N>, SendMessageEnqueue<N, SocketPtr<S>>::ReadableMessage)>
       template<typename Msg, typename Proc = ka::constant_function_t<bool>>
       void send(Msg&& msg, SslEnabled ssl, const Proc& onSent = {true})
       {
@@ -242,18 +263,21 @@ namespace qi
     template<typename N, typename S>
     template<typename Proc>
     Connected<N, S>::Connected(const SocketPtr<S>& socket, SslEnabled ssl, size_t maxPayload,
-        const Proc& onReceive, qi::int64_t messageHandlingTimeoutInMus)
-      : _impl(std::make_shared<Impl>(socket))
+        const Proc& onReceive, qi::int64_t messageHandlingTimeoutInMus,
+        std::size_t receiveBufferSize, SendBatchLimits sendBatchLimits)
+      : _impl(std::make_shared<Impl>(socket, receiveBufferSize, sendBatchLimits))
     {
       _impl->start(ssl, maxPayload, onReceive, messageHandlingTimeoutInMus);
     }
 
     template<typename N, typename S>
-    Connected<N, S>::Impl::Impl(const SocketPtr<S>& s)
+    Connected<N, S>::Impl::Impl(const SocketPtr<S>& s, std::size_t receiveBufferSize,
+        SendBatchLimits sendBatchLimits)
       : _result{ boost::make_shared<SyncConnectedResult<N, S>>(ConnectedResult<N, S>{ s }) }
       , _stopRequested(false)
       , _shuttingdown(false)
-      , _sendMsg{s}
+      , _receiveMsg{receiveBufferSize}
+      , _sendMsg{s, sendBatchLimits}
     {
     }
 
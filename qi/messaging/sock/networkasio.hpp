@@ -48,6 +48,12 @@ namespace qi { namespace sock {
     {
       boost::asio::async_read(s, b, h);
     }
+    /// NetSslSocket S, MutableBufferSequence B, ReadHandler H
+    template<typename S, typename B, typename H>
+    static void async_read_some(S& s, const B& b, H h)
+    {
+      s.async_read_some(b, h);
+    }
     /// NetSslSocket S, ConstBufferSequence B, WriteHandler H
     template<typename S, typename B, typename H>
     static void async_write(S& s, const B& b, H h)
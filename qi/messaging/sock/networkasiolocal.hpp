@@ -0,0 +1,178 @@
+#pragma once
+#ifndef _QI_SOCK_NETWORKASIOLOCAL_HPP
+#define _QI_SOCK_NETWORKASIOLOCAL_HPP
+#include <atomic>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <qi/messaging/sock/networkasio.hpp>
+#include <qi/messaging/sock/option.hpp>
+
+/// @file
+/// Contains the implementation of the Network concept for boost::asio local
+/// (unix domain) stream sockets.
+///
+/// URLs are of the form `unix:///path/to/socket`: the host part is the path of
+/// the socket file and the port is not used.
+///
+/// See traits.hpp
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+# define QI_SOCK_HAS_LOCAL_SOCKETS 1
+
+namespace qi { namespace sock {
+
+  /// "Resolves" a URL of a local socket into its endpoint, that is the path of
+  /// the socket file. No lookup is needed, but this lets local sockets go
+  /// through the same connecting steps as TCP sockets.
+  ///
+  /// Models the NetResolver concept. The handler passed to `async_resolve` is
+  /// called with `operationAborted` if the resolver is cancelled or destroyed
+  /// before.
+  class LocalResolver
+  {
+  public:
+    using endpoint_type = boost::asio::local::stream_protocol::endpoint;
+
+    struct query
+    {
+      enum flags { all_matching };
+      std::string path;
+      query(std::string host, std::string /*port*/, flags = all_matching)
+        : path(std::move(host))
+      {
+      }
+    };
+
+    /// Local endpoints have no IP address. This lets them go through the IP
+    /// version filtering of the resolve step.
+    struct endpoint_with_address : endpoint_type
+    {
+      struct address_type
+      {
+        bool is_v6() const { return false; }
+      };
+
+      explicit endpoint_with_address(const endpoint_type& ep)
+        : endpoint_type(ep)
+      {
+      }
+
+      address_type address() const { return {}; }
+    };
+
+    class entry
+    {
+      endpoint_type _endpoint;
+    public:
+      explicit entry(const endpoint_type& ep = {})
+        : _endpoint(ep)
+      {
+      }
+
+      endpoint_with_address endpoint() const
+      {
+        return endpoint_with_address{_endpoint};
+      }
+
+      operator endpoint_type() const
+      {
+        return _endpoint;
+      }
+    };
+
+    /// Iterates over a single entry. A default-constructed iterator is the end.
+    class iterator
+    {
+      boost::shared_ptr<const entry> _entry;
+    public:
+      using value_type = entry;
+      using iterator_category = std::forward_iterator_tag;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const value_type*;
+      using reference = const value_type&;
+
+      iterator() = default;
+      explicit iterator(const endpoint_type& ep)
+        : _entry(boost::make_shared<const entry>(ep))
+      {
+      }
+
+      reference operator*() const { return *_entry; }
+      pointer operator->() const { return _entry.get(); }
+      iterator& operator++() { _entry.reset(); return *this; }
+      iterator operator++(int) { auto it = *this; ++*this; return it; }
+      friend bool operator==(const iterator& a, const iterator& b) { return a._entry == b._entry; }
+      friend bool operator!=(const iterator& a, const iterator& b) { return !(a == b); }
+    };
+
+    explicit LocalResolver(boost::asio::io_service& io)
+      : _io(&io)
+      , _cancelled(boost::make_shared<std::atomic<bool>>(false))
+    {
+    }
+
+    LocalResolver(LocalResolver&&) = default;
+    LocalResolver& operator=(LocalResolver&&) = default;
+
+    ~LocalResolver()
+    {
+      cancel();
+    }
+
+    /// Procedure<void (boost::system::error_code, iterator)> H
+    template<typename H>
+    void async_resolve(const query& q, H handler)
+    {
+      auto cancelled = _cancelled;
+      const endpoint_type ep{q.path};
+      _io->post([=]() mutable {
+        if (*cancelled)
+          handler(boost::system::error_code{boost::asio::error::operation_aborted}, iterator{});
+        else
+          handler(boost::system::error_code{}, iterator{ep});
+      });
+    }
+
+    void cancel()
+    {
+      if (_cancelled) // Not moved-from.
+        *_cancelled = true;
+    }
+
+    boost::asio::io_service& get_io_service()
+    {
+      return *_io;
+    }
+
+  private:
+    boost::asio::io_service* _io;
+    boost::shared_ptr<std::atomic<bool>> _cancelled;
+  };
+
+  /// Model the `Network` concept for boost::asio local stream sockets.
+  ///
+  /// SSL is never enabled on local sockets but the types must exist: they
+  /// are the ones of NetworkAsio over a local socket.
+  struct NetworkAsioLocal : NetworkAsio
+  {
+    using acceptor_type = boost::asio::local::stream_protocol::acceptor;
+    using resolver_type = LocalResolver;
+    using ssl_socket_type = boost::asio::ssl::stream<boost::asio::local::stream_protocol::socket>;
+    // Local sockets do not delay small writes.
+    using socket_option_no_delay_type = NoSocketOption;
+    using accept_option_reuse_address_type = boost::asio::local::stream_protocol::acceptor::reuse_address;
+
+    /// Keepalive does not apply to local sockets: the peer is on the same host
+    /// and the kernel reports its death immediately.
+    static void setSocketNativeOptions(boost::asio::local::stream_protocol::socket::native_handle_type, int)
+    {
+    }
+  };
+}} // namespace qi::sock
+
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+#endif // _QI_SOCK_NETWORKASIOLOCAL_HPP
@@ -66,6 +66,25 @@ namespace qi { namespace sock {
     }
   };
 
+  /// Option for networks that do not support it: setting it does nothing.
+  struct NoSocketOption
+  {
+    NoSocketOption(bool) {}
+  };
+
+  /// NetLowestSocket L, NetOption O
+  template<typename L, typename O>
+  void setOption(L& socket, const O& option)
+  {
+    socket.set_option(option);
+  }
+
+  /// NetLowestSocket L
+  template<typename L>
+  void setOption(L&, const NoSocketOption&)
+  {
+  }
+
   /// Set default options on a socket, including the timeout.
   ///
   /// Network N,
@@ -78,7 +97,7 @@ namespace qi { namespace sock {
     // Transmit each Message without delay
     try
     {
-      (*socket).lowest_layer().set_option(sock::SocketOptionNoDelay<N>{true});
+      setOption((*socket).lowest_layer(), sock::SocketOptionNoDelay<N>{true});
     }
     catch (const std::exception& e)
     {
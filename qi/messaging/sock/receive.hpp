@@ -9,10 +9,15 @@
 #include <ka/src.hpp>
 #include "src/messaging/message.hpp"
 #include <qi/trackable.hpp>
+#include <qi/buffer.hpp>
 #include <qi/log.hpp>
+#include <qi/assert.hpp>
 #include <ka/macroregular.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/optional.hpp>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 /// @file
 /// Contains functions and types related to message reception on a socket.
@@ -125,6 +130,39 @@
 ///  implementing the `Trackable` 'interface'.
 ///
 ///
+/// ## Buffered message reception
+///
+/// `receiveMessage` issues two reads per message (header, then payload). For
+/// streams of small messages, this costs two system calls and two handler
+/// dispatches per message.
+///
+/// `receiveMessageBuffered` is an alternative receive loop that reads as many
+/// bytes as are available into a `ReceiveBuffer` and then parses as many
+/// complete messages as possible from it before reading again:
+///
+/// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+///           start
+///             |
+///             v
+///   complete msg in buffer? --- no ---> async read some --> append to buffer
+///             | yes      ^                                        |
+///             v          |________________________________________|
+/// pass msg/error to upper layer*
+///             |
+///       must continue? --- yes ---> (back to "complete msg in buffer?")
+///             | no
+///             v
+///            stop
+/// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+///
+/// Messages whose size exceeds the capacity of the receive buffer are not
+/// accumulated in it: the bytes already buffered are moved into the message and
+/// the rest of the payload is read directly into the message buffer.
+///
+/// `ReceiveMessageContinuous` uses this loop if it is constructed with a
+/// non-zero receive buffer size.
+///
+///
 /// ## Data exchange through layers
 ///
 /// Finally, this is how data is exchanged through callbacks between the
@@ -262,7 +300,7 @@ namespace qi { namespace sock {
       if (header.magic != Message::Header::magicCookie)
       {
         qiLogWarning(logCategory()) << &(*socket) << ": Incorrect magic from "
-          << (*socket).lowest_layer().remote_endpoint().address().to_string()
+          << addressString((*socket).lowest_layer().remote_endpoint())
           << " (expected " << Message::Header::magicCookie
           << ", got " << header.magic << ").";
         receiveErrorAndMaybeReceiveNext(fault<ErrorCode<N>>());
@@ -336,6 +374,306 @@ namespace qi { namespace sock {
     }
   }
 
+  /// Storage for bytes read from a socket but not yet parsed into messages.
+  ///
+  /// Unconsumed bytes are always kept contiguous, so that a message header or
+  /// payload can be read in place. When the free space at the end of the
+  /// storage runs out, unconsumed bytes are moved back to the front (they are
+  /// at most one partial message, so this is cheap).
+  ///
+  /// Payloads can be sliced out of the storage without being copied. The
+  /// storage is then never written again: the unconsumed bytes are moved to a
+  /// new storage instead, and the previous one is freed with its last slice.
+  class ReceiveBuffer
+  {
+    Buffer _storage;
+    std::size_t _begin = 0u;
+    std::size_t _end = 0u;
+    bool _sliced = false;
+  public:
+  // Custom:
+    explicit ReceiveBuffer(std::size_t capacity = 0u)
+    {
+      if (capacity != 0u)
+      {
+        _storage.reserve(capacity);
+      }
+    }
+
+    std::size_t capacity() const
+    {
+      return _storage.size();
+    }
+
+    /// Number of bytes received but not consumed yet.
+    std::size_t size() const
+    {
+      return _end - _begin;
+    }
+
+    const unsigned char* data() const
+    {
+      return static_cast<const unsigned char*>(
+        static_cast<const Buffer&>(_storage).data()) + _begin;
+    }
+
+    /// Marks `n` bytes as parsed.
+    /// Precondition: n <= size()
+    void consume(std::size_t n)
+    {
+      QI_ASSERT(n <= size());
+      _begin += n;
+      if (_begin == _end)
+      {
+        _begin = _end = 0u;
+      }
+    }
+
+    /// Returns a buffer referring to the next `n` bytes without copying them,
+    /// and marks them as parsed.
+    /// Precondition: n <= size()
+    Buffer slice(std::size_t n)
+    {
+      QI_ASSERT(n <= size());
+      if (n == 0u)
+      {
+        return Buffer{};
+      }
+      Buffer slice = _storage.slice(_begin, n);
+      _sliced = true;
+      consume(n);
+      return slice;
+    }
+
+    /// Drops all unconsumed bytes.
+    void clear()
+    {
+      _begin = _end = 0u;
+    }
+
+    /// Returns the address where the next bytes can be received.
+    /// Unconsumed bytes are moved to the front of the storage if needed to
+    /// maximize the free space, or to a new storage if the current one has
+    /// been sliced.
+    unsigned char* prepare()
+    {
+      if (_sliced)
+      {
+        Buffer storage;
+        auto newData = static_cast<unsigned char*>(storage.reserve(capacity()));
+        std::memcpy(newData, data(), size());
+        _storage = std::move(storage);
+        _sliced = false;
+        _end -= _begin;
+        _begin = 0u;
+      }
+      else if (_begin != 0u)
+      {
+        auto storageData = static_cast<unsigned char*>(_storage.data());
+        std::memmove(storageData, storageData + _begin, size());
+        _end -= _begin;
+        _begin = 0u;
+      }
+      return static_cast<unsigned char*>(_storage.data()) + _end;
+    }
+
+    /// Number of bytes that can be received at the address returned by
+    /// `prepare()`.
+    std::size_t freeSize() const
+    {
+      return capacity() - _end;
+    }
+
+    /// Marks `n` bytes, received at the address returned by `prepare()`, as
+    /// available for parsing.
+    /// Precondition: n <= freeSize()
+    void commit(std::size_t n)
+    {
+      QI_ASSERT(n <= freeSize());
+      _end += n;
+    }
+  };
+
+  /// Same as `receiveMessage` but reads the socket by chunks into the given
+  /// receive buffer, and parses as many messages as possible from each chunk.
+  ///
+  /// The message buffer is a slice of the receive buffer: the payload is not
+  /// copied. If the whole message cannot fit in the receive buffer, the bytes
+  /// already received are copied into the message buffer and the rest of the
+  /// payload is read directly into it.
+  ///
+  /// Precondition: The receive buffer must be valid until the handler has been
+  ///   called, and its capacity must be at least the size of a message header.
+  ///
+  /// Precondition: The receive buffer must not be shared between several
+  ///   sockets, nor between several concurrent calls.
+  ///
+  /// Network N,
+  /// Mutable<SslSocket<N>> S,
+  /// Mutable<Message> M,
+  /// Procedure<Optional<M> (ErrorCode<N>, M)> Proc,
+  /// Transformation<Procedure> F0,
+  /// Transformation<Procedure<void (Args...)>> F1
+  template<typename N, typename S, typename M, typename Proc, typename F0 = ka::id_transfo_t, typename F1 = ka::id_transfo_t>
+  void receiveMessageBuffered(const S& socket, ReceiveBuffer* recvBuffer, M ptrMsg,
+    SslEnabled ssl, size_t maxPayload, Proc onReceive,
+    F0 lifetimeTransfo = F0{}, F1 syncTransfo = F1{});
+
+  namespace detail
+  {
+    /// Network N,
+    /// Mutable<SslSocket<N>> S,
+    /// MutableBufferSequence B,
+    /// NetTransferHandler H
+    template<typename N, typename S, typename B, typename H>
+    void asyncReadSome(const S& socket, SslEnabled ssl, const B& buffer, const H& handler)
+    {
+      if (*ssl)
+      {
+        N::async_read_some(*socket, buffer, handler);
+      }
+      else
+      {
+        N::async_read_some((*socket).next_layer(), buffer, handler);
+      }
+    }
+
+    /// Network N,
+    /// Mutable<SslSocket<N>> S,
+    /// MutableBufferSequence B,
+    /// NetTransferHandler H
+    template<typename N, typename S, typename B, typename H>
+    void asyncRead(const S& socket, SslEnabled ssl, const B& buffer, const H& handler)
+    {
+      if (*ssl)
+      {
+        N::async_read(*socket, buffer, handler);
+      }
+      else
+      {
+        N::async_read((*socket).next_layer(), buffer, handler);
+      }
+    }
+  } // namespace detail
+
+  /// Network N,
+  /// Mutable<SslSocket<N>> S,
+  /// Mutable<Message> M,
+  /// Procedure<Optional<M> (ErrorCode<N>, M)> Proc,
+  /// Transformation<Procedure> F0,
+  /// Transformation<Procedure<void (Args...)>> F1
+  template<typename N, typename S, typename M, typename Proc, typename F0, typename F1>
+  void receiveMessageBuffered(const S& socket, ReceiveBuffer* recvBuffer, M ptrMsg,
+    SslEnabled ssl, size_t maxPayload, Proc onReceive,
+    F0 lifetimeTransfo, F1 syncTransfo)
+  {
+    static const std::size_t headerSize = sizeof(Message::Header);
+    QI_ASSERT(recvBuffer->capacity() >= headerSize);
+
+    auto receiveNext = [&](M ptrNextMsg) {
+      receiveMessageBuffered<N>(socket, recvBuffer, ptrNextMsg, ssl, maxPayload,
+        onReceive, lifetimeTransfo, syncTransfo);
+    };
+
+    // The data remaining in the buffer cannot be trusted anymore after an
+    // error, as we have lost track of message boundaries.
+    auto receiveErrorAndMaybeReceiveNext = [&](ErrorCode<N> erc) {
+      recvBuffer->clear();
+      if (auto optionalPtrMsg = onReceive(erc, M{}))
+      {
+        receiveNext(*optionalPtrMsg);
+      }
+    };
+
+    // We parse as many complete messages as possible from the bytes we
+    // already have before reading the socket again.
+    while (recvBuffer->size() >= headerSize)
+    {
+      auto& msg = *ptrMsg;
+      std::memcpy(&msg.header(), recvBuffer->data(), headerSize);
+      const auto& header = msg.header();
+      if (header.magic != Message::Header::magicCookie)
+      {
+        qiLogWarning(logCategory()) << &(*socket) << ": Incorrect magic from "
+          << addressString((*socket).lowest_layer().remote_endpoint())
+          << " (expected " << Message::Header::magicCookie
+          << ", got " << header.magic << ").";
+        receiveErrorAndMaybeReceiveNext(fault<ErrorCode<N>>());
+        return;
+      }
+      const std::size_t payload = header.size;
+      if (payload > maxPayload)
+      {
+        qiLogWarning(logCategory()) << "Receiving message of size " << payload
+          << " above maximum configured payload size " << maxPayload <<
+             " (configure with environment variable QI_MAX_MESSAGE_PAYLOAD).";
+        receiveErrorAndMaybeReceiveNext(messageSize<ErrorCode<N>>());
+        return;
+      }
+      const std::size_t bufferedPayload = recvBuffer->size() - headerSize;
+      if (bufferedPayload < payload && headerSize + payload <= recvBuffer->capacity())
+      {
+        // The message will fit in the receive buffer once we have read more.
+        break;
+      }
+      recvBuffer->consume(headerSize);
+
+      if (bufferedPayload < payload)
+      {
+        // The message is too big for the receive buffer: we move what we have
+        // into the message buffer, and the rest of the payload is read
+        // directly into it.
+        auto messageBuffer = msg.extractBuffer();
+        auto payloadPtr = static_cast<unsigned char*>(messageBuffer.reserve(payload));
+        std::memcpy(payloadPtr, recvBuffer->data(), bufferedPayload);
+        msg.setBuffer(std::move(messageBuffer));
+        recvBuffer->consume(bufferedPayload);
+
+        auto readData = lifetimeTransfo([=](ErrorCode<N> erc, std::size_t /*len*/) mutable {
+          if (auto optionalPtrNextMsg = onReceive(erc, ptrMsg))
+          {
+            receiveMessageBuffered<N>(socket, recvBuffer, *optionalPtrNextMsg, ssl,
+              maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+          }
+        });
+        detail::asyncRead<N>(socket, ssl,
+          N::buffer(payloadPtr + bufferedPayload, payload - bufferedPayload),
+          syncTransfo(readData));
+        return;
+      }
+
+      // The whole payload is available: the message refers to it in place.
+      msg.setBuffer(recvBuffer->slice(payload));
+
+      auto optionalPtrNextMsg = onReceive(success<ErrorCode<N>>(), ptrMsg);
+      if (!optionalPtrNextMsg)
+      {
+        return;
+      }
+      ptrMsg = *optionalPtrNextMsg;
+    }
+
+    // We need more bytes to complete the next message.
+    auto readSome = syncTransfo(lifetimeTransfo([=](ErrorCode<N> erc, std::size_t len) mutable {
+      if (erc)
+      {
+        recvBuffer->clear();
+        if (auto optionalPtrMsg = onReceive(erc, M{}))
+        {
+          receiveMessageBuffered<N>(socket, recvBuffer, *optionalPtrMsg, ssl,
+            maxPayload, onReceive, lifetimeTransfo, syncTransfo);
+        }
+        return;
+      }
+      // When using SSL, we are sometimes called spuriously with no data.
+      recvBuffer->commit(len);
+      receiveMessageBuffered<N>(socket, recvBuffer, ptrMsg, ssl, maxPayload,
+        onReceive, lifetimeTransfo, syncTransfo);
+    }));
+    unsigned char* const freeSpace = recvBuffer->prepare();
+    detail::asyncReadSome<N>(socket, ssl, N::buffer(freeSpace, recvBuffer->freeSize()), readSome);
+  }
+
   /// Receive continuously messages until told to stop.
   ///
   /// A handler is called when a message is received.
@@ -354,6 +692,9 @@ namespace qi { namespace sock {
   /// A sync procedure transformation can also be provided to wrap any
   /// handler passed to the network. A typical use is to strand the handler.
   ///
+  /// If constructed with a non-zero receive buffer size, messages are received
+  /// with `receiveMessageBuffered` instead of `receiveMessage`.
+  ///
   /// Example: receiving messages until an error occurs
   /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
   /// ReceiveMessageContinuous<N> c{socket, SslEnabled{false}, maxPayload,
@@ -372,9 +713,20 @@ namespace qi { namespace sock {
   class ReceiveMessageContinuous
   {
     Message _msg;
+    ReceiveBuffer _recvBuffer;
   public:
   // QuasiRegular:
     ReceiveMessageContinuous() = default;
+  // Custom:
+    /// A null size means that the socket is read message by message, without
+    /// intermediate buffer. Otherwise the size is raised to at least the size
+    /// of a message header.
+    explicit ReceiveMessageContinuous(std::size_t receiveBufferSize)
+      : _recvBuffer(receiveBufferSize == 0u
+                      ? 0u
+                      : std::max(receiveBufferSize, sizeof(Message::Header)))
+    {
+    }
     // TODO: uncomment when messages are comparable, or when latest GCC is fixed.
 //    KA_GENERATE_FRIEND_REGULAR_OPS_1(ReceiveMessageContinuous, _msg)
   // Procedure:
@@ -386,29 +738,34 @@ namespace qi { namespace sock {
     void operator()(const S& socket, SslEnabled ssl, size_t maxPayload,
         Proc onReceive, const F0& lifetimeTransfo = {}, const F1& syncTransfo = {})
     {
-      receiveMessage<N>(socket, &_msg, ssl, maxPayload,
-
-        // This callback will be called when a message has been received.
-        // The pointer is the one we passed, or `nullptr` if an error occurred.
-        // It informs the upper layer that a message has been received and let
-        // it decide if we must continue receiving messages.
-        // If we must continue receiving messages, this callback itself returns
-        // a non-empty optional with a pointer to the memory where a new message
-        // can be received.
-        [=](ErrorCode<N> erc, const Message* m) mutable -> boost::optional<Message*> {
-          if (onReceive(erc, m))
-          {
-            // Must continue.
-            auto dataBuffer = _msg.extractBuffer();
-            dataBuffer.clear();
-            _msg.setBuffer(std::move(dataBuffer));
-            return {&_msg}; // We reuse the message memory to receive the next message.
-          }
-          return {};
-        },
-        lifetimeTransfo,
-        syncTransfo
-      );
+      // This callback will be called when a message has been received.
+      // The pointer is the one we passed, or `nullptr` if an error occurred.
+      // It informs the upper layer that a message has been received and let
+      // it decide if we must continue receiving messages.
+      // If we must continue receiving messages, this callback itself returns
+      // a non-empty optional with a pointer to the memory where a new message
+      // can be received.
+      auto onReceiveMsg = [=](ErrorCode<N> erc, const Message* m) mutable -> boost::optional<Message*> {
+        if (onReceive(erc, m))
+        {
+          // Must continue.
+          auto dataBuffer = _msg.extractBuffer();
+          dataBuffer.clear();
+          _msg.setBuffer(std::move(dataBuffer));
+          return {&_msg}; // We reuse the message memory to receive the next message.
+        }
+        return {};
+      };
+      if (_recvBuffer.capacity() != 0u)
+      {
+        receiveMessageBuffered<N>(socket, &_recvBuffer, &_msg, ssl, maxPayload,
+          onReceiveMsg, lifetimeTransfo, syncTransfo);
+      }
+      else
+      {
+        receiveMessage<N>(socket, &_msg, ssl, maxPayload,
+          onReceiveMsg, lifetimeTransfo, syncTransfo);
+      }
     }
   };
 
@@ -14,6 +14,7 @@
 #include <qi/messaging/sock/error.hpp>
 #include <qi/messaging/sock/common.hpp>
 #include <ka/src.hpp>
+#include <ka/macroregular.hpp>
 #include <qi/trackable.hpp>
 #include <qi/future.hpp>
 #include <ka/scoped.hpp>
@@ -64,12 +65,12 @@
 /// The memory for the messages can be for example maintained by an instance of
 /// `SendMessageEnqueue`. As `sendMessage`, it implements a message
 /// send loop, but being an object it can have a state and takes leverage
-/// of this to maintain a message queue. It passes the first message of the queue to
-/// `sendMessage` and removes it from the queue when sending is done. In this
-/// case, `SendMessageEnqueue` effectively constitutes the upper layer of
-/// `sendMessage`.
+/// of this to maintain a message queue. Instead of sending messages one by
+/// one, it gathers the buffers of as many enqueued messages as allowed by its
+/// `SendBatchLimits` into a single write, and removes them from the queue when
+/// this write is done.
 ///
-/// `SendMessageEnqueue` has itself an upper layer: it passes it the
+/// `SendMessageEnqueue` has itself an upper layer: it passes it each
 /// sent message though a callback. This callback returns a boolean to
 /// signal if message sending must continue.
 ///
@@ -80,15 +81,15 @@
 ///  SendMessageEnqueue start
 ///             |
 ///             v
-///   sendMessage(_msgQueue.begin()) <--
-///             | message sent          |
-///             v                       |
-/// pass msg/error to upper layer*      |
-///             |                       |
-///             v                       |
-///   remove msg from queue             |
-///             |                       |
-///       must continue? ---------------
+/// async write first msgs of _msgQueue <--
+///             | messages sent            |
+///             v                          |
+/// pass each msg/error to upper layer*    |
+///             |                          |
+///             v                          |
+///   remove msgs from queue               |
+///             |                          |
+///       must continue? ------------------
 ///             | no         yes
 ///             v
 ///            stop
@@ -105,25 +106,24 @@
 ///                         ^ | bool
 ///         (Error, IterMsg)| v
 /// Layer 1:         SendMessageEnqueue
-///                         ^ | optional<IterMsg>
-///         (Error, IterMsg)| v
-/// Layer 0:            sendMessage
+///                         |
+///                         v
+/// Layer 0:           N::async_write
 /// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 namespace qi { namespace sock {
 
-  /// Make network buffers for the given message.
+  /// Append to `buffers` the network buffers for the given message.
   ///
-  /// One buffer is for the header and the other one is for data.
+  /// One buffer is for the header and the others are for data.
   ///
   /// Network N
   template<typename N>
-  std::vector<ConstBuffer<N>> makeBuffers(const Message& msg)
+  void appendBuffers(const Message& msg, std::vector<ConstBuffer<N>>& buffers)
   {
     // header buffer
     ConstBuffer<N> headerBuffer = N::buffer(static_cast<const void*>(&msg.header()),
       sizeof(Message::Header));
-    std::vector<ConstBuffer<N>> buffers;
     const auto& msgBuffer = msg.buffer();
 
     // A buffer has a header and data.
@@ -139,7 +139,7 @@ namespace qi { namespace sock {
     // Memory layout for a buffer with 2 subbuffers:
     // (low address)                                                         (high address)
     // |header|buffer_part_0|size_subbuffer_0|buffer_part_1|size_subbuffer_1|buffer_part_2|
-    buffers.reserve(1 + 2 * msgBuffer.subBuffers().size() + 1);
+    buffers.reserve(buffers.size() + 1 + 2 * msgBuffer.subBuffers().size() + 1);
     buffers.push_back(headerBuffer);
 
     decltype(msgBuffer.size()) beginOffset = 0;
@@ -160,9 +160,75 @@ namespace qi { namespace sock {
     // end of main buffer
     buffers.push_back(N::buffer(
       static_cast<const char*>(msgBuffer.data()) + beginOffset, msgBuffer.size() - beginOffset));
+  }
+
+  /// Make network buffers for the given message.
+  ///
+  /// One buffer is for the header and the others are for data.
+  ///
+  /// Network N
+  template<typename N>
+  std::vector<ConstBuffer<N>> makeBuffers(const Message& msg)
+  {
+    std::vector<ConstBuffer<N>> buffers;
+    appendBuffers<N>(msg, buffers);
     return buffers;
   }
 
+  /// Bounds on the amount of data gathered from the send queue into a single
+  /// write.
+  ///
+  /// A write always contains at least one message, even if this message alone
+  /// exceeds the limits.
+  /// A byte count of 0 disables gathering: messages are written one by one.
+  struct SendBatchLimits
+  {
+    /// Maximum number of bytes (headers included).
+    std::size_t maxByteCount;
+    /// Maximum number of network buffers (a message has at least 2 of them).
+    std::size_t maxBufferCount;
+
+    SendBatchLimits(std::size_t maxByteCount = 65536u, std::size_t maxBufferCount = 64u)
+      : maxByteCount(maxByteCount)
+      , maxBufferCount(maxBufferCount)
+    {
+    }
+    KA_GENERATE_FRIEND_REGULAR_OPS_2(SendBatchLimits, maxByteCount, maxBufferCount)
+  };
+
+  /// Buffer sequence referring to a vector of network buffers.
+  ///
+  /// Writes copy their buffer sequence: passing them this reference instead of
+  /// the vector avoids an allocation per write.
+  ///
+  /// Precondition: The vector must be valid and not modified until the write
+  ///   has completed.
+  ///
+  /// Network N
+  template<typename N>
+  class ConstBufferSequenceRef
+  {
+    const std::vector<ConstBuffer<N>>* _buffers;
+  public:
+    using value_type = ConstBuffer<N>;
+    using const_iterator = typename std::vector<ConstBuffer<N>>::const_iterator;
+
+    explicit ConstBufferSequenceRef(const std::vector<ConstBuffer<N>>& buffers)
+      : _buffers(&buffers)
+    {
+    }
+
+    const_iterator begin() const
+    {
+      return _buffers->begin();
+    }
+
+    const_iterator end() const
+    {
+      return _buffers->end();
+    }
+  };
+
   /// Send a message through the socket and call the handler when the operation
   /// is complete, successfully or not.
   ///
@@ -225,10 +291,13 @@ namespace qi { namespace sock {
   /// The messages will be sent in a FIFO manner.
   /// Sending messages is thread-safe.
   ///
-  /// The actual sending is done by `sendMessage`.
+  /// Messages enqueued while a write is in progress are gathered into a single
+  /// write once it completes, within the bounds of the `SendBatchLimits`.
   ///
   /// When a message has been sent, a callback is called. This callback return
   /// a boolean to decide if the queue, if not empty, must continue to be processed.
+  /// The callback is called for each message of a write, in order, even if it
+  /// returned `false` for a previous message of the same write.
   ///
   /// If you decide to stop the queue processing and it contain some messages,
   /// the queue is not cleared. Next time you send a message, it will
@@ -246,13 +315,17 @@ namespace qi { namespace sock {
   template<typename N, typename S>
   struct SendMessageEnqueue
   {
-    using ReadableMessage = std::list<Message>::const_iterator;
+  private:
+    using SendQueue = std::list<Message>;
+  public:
+    using ReadableMessage = typename SendQueue::const_iterator;
     SendMessageEnqueue()
       : _sending{false}
     {
     }
-    explicit SendMessageEnqueue(const S& socket)
+    explicit SendMessageEnqueue(const S& socket, SendBatchLimits limits = {})
       : _socket(socket)
+      , _limits(limits)
       , _sending{false}
     {
     }
@@ -267,20 +340,42 @@ namespace qi { namespace sock {
     void operator()(Msg&&, SslEnabled, Proc onSent = Proc{true},
       const F0& lifetimeTransfo = F0{}, const F1& syncTransfo = F1{});
   private:
+    using I = typename SendQueue::iterator;
+
+    /// Writes the messages at the front of the queue.
+    /// Precondition: The queue is not empty and the sending flag is raised.
+    template<typename Proc, typename F0, typename F1>
+    void sendFront(SslEnabled, Proc onSent, F0 lifetimeTransfo, F1 syncTransfo);
+
+    /// Informs the upper layer of the sending of the messages in [first, last)
+    /// and removes them from the queue.
+    /// Returns true if the next messages of the queue must be sent.
+    template<typename Proc>
+    bool eraseSent(ErrorCode<N> erc, I first, std::size_t count, Proc& onSent);
+
     S _socket;
+    SendBatchLimits _limits;
     /// A list is used because we need the iterators not to be invalidated by
     /// insertions at begin or end, which is not the case with deque.
     /// See [23.3.3.4 deque modifiers].
-    std::list<Message> _sendQueue;
+    SendQueue _sendQueue;
+    /// Nodes of sent messages, whose messages have been reset, kept so that
+    /// enqueuing a message does not allocate. At most `maxSpareNodeCount` are
+    /// kept, so that a burst of messages does not hold memory afterwards.
+    SendQueue _spareNodes;
+    static const std::size_t maxSpareNodeCount = 64u;
+    /// Network buffers of the write in progress. The vector is kept to reuse
+    /// its capacity from one write to the other.
+    std::vector<ConstBuffer<N>> _buffers;
     bool _sending;
     std::mutex _sendMutex;
   };
 
   // Lemma SendMessageEnqueue.0:
-  //  If a message is already being sent, the message is queued without
-  //  invalidating the one being sent.
+  //  If messages are already being sent, the message is queued without
+  //  invalidating the ones being sent.
   // Proof:
-  //  All messages are put in the send queue, including the one being sent.
+  //  All messages are put in the send queue, including the ones being sent.
   //  The send queue is a list so adding an element doesn't invalidate the other ones.
   template<typename N, typename S>
   template<typename Msg, typename Proc, typename F0, typename F1>
@@ -288,13 +383,18 @@ namespace qi { namespace sock {
       const F0& lifetimeTransfo, const F1& syncTransfo)
   {
     qiLogDebug(logCategory()) << _socket.get() << " SendMessageEnqueue()(" << msg.type() << ": " << msg.address() << ", ssl=" << *ssl << ")";
-    using I = decltype(_sendQueue.begin());
-    I itMsg;
     bool mustStartSendLoop = false;
     {
       std::lock_guard<std::mutex> lock{_sendMutex};
-      _sendQueue.emplace_back(std::forward<Msg>(msg));
-      itMsg = _sendQueue.begin();
+      if (_spareNodes.empty())
+      {
+        _sendQueue.emplace_back(std::forward<Msg>(msg));
+      }
+      else
+      {
+        _spareNodes.front() = std::forward<Msg>(msg);
+        _sendQueue.splice(_sendQueue.end(), _spareNodes, _spareNodes.begin());
+      }
       // We've just added a message to the queue, so if we are not currently sending,
       // we must (re)start the send loop.
       if (!_sending)
@@ -306,63 +406,132 @@ namespace qi { namespace sock {
     if (mustStartSendLoop)
     {
       // Lemma SendMessageEnqueue.1:
-      //  When calling sendMessage, itMsg is still valid.
+      //  When calling sendFront, the send queue is not empty.
       // Proof:
-      //  The send queue is a std::list, so inserting or erasing other elements
-      //  doesn't invalidate the iterator.
       //  Each thread adds a message to the send queue. But only one at a time
-      //  can enter this branch (by tryRaiseAtomicFlag.0).
+      //  can enter this branch (by the sending flag).
       //  Also, the sending flag is only modified while the queue is locked, so
       //  the scenario where a thread B adds a message to the queue, is suspended
       //  just before evaluating the condition of this branch, then the send loop
       //  thread A clears the queue, and then the thread B resumes, is correctly handled.
-      //  Moreover, this branch results in exactly one message being removed from
-      //  the send queue (by SendMessageEnqueue.2).
+      //  Moreover, the send loop only clears the sending flag when it has
+      //  emptied the queue or has been asked to stop (by SendMessageEnqueue.2).
       //  Therefore, at this point the number of messages in the send queue is
       //  always at least 1.
+      sendFront(ssl, std::move(onSent), lifetimeTransfo, syncTransfo);
+    }
+  }
+
+  template<typename N, typename S>
+  template<typename Proc, typename F0, typename F1>
+  void SendMessageEnqueue<N, S>::sendFront(SslEnabled ssl, Proc onSent,
+      F0 lifetimeTransfo, F1 syncTransfo)
+  {
+    // The written messages are counted: an end iterator would also cover the
+    // messages enqueued during the write.
+    I first;
+    std::size_t count = 0u;
+    {
+      std::lock_guard<std::mutex> lock{_sendMutex};
+      QI_ASSERT(_sending && !_sendQueue.empty());
+      _buffers.clear();
+      first = _sendQueue.begin();
+      auto last = first;
+      std::size_t byteCount = 0u;
+      do
+      {
+        const auto prevBufferCount = _buffers.size();
+        appendBuffers<N>(*last, _buffers);
+        const auto newByteCount = byteCount + sizeof(Message::Header) + last->buffer().totalSize();
+        const bool overLimits = newByteCount > _limits.maxByteCount
+                             || _buffers.size() > _limits.maxBufferCount;
+        if (last != first && overLimits)
+        {
+          _buffers.erase(_buffers.begin() + prevBufferCount, _buffers.end());
+          break;
+        }
+        byteCount = newByteCount;
+        ++last;
+        ++count;
+      }
+      while (last != _sendQueue.end());
+    }
 
-      // Lemma SendMessageEnqueue.2:
-      //  eraseAndReturnNextMessage erases from the send queue the element pointed
-      //  by the given iterator, even if an exception is thrown.
+    // This callback will be called when the messages have been sent, or an
+    // error occurred. It passes an iterator on each sent message to the upper
+    // layer, which in return decides whether sending of the enqueued messages
+    // must continue.
+    auto writeCont = syncTransfo(lifetimeTransfo(
+      [=](ErrorCode<N> erc, std::size_t /*len*/) mutable {
+        if (eraseSent(erc, first, count, onSent))
+        {
+          sendFront(ssl, onSent, lifetimeTransfo, syncTransfo);
+        }
+      }));
+    // `_buffers` is not modified until the write has completed.
+    const ConstBufferSequenceRef<N> buffers{_buffers};
+    if (*ssl)
+    {
+      N::async_write(*_socket, buffers, writeCont);
+    }
+    else
+    {
+      N::async_write((*_socket).next_layer(), buffers, writeCont);
+    }
+  }
 
-      // This callback will be called when a message has been sent, or an error
-      // occurred. It passes an iterator on the sent message to the upper layer,
-      // which in return decides whether sending of the enqueued messaged must
-      // continue. Then, the callback erase the message.
-      auto eraseAndReturnNextMessage =
-        [&, onSent](ErrorCode<N> erc, I itSent) mutable -> boost::optional<I> {
-          // It's ok to allow new sendings once the current one is complete.
-          bool mustContinue = false;
-          boost::optional<I> itNext;
-          try
+  // Lemma SendMessageEnqueue.2:
+  //  eraseSent erases from the send queue the `count` elements from `first` and
+  //  clears the sending flag if it returns false, even if an exception is thrown.
+  template<typename N, typename S>
+  template<typename Proc>
+  bool SendMessageEnqueue<N, S>::eraseSent(ErrorCode<N> erc, I first, std::size_t count, Proc& onSent)
+  {
+    bool mustContinue = true;
+    try
+    {
+      // A scoped is used to cope with potential exception thrown by onSent.
+      auto scopedErase = ka::scoped([&] {
+        std::lock_guard<std::mutex> lock{_sendMutex};
+        auto it = first;
+        for (std::size_t i = 0u; i != count; ++i)
+        {
+          const auto sent = it++;
+          if (_spareNodes.size() < maxSpareNodeCount)
           {
-            // A scoped is used to cope with potential exception thrown by onSent.
-            auto scopedErase = ka::scoped([&] {
-              std::lock_guard<std::mutex> lock{_sendMutex};
-              _sendQueue.erase(itSent);
-              if (!mustContinue || _sendQueue.empty())
-              {
-                QI_ASSERT(_sending);
-                if (!_sending)
-                  qiLogWarning(logCategory()) << "SendMessageEnqueue: sending flag should be raised.";
-                _sending = false;
-                return;
-              }
-              itNext = _sendQueue.begin();
-            });
-            mustContinue = onSent(erc, itSent);
+            *sent = Message{}; // Releases the payload.
+            _spareNodes.splice(_spareNodes.end(), _sendQueue, sent);
           }
-          catch (const std::exception& e)
+          else
           {
-            qiLogError(logCategory()) << "Error in post-send phase: " << e.what();
-            throw;
+            _sendQueue.erase(sent);
           }
-          return itNext;
-        };
-
-      sendMessage<N>(_socket, itMsg, std::move(eraseAndReturnNextMessage), ssl,
-        lifetimeTransfo, syncTransfo);
+        }
+        if (!mustContinue || _sendQueue.empty())
+        {
+          QI_ASSERT(_sending);
+          if (!_sending)
+            qiLogWarning(logCategory()) << "SendMessageEnqueue: sending flag should be raised.";
+          _sending = false;
+          mustContinue = false;
+        }
+      });
+      mustContinue = false; // In case onSent throws.
+      bool upperLayerContinues = true;
+      auto it = first;
+      for (std::size_t i = 0u; i != count; ++i, ++it)
+      {
+        // onSent is evaluated first, to be called for each message.
+        upperLayerContinues = onSent(erc, ReadableMessage{it}) && upperLayerContinues;
+      }
+      mustContinue = upperLayerContinues;
+    }
+    catch (const std::exception& e)
+    {
+      qiLogError(logCategory()) << "Error in post-send phase: " << e.what();
+      throw;
     }
+    return mustContinue;
   }
 
   /// Functor that sends messages and tracks the object's lifetime.
@@ -379,8 +548,8 @@ namespace qi { namespace sock {
     using Trackable<SendMessageEnqueueTrack>::destroy;
 
     SendMessageEnqueueTrack() = default;
-    explicit SendMessageEnqueueTrack(const S& socket)
-      : _sendMsg{socket}
+    explicit SendMessageEnqueueTrack(const S& socket, SendBatchLimits limits = {})
+      : _sendMsg{socket, limits}
     {
     }
     ~SendMessageEnqueueTrack()
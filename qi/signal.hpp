@@ -7,11 +7,13 @@
 #ifndef _QI_SIGNAL_HPP_
 #define _QI_SIGNAL_HPP_
 
+#include <stdexcept>
 #include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <qi/atomic.hpp>
 
 #include <qi/anyfunction.hpp>
+#include <qi/clock.hpp>
 #include <qi/type/typeobject.hpp>
 
 #include <boost/thread/thread.hpp>
@@ -34,6 +36,73 @@ namespace qi {
 
   using SignalLink = qi::uint64_t;
 
+  /// How the emissions of a signal are sent to its remote subscribers, see
+  /// SignalBase::setRemoteEventPolicy. Local subscribers are not affected.
+  struct QI_API RemoteEventPolicy
+  {
+    enum Mode
+    {
+      /// One message per emission.
+      Mode_Immediate,
+      /// Up to `maxBatchSize` emissions are sent in one message, at most
+      /// `delay` after the first of them.
+      Mode_Batch,
+      /// Only the last emission is sent, `delay` after the first emission
+      /// which was not sent yet.
+      Mode_Conflate,
+      /// At most one message every `delay`. An emission is sent right away if
+      /// the last message is older than that, otherwise the last emission of
+      /// the period is sent at its end.
+      Mode_RateLimit,
+    };
+
+    RemoteEventPolicy()
+      : mode(Mode_Immediate)
+      , maxBatchSize(1)
+      , delay(0)
+    {}
+
+    static RemoteEventPolicy immediate()
+    {
+      return RemoteEventPolicy();
+    }
+
+    static RemoteEventPolicy batch(unsigned int maxBatchSize, Duration maxDelay)
+    {
+      RemoteEventPolicy policy;
+      policy.mode = Mode_Batch;
+      policy.maxBatchSize = maxBatchSize;
+      policy.delay = maxDelay;
+      return policy;
+    }
+
+    /// With a null delay, the emissions made while the previous one is being
+    /// sent are conflated.
+    static RemoteEventPolicy conflate(Duration delay = Duration(0))
+    {
+      RemoteEventPolicy policy;
+      policy.mode = Mode_Conflate;
+      policy.delay = delay;
+      return policy;
+    }
+
+    /// Throws std::invalid_argument if `hertz` is not strictly positive.
+    static RemoteEventPolicy rateLimit(double hertz)
+    {
+      if (!(hertz > 0))
+        throw std::invalid_argument("RemoteEventPolicy::rateLimit: the rate must be positive");
+      RemoteEventPolicy policy;
+      policy.mode = Mode_RateLimit;
+      policy.delay = boost::chrono::duration_cast<Duration>(
+          boost::chrono::duration<double>(1.0 / hertz));
+      return policy;
+    }
+
+    Mode mode;
+    unsigned int maxBatchSize;
+    Duration delay;
+  };
+
 
   /// SignalBase provides a signal subscription mechanism called "connection".
   /// Derived classes can customize the subscription step by setting
@@ -147,6 +216,13 @@ namespace qi {
     /// You can use this to avoid computing if no one has subscribed to the signal.
     void setOnSubscribers(OnSubscribers onSubscribers);
 
+    /// Set how emissions are sent to the remote subscribers which connect
+    /// afterwards, for instance to send the values of a high frequency signal
+    /// by batches. Batches are only sent to peers supporting them, others
+    /// receive the same emissions one by one.
+    void setRemoteEventPolicy(const RemoteEventPolicy& policy);
+    RemoteEventPolicy remoteEventPolicy() const;
+
     static const SignalLink invalidSignalLink;
     void _setSignature(const Signature &s);
   protected:
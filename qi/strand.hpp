@@ -7,7 +7,6 @@
 #ifndef _QI_STRAND_HPP_
 #define _QI_STRAND_HPP_
 
-#include <deque>
 #include <atomic>
 #include <qi/assert.hpp>
 #include <qi/detail/executioncontext.hpp>
@@ -43,20 +42,25 @@ public:
   enum class State;
 
   struct Callback;
-
-  using Queue = std::deque<boost::shared_ptr<Callback>>;
+  // Job of the queue, pooled: a posted callback or a Callback.
+  struct Node;
 
   qi::ExecutionContext& _executor;
   std::atomic<unsigned int> _curId;
   std::atomic<unsigned int> _aliveCount;
-  bool _processing; // protected by mutex, no need for atomic
+  std::atomic<bool> _processing;
   std::atomic<int> _processingThread;
-  boost::recursive_mutex _mutex;
+  boost::recursive_mutex _mutex; // for the wait of join
   boost::condition_variable_any _processFinished;
-  bool _dying;
-  Queue _queue;
+  std::atomic<bool> _dying;
+  // Jobs pushed by any thread, the latest first (lock-free stack).
+  std::atomic<Node*> _incoming;
+  // Jobs taken from _incoming and not run yet, in order. Only accessed while
+  // processing, or by join once the processing stopped.
+  Node* _pending;
 
   explicit StrandPrivate(qi::ExecutionContext& executor);
+  ~StrandPrivate();
 
   // Schedules the callback for execution. If the trigger date `tp` is in the past, executes the
   // callback immediately in the calling thread.
@@ -76,8 +80,8 @@ public:
   void cancel(boost::shared_ptr<Callback> cbStruct);
   bool isInThisContext() const override;
 
-  void postImpl(boost::function<void()> callback, ExecutionOptions options) override
-  { QI_ASSERT(false); throw 0; }
+  // Queues the callback, without promise nor cancelation.
+  void postImpl(boost::function<void()> callback, ExecutionOptions options) override;
 
   qi::Future<void> async(const boost::function<void()>& callback, qi::SteadyClockTimePoint tp) override
   { QI_ASSERT(false); throw 0; }
@@ -86,9 +90,19 @@ public:
   { QI_ASSERT(false); throw 0; }
 
   using ExecutionContext::async;
+  // Sets the error of the jobs not run yet, and drops them.
+  void failPendingJobs();
+
 private:
-  void stopProcess(boost::recursive_mutex::scoped_lock& lock,
-                   bool finished);
+  void push(Node* node, ExecutionOptions options);
+  Node* takeNext();
+  void run(Node& node);
+  // Moves the job from `expected` to the Running state, or from the Canceled
+  // state if it must never be skipped. Returns false if it is not ours to run
+  // or fail anymore.
+  bool claim(Callback& cbStruct, State expected);
+  void stopProcess();
+  bool tryStopProcess();
 };
 
 inline StrandPrivate::StrandPrivate(qi::ExecutionContext& executor)
@@ -98,6 +112,8 @@ inline StrandPrivate::StrandPrivate(qi::ExecutionContext& executor)
   , _processing(false)
   , _processingThread(0)
   , _dying(false)
+  , _incoming(nullptr)
+  , _pending(nullptr)
 {
 }
 
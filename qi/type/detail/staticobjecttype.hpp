@@ -71,6 +71,8 @@ public:
   virtual qi::Future<void> disconnect(void* instance, AnyObject context, SignalLink linkId);
   virtual qi::Future<AnyValue> property(void* instance, AnyObject context, unsigned int id);
   virtual qi::Future<void> setProperty(void* instance, AnyObject context, unsigned int id, AnyValue value);
+  /// The signal `id` of `instance`, or of its property `id`. Null if there is none.
+  SignalBase* signal(void* instance, AnyObject context, unsigned int id);
 
   virtual const std::vector<std::pair<TypeInterface*, int> >& parentTypes();
   virtual void* initializeStorage(void*);
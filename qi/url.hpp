@@ -30,6 +30,9 @@ namespace qi {
    *    <li>- *empty string*</li>
    *  </ul>
    *
+   *  For the `unix` protocol (local sockets), everything after `unix://` is
+   *  the path of the socket and there is no port: `unix:///tmp/qi.sock`.
+   *
    *  @note This class is copyable.
    */
   class QI_API Url
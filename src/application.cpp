@@ -23,6 +23,7 @@
 #include <boost/algorithm/string/split.hpp>
 
 #include "utils.hpp"
+#include "type/binarycodec_p.hpp"
 
 #ifdef __APPLE__
 #include <mach-o/dyld.h>
@@ -369,6 +370,8 @@ namespace qi {
   void Application::unloadModule(void* handle)
   {
     os::dlclose(handle);
+    // The types of the module are gone, and new ones may get their addresses.
+    detail::clearCodecPlanCache();
   }
 
   Application::~Application()
@@ -7,9 +7,11 @@
 #include <qi/buffer.hpp>
 #include <qi/log.hpp>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
+#include <new>
 #include <iomanip>
 #include <ctype.h>
 
@@ -17,6 +19,7 @@
 #include <boost/make_shared.hpp>
 
 #include "buffer_p.hpp"
+#include "bufferpool_p.hpp"
 
 
 qiLogCategory("qi.Buffer");
@@ -35,7 +38,7 @@ namespace qi
   {
     if (_bigdata)
     {
-      free(_bigdata);
+      detail::deallocateBufferBlock(_bigdata, available);
       _bigdata = NULL;
     }
   }
@@ -44,18 +47,10 @@ namespace qi
     : _bigdata(nullptr)
     , _cachedSubBufferTotalSize(b._cachedSubBufferTotalSize)
     , used(b.used)
-    , available(b.available)
+    , available(sizeof(_data))
     , _subBuffers(b._subBuffers)
   {
-    if (b._bigdata)
-    {
-      _bigdata = static_cast<unsigned char*>(malloc(b.used));
-      ::memcpy(_bigdata, b._bigdata, b.used);
-    }
-    else
-    {
-      ::memcpy(_data, b._data, b.used);
-    }
+    copyData(b);
   }
 
   BufferPrivate& BufferPrivate::operator=(const BufferPrivate& b)
@@ -63,23 +58,31 @@ namespace qi
     if (&b == this) return *this;
     _cachedSubBufferTotalSize = b._cachedSubBufferTotalSize;
     used = b.used;
-    available = b.available;
     _subBuffers = b._subBuffers;
+    _view.reset();
     if (_bigdata)
     {
-      free(_bigdata);
+      detail::deallocateBufferBlock(_bigdata, available);
       _bigdata = NULL;
     }
-    if (b._bigdata)
-    {
-      _bigdata = static_cast<unsigned char*>(malloc(b.used));
-      ::memcpy(_bigdata, b._bigdata, b.used);
-    }
-    else
+    available = sizeof(_data);
+    copyData(b);
+    return *this;
+  }
+
+  // Only the used bytes are copied, so the available size must match what is
+  // actually allocated here, not the size available in `b`.
+  void BufferPrivate::copyData(const BufferPrivate& b)
+  {
+    if (b.used > sizeof(_data))
     {
-      ::memcpy(_data, b._data, b.used);
+      size_t size = b.used;
+      _bigdata = static_cast<unsigned char*>(detail::allocateBufferBlock(size));
+      if (!_bigdata)
+        throw std::bad_alloc();
+      available = size;
     }
-    return *this;
+    ::memcpy(data(), b.data(), b.used);
   }
 
   struct MyPoolTag { };
@@ -124,6 +127,8 @@ namespace qi
 
   unsigned char* BufferPrivate::data()
   {
+    if (_view)
+      return static_cast<unsigned char*>(const_cast<void*>(_view.get()));
     return _bigdata ? _bigdata : _data;
   }
 
@@ -134,53 +139,128 @@ namespace qi
 
   bool BufferPrivate::resize(size_t neededSize)
   {
-    neededSize += BLOCK; // Should be enough in most cases;
+    // Geometric growth, so that successive writes are amortized. Beyond the
+    // biggest pooled block, the growth is capped so that a big buffer does
+    // not reserve as much memory again: realloc usually extends these blocks
+    // without copying them.
+    neededSize = std::max(neededSize, available + std::min(available, detail::maxPooledBlockSize));
 
     qiLogDebug() << "Resizing buffer from " << available << " to " << neededSize;
     unsigned char *newBigdata;
 
-    newBigdata = static_cast<unsigned char *>(realloc(_bigdata, neededSize));
+    newBigdata = static_cast<unsigned char *>(_bigdata
+      ? detail::reallocateBufferBlock(_bigdata, available, used, neededSize)
+      : detail::allocateBufferBlock(neededSize));
     if (newBigdata == NULL)
       return false;
     if (!_bigdata && used > 0)
       ::memcpy(newBigdata, _data, used);
     available = neededSize;
-    _bigdata = newBigdata; // Don't worry, realloc free previous buffer if needed
+    _bigdata = newBigdata; // The previous block, if any, has been given back.
     return true;
   }
 
+  namespace
+  {
+    // Buffers without private data (default constructed or moved-from
+    // buffers) are empty: they point here, so that their data is never null.
+    unsigned char emptyBufferData[1] = {};
+
+    // The private data of a buffer is shared by its copies, which count
+    // themselves in _shareCount. A buffer owning its private data alone is
+    // the only one which can copy it, so a count of 1 cannot change behind
+    // its back.
+    bool isShared(const BufferPrivate& p)
+    {
+      // Acquire the modifications made by the copies which released it.
+      return p._shareCount.load(std::memory_order_acquire) != 1;
+    }
+
+    void releaseShare(const boost::shared_ptr<BufferPrivate>& p)
+    {
+      if (p)
+        p->_shareCount.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    // Makes `p` share the private data of another buffer.
+    void share(boost::shared_ptr<BufferPrivate>& p, const boost::shared_ptr<BufferPrivate>& other)
+    {
+      if (p == other)
+        return;
+      if (other)
+        other->_shareCount.fetch_add(1, std::memory_order_relaxed);
+      releaseShare(p);
+      p = other;
+    }
+
+    // Makes `p` own private data which no buffer shares yet.
+    void own(boost::shared_ptr<BufferPrivate>& p, boost::shared_ptr<BufferPrivate> fresh)
+    {
+      releaseShare(p);
+      p = std::move(fresh);
+    }
+
+    // Copy-on-write: the private data is shared between the copies of a
+    // buffer, so it must be copied before being modified if it is shared.
+    // External data is never modified, it is always copied. Empty buffers
+    // get their private data here, the first time they are modified.
+    void unshare(boost::shared_ptr<BufferPrivate>& p)
+    {
+      if (!p)
+        p = boost::make_shared<BufferPrivate>();
+      else if (isShared(*p) || p->_view)
+        own(p, boost::make_shared<BufferPrivate>(*p));
+    }
+  } // namespace
+
+  Buffer BufferPrivate::makeView(boost::shared_ptr<const void> data, size_t size)
+  {
+    auto p = boost::make_shared<BufferPrivate>();
+    p->_view = std::move(data);
+    p->used = size;
+    p->available = size;
+    Buffer buffer;
+    buffer._p = std::move(p);
+    return buffer;
+  }
+
   Buffer::Buffer()
-    : _p(boost::make_shared<BufferPrivate>())
   {
   }
 
   Buffer::Buffer(const Buffer& b)
-    : _p(boost::make_shared<BufferPrivate>(*b._p))
   {
+    share(_p, b._p);
   }
 
   Buffer& Buffer::operator=(const Buffer& b)
   {
-    _p = boost::make_shared<BufferPrivate>(*b._p);
+    share(_p, b._p);
     return *this;
   }
 
   Buffer::Buffer(Buffer&& b)
     : _p(std::move(b._p))
   {
-    // The default state of a qi::Buffer contains a valid BufferPrivate pointer.
-    b._p = boost::make_shared<BufferPrivate>();
   }
 
   Buffer& Buffer::operator=(Buffer&& b)
   {
+    if (this == &b)
+      return *this;
+    releaseShare(_p);
     _p = std::move(b._p);
-    b._p = boost::make_shared<BufferPrivate>();
     return *this;
   }
 
+  Buffer::~Buffer()
+  {
+    releaseShare(_p);
+  }
+
   bool Buffer::write(const void *data, size_t size)
   {
+    unshare(_p);
     if (_p->used + size > _p->available)
     {
       bool ret = _p->resize(_p->used + size);
@@ -198,24 +278,27 @@ namespace qi
 
   size_t Buffer::addSubBuffer(const Buffer& buffer)
   {
-    size_t subBufferSize = buffer.size();
-    size_t actualUsed = _p->used;
+    // Take the copy before writing, so that adding a buffer to itself does not
+    // make its private data own itself.
+    Buffer subBuffer(buffer);
+    size_t subBufferSize = subBuffer.size();
+    size_t actualUsed = size();
 
     write((size_type*)&subBufferSize, sizeof(size_type));
 
-    _p->_subBuffers.push_back(std::make_pair(actualUsed, buffer));
-    _p->_cachedSubBufferTotalSize += buffer.totalSize();
+    _p->_cachedSubBufferTotalSize += subBuffer.totalSize();
+    _p->_subBuffers.push_back(std::make_pair(actualUsed, std::move(subBuffer)));
     return actualUsed;
   }
 
   bool Buffer::hasSubBuffer(size_t offset) const
   {
-    return _p->indexOfSubBuffer(offset) ? true : false;
+    return _p && _p->indexOfSubBuffer(offset);
   }
 
   const Buffer& Buffer::subBuffer(size_t offset) const
   {
-    if (const auto index = _p->indexOfSubBuffer(offset))
+    if (const auto index = _p ? _p->indexOfSubBuffer(offset) : boost::none)
     {
       return _p->_subBuffers[*index].second;
     }
@@ -225,19 +308,35 @@ namespace qi
     }
   }
 
+  Buffer Buffer::slice(size_t offset, size_t length) const
+  {
+    if (offset > size() || length > size() - offset)
+      throw std::runtime_error("The slice is out of the buffer.");
+    if (length == 0)
+      return Buffer();
+    // The slice counts as a copy of this buffer until it is destroyed, so
+    // that the data is copied before this buffer modifies it.
+    const auto source = _p;
+    source->_shareCount.fetch_add(1, std::memory_order_relaxed);
+    boost::shared_ptr<const void> data(source->data() + offset,
+                                       [source](const void*) { releaseShare(source); });
+    return BufferPrivate::makeView(std::move(data), length);
+  }
+
   size_t Buffer::size() const
   {
-    return _p->used;
+    return _p ? _p->used : 0;
   }
 
   size_t Buffer::totalSize() const
   {
-    return size() + _p->_cachedSubBufferTotalSize;
+    return _p ? _p->used + _p->_cachedSubBufferTotalSize : 0;
   }
 
   const std::vector<std::pair<size_t, Buffer> > & Buffer::subBuffers() const
   {
-    return _p->_subBuffers;
+    static const std::vector<std::pair<size_t, Buffer> > noSubBuffers;
+    return _p ? _p->_subBuffers : noSubBuffers;
   }
 
   /*
@@ -247,6 +346,7 @@ namespace qi
   */
   void *Buffer::reserve(size_t size)
   {
+    unshare(_p);
     if (_p->used + size > _p->available)
       _p->resize(_p->used + size);
 
@@ -258,6 +358,14 @@ namespace qi
 
   void Buffer::clear()
   {
+    if (!_p)
+      return;
+    if (isShared(*_p) || _p->_view)
+    {
+      releaseShare(_p);
+      _p.reset();
+      return;
+    }
     _p->used = 0;
     _p->_subBuffers.clear();
     _p->_cachedSubBufferTotalSize = 0;
@@ -265,43 +373,49 @@ namespace qi
 
   void* Buffer::data()
   {
-    return _p ? _p->data() : 0;
+    if (!_p)
+      return emptyBufferData;
+    unshare(_p);
+    return _p->data();
   }
 
   const void* Buffer::data() const
   {
-    return _p ? _p->data() : 0;
+    return _p ? _p->data() : emptyBufferData;
   }
 
   const void *Buffer::read(size_t offset, size_t length) const
   {
-    if (offset + length > _p->used)
+    if (offset + length > size())
     {
       qiLogDebug() << "Attempt to read " << offset+length
-       <<" on buffer of size " << _p->used;
+       <<" on buffer of size " << size();
       return  nullptr;
     }
-    return (char*)_p->data() + offset;
+    return static_cast<const char*>(data()) + offset;
   }
 
   size_t Buffer::read(void* buffer, size_t offset, size_t length) const
   {
-    if (offset > _p->used)
+    if (offset > size())
     {
       qiLogDebug() << "Attempt to read " << offset+length
-      <<" on buffer of size " << _p->used;
+      <<" on buffer of size " << size();
       return -1;
     }
-    size_t copy = std::min(length, _p->used - offset);
-    memcpy(buffer, (char*)_p->data()+offset, copy);
+    size_t copy = std::min(length, size() - offset);
+    memcpy(buffer, static_cast<const char*>(data()) + offset, copy);
     return copy;
   }
 
   bool Buffer::operator==(const Buffer& b) const
   {
-    const bool aHasBuffer = (_p.get() != nullptr);
-    const bool bHasBuffer = (b._p.get() != nullptr);
-    return (aHasBuffer == bHasBuffer) && (!aHasBuffer || *_p == *b._p);
+    if (_p == b._p) return true;
+    // An empty buffer may or may not have private data.
+    if (!_p || !b._p)
+      return totalSize() == 0 && b.totalSize() == 0
+          && subBuffers().empty() && b.subBuffers().empty();
+    return *_p == *b._p;
   }
 
   namespace detail {
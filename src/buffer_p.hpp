@@ -8,10 +8,12 @@
 #define _SRC_BUFFER_P_HPP_
 
 #define STATIC_BLOCK 768
-#define BLOCK   4096
 
+#include <atomic>
 #include <vector>
 #include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <qi/buffer.hpp>
 #include <qi/atomic.hpp>
 #include <qi/types.hpp>
 
@@ -29,15 +31,26 @@ namespace qi
     unsigned char* data();
     const unsigned char* data() const;
     bool            resize(size_t size = 0x100000);
+    void            copyData(const BufferPrivate& b);
     boost::optional<size_t> indexOfSubBuffer(size_t offset) const;
     friend bool operator==(const BufferPrivate& a, const BufferPrivate& b);
 
+    /// Returns a buffer whose data is the `size` bytes at `data`, without
+    /// copying them. `data` is kept alive as long as the buffer (or one of its
+    /// copies) reads it. The data is copied the first time the buffer is
+    /// modified, so it is never written.
+    static Buffer makeView(boost::shared_ptr<const void> data, size_t size);
+
   public:
     unsigned char*  _bigdata;
     unsigned char   _data[STATIC_BLOCK] = {};
     size_t          _cachedSubBufferTotalSize;
     size_t          used; // size used
     size_t          available; // total size of buffer
+    boost::shared_ptr<const void> _view; // external data, see makeView
+    // Number of Buffer objects sharing this data (copy-on-write): it is only
+    // modified when it is not shared.
+    std::atomic<unsigned int> _shareCount{1};
 
     std::vector<std::pair<size_t, Buffer> > _subBuffers;
   };
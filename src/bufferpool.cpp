@@ -0,0 +1,305 @@
+/*
+**  Copyright (C) 2012 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#include <qi/buffer.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "bufferpool_p.hpp"
+
+qiLogCategory("qi.Buffer");
+
+namespace qi
+{
+  namespace
+  {
+    // Size classes are the powers of 2 from 1 KiB to 1 MiB. Smaller data
+    // usually fits in the internal storage of buffers, and bigger blocks are
+    // not pooled.
+    const std::size_t minClassSizeLog2 = 10;
+    const std::size_t maxClassSizeLog2 = 20;
+    const std::size_t classCount = maxClassSizeLog2 - minClassSizeLog2 + 1;
+    const std::size_t maxClassSize = std::size_t{1} << maxClassSizeLog2;
+    static_assert(maxClassSize == detail::maxPooledBlockSize, "The biggest class is the biggest pooled block.");
+
+    // Blocks of up to 64 KiB are also cached per thread.
+    const std::size_t threadCachedClassCount = 16 - minClassSizeLog2 + 1;
+    const std::size_t threadCacheBlockCount = 4;
+
+    const std::size_t defaultMaxPooledBytes = 32 * 1024 * 1024;
+
+    std::size_t classSize(std::size_t index)
+    {
+      return std::size_t{1} << (minClassSizeLog2 + index);
+    }
+
+    // Index of the smallest class whose blocks can hold `size` bytes.
+    // Precondition: size <= maxClassSize
+    std::size_t classIndex(std::size_t size)
+    {
+      std::size_t index = 0;
+      while (classSize(index) < size)
+        ++index;
+      return index;
+    }
+
+    bool isClassSize(std::size_t size)
+    {
+      return size <= maxClassSize && size >= classSize(0) && (size & (size - 1)) == 0;
+    }
+
+    struct ThreadCache
+    {
+      std::array<std::array<void*, threadCacheBlockCount>, threadCachedClassCount> blocks;
+      std::array<std::size_t, threadCachedClassCount> counts;
+
+      ThreadCache()
+      {
+        counts.fill(0);
+      }
+    };
+
+    void releaseThreadCache(ThreadCache* cache);
+
+    struct BufferPool
+    {
+      std::atomic<bool> enabled;
+      std::atomic<std::size_t> maxPooledBytes;
+      std::atomic<std::size_t> pooledBytes;
+      std::atomic<std::size_t> pooledBytesHighWater;
+      std::atomic<qi::uint64_t> hitCount;
+      std::atomic<qi::uint64_t> missCount;
+
+      // Blocks shared by all threads, per size class.
+      std::mutex sharedMutex;
+      std::array<std::vector<void*>, classCount> shared;
+
+      boost::thread_specific_ptr<ThreadCache> threadCache;
+
+      BufferPool()
+        : enabled(os::getenv("QI_BUFFER_POOL") == "1")
+        , maxPooledBytes(defaultMaxPooledBytes)
+        , pooledBytes(0)
+        , pooledBytesHighWater(0)
+        , hitCount(0)
+        , missCount(0)
+        , threadCache(&releaseThreadCache)
+      {
+        const auto maxBytes = os::getenv("QI_BUFFER_POOL_MAX_BYTES");
+        if (!maxBytes.empty())
+          maxPooledBytes = boost::lexical_cast<std::size_t>(maxBytes);
+      }
+
+      ThreadCache& localCache()
+      {
+        ThreadCache* cache = threadCache.get();
+        if (!cache)
+        {
+          cache = new ThreadCache;
+          threadCache.reset(cache);
+        }
+        return *cache;
+      }
+
+      // Accounts for a block entering the pool.
+      // Returns false if it would exceed the maximum pooled size.
+      bool addPooledBytes(std::size_t size)
+      {
+        auto pooled = pooledBytes.load(std::memory_order_relaxed);
+        do
+        {
+          if (pooled + size > maxPooledBytes.load(std::memory_order_relaxed))
+            return false;
+        }
+        while (!pooledBytes.compare_exchange_weak(pooled, pooled + size, std::memory_order_relaxed));
+
+        const auto newPooled = pooled + size;
+        auto highWater = pooledBytesHighWater.load(std::memory_order_relaxed);
+        while (newPooled > highWater
+               && !pooledBytesHighWater.compare_exchange_weak(highWater, newPooled,
+                                                              std::memory_order_relaxed))
+        {
+        }
+        return true;
+      }
+
+      void removePooledBytes(std::size_t size)
+      {
+        pooledBytes.fetch_sub(size, std::memory_order_relaxed);
+      }
+
+      void* take(std::size_t index)
+      {
+        if (index < threadCachedClassCount)
+        {
+          ThreadCache& cache = localCache();
+          if (cache.counts[index] != 0)
+            return cache.blocks[index][--cache.counts[index]];
+        }
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        auto& blocks = shared[index];
+        if (blocks.empty())
+          return nullptr;
+        void* block = blocks.back();
+        blocks.pop_back();
+        return block;
+      }
+
+      void put(void* block, std::size_t index)
+      {
+        if (index < threadCachedClassCount)
+        {
+          ThreadCache& cache = localCache();
+          if (cache.counts[index] != threadCacheBlockCount)
+          {
+            cache.blocks[index][cache.counts[index]++] = block;
+            return;
+          }
+        }
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        shared[index].push_back(block);
+      }
+
+      // Frees the shared blocks until the pooled size fits in `limit`.
+      // Blocks cached by threads are only released when these threads exit.
+      void trim(std::size_t limit)
+      {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        for (std::size_t index = classCount; index != 0 && pooledBytes > limit; --index)
+        {
+          auto& blocks = shared[index - 1];
+          while (!blocks.empty() && pooledBytes > limit)
+          {
+            ::free(blocks.back());
+            blocks.pop_back();
+            removePooledBytes(classSize(index - 1));
+          }
+        }
+      }
+    };
+
+    // Leaked on purpose, so that buffers can still be freed during static
+    // destruction.
+    BufferPool& bufferPool()
+    {
+      static BufferPool* const pool = new BufferPool;
+      return *pool;
+    }
+
+    // Called at thread exit: the blocks of the thread go to the shared cache.
+    void releaseThreadCache(ThreadCache* cache)
+    {
+      auto& pool = bufferPool();
+      {
+        std::lock_guard<std::mutex> lock(pool.sharedMutex);
+        for (std::size_t index = 0; index != threadCachedClassCount; ++index)
+        {
+          auto& blocks = pool.shared[index];
+          blocks.insert(blocks.end(), cache->blocks[index].begin(),
+                        cache->blocks[index].begin() + cache->counts[index]);
+        }
+      }
+      delete cache;
+    }
+  } // namespace
+
+  namespace detail
+  {
+    void* allocateBufferBlock(std::size_t& size)
+    {
+      auto& pool = bufferPool();
+      if (!pool.enabled.load(std::memory_order_relaxed) || size > maxClassSize)
+        return ::malloc(size);
+
+      const auto index = classIndex(size);
+      size = classSize(index);
+      if (void* block = pool.take(index))
+      {
+        pool.removePooledBytes(size);
+        pool.hitCount.fetch_add(1, std::memory_order_relaxed);
+        return block;
+      }
+      pool.missCount.fetch_add(1, std::memory_order_relaxed);
+      return ::malloc(size);
+    }
+
+    void* reallocateBufferBlock(void* block, std::size_t blockSize, std::size_t used,
+                                std::size_t& size)
+    {
+      auto& pool = bufferPool();
+      if (!pool.enabled.load(std::memory_order_relaxed)
+          || (size > maxClassSize && !isClassSize(blockSize)))
+      {
+        // Neither block is pooled: realloc may avoid the copy.
+        return ::realloc(block, size);
+      }
+      void* newBlock = allocateBufferBlock(size);
+      if (!newBlock)
+        return nullptr;
+      if (block)
+      {
+        ::memcpy(newBlock, block, used);
+        deallocateBufferBlock(block, blockSize);
+      }
+      return newBlock;
+    }
+
+    void deallocateBufferBlock(void* block, std::size_t size)
+    {
+      if (!block)
+        return;
+      auto& pool = bufferPool();
+      if (!pool.enabled.load(std::memory_order_relaxed) || !isClassSize(size)
+          || !pool.addPooledBytes(size))
+      {
+        ::free(block);
+        return;
+      }
+      pool.put(block, classIndex(size));
+    }
+  } // namespace detail
+
+  BufferPoolStats bufferPoolStats()
+  {
+    auto& pool = bufferPool();
+    BufferPoolStats stats;
+    stats.pooledBytes = pool.pooledBytes.load(std::memory_order_relaxed);
+    stats.pooledBytesHighWater = pool.pooledBytesHighWater.load(std::memory_order_relaxed);
+    stats.hitCount = pool.hitCount.load(std::memory_order_relaxed);
+    stats.missCount = pool.missCount.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  void setBufferPoolEnabled(bool enabled)
+  {
+    auto& pool = bufferPool();
+    pool.enabled = enabled;
+    qiLogVerbose() << "Buffer pool " << (enabled ? "enabled" : "disabled");
+    if (!enabled)
+      pool.trim(0);
+  }
+
+  bool isBufferPoolEnabled()
+  {
+    return bufferPool().enabled;
+  }
+
+  void setBufferPoolMaxPooledBytes(size_t maxBytes)
+  {
+    auto& pool = bufferPool();
+    pool.maxPooledBytes = maxBytes;
+    pool.trim(maxBytes);
+  }
+} // !qi
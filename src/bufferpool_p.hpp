@@ -0,0 +1,43 @@
+#pragma once
+/*
+**  Copyright (C) 2012 Aldebaran Robotics
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_BUFFERPOOL_P_HPP_
+#define _SRC_BUFFERPOOL_P_HPP_
+
+#include <cstddef>
+
+namespace qi
+{
+  namespace detail
+  {
+    /// Size of the biggest blocks the buffer pool keeps.
+    const std::size_t maxPooledBlockSize = 1024 * 1024;
+
+    /// Allocates a block for the data of a buffer, of at least `size` bytes.
+    /// `size` is set to the actual size of the block.
+    /// Returns null if the allocation fails.
+    ///
+    /// When the buffer pool is enabled, sizes are rounded up to size classes
+    /// (powers of 2) and freed blocks are reused, first from a per-thread
+    /// cache, then from a shared one. All blocks come from `malloc`, so a block
+    /// can be freed whether the pool is enabled or not.
+    void* allocateBufferBlock(std::size_t& size);
+
+    /// Grows a block returned by `allocateBufferBlock` to at least `size`
+    /// bytes, keeping its first `used` bytes.
+    /// `size` is set to the actual size of the new block.
+    /// Returns null if the allocation fails, in which case the block is left
+    /// untouched.
+    void* reallocateBufferBlock(void* block, std::size_t blockSize, std::size_t used,
+                                std::size_t& size);
+
+    /// Gives back a block returned by `allocateBufferBlock`, `size` being the
+    /// size it returned.
+    void deallocateBufferBlock(void* block, std::size_t size);
+  }
+}
+
+#endif  // _SRC_BUFFERPOOL_P_HPP_
@@ -83,6 +83,13 @@ namespace qi {
     return _buffer->subBuffers()[_subCursor++].second;
   }
 
+  Buffer BufferReader::readSlice(size_t length)
+  {
+    Buffer slice = _buffer->slice(_cursor, length);
+    _cursor += length;
+    return slice;
+  }
+
   size_t BufferReader::position() const
   {
     return _cursor;
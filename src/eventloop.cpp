@@ -2,6 +2,8 @@
 **  Copyright (C) 2012, 2013 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <algorithm>
+#include <cmath>
 #include <thread>
 #include <system_error>
 #include <memory>
@@ -25,6 +27,7 @@
 #include <qi/getenv.hpp>
 
 #include "eventloop_p.hpp"
+#include "tasknodepool_p.hpp"
 #ifdef WITH_PROBES
 # include "tp_qi.h"
 #else
@@ -35,87 +38,67 @@ qiLogCategory("qi.eventloop");
 
 namespace qi {
 
-  class EventLoopAsio::WorkerThreadPool
+  void WorkerThreadPool::joinAll()
   {
-    using Container = std::vector<std::thread>;
-
-  public:
-    ~WorkerThreadPool() { joinAll(); }
-
-    // Launches a new worker thread which will run the function 'func(args)'.
-    // Note: It is undefined behavior to call this method while joinAll is also being called.
-    template<class Func, class... Args>
-    void launch(Func&& func, Args&&... args)
-    {
-      _workers->emplace_back(std::forward<Func>(func), std::forward<Args>(args)...);
-    }
-
-    // Launches 'count' new worker threads which will each run the function 'func(args)'.
-    // Both the function func and the arguments args will be copied for each call.
-    // Note: It is undefined behavior to call this method while joinAll is also being called.
-    template<class Func, class... Args>
-    void launchN(int count, Func&& func, Args&&... args)
+    Container workers;
     {
       auto syncedWorkers = _workers.synchronize();
-      syncedWorkers->reserve(syncedWorkers->size() + static_cast<Container::size_type>(count));
-      for (int i = 0; i < count; ++i)
+      if (isWorker(*syncedWorkers, std::this_thread::get_id()))
       {
-        syncedWorkers->emplace_back(func, args...);
+        throw std::system_error(std::make_error_code(std::errc::resource_deadlock_would_occur));
       }
+
+      using std::swap;
+      swap(*syncedWorkers, workers);
     }
 
-    // Joins all the worker threads and clears the threads container, effectively destroying the thread objects.
-    // Throws a std::system_error if called from one of the worker threads as this would be a deadlock.
-    void joinAll()
+    joinRetired();
+    for (auto& worker : workers)
     {
-      Container workers;
+      if (worker.joinable())
       {
-        auto syncedWorkers = _workers.synchronize();
-        if (isWorker(*syncedWorkers, std::this_thread::get_id()))
+        try
         {
-          throw std::system_error(std::make_error_code(std::errc::resource_deadlock_would_occur));
+          worker.join();
         }
-
-        using std::swap;
-        swap(*syncedWorkers, workers);
-      }
-
-      for (auto& worker : workers)
-      {
-        if (worker.joinable())
+        catch (const std::exception& ex)
         {
-          try
-          {
-            worker.join();
-          }
-          catch (const std::exception& ex)
-          {
-            qiLogWarning() << "Failed to join a worker thread: " << ex.what();
-          }
+          qiLogWarning() << "Failed to join a worker thread: " << ex.what();
         }
       }
     }
+  }
 
-    // This method is thread safe but is ambiguous when joinAll is also being called.
-    Container::size_type size() const
-    {
-      return _workers->size();
-    }
+  void WorkerThreadPool::retire(std::thread::id id)
+  {
+    auto syncedWorkers = _workers.synchronize();
+    auto it = std::find_if(syncedWorkers->begin(), syncedWorkers->end(),
+                           [&](const std::thread& t) { return t.get_id() == id; });
+    if (it == syncedWorkers->end())
+      return;
+    _retired->push_back(std::move(*it));
+    syncedWorkers->erase(it);
+  }
 
-    // This method is thread safe but may return a false negative when joinAll is also being called.
-    bool isWorker(std::thread::id id) const
+  void WorkerThreadPool::joinRetired()
+  {
+    Container retired;
     {
-      return isWorker(*_workers, id);
+      auto syncedRetired = _retired.synchronize();
+      using std::swap;
+      swap(*syncedRetired, retired);
     }
-
-  private:
-    static bool isWorker(const Container& workers, std::thread::id id)
+    for (auto& worker : retired)
     {
-      return boost::algorithm::any_of(workers, [&](const std::thread& t) { return t.get_id() == id; });
+      if (worker.joinable())
+        worker.join();
     }
+  }
 
-    boost::synchronized_value<Container> _workers;
-  };
+  bool WorkerThreadPool::isWorker(const Container& workers, std::thread::id id)
+  {
+    return boost::algorithm::any_of(workers, [&](const std::thread& t) { return t.get_id() == id; });
+  }
 
   using SteadyTimer = boost::asio::basic_waitable_timer<SteadyClock>;
 
@@ -125,12 +108,37 @@ namespace qi {
   static const auto gPingTimeoutEnvVar = "QI_EVENTLOOP_PING_TIMEOUT";
   static const auto gGracePeriodEnvVar = "QI_EVENTLOOP_GRACE_PERIOD";
   static const auto gMaxTimeoutsEnvVar = "QI_EVENTLOOP_MAX_TIMEOUTS";
+  static const auto gTargetLatencyEnvVar = "QI_EVENTLOOP_TARGET_LATENCY_US";
+  static const auto gIdleRetireEnvVar = "QI_EVENTLOOP_IDLE_RETIRE_MS";
+  // Period of the measurement of the queue latency.
+  static const qi::MilliSeconds gAdaptationPeriod{100};
+  // Number of consecutive periods the latency must stay above the target for
+  // a worker to be spawned.
+  static const unsigned int gSlowPeriodsBeforeSpawn = 3;
   const char* const EventLoopAsio::defaultName = "MainEventLoop";
 
+  namespace
+  {
+    /// Runs the handler of an expired timer of the wheel.
+    struct ExpiredTimer
+    {
+      TimerWheel::Handler handler;
+
+      void operator()()
+      {
+        handler(boost::system::error_code());
+      }
+    };
+  }
+
   EventLoopAsio::EventLoopAsio(int threadCount, std::string name, bool spawnOnOverload)
     : EventLoopPrivate(std::move(name))
     , _work(nullptr)
-    , _maxThreads(0)
+      // Expired timers run from the queue of the io service, so that the
+      // workers share them.
+    , _timerWheel(makeTimerWheelScheduler(_io, [this](TimerWheel::Handler& handler) {
+        _io.post(ExpiredTimer{std::move(handler)});
+      }))
     , _workerThreads(new WorkerThreadPool())
     , _spawnOnOverload(spawnOnOverload)
   {
@@ -154,6 +162,7 @@ namespace qi {
     _io.reset();
     delete _work.exchange(new boost::asio::io_service::work(_io));
 
+    _minThreads = threadCount;
     _maxThreads = qi::os::getEnvDefault(gMaxThreadsEnvVar, 150);
     _workerThreads->launchN(threadCount, &EventLoopAsio::runWorkerLoop, this);
     if (_spawnOnOverload)
@@ -190,7 +199,7 @@ namespace qi {
     join();
   }
 
-  void EventLoopAsio::runPingLoop()
+  void EventLoopPrivate::runPingLoop()
   {
     qi::os::setCurrentThreadName("EvLoop.mon");
     static const unsigned int msTimeout = qi::os::getEnvDefault(gPingTimeoutEnvVar, 500u);
@@ -198,7 +207,8 @@ namespace qi {
     static const unsigned int maxTimeouts = qi::os::getEnvDefault(gMaxTimeoutsEnvVar, 20u);
 
     unsigned int nbTimeout = 0;
-    while (_work.load())
+    Adaptation adaptation;
+    while (isRunning())
     {
       qiLogDebug() << "Ping";
       auto calling = asyncCall(Seconds{0}, []{});
@@ -206,15 +216,15 @@ namespace qi {
       QI_ASSERT(callState != FutureState_None);
       if (callState == FutureState_Running)
       {
-        const auto workerCount = static_cast<int>(_workerThreads->size());
+        const auto workers = workerCount();
         const auto maxThreads = _maxThreads.load();
-        if (maxThreads && workerCount > maxThreads) // we count in nThreads
+        if (maxThreads && workers > maxThreads) // we count in nThreads
         {
           ++nbTimeout;
           qiLogInfo() << "Threadpool " << _name << " limit reached (" << nbTimeout
-                      << " timeouts, number of tasks: " << _totalTask.load()
-                      << ", number of active tasks: " << _activeTask.load()
-                      << ", number of threads: " << workerCount
+                      << " timeouts, number of tasks: " << taskCount()
+                      << ", number of active tasks: " << activeTaskCount()
+                      << ", number of threads: " << workers
                       << ", maximum number of threads: " << maxThreads << ")";
 
           if (nbTimeout >= maxTimeouts)
@@ -238,8 +248,9 @@ namespace qi {
         }
         else
         {
-          qiLogInfo() << _name << ": Spawning more threads (" << workerCount << ')';
-          _workerThreads->launch(&EventLoopAsio::runWorkerLoop, this);
+          qiLogInfo() << _name << ": Spawning more threads (" << workers << ')';
+          spawnWorker();
+          ++_spawnedThreadCount;
         }
         qi::os::msleep(msGrace);
       }
@@ -247,7 +258,7 @@ namespace qi {
       {
         // If the event loop has been stopped and work has been destroyed at this point then
         // maybe the future has been set in error, so just ignore the result and leave.
-        if (!_work.load())
+        if (!isRunning())
         {
           qiLogDebug() << "Ignoring ping result, the event loop is being stopped";
           break;
@@ -256,11 +267,131 @@ namespace qi {
         QI_ASSERT(callState == FutureState_FinishedWithValue);
         nbTimeout = 0;
         qiLogDebug() << "Ping ok";
-        qi::os::msleep(msTimeout);
+        adaptWorkerCount(MilliSeconds{msTimeout}, adaptation);
       }
     }
   }
 
+  void EventLoopPrivate::adaptWorkerCount(qi::Duration duration, Adaptation& adaptation)
+  {
+    static const unsigned int targetLatencyUs = qi::os::getEnvDefault(gTargetLatencyEnvVar, 10000u);
+    static const unsigned int idleRetireMs = qi::os::getEnvDefault(gIdleRetireEnvVar, 5000u);
+    static const auto idlePeriodsBeforeRetire =
+      std::max(idleRetireMs / static_cast<unsigned int>(gAdaptationPeriod.count()), 1u);
+
+    const auto end = SteadyClock::now() + duration;
+    while (isRunning())
+    {
+      const auto remaining = end - SteadyClock::now();
+      if (remaining <= Duration::zero())
+        return;
+      qi::sleepFor(std::min<Duration>(remaining, gAdaptationPeriod));
+
+      const auto counts = _queueLatency.take();
+      const auto median = QueueLatencyHistogram::percentile(counts, 0.5);
+      const auto p99 = QueueLatencyHistogram::percentile(counts, 0.99);
+      _queueLatencyMedianNs = median.count();
+      _queueLatencyP99Ns = p99.count();
+      if (targetLatencyUs == 0)
+        continue;
+
+      const Duration target = MicroSeconds(targetLatencyUs);
+      const auto workers = workerCount();
+      if (p99 > target)
+      {
+        adaptation.idlePeriods = 0;
+        if (++adaptation.slowPeriods < gSlowPeriodsBeforeSpawn)
+          continue;
+        adaptation.slowPeriods = 0;
+        const auto maxThreads = _maxThreads.load();
+        if (maxThreads && workers >= maxThreads)
+          continue;
+        qiLogVerbose() << _name << ": queue latency " << qi::to_string(p99)
+                       << ", spawning a thread (" << workers << ')';
+        spawnWorker();
+        ++_spawnedThreadCount;
+        continue;
+      }
+
+      adaptation.slowPeriods = 0;
+      // Idle: the latency is well below the target, and at least two
+      // workers have nothing to do.
+      if (p99 * 4 > target || activeTaskCount() + 1 >= workers)
+      {
+        adaptation.idlePeriods = 0;
+        continue;
+      }
+      if (++adaptation.idlePeriods < idlePeriodsBeforeRetire)
+        continue;
+      adaptation.idlePeriods = 0;
+      if (workers <= _minThreads.load())
+        continue;
+      if (retireWorker())
+      {
+        qiLogVerbose() << _name << ": workers idle, retiring a thread (" << workers << ')';
+        ++_retiredThreadCount;
+      }
+    }
+  }
+
+  EventLoopStats EventLoopPrivate::stats() const
+  {
+    return EventLoopStats{
+      workerCount(),
+      _minThreads.load(),
+      _maxThreads.load(),
+      taskCount(),
+      activeTaskCount(),
+      Duration(_queueLatencyMedianNs.load()),
+      Duration(_queueLatencyP99Ns.load()),
+      _spawnedThreadCount.load(),
+      _retiredThreadCount.load()
+    };
+  }
+
+  const std::size_t QueueLatencyHistogram::bucketCount;
+
+  void QueueLatencyHistogram::record(qi::Duration wait)
+  {
+    // Bucket i holds the latencies in [2^(i-1), 2^i[ microseconds.
+    auto us = static_cast<qi::uint64_t>(
+      std::max<qi::int64_t>(boost::chrono::duration_cast<MicroSeconds>(wait).count(), 0));
+    std::size_t bucket = 0;
+    while (us != 0 && bucket + 1 < bucketCount)
+    {
+      us >>= 1;
+      ++bucket;
+    }
+    _counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  QueueLatencyHistogram::Counts QueueLatencyHistogram::take()
+  {
+    Counts counts;
+    for (std::size_t i = 0; i != bucketCount; ++i)
+      counts[i] = _counts[i].exchange(0, std::memory_order_relaxed);
+    return counts;
+  }
+
+  qi::Duration QueueLatencyHistogram::percentile(const Counts& counts, double fraction)
+  {
+    qi::uint64_t total = 0;
+    for (const auto count : counts)
+      total += count;
+    if (total == 0)
+      return Duration::zero();
+
+    const auto rank = static_cast<qi::uint64_t>(std::ceil(fraction * static_cast<double>(total)));
+    qi::uint64_t seen = 0;
+    for (std::size_t i = 0; i != bucketCount; ++i)
+    {
+      seen += counts[i];
+      if (seen >= rank)
+        return MicroSeconds(qi::int64_t(1) << i);
+    }
+    return MicroSeconds(qi::int64_t(1) << (bucketCount - 1));
+  }
+
   void EventLoopAsio::runWorkerLoop()
   {
     qiLogDebug() << this << "run starting from pool";
@@ -342,11 +473,94 @@ namespace qi {
     }
   }
 
-  void EventLoopAsio::post(qi::Duration delay,
-      const boost::function<void ()>& cb, ExecutionOptions options)
+  class EventLoopAsio::PostedTask
   {
-    static boost::system::error_code erc;
+  public:
+    using allocator_type = detail::TaskNodeAllocator<void>;
+
+    PostedTask(EventLoopAsio* loop, boost::function<void()> callback, qi::uint64_t id)
+      : _loop(loop)
+      , _callback(std::move(callback))
+      , _id(id)
+      , _postedAt(SteadyClock::now())
+    {
+      ++_loop->_totalTask;
+    }
 
+    PostedTask(PostedTask&& other)
+      : _loop(other._loop)
+      , _callback(std::move(other._callback))
+      , _id(other._id)
+      , _postedAt(other._postedAt)
+    {
+      other._loop = nullptr;
+    }
+
+    // Asio requires handlers to be copyable. Every copy counts the task.
+    PostedTask(const PostedTask& other)
+      : _loop(other._loop)
+      , _callback(other._callback)
+      , _id(other._id)
+      , _postedAt(other._postedAt)
+    {
+      if (_loop)
+        ++_loop->_totalTask;
+    }
+
+    PostedTask& operator=(const PostedTask&) = delete;
+
+    // The task is also counted until then when it is dropped without running,
+    // at the destruction of the io service.
+    ~PostedTask()
+    {
+      if (_loop)
+        --_loop->_totalTask;
+    }
+
+    void operator()()
+    {
+      _loop->invokePosted(_callback, _id, _postedAt);
+    }
+
+    allocator_type get_allocator() const
+    {
+      return {};
+    }
+
+  private:
+    EventLoopAsio* _loop;
+    boost::function<void()> _callback;
+    qi::uint64_t _id;
+    qi::SteadyClockTimePoint _postedAt;
+  };
+
+  void EventLoopAsio::invokePosted(boost::function<void()>& f, qi::uint64_t id,
+                                   qi::SteadyClockTimePoint postedAt)
+  {
+    boost::ignore_unused(id);
+    recordQueueLatency(postedAt);
+    auto _ = ka::scoped_incr_and_decr(_activeTask);
+    tracepoint(qi_qi, eventloop_task_start, id);
+
+    try
+    {
+      f();
+      tracepoint(qi_qi, eventloop_task_stop, id);
+    }
+    catch (const detail::TerminateThread& /* e */)
+    {
+      throw;
+    }
+    catch (...)
+    {
+      // Nobody waits for the result of a posted task.
+      tracepoint(qi_qi, eventloop_task_error, id);
+    }
+  }
+
+  void EventLoopAsio::post(qi::Duration delay,
+      boost::function<void ()> cb, ExecutionOptions options)
+  {
     if (!_work.load())
     {
       // This seems to be an error but as we have this log a lot sometimes at the destruction
@@ -360,12 +574,11 @@ namespace qi {
       const auto id = ++gTaskId;
       tracepoint(qi_qi, eventloop_post, id, cb.target_type().name());
 
-      auto countTotalTask = ka::shared_ptr(ka::scoped_incr_and_decr(_totalTask));
-      _io.post([=] { invoke_maybe(cb, id, Promise<void>{}, erc, countTotalTask); });
+      _io.post(PostedTask{this, std::move(cb), id});
     }
     else
     {
-      asyncCall(delay, cb, options).then([](const Future<void>& fut)
+      asyncCall(delay, std::move(cb), options).then([](const Future<void>& fut)
       {
         if (fut.hasError())
         {
@@ -375,16 +588,16 @@ namespace qi {
     }
   }
 
-  namespace detail
+  template <typename D>
+  qi::Future<void> EventLoopAsio::asyncWaitOnTimerWheel(qi::SteadyClockTimePoint deadline,
+      boost::function<void()> cb, qi::uint64_t id, D countTask, ExecutionOptions options)
   {
-    template<class CancelFunc>
-    qi::Promise<void> makeCancelingPromise(ExecutionOptions options, CancelFunc&& onCancel)
-    {
-      if (options.onCancelRequested == CancelOption::NeverSkipExecution)
-        return qi::Promise<void>();
-      else
-        return qi::Promise<void>(std::forward<CancelFunc>(onCancel));
-    }
+    Promise<void> prom;
+    auto cancel = _timerWheel->add(deadline, [=](const boost::system::error_code& erc) {
+      invoke_maybe(cb, id, prom, erc, countTask);
+    });
+    detail::setCancelingFunction(prom, options, std::move(cancel));
+    return prom.future();
   }
 
   qi::Future<void> EventLoopAsio::asyncCall(qi::Duration delay,
@@ -400,6 +613,9 @@ namespace qi {
     auto countTotalTask = ka::shared_ptr(ka::scoped_incr_and_decr(_totalTask));
 
     tracepoint(qi_qi, eventloop_delay, id, cb.target_type().name(), boost::chrono::duration_cast<qi::MicroSeconds>(delay).count());
+    if (_timerWheel && delay > Duration::zero() && _timerWheel->handles(delay))
+      return asyncWaitOnTimerWheel(SteadyClock::now() + delay, std::move(cb), id, countTotalTask, options);
+
     if (delay > Duration::zero())
     {
       boost::shared_ptr<boost::asio::steady_timer> timer = boost::make_shared<boost::asio::steady_timer>(boost::ref(_io));
@@ -409,14 +625,18 @@ namespace qi {
       return prom.future();
     }
     Promise<void> prom;
-    _io.post([=] { invoke_maybe(cb, id, prom, erc, countTotalTask); });
+    const auto postedAt = SteadyClock::now();
+    _io.post([=] {
+      recordQueueLatency(postedAt);
+      invoke_maybe(cb, id, prom, erc, countTotalTask);
+    });
     return prom.future();
   }
 
   void EventLoopAsio::post(qi::SteadyClockTimePoint timepoint,
-      const boost::function<void ()>& cb, ExecutionOptions options)
+      boost::function<void ()> cb, ExecutionOptions options)
   {
-    asyncCall(timepoint, cb, options).then([](const Future<void>& fut)
+    asyncCall(timepoint, std::move(cb), options).then([](const Future<void>& fut)
     {
       if (fut.hasError())
       {
@@ -436,6 +656,9 @@ namespace qi {
     auto countTotalTask = ka::shared_ptr(ka::scoped_incr_and_decr(_totalTask));
 
     //tracepoint(qi_qi, eventloop_delay, id, cb.target_type().name(), qi::MicroSeconds(delay).count());
+    if (_timerWheel && _timerWheel->handles(timepoint - SteadyClock::now()))
+      return asyncWaitOnTimerWheel(timepoint, std::move(cb), id, countTotalTask, options);
+
     boost::shared_ptr<SteadyTimer> timer = boost::make_shared<SteadyTimer>(boost::ref(_io));
     timer->expires_at(timepoint);
     auto prom = detail::makeCancelingPromise(options, boost::bind(&SteadyTimer::cancel, timer));
@@ -453,8 +676,76 @@ namespace qi {
     return static_cast<void*>(&_io);
   }
 
+  bool EventLoopAsio::isRunning() const
+  {
+    return _work.load() != nullptr;
+  }
+
+  int EventLoopAsio::workerCount() const
+  {
+    return static_cast<int>(_workerThreads->size());
+  }
+
+  void EventLoopAsio::spawnWorker()
+  {
+    _workerThreads->launch(&EventLoopAsio::runWorkerLoop, this);
+  }
+
+  bool EventLoopAsio::retireWorker()
+  {
+    _workerThreads->joinRetired();
+    // The first worker to take it exits.
+    _io.post([this] {
+      _workerThreads->retire(std::this_thread::get_id());
+      throw detail::TerminateThread();
+    });
+    return true;
+  }
+
+  int64_t EventLoopAsio::taskCount() const
+  {
+    return _totalTask.load();
+  }
+
+  int64_t EventLoopAsio::activeTaskCount() const
+  {
+    return _activeTask.load();
+  }
+
+  namespace
+  {
+    const auto gSchedulerEnvVar = "QI_EVENTLOOP_SCHEDULER";
+    boost::synchronized_value<std::string> gSchedulerOption;
+
+    void setSchedulerOption(const std::string& scheduler)
+    {
+      *gSchedulerOption = scheduler;
+    }
+
+    _QI_COMMAND_LINE_OPTIONS(
+      "Event loop options",
+      ("qi-eventloop-scheduler", value<std::string>()->notifier(&setSchedulerOption),
+       "Scheduler of the event loops created afterwards: asio (default) or workstealing.\n"
+       "Can be set with env var QI_EVENTLOOP_SCHEDULER")
+    )
+  }
+
+  std::shared_ptr<EventLoopPrivate> makeEventLoopPrivate(int threadCount, std::string name,
+                                                         bool spawnOnOverload)
+  {
+    std::string scheduler = *gSchedulerOption;
+    if (scheduler.empty())
+      scheduler = qi::os::getenv(gSchedulerEnvVar);
+
+    if (scheduler == "workstealing")
+      return std::make_shared<EventLoopWorkStealing>(threadCount, std::move(name), spawnOnOverload);
+    if (!scheduler.empty() && scheduler != "asio")
+      qiLogWarning() << "Unknown event loop scheduler '" << scheduler << "', using asio";
+    return std::make_shared<EventLoopAsio>(threadCount, std::move(name), spawnOnOverload);
+  }
+
   EventLoop::EventLoop(std::string name, int nthreads, bool spawnOnOverload)
-    : _p(std::make_shared<EventLoopAsio>(nthreads, name, spawnOnOverload))
+    : _p(makeEventLoopPrivate(nthreads, name, spawnOnOverload))
     , _name(name)
   {
   }
@@ -535,7 +826,7 @@ namespace qi {
   {
     return safeCall(_p, [&](const ImplPtr& impl){
       qiLogDebug() << this << " EventLoop post " << &callback;
-      impl->post(delay, callback, options);
+      impl->post(delay, std::move(callback), options);
       qiLogDebug() << this << " EventLoop post done " << &callback;
     });
   }
@@ -579,6 +870,15 @@ namespace qi {
     });
   }
 
+  EventLoopStats EventLoop::stats() const
+  {
+    return safeCall(_p, [](const ImplPtr& impl) {
+      return impl->stats();
+    }, [] {
+      return EventLoopStats{};
+    });
+  }
+
   void EventLoop::setMaxThreads(unsigned int max)
   {
     return safeCall(_p, [=](const ImplPtr& impl){
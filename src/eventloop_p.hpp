@@ -7,11 +7,22 @@
 #ifndef _SRC_EVENTLOOP_P_HPP_
 #define _SRC_EVENTLOOP_P_HPP_
 
+#include <array>
 #include <atomic>
+#include <deque>
+#include <memory>
 #include <thread>
+#include <vector>
 #include <boost/asio.hpp>
+#include <boost/optional.hpp>
 #include <qi/eventloop.hpp>
+#include <qi/future.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/synchronized_value.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "timerwheel_p.hpp"
 
 namespace qi {
   class AsyncCallHandlePrivate
@@ -35,6 +46,28 @@ namespace qi {
     Stream* sd;
   };
 
+  /// Histogram of the time tasks wait in the queue of an event loop, with
+  /// buckets of powers of two microseconds. Recorded by the workers without
+  /// locking, and taken periodically.
+  class QueueLatencyHistogram
+  {
+  public:
+    static const std::size_t bucketCount = 32;
+    using Counts = std::array<qi::uint64_t, bucketCount>;
+
+    void record(qi::Duration wait);
+
+    /// Returns the counts recorded since the last call.
+    Counts take();
+
+    /// Upper bound of the latency of the given fraction of the values, or
+    /// zero if there is none.
+    static qi::Duration percentile(const Counts& counts, double fraction);
+
+  private:
+    std::array<std::atomic<qi::uint64_t>, bucketCount> _counts{};
+  };
+
   class EventLoopPrivate
   {
   public:
@@ -46,15 +79,142 @@ namespace qi {
     virtual void join()=0;
     virtual void stop()=0;
     virtual qi::Future<void> asyncCall(qi::Duration delay, boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions())=0;
-    virtual void post(qi::Duration delay, const boost::function<void ()>& callback, ExecutionOptions options = defaultExecutionOptions())=0;
+    virtual void post(qi::Duration delay, boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions())=0;
     virtual qi::Future<void> asyncCall(qi::SteadyClockTimePoint timepoint, boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions())=0;
-    virtual void post(qi::SteadyClockTimePoint timepoint, const boost::function<void ()>& callback, ExecutionOptions options = defaultExecutionOptions())=0;
+    virtual void post(qi::SteadyClockTimePoint timepoint, boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions())=0;
     virtual void* nativeHandle()=0;
     virtual void setMaxThreads(unsigned int max)=0;
+    EventLoopStats stats() const;
     boost::synchronized_value<boost::function<void()>> _emergencyCallback;
     const std::string _name;
+
+  protected:
+    // Between pings, spawns a worker when the queue latency stays above the
+    // target (QI_EVENTLOOP_TARGET_LATENCY_US) and retires one when the workers
+    // stay idle (QI_EVENTLOOP_IDLE_RETIRE_MS), within the minimum and maximum
+    // numbers of threads.
+    // As a fallback, spawns a new worker each time a ping is not handled in
+    // time, until the maximum number of threads is reached. Then, calls the
+    // emergency callback.
+    void runPingLoop();
+
+    virtual bool isRunning() const = 0;
+    virtual int workerCount() const = 0;
+    virtual void spawnWorker() = 0;
+    // Makes a worker exit once it is done with its current task. Returns
+    // false if the scheduler cannot retire workers.
+    virtual bool retireWorker() = 0;
+    virtual int64_t taskCount() const = 0;
+    virtual int64_t activeTaskCount() const = 0;
+
+    void recordQueueLatency(qi::SteadyClockTimePoint queuedAt)
+    {
+      _queueLatency.record(qi::SteadyClock::now() - queuedAt);
+    }
+
+    std::atomic<int> _minThreads{0};
+    std::atomic<int> _maxThreads{0};
+
+  private:
+    // Consecutive measurement periods with a high latency or idle workers.
+    struct Adaptation
+    {
+      unsigned int slowPeriods = 0;
+      unsigned int idlePeriods = 0;
+    };
+
+    // Measures the queue latency and adapts the number of workers every
+    // period, until `duration` elapsed.
+    void adaptWorkerCount(qi::Duration duration, Adaptation& adaptation);
+
+    QueueLatencyHistogram _queueLatency;
+    std::atomic<qi::int64_t> _queueLatencyMedianNs{0};
+    std::atomic<qi::int64_t> _queueLatencyP99Ns{0};
+    std::atomic<qi::uint64_t> _spawnedThreadCount{0};
+    std::atomic<qi::uint64_t> _retiredThreadCount{0};
   };
 
+  /// Threads of an event loop.
+  class WorkerThreadPool
+  {
+    using Container = std::vector<std::thread>;
+
+  public:
+    ~WorkerThreadPool() { joinAll(); }
+
+    // Launches a new worker thread which will run the function 'func(args)'.
+    // Note: It is undefined behavior to call this method while joinAll is also being called.
+    template<class Func, class... Args>
+    void launch(Func&& func, Args&&... args)
+    {
+      _workers->emplace_back(std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    // Launches 'count' new worker threads which will each run the function 'func(args)'.
+    // Both the function func and the arguments args will be copied for each call.
+    // Note: It is undefined behavior to call this method while joinAll is also being called.
+    template<class Func, class... Args>
+    void launchN(int count, Func&& func, Args&&... args)
+    {
+      auto syncedWorkers = _workers.synchronize();
+      syncedWorkers->reserve(syncedWorkers->size() + static_cast<Container::size_type>(count));
+      for (int i = 0; i < count; ++i)
+      {
+        syncedWorkers->emplace_back(func, args...);
+      }
+    }
+
+    // Joins all the worker threads and clears the threads container, effectively destroying the thread objects.
+    // Throws a std::system_error if called from one of the worker threads as this would be a deadlock.
+    void joinAll();
+
+    // Called by a worker about to exit: it is no longer counted, and is joined by the next call to
+    // joinRetired or joinAll.
+    void retire(std::thread::id id);
+
+    // Joins the retired workers. Must not be called from a worker.
+    void joinRetired();
+
+    // This method is thread safe but is ambiguous when joinAll is also being called.
+    Container::size_type size() const
+    {
+      return _workers->size();
+    }
+
+    // This method is thread safe but may return a false negative when joinAll is also being called.
+    bool isWorker(std::thread::id id) const
+    {
+      return isWorker(*_workers, id);
+    }
+
+  private:
+    static bool isWorker(const Container& workers, std::thread::id id);
+
+    boost::synchronized_value<Container> _workers;
+    boost::synchronized_value<Container> _retired;
+  };
+
+  namespace detail
+  {
+    template<class CancelFunc>
+    qi::Promise<void> makeCancelingPromise(ExecutionOptions options, CancelFunc&& onCancel)
+    {
+      if (options.onCancelRequested == CancelOption::NeverSkipExecution)
+        return qi::Promise<void>();
+      else
+        return qi::Promise<void>(std::forward<CancelFunc>(onCancel));
+    }
+
+    /// Same as makeCancelingPromise, for a promise created before the
+    /// function canceling its task.
+    template<class CancelFunc>
+    void setCancelingFunction(qi::Promise<void>& promise, ExecutionOptions options, CancelFunc onCancel)
+    {
+      if (options.onCancelRequested != CancelOption::NeverSkipExecution)
+        promise.setOnCancel([onCancel](qi::Promise<void>&) { onCancel(); });
+    }
+  }
+
   class EventLoopAsio final: public EventLoopPrivate
   {
   public:
@@ -71,27 +231,42 @@ namespace qi {
     qi::Future<void> asyncCall(qi::Duration delay,
       boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
     void post(qi::Duration delay,
-      const boost::function<void ()>& callback, ExecutionOptions options = defaultExecutionOptions()) override;
+      boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
     qi::Future<void> asyncCall(qi::SteadyClockTimePoint timepoint,
         boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
     void post(qi::SteadyClockTimePoint timepoint,
-        const boost::function<void ()>& callback, ExecutionOptions options = defaultExecutionOptions()) override;
+        boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
     void* nativeHandle() override;
     void setMaxThreads(unsigned int max) override;
 
+  protected:
+    bool isRunning() const override;
+    int workerCount() const override;
+    void spawnWorker() override;
+    bool retireWorker() override;
+    int64_t taskCount() const override;
+    int64_t activeTaskCount() const override;
+
   private:
     /// Destructible D
     template<typename D>
     void invoke_maybe(boost::function<void()> f, qi::uint64_t id, qi::Promise<void> p,
                       const boost::system::error_code& erc, D countTask);
+    void invokePosted(boost::function<void()>& f, qi::uint64_t id, qi::SteadyClockTimePoint postedAt);
+    template<typename D>
+    qi::Future<void> asyncWaitOnTimerWheel(qi::SteadyClockTimePoint deadline, boost::function<void()> cb,
+                                           qi::uint64_t id, D countTask, ExecutionOptions options);
     void runWorkerLoop();
-    void runPingLoop();
+
+    /// Handler of a callback posted without delay. It fulfills no promise
+    /// and its operation is allocated from the task node pool.
+    class PostedTask;
 
     boost::asio::io_service _io;
     std::atomic<boost::asio::io_service::work*> _work; // keep io.run() alive
-    std::atomic<int> _maxThreads;
+    // Null if disabled.
+    const std::unique_ptr<TimerWheelScheduler> _timerWheel;
 
-    class WorkerThreadPool;
     std::unique_ptr<WorkerThreadPool> _workerThreads;
     std::thread _pingThread;
 
@@ -99,6 +274,136 @@ namespace qi {
     std::atomic<int64_t> _activeTask {0};
     const bool _spawnOnOverload;
   };
+
+  /// Event loop scheduling its tasks on per-worker queues with work stealing.
+  ///
+  /// A task posted from one of the workers goes to the queue of this worker,
+  /// which runs it unless another worker, idle, steals it first. Tasks posted
+  /// from other threads go to a shared injection queue. Workers only contend
+  /// with the ones stealing from them, and tasks tend to stay on the thread
+  /// (and the core) that created them.
+  ///
+  /// Timers and the native handle are served by an io_service run by a
+  /// dedicated thread: tasks whose delay expires are injected into the
+  /// workers' queues.
+  ///
+  /// Tasks posted from a given thread are started in order, as long as they
+  /// are not stolen. Like with EventLoopAsio, there is no ordering guarantee
+  /// between tasks run by different workers.
+  class EventLoopWorkStealing final: public EventLoopPrivate
+  {
+  public:
+    explicit EventLoopWorkStealing(int threadCount = 0, std::string name = EventLoopAsio::defaultName,
+      bool spawnOnOverload = true);
+    ~EventLoopWorkStealing() override;
+
+    bool isInThisContext() const override;
+    void start(int nthreads) override;
+    void join() override;
+    void stop() override;
+    qi::Future<void> asyncCall(qi::Duration delay,
+      boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
+    void post(qi::Duration delay,
+      boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
+    qi::Future<void> asyncCall(qi::SteadyClockTimePoint timepoint,
+        boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
+    void post(qi::SteadyClockTimePoint timepoint,
+        boost::function<void ()> callback, ExecutionOptions options = defaultExecutionOptions()) override;
+    void* nativeHandle() override;
+    void setMaxThreads(unsigned int max) override;
+
+  protected:
+    bool isRunning() const override;
+    int workerCount() const override;
+    void spawnWorker() override;
+    // Workers own their queue: they are never retired.
+    bool retireWorker() override
+    {
+      return false;
+    }
+    int64_t taskCount() const override;
+    int64_t activeTaskCount() const override;
+
+  private:
+    struct Task
+    {
+      boost::function<void()> callback;
+      // Not set for posted tasks, which nobody waits for.
+      boost::optional<qi::Promise<void>> promise;
+      // Set by push.
+      qi::SteadyClockTimePoint pushedAt;
+    };
+
+    class TaskQueue
+    {
+    public:
+      void push(Task task);
+      bool pop(Task& task);
+      // May be outdated as soon as it returns.
+      std::size_t size() const { return _size.load(); }
+      void clear();
+
+    private:
+      boost::mutex _mutex;
+      std::deque<Task> _tasks;
+      std::atomic<std::size_t> _size{0};
+    };
+
+    struct Worker
+    {
+      TaskQueue queue;
+      std::atomic<bool> busy{false};
+      unsigned int tick = 0;
+    };
+
+    // The workers are owned by _workers.
+    static void doNotDelete(Worker*) {}
+
+    void runWorkerLoop(std::size_t index);
+    void runIoLoop();
+    void push(Task task);
+    bool nextTask(std::size_t index, Task& task);
+    bool hasPendingTask() const;
+    void waitForTask();
+    void wakeUpWorker();
+    void runTask(Worker& worker, Task& task);
+    template<typename Timer>
+    qi::Future<void> asyncWait(boost::shared_ptr<Timer> timer, boost::function<void()> callback,
+                               ExecutionOptions options);
+    qi::Future<void> asyncWaitOnTimerWheel(qi::SteadyClockTimePoint deadline,
+                                           boost::function<void()> callback, ExecutionOptions options);
+
+    std::atomic<bool> _running{false};
+    const bool _spawnOnOverload;
+
+    // Slots are allocated when the loop starts and filled as workers are
+    // spawned, so that they can be read without locking.
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<std::size_t> _workerCount{0};
+    TaskQueue _injected;
+    boost::thread_specific_ptr<Worker> _currentWorker;
+
+    boost::mutex _sleepMutex;
+    boost::condition_variable _sleepCondition;
+    std::atomic<int> _sleepingCount{0};
+    int _wakeUpCount = 0;
+
+    boost::asio::io_service _io;
+    std::unique_ptr<boost::asio::io_service::work> _work;
+    // Null if disabled.
+    const std::unique_ptr<TimerWheelScheduler> _timerWheel;
+    std::thread _ioThread;
+    std::atomic<std::thread::id> _ioThreadId{std::thread::id()};
+
+    std::unique_ptr<WorkerThreadPool> _workerThreads;
+    std::thread _pingThread;
+  };
+
+  /// Creates the implementation of an event loop, using the scheduler set by
+  /// the `--qi-eventloop-scheduler` option or by the QI_EVENTLOOP_SCHEDULER
+  /// environment variable: "asio" (the default) or "workstealing".
+  std::shared_ptr<EventLoopPrivate> makeEventLoopPrivate(int threadCount, std::string name,
+                                                         bool spawnOnOverload);
 }
 
 #endif  // _SRC_EVENTLOOP_P_HPP_
@@ -0,0 +1,198 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <boost/thread/mutex.hpp>
+
+#include <qi/application.hpp>
+#include <qi/getenv.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+#include "eventloopshards_p.hpp"
+
+qiLogCategory("qi.eventloop");
+
+namespace qi
+{
+  namespace detail
+  {
+    struct EventLoopShard
+    {
+      std::string name;
+      // Stopped at the exit of the application, but destroyed with the last
+      // connection assigned to the shard, whose socket uses its io service.
+      std::unique_ptr<EventLoop> eventLoop;
+      std::atomic<unsigned int> connectionCount{0};
+      std::atomic<qi::uint64_t> totalConnectionCount{0};
+    };
+  }
+
+  namespace
+  {
+    const auto gShardCountEnvVar = "QI_NETWORK_EVENTLOOP_SHARDS";
+    const auto gShardAffinityEnvVar = "QI_NETWORK_EVENTLOOP_SHARD_AFFINITY";
+    const auto gShardPolicyEnvVar = "QI_NETWORK_EVENTLOOP_SHARD_POLICY";
+
+    using ShardPtr = std::shared_ptr<detail::EventLoopShard>;
+
+    struct ShardsState
+    {
+      boost::mutex mutex;
+      bool initialized = false;
+      std::vector<ShardPtr> shards;
+      EventLoopShardPolicy policy;
+    };
+
+    // Leaked on purpose, so that connections can still be released during
+    // static destruction.
+    ShardsState& shardsState()
+    {
+      static ShardsState* const state = new ShardsState;
+      return *state;
+    }
+
+    std::vector<EventLoopShardStats> statsOf(const std::vector<ShardPtr>& shards)
+    {
+      std::vector<EventLoopShardStats> stats;
+      stats.reserve(shards.size());
+      for (const auto& shard : shards)
+        stats.push_back(EventLoopShardStats{shard->name, shard->connectionCount.load(),
+                                            shard->totalConnectionCount.load()});
+      return stats;
+    }
+
+    EventLoopShardPolicy policyFromEnv()
+    {
+      const auto name = qi::os::getEnvDefault<std::string>(gShardPolicyEnvVar, "roundrobin");
+      if (name == "leastloaded")
+        return leastLoadedShardPolicy();
+      if (name != "roundrobin")
+        qiLogWarning() << "Unknown " << gShardPolicyEnvVar << " '" << name
+                       << "', using roundrobin";
+      return roundRobinShardPolicy();
+    }
+
+    void stopShards()
+    {
+      auto& state = shardsState();
+      std::vector<ShardPtr> shards;
+      {
+        boost::mutex::scoped_lock lock(state.mutex);
+        std::swap(shards, state.shards);
+      }
+      // Only join the threads: connections may outlive the shards, and
+      // their last one is then never released from a thread of its shard.
+      for (auto& shard : shards)
+        shard->eventLoop->stop();
+    }
+
+    // Must be called with the mutex of the state locked.
+    void initializeShards(ShardsState& state)
+    {
+      state.initialized = true;
+      if (!state.policy)
+        state.policy = policyFromEnv();
+
+      const auto shardCount = qi::os::getEnvDefault(gShardCountEnvVar, 0u);
+      if (shardCount == 0)
+        return;
+      const bool pinned = qi::os::getEnvDefault(gShardAffinityEnvVar, 1u) != 0;
+      const long cpuCount = std::max(qi::os::numberOfCPUs(), 1L);
+
+      qiLogVerbose() << "Creating " << shardCount << " network event loop shards";
+      for (unsigned int i = 0; i != shardCount; ++i)
+      {
+        auto shard = std::make_shared<detail::EventLoopShard>();
+        shard->name = "EventLoopNetwork" + std::to_string(i);
+        shard->eventLoop.reset(new EventLoop(shard->name, 1, false));
+        if (pinned)
+        {
+          const int cpu = static_cast<int>(i % cpuCount);
+          const auto name = shard->name;
+          shard->eventLoop->post([cpu, name] {
+            if (!qi::os::setCurrentThreadCPUAffinity(std::vector<int>{cpu}))
+              qiLogWarning() << "Cannot pin " << name << " to cpu " << cpu;
+          });
+        }
+        state.shards.push_back(std::move(shard));
+      }
+      Application::atExit(&stopShards);
+    }
+  }
+
+  NetworkEventLoopShardPtr NetworkEventLoopShard::assign()
+  {
+    auto& state = shardsState();
+    ShardPtr shard;
+    {
+      boost::mutex::scoped_lock lock(state.mutex);
+      if (!state.initialized)
+        initializeShards(state);
+      if (state.shards.empty())
+        return {};
+      const auto index = state.policy(statsOf(state.shards)) % state.shards.size();
+      shard = state.shards[index];
+      ++shard->connectionCount;
+      ++shard->totalConnectionCount;
+    }
+    return std::make_shared<NetworkEventLoopShard>(std::move(shard));
+  }
+
+  NetworkEventLoopShard::NetworkEventLoopShard(std::shared_ptr<detail::EventLoopShard> shard)
+    : _shard(std::move(shard))
+  {
+  }
+
+  NetworkEventLoopShard::~NetworkEventLoopShard()
+  {
+    --_shard->connectionCount;
+  }
+
+  EventLoop* NetworkEventLoopShard::eventLoop() const
+  {
+    return _shard->eventLoop.get();
+  }
+
+  EventLoopShardPolicy roundRobinShardPolicy()
+  {
+    auto next = std::make_shared<std::atomic<std::size_t>>(0);
+    return [next](const std::vector<EventLoopShardStats>& shards) {
+      return (*next)++ % shards.size();
+    };
+  }
+
+  EventLoopShardPolicy leastLoadedShardPolicy()
+  {
+    return [](const std::vector<EventLoopShardStats>& shards) {
+      // Among the least loaded, the one which had the fewest connections.
+      const auto it = std::min_element(shards.begin(), shards.end(),
+        [](const EventLoopShardStats& a, const EventLoopShardStats& b) {
+          return std::make_pair(a.connectionCount, a.totalConnectionCount)
+               < std::make_pair(b.connectionCount, b.totalConnectionCount);
+        });
+      return static_cast<std::size_t>(it - shards.begin());
+    };
+  }
+
+  void setNetworkEventLoopShardPolicy(EventLoopShardPolicy policy)
+  {
+    auto& state = shardsState();
+    boost::mutex::scoped_lock lock(state.mutex);
+    state.policy = policy ? std::move(policy) : policyFromEnv();
+  }
+
+  std::vector<EventLoopShardStats> networkEventLoopShardStats()
+  {
+    auto& state = shardsState();
+    boost::mutex::scoped_lock lock(state.mutex);
+    if (!state.initialized)
+      initializeShards(state);
+    return statsOf(state.shards);
+  }
+}
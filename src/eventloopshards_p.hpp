@@ -0,0 +1,47 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_EVENTLOOPSHARDS_P_HPP_
+#define _SRC_EVENTLOOPSHARDS_P_HPP_
+
+#include <memory>
+#include <qi/eventloop.hpp>
+
+namespace qi
+{
+  namespace detail
+  {
+    struct EventLoopShard;
+  }
+
+  /// Assignment of a connection to a shard of the network event loop, see
+  /// `setNetworkEventLoopShardPolicy`. The connection counts in the load of
+  /// its shard until the assignment is destroyed, and the event loop of the
+  /// shard lives at least as long.
+  class NetworkEventLoopShard
+  {
+  public:
+    /// Assigns a new connection to the shard chosen by the policy. Returns
+    /// null if the network event loop has no shards.
+    static std::shared_ptr<NetworkEventLoopShard> assign();
+
+    explicit NetworkEventLoopShard(std::shared_ptr<detail::EventLoopShard> shard);
+    ~NetworkEventLoopShard();
+
+    NetworkEventLoopShard(const NetworkEventLoopShard&) = delete;
+    NetworkEventLoopShard& operator=(const NetworkEventLoopShard&) = delete;
+
+    /// The event loop that must run the connection.
+    EventLoop* eventLoop() const;
+
+  private:
+    const std::shared_ptr<detail::EventLoopShard> _shard;
+  };
+
+  using NetworkEventLoopShardPtr = std::shared_ptr<NetworkEventLoopShard>;
+}
+
+#endif  // _SRC_EVENTLOOPSHARDS_P_HPP_
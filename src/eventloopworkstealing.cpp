@@ -0,0 +1,494 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+#include <algorithm>
+#include <system_error>
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/make_shared.hpp>
+
+#include <ka/scoped.hpp>
+#include <qi/log.hpp>
+#include <qi/getenv.hpp>
+
+#include "eventloop_p.hpp"
+
+qiLogCategory("qi.eventloop");
+
+namespace qi {
+
+  namespace
+  {
+    const auto gThreadCountEnvVar = "QI_EVENTLOOP_THREAD_COUNT";
+    const auto gMaxThreadsEnvVar  = "QI_EVENTLOOP_MAX_THREADS";
+    const int defaultMaxThreads = 150;
+
+    // A worker looks at the injection queue first once every this number of
+    // tasks, so that tasks posted from other threads are not starved by the
+    // ones the workers keep posting to themselves.
+    const unsigned int injectionCheckInterval = 61;
+
+    // Number of times an idle worker looks for tasks before sleeping: tasks
+    // often come in bursts, and waking a worker up is costly.
+    const int idleSpinCount = 64;
+
+    using SteadyTimer = boost::asio::basic_waitable_timer<SteadyClock>;
+  }
+
+  void EventLoopWorkStealing::TaskQueue::push(Task task)
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _tasks.push_back(std::move(task));
+    ++_size;
+  }
+
+  bool EventLoopWorkStealing::TaskQueue::pop(Task& task)
+  {
+    if (_size.load(std::memory_order_relaxed) == 0)
+      return false;
+    boost::mutex::scoped_lock lock(_mutex);
+    if (_tasks.empty())
+      return false;
+    task = std::move(_tasks.front());
+    _tasks.pop_front();
+    --_size;
+    return true;
+  }
+
+  void EventLoopWorkStealing::TaskQueue::clear()
+  {
+    std::deque<Task> tasks;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      tasks.swap(_tasks);
+      _size = 0;
+    }
+    // The tasks are destroyed without the lock, their promises are broken.
+  }
+
+  EventLoopWorkStealing::EventLoopWorkStealing(int threadCount, std::string name, bool spawnOnOverload)
+    : EventLoopPrivate(std::move(name))
+    , _spawnOnOverload(spawnOnOverload)
+    , _currentWorker(&EventLoopWorkStealing::doNotDelete)
+      // Expired timers only inject their task, directly from the io thread.
+    , _timerWheel(makeTimerWheelScheduler(_io, [](TimerWheel::Handler& handler) {
+        handler(boost::system::error_code());
+      }))
+    , _workerThreads(new WorkerThreadPool())
+  {
+    start(threadCount);
+  }
+
+  EventLoopWorkStealing::~EventLoopWorkStealing()
+  {
+    try
+    {
+      stop();
+    }
+    catch (const std::exception& ex)
+    {
+      qiLogWarning() << "Failed to stop and join the EventLoopWorkStealing: " << ex.what();
+    }
+    catch (...)
+    {
+      qiLogWarning() << "Failed to stop and join the EventLoopWorkStealing: unknown exception";
+    }
+  }
+
+  void EventLoopWorkStealing::start(int threadCount)
+  {
+    if (_workerThreads->size() > 0) // workers are already running
+    {
+      qiLogVerbose() << "The event loop is already started and worker threads are running, this call to start is ignored.";
+      return;
+    }
+
+    if (threadCount <= 0)
+    {
+      threadCount =
+          qi::os::getEnvDefault(gThreadCountEnvVar, std::max(static_cast<int>(std::thread::hardware_concurrency()), 3));
+    }
+    _minThreads = threadCount;
+    _maxThreads = qi::os::getEnvDefault(gMaxThreadsEnvVar, defaultMaxThreads);
+
+    // The ping loop may spawn one worker over the maximum.
+    const auto capacity = std::max({threadCount, _maxThreads.load(), defaultMaxThreads}) + 1;
+    _workers.clear();
+    _workers.resize(static_cast<std::size_t>(capacity));
+    _workerCount = 0;
+
+    _io.reset();
+    _work.reset(new boost::asio::io_service::work(_io));
+    _running = true;
+
+    _ioThread = std::thread(&EventLoopWorkStealing::runIoLoop, this);
+    for (int i = 0; i < threadCount; ++i)
+      spawnWorker();
+    if (_spawnOnOverload)
+    {
+      _pingThread = std::thread(&EventLoopWorkStealing::runPingLoop, this);
+    }
+  }
+
+  void EventLoopWorkStealing::stop()
+  {
+    qiLogDebug() << "Stopping EventLoopWorkStealing: " << this;
+    _running = false;
+    {
+      boost::mutex::scoped_lock lock(_sleepMutex);
+      _sleepCondition.notify_all();
+    }
+    _work.reset();
+    _io.stop();
+
+    join();
+
+    _injected.clear();
+    for (auto& worker : _workers)
+    {
+      if (worker)
+        worker->queue.clear();
+    }
+  }
+
+  void EventLoopWorkStealing::join()
+  {
+    if (_pingThread.joinable())
+    {
+      qiLogVerbose() << "Waiting for the ping thread ...";
+      _pingThread.join();
+      qiLogDebug()  << "Waiting for the ping thread - DONE";
+    }
+
+    if (_ioThread.joinable())
+    {
+      _ioThread.join();
+      _ioThreadId = std::thread::id();
+    }
+
+    qiLogVerbose()
+        << "Waiting threads from the pool \"" << _name << "\", remaining tasks: "
+        << taskCount() << " (" << activeTaskCount() <<  " active)...";
+    _workerThreads->joinAll();
+    qiLogDebug()  << "Waiting threads from the pool - DONE";
+  }
+
+  void EventLoopWorkStealing::runIoLoop()
+  {
+    qi::os::setCurrentThreadName(_name + ".io");
+    _ioThreadId = std::this_thread::get_id();
+    while (true) {
+      try
+      {
+        _io.run();
+        break;
+      } catch(const detail::TerminateThread& /* e */) {
+        break;
+      } catch(const std::exception& e) {
+        qiLogWarning() << "Error caught in eventloop(" << _name << ").async: " << e.what();
+      } catch(...) {
+        qiLogWarning() << "Uncaught exception in eventloop(" << _name << ")";
+      }
+    }
+  }
+
+  void EventLoopWorkStealing::runWorkerLoop(std::size_t index)
+  {
+    qiLogDebug() << this << "run starting from pool";
+    qi::os::setCurrentThreadName(_name);
+
+    Worker& self = *_workers[index];
+    _currentWorker.reset(&self);
+    auto _ = ka::scoped([&] { _currentWorker.reset(); });
+
+    Task task;
+    while (_running.load())
+    {
+      if (!nextTask(index, task))
+      {
+        waitForTask();
+        continue;
+      }
+      try
+      {
+        runTask(self, task);
+      }
+      catch (const detail::TerminateThread& /* e */)
+      {
+        break;
+      }
+    }
+  }
+
+  void EventLoopWorkStealing::runTask(Worker& worker, Task& task)
+  {
+    worker.busy.store(true, std::memory_order_relaxed);
+    recordQueueLatency(task.pushedAt);
+    // Release what the callback holds as soon as it is done.
+    auto _ = ka::scoped([&] {
+      task = Task{};
+      worker.busy.store(false, std::memory_order_relaxed);
+    });
+
+    try
+    {
+      task.callback();
+      if (task.promise)
+        task.promise->setValue(0);
+    }
+    catch (const detail::TerminateThread& /* e */)
+    {
+      throw;
+    }
+    catch (const std::exception& ex)
+    {
+      if (task.promise)
+        task.promise->setError(ex.what());
+    }
+    catch (...)
+    {
+      if (task.promise)
+        task.promise->setError("unknown error");
+    }
+  }
+
+  bool EventLoopWorkStealing::nextTask(std::size_t index, Task& task)
+  {
+    Worker& self = *_workers[index];
+    if (++self.tick % injectionCheckInterval == 0 && _injected.pop(task))
+      return true;
+    if (self.queue.pop(task) || _injected.pop(task))
+      return true;
+
+    // Steal from the other workers, starting from a different one each time
+    // so that the victims are spread.
+    const auto count = _workerCount.load(std::memory_order_acquire);
+    for (std::size_t i = 1; i < count; ++i)
+    {
+      const auto victim = (index + self.tick + i) % count;
+      if (victim != index && _workers[victim]->queue.pop(task))
+        return true;
+    }
+    return false;
+  }
+
+  bool EventLoopWorkStealing::hasPendingTask() const
+  {
+    if (_injected.size() > 0)
+      return true;
+    const auto count = _workerCount.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (_workers[i]->queue.size() > 0)
+        return true;
+    }
+    return false;
+  }
+
+  void EventLoopWorkStealing::waitForTask()
+  {
+    for (int i = 0; i < idleSpinCount; ++i)
+    {
+      if (hasPendingTask() || !_running.load())
+        return;
+      std::this_thread::yield();
+    }
+
+    boost::mutex::scoped_lock lock(_sleepMutex);
+    // Pushers check this counter after pushing, and we check the queues after
+    // incrementing it: either we see their task, or they see us sleeping and
+    // wake us up.
+    ++_sleepingCount;
+    while (_running.load() && _wakeUpCount == 0 && !hasPendingTask())
+      _sleepCondition.wait(lock);
+    if (_wakeUpCount > 0)
+      --_wakeUpCount;
+    --_sleepingCount;
+  }
+
+  void EventLoopWorkStealing::wakeUpWorker()
+  {
+    boost::mutex::scoped_lock lock(_sleepMutex);
+    // Do not accumulate wake-ups for workers which found a task by themselves.
+    if (_wakeUpCount < _sleepingCount.load())
+    {
+      ++_wakeUpCount;
+      _sleepCondition.notify_one();
+    }
+  }
+
+  void EventLoopWorkStealing::push(Task task)
+  {
+    task.pushedAt = SteadyClock::now();
+    if (Worker* worker = _currentWorker.get())
+      worker->queue.push(std::move(task));
+    else
+      _injected.push(std::move(task));
+
+    if (_sleepingCount.load() > 0)
+      wakeUpWorker();
+  }
+
+  void EventLoopWorkStealing::post(qi::Duration delay,
+      boost::function<void ()> cb, ExecutionOptions options)
+  {
+    if (!_running.load())
+    {
+      qiLogVerbose() << "Schedule attempt on destroyed thread pool";
+      return;
+    }
+
+    if (delay == qi::Duration(0))
+    {
+      push(Task{std::move(cb), boost::none});
+    }
+    else
+    {
+      asyncCall(delay, std::move(cb), options).then([](const Future<void>& fut)
+      {
+        if (fut.hasError())
+        {
+          qiLogError() << "Error during asyncCall: " << fut.error();
+        }
+      });
+    }
+  }
+
+  void EventLoopWorkStealing::post(qi::SteadyClockTimePoint timepoint,
+      boost::function<void ()> cb, ExecutionOptions options)
+  {
+    asyncCall(timepoint, std::move(cb), options).then([](const Future<void>& fut)
+    {
+      if (fut.hasError())
+      {
+        qiLogError() << "Error during asyncCall: " << fut.error();
+      }
+    });
+  }
+
+  template<typename Timer>
+  qi::Future<void> EventLoopWorkStealing::asyncWait(boost::shared_ptr<Timer> timer,
+      boost::function<void()> cb, ExecutionOptions options)
+  {
+    auto prom = detail::makeCancelingPromise(options, boost::bind(&Timer::cancel, timer));
+    // The io thread only injects the task when the timer expires, the task
+    // itself runs on a worker.
+    timer->async_wait([=](const boost::system::error_code& erc) mutable {
+      if (erc)
+        prom.setCanceled();
+      else
+        push(Task{cb, prom});
+    });
+    return prom.future();
+  }
+
+  qi::Future<void> EventLoopWorkStealing::asyncWaitOnTimerWheel(qi::SteadyClockTimePoint deadline,
+      boost::function<void()> cb, ExecutionOptions options)
+  {
+    Promise<void> prom;
+    auto cancel = _timerWheel->add(deadline, [=](const boost::system::error_code& erc) mutable {
+      if (erc)
+        prom.setCanceled();
+      else
+        push(Task{cb, prom});
+    });
+    detail::setCancelingFunction(prom, options, std::move(cancel));
+    return prom.future();
+  }
+
+  qi::Future<void> EventLoopWorkStealing::asyncCall(qi::Duration delay,
+      boost::function<void ()> cb, ExecutionOptions options)
+  {
+    if (!_running.load())
+      return qi::makeFutureError<void>("Schedule attempt on destroyed thread pool");
+
+    if (_timerWheel && delay > Duration::zero() && _timerWheel->handles(delay))
+      return asyncWaitOnTimerWheel(SteadyClock::now() + delay, std::move(cb), options);
+
+    if (delay > Duration::zero())
+    {
+      auto timer = boost::make_shared<boost::asio::steady_timer>(boost::ref(_io));
+      timer->expires_from_now(boost::chrono::duration_cast<boost::asio::steady_timer::duration>(delay));
+      return asyncWait(timer, std::move(cb), options);
+    }
+    Promise<void> prom;
+    push(Task{std::move(cb), prom});
+    return prom.future();
+  }
+
+  qi::Future<void> EventLoopWorkStealing::asyncCall(qi::SteadyClockTimePoint timepoint,
+      boost::function<void ()> cb, ExecutionOptions options)
+  {
+    if (!_running.load())
+      return qi::makeFutureError<void>("Schedule attempt on destroyed thread pool");
+
+    if (_timerWheel && _timerWheel->handles(timepoint - SteadyClock::now()))
+      return asyncWaitOnTimerWheel(timepoint, std::move(cb), options);
+
+    auto timer = boost::make_shared<SteadyTimer>(boost::ref(_io));
+    timer->expires_at(timepoint);
+    return asyncWait(timer, std::move(cb), options);
+  }
+
+  bool EventLoopWorkStealing::isInThisContext() const
+  {
+    return _currentWorker.get() != nullptr || std::this_thread::get_id() == _ioThreadId.load();
+  }
+
+  void EventLoopWorkStealing::setMaxThreads(unsigned int max)
+  {
+    _maxThreads = static_cast<int>(max);
+  }
+
+  void* EventLoopWorkStealing::nativeHandle()
+  {
+    return static_cast<void*>(&_io);
+  }
+
+  bool EventLoopWorkStealing::isRunning() const
+  {
+    return _running.load();
+  }
+
+  int EventLoopWorkStealing::workerCount() const
+  {
+    return static_cast<int>(_workerCount.load());
+  }
+
+  void EventLoopWorkStealing::spawnWorker()
+  {
+    // Only called by start and by the ping loop, which do not run
+    // concurrently.
+    const auto index = _workerCount.load();
+    if (index == _workers.size())
+    {
+      qiLogVerbose() << "Threadpool " << _name << ": cannot spawn more than " << index << " threads";
+      return;
+    }
+    _workers[index].reset(new Worker);
+    _workerCount.store(index + 1, std::memory_order_release);
+    _workerThreads->launch(&EventLoopWorkStealing::runWorkerLoop, this, index);
+  }
+
+  int64_t EventLoopWorkStealing::taskCount() const
+  {
+    auto count = static_cast<int64_t>(_injected.size());
+    const auto workers = _workerCount.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < workers; ++i)
+      count += static_cast<int64_t>(_workers[i]->queue.size());
+    return count + activeTaskCount();
+  }
+
+  int64_t EventLoopWorkStealing::activeTaskCount() const
+  {
+    int64_t count = 0;
+    const auto workers = _workerCount.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < workers; ++i)
+    {
+      if (_workers[i]->busy.load(std::memory_order_relaxed))
+        ++count;
+    }
+    return count;
+  }
+}
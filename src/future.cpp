@@ -6,6 +6,8 @@
 #include <qi/log.hpp>
 #include <qi/os.hpp>
 
+#include <memory>
+
 #include <boost/thread.hpp>
 #include <boost/pool/singleton_pool.hpp>
 
@@ -19,15 +21,27 @@ namespace qi {
       void* operator new(size_t);
       void operator delete(void*);
       FutureBasePrivate();
+      ~FutureBasePrivate();
 
       // Disable copy
       FutureBasePrivate(const FutureBasePrivate&) = delete;
       FutureBasePrivate& operator=(const FutureBasePrivate&) = delete;
 
-      boost::condition_variable_any _cond;
-      boost::recursive_mutex _mutex;
+      // Only created for a future which is waited for before being set.
+      struct Waiter
+      {
+        boost::mutex _mutex;
+        boost::condition_variable _cond;
+      };
+
+      Waiter& waiter();
+
+      std::atomic<Waiter*> _waiter;
+      // Written before the state is published.
       std::string  _error;
       std::atomic<FutureState> _state;
+      // Whether the result is being set, by the only one allowed to.
+      std::atomic<bool> _finishing;
       std::atomic<bool> _cancelRequested;
     };
 
@@ -45,14 +59,29 @@ namespace qi {
     }
 
     FutureBasePrivate::FutureBasePrivate()
-      : _cond(),
-        _mutex(),
+      : _waiter(nullptr),
         _error(),
         _state(FutureState_None),
+        _finishing(false),
         _cancelRequested(false)
+    {
+    }
 
+    FutureBasePrivate::~FutureBasePrivate()
+    {
+      delete _waiter.load();
+    }
 
+    FutureBasePrivate::Waiter& FutureBasePrivate::waiter()
     {
+      Waiter* waiter = _waiter.load();
+      if (waiter)
+        return *waiter;
+      std::unique_ptr<Waiter> newWaiter(new Waiter);
+      if (_waiter.compare_exchange_strong(waiter, newWaiter.get()))
+        return *newWaiter.release();
+      // Another thread created it first.
+      return *waiter;
     }
 
     FutureBase::FutureBase()
@@ -75,38 +104,58 @@ namespace qi {
       return p->_state.load() != FutureState_Running;
     }
 
+    // Calls `wait` on the condition of the waiter of the future, with its
+    // mutex locked, unless the future is not running.
+    template <typename Wait>
+    static FutureState waitWith(FutureBasePrivate* p, Wait wait)
+    {
+      if (p->_state.load() != FutureState_Running)
+        return FutureState(p->_state.load());
+      auto& waiter = p->waiter();
+      boost::unique_lock<boost::mutex> lock(waiter._mutex);
+      wait(waiter._cond, lock);
+      return FutureState(p->_state.load());
+    }
+
     FutureState FutureBase::wait(int msecs) const {
-      boost::recursive_mutex::scoped_lock lock(_p->_mutex);
-      if (_p->_state.load() != FutureState_Running)
-        return FutureState(_p->_state.load());
-      if (msecs == FutureTimeout_Infinite)
-        _p->_cond.wait(lock, boost::bind(&waitFinished, _p));
-      else if (msecs > 0)
-        _p->_cond.wait_for(lock, qi::MilliSeconds(msecs),
-            boost::bind(&waitFinished, _p));
       // msecs <= 0 : do nothing just return the state
-      return FutureState(_p->_state.load());
+      if (msecs <= 0)
+        return FutureState(_p->_state.load());
+      const auto p = _p;
+      return waitWith(p, [=](boost::condition_variable& cond, boost::unique_lock<boost::mutex>& lock) {
+        if (msecs == FutureTimeout_Infinite)
+          cond.wait(lock, boost::bind(&waitFinished, p));
+        else
+          cond.wait_for(lock, qi::MilliSeconds(msecs), boost::bind(&waitFinished, p));
+      });
     }
 
     FutureState FutureBase::wait(qi::Duration duration) const {
-      boost::recursive_mutex::scoped_lock lock(_p->_mutex);
-      if (_p->_state.load() != FutureState_Running)
-        return FutureState(_p->_state.load());
-      _p->_cond.wait_for(lock, duration, boost::bind(&waitFinished, _p));
-      return FutureState(_p->_state.load());
+      const auto p = _p;
+      return waitWith(p, [=](boost::condition_variable& cond, boost::unique_lock<boost::mutex>& lock) {
+        cond.wait_for(lock, duration, boost::bind(&waitFinished, p));
+      });
     }
 
     FutureState FutureBase::wait(qi::SteadyClock::time_point timepoint) const {
-      boost::recursive_mutex::scoped_lock lock(_p->_mutex);
+      const auto p = _p;
+      return waitWith(p, [=](boost::condition_variable& cond, boost::unique_lock<boost::mutex>& lock) {
+        cond.wait_until(lock, timepoint, boost::bind(&waitFinished, p));
+      });
+    }
+
+    bool FutureBase::startFinish() {
       if (_p->_state.load() != FutureState_Running)
-        return FutureState(_p->_state.load());
-      _p->_cond.wait_until(lock, timepoint, boost::bind(&waitFinished, _p));
-      return FutureState(_p->_state.load());
+        return false;
+      return !_p->_finishing.exchange(true);
+    }
+
+    void FutureBase::abortFinish() {
+      _p->_finishing = false;
     }
 
     void FutureBase::reportValue() {
-      //always set by setValue
-      //boost::recursive_mutex::scoped_lock lock(_p->_mutex);
+      //always set by setValue, after startFinish
       _p->_state = FutureState_FinishedWithValue;
     }
 
@@ -115,16 +164,14 @@ namespace qi {
     }
 
     void FutureBase::reportCanceled() {
-      //always set by setCanceled
-      //boost::recursive_mutex::scoped_lock lock(_p->_mutex);
+      //always set by setCanceled, after startFinish
       _p->_state = FutureState_Canceled;
     }
 
     void FutureBase::reportError(const std::string &message) {
-      //always set by setError
-      //boost::recursive_mutex::scoped_lock lock(_p->_mutex);
-      _p->_state = FutureState_FinishedWithError;
+      //always set by setError, after startFinish
       _p->_error = message;
+      _p->_state = FutureState_FinishedWithError;
     }
 
     void FutureBase::reportStart() {
@@ -133,8 +180,12 @@ namespace qi {
     }
 
     void FutureBase::notifyFinish() {
-      boost::unique_lock<boost::recursive_mutex> l{_p->_mutex};
-      _p->_cond.notify_all();
+      // A waiter created after this load sees the new state.
+      if (auto waiter = _p->_waiter.load())
+      {
+        boost::unique_lock<boost::mutex> l{waiter->_mutex};
+        waiter->_cond.notify_all();
+      }
     }
 
     bool FutureBase::isFinished() const {
@@ -171,14 +222,8 @@ namespace qi {
         throw FutureException(FutureException::ExceptionState_FutureTimeout);
       if (_p->_state.load() != FutureState_FinishedWithError)
         throw FutureException(FutureException::ExceptionState_FutureHasNoError);
-      boost::recursive_mutex::scoped_lock lock(_p->_mutex);
       return _p->_error;
     }
-
-    boost::recursive_mutex& FutureBase::mutex()
-    {
-      return _p->_mutex;
-    }
   }
 
   std::string FutureException::stateToString(const ExceptionState &es) {
@@ -4,10 +4,18 @@
 */
 
 #include <boost/make_shared.hpp>
+#include <boost/thread/tss.hpp>
 
 #include <qi/anyobject.hpp>
+#include <qi/async.hpp>
+#include <qi/messaging/calldeadline.hpp>
+#include <qi/type/dynamicobject.hpp>
 #include <qi/type/objecttypebuilder.hpp>
+#include <qi/type/detail/staticobjecttype.hpp>
 #include "boundobject.hpp"
+#include "calldeadline_p.hpp"
+#include "eventcoalescer.hpp"
+#include "streamcontext.hpp"
 
 qiLogCategory("qimessaging.boundobject");
 
@@ -15,18 +23,16 @@ const auto invalidValueError = "The value is invalid.";
 
 namespace qi {
 
-  static AnyReference forwardEvent(const GenericFunctionParameters& params,
-                                   unsigned int service, unsigned int object,
-                                   unsigned int event, Signature sig,
-                                   MessageSocketPtr client,
-                                   boost::weak_ptr<ObjectHost> context,
-                                   const std::string& signature)
+  // Sets the arguments of an emission as the value of msg, or appends them
+  // to it. Returns true if they had to be set as a dynamic value, which the
+  // message must then be flagged with (TypeFlag_DynamicPayload).
+  static bool setEventValues(qi::Message& msg, const GenericFunctionParameters& params,
+                             const Signature& sig, const MessageSocketPtr& client,
+                             const boost::weak_ptr<ObjectHost>& context,
+                             const std::string& signature, bool forceDynamic)
   {
-    qiLogDebug() << "forwardEvent";
-    qi::Message msg;
     // FIXME: would like to factor with serveresult.hpp convertAndSetValue()
     // but we have a setValue/setValues issue
-    bool processed = false;
     if (!signature.empty() && client->remoteCapability("MessageFlags", false))
     {
       qiLogDebug() << "forwardEvent attempting conversion to " << signature;
@@ -47,9 +53,8 @@ namespace qi {
         {
           qiLogDebug() << "forwardEvent success " << res[0].type()->infoString();
           msg.setValues(res, "m", context, client.get());
-          msg.addFlags(Message::TypeFlag_DynamicPayload);
           res.destroy();
-          processed = true;
+          return true;
         }
       }
       catch(const std::exception& /* e */)
@@ -57,35 +62,185 @@ namespace qi {
         qiLogDebug() << "forwardEvent failed to convert to forced type";
       }
     }
-    if (!processed)
+    if (!forceDynamic)
     {
       try {
         msg.setValues(params, sig, context, client.get());
+        return false;
       }
       catch (const std::exception& e)
       {
         qiLogVerbose() << "forwardEvent::setValues exception: " << e.what();
         if (!client->remoteCapability("MessageFlags", false))
           throw e;
-        // Delegate conversion to the remote end.
-        msg.addFlags(Message::TypeFlag_DynamicPayload);
-        msg.setValues(params, "m", context, client.get());
       }
     }
+    // Delegate conversion to the remote end.
+    msg.setValues(params, "m", context, client.get());
+    return true;
+  }
+
+  static void sendEvent(qi::Message& msg, unsigned int service, unsigned int object,
+                        unsigned int event, const MessageSocketPtr& client)
+  {
     msg.setService(service);
     msg.setFunction(event);
     msg.setType(Message::Type_Event);
     msg.setObject(object);
     client->send(msg);
+  }
+
+  static AnyReference forwardEvent(const GenericFunctionParameters& params,
+                                   unsigned int service, unsigned int object,
+                                   unsigned int event, Signature sig,
+                                   MessageSocketPtr client,
+                                   boost::weak_ptr<ObjectHost> context,
+                                   const std::string& signature)
+  {
+    qiLogDebug() << "forwardEvent";
+    qi::Message msg;
+    if (setEventValues(msg, params, sig, client, context, signature, false))
+      msg.addFlags(Message::TypeFlag_DynamicPayload);
+    sendEvent(msg, service, object, event, client);
     return AnyReference();
   }
 
+  // Sends emissions coalesced by an EventCoalescer, in one message if the
+  // remote end supports it.
+  static void forwardEvents(const std::vector<EventCoalescer::Values>& emissions,
+                            unsigned int service, unsigned int object,
+                            unsigned int event, Signature sig,
+                            MessageSocketPtr client,
+                            boost::weak_ptr<ObjectHost> context,
+                            const std::string& signature)
+  {
+    if (emissions.size() == 1
+        || !client->sharedCapability<bool>(capabilityname::eventBatching, false))
+    {
+      for (const auto& values : emissions)
+        forwardEvent(EventCoalescer::parameters(values), service, object, event, sig,
+                     client, context, signature);
+      return;
+    }
+
+    qiLogDebug() << "forwardEvents " << emissions.size();
+    // All the emissions must be encoded the same way: dynamic values are used
+    // for all of them as soon as one needs it.
+    auto setBatchValues = [&](qi::Message& msg, bool dynamic) {
+      const auto count = static_cast<qi::uint32_t>(emissions.size());
+      msg.setValues(std::vector<AnyReference>{AnyReference::from(count)}, context, client.get());
+      for (const auto& values : emissions)
+      {
+        const auto params = EventCoalescer::parameters(values);
+        if (setEventValues(msg, params, sig, client, context, signature, dynamic) != dynamic)
+          return false;
+      }
+      return true;
+    };
+    qi::Message msg;
+    bool dynamic = false;
+    if (!setBatchValues(msg, dynamic))
+    {
+      msg = qi::Message();
+      dynamic = true;
+      setBatchValues(msg, dynamic);
+    }
+    msg.addFlags(Message::TypeFlag_EventBatch);
+    if (dynamic)
+      msg.addFlags(Message::TypeFlag_DynamicPayload);
+    sendEvent(msg, service, object, event, client);
+  }
+
+  static RemoteEventPolicy remoteEventPolicy(const AnyObject& object, unsigned int event)
+  {
+    GenericObject* go = object.asGenericObject();
+    SignalBase* signal = nullptr;
+    if (go->type == getDynamicTypeInterface())
+      signal = static_cast<DynamicObject*>(go->value)->signal(event);
+    else if (auto type = dynamic_cast<detail::StaticObjectTypeBase*>(go->type))
+      signal = type->signal(go->value, object, event);
+    return signal ? signal->remoteEventPolicy() : RemoteEventPolicy();
+  }
+
+  // The subscriber forwarding the emissions of a signal to a remote end,
+  // according to the policy of the signal.
+  static AnyFunction makeEventForwarder(const AnyObject& object, unsigned int service,
+                                        unsigned int objectId, unsigned int event,
+                                        Signature sig, MessageSocketPtr client,
+                                        boost::weak_ptr<ObjectHost> context,
+                                        const std::string& signature)
+  {
+    const RemoteEventPolicy policy = remoteEventPolicy(object, event);
+    if (policy.mode == RemoteEventPolicy::Mode_Immediate)
+      return AnyFunction::fromDynamicFunction(boost::bind(&forwardEvent, _1, service, objectId,
+                                                          event, sig, client, context, signature));
+    auto coalescer = std::make_shared<EventCoalescer>(policy,
+        boost::bind(&forwardEvents, _1, service, objectId, event, sig, client, context, signature));
+    return AnyFunction::fromDynamicFunction([coalescer](const GenericFunctionParameters& params) {
+      coalescer->push(params);
+      return AnyReference();
+    });
+  }
+
   struct ServiceBoundObject::CancelableKit
   {
     ServiceBoundObject::CancelableMap map;
     boost::mutex                      guard;
   };
 
+  namespace
+  {
+    // A call dispatched by a ServiceBoundObject, on the stack of the thread
+    // dispatching it. Calls can be nested, e.g. a direct call on an object
+    // calling another local service.
+    struct DispatchedCall
+    {
+      const ServiceBoundObject* object;
+      MessageSocketPtr socket;
+      DispatchedCall* outer;
+    };
+
+    void noDelete(DispatchedCall*) {}
+
+    // The innermost call dispatched by the current thread.
+    boost::thread_specific_ptr<DispatchedCall>& dispatchedCalls()
+    {
+      static boost::thread_specific_ptr<DispatchedCall> calls(&noDelete);
+      return calls;
+    }
+
+    class DispatchedCallScope
+    {
+    public:
+      DispatchedCallScope(const ServiceBoundObject* object, MessageSocketPtr socket)
+        : _call{object, std::move(socket), dispatchedCalls().get()}
+      {
+        dispatchedCalls().reset(&_call);
+      }
+
+      ~DispatchedCallScope()
+      {
+        dispatchedCalls().reset(_call.outer);
+      }
+
+      DispatchedCallScope(const DispatchedCallScope&) = delete;
+      DispatchedCallScope& operator=(const DispatchedCallScope&) = delete;
+
+    private:
+      DispatchedCall _call;
+    };
+
+    MessageSocketPtr dispatchedCallSocket(const ServiceBoundObject* object)
+    {
+      for (auto call = dispatchedCalls().get(); call; call = call->outer)
+      {
+        if (call->object == object)
+          return call->socket;
+      }
+      return {};
+    }
+  }
+
   ServiceBoundObject::ServiceBoundObject(unsigned int serviceId, unsigned int objectId,
                                          qi::AnyObject object,
                                          qi::MetaCallType mct,
@@ -93,6 +248,9 @@ namespace qi {
                                          boost::optional<boost::weak_ptr<ObjectHost>> owner)
     : ObjectHost(serviceId)
     , _cancelables(boost::make_shared<CancelableKit>())
+    , _admission(CallAdmission::Limits::fromEnvironment().enabled()
+                 ? std::make_shared<CallAdmission>(CallAdmission::Limits::fromEnvironment())
+                 : CallAdmissionPtr())
     , _links()
     , _serviceId(serviceId)
     , _objectId(objectId)
@@ -124,7 +282,7 @@ namespace qi {
     {
       ob = new qi::ObjectTypeBuilder<ServiceBoundObject>();
       // these are called synchronously by onMessage (and this is needed for
-      // _currentSocket), no need for threadsafety here
+      // currentSocket())
       ob->setThreadingModel(ObjectThreadingModel_MultiThread);
       /* Network-related stuff.
       */
@@ -146,17 +304,29 @@ namespace qi {
     return result;
   }
 
+  qi::MessageSocketPtr ServiceBoundObject::currentSocket() const
+  {
+#ifndef NDEBUG
+    if (_callType != MetaCallType_Direct)
+      qiLogWarning() << " currentSocket() used but callType is not direct";
+#endif
+    return dispatchedCallSocket(this);
+  }
+
   // Bound Method
   qi::Future<SignalLink> ServiceBoundObject::registerEvent(unsigned int objectId, unsigned int eventId, SignalLink remoteSignalLinkId) {
     // fetch signature
     const MetaSignal* ms = _object.metaObject().signal(eventId);
     if (!ms)
       throw std::runtime_error("No such signal");
-    QI_ASSERT(_currentSocket);
-    AnyFunction mc = AnyFunction::fromDynamicFunction(boost::bind(&forwardEvent, _1, _serviceId, _objectId, eventId, ms->parametersSignature(), _currentSocket, weakPtr(), ""));
+    const MessageSocketPtr socket = dispatchedCallSocket(this);
+    QI_ASSERT(socket);
+    AnyFunction mc = makeEventForwarder(_object, _serviceId, _objectId, eventId, ms->parametersSignature(), socket, weakPtr(), "");
     qi::Future<SignalLink> linking = _object.connect(eventId, mc);
-    auto& linkEntry = _links[_currentSocket][remoteSignalLinkId];
-    linkEntry = RemoteSignalLink(linking, eventId);
+    {
+      boost::mutex::scoped_lock lock(_linksMutex);
+      _links[socket][remoteSignalLinkId] = RemoteSignalLink(linking, eventId);
+    }
     return linking.andThen([=](SignalLink linkId) mutable {
       qiLogDebug() << "SBO rl " << remoteSignalLinkId << " ll " << linkId;
       return linkId;
@@ -168,11 +338,14 @@ namespace qi {
     const MetaSignal* ms = _object.metaObject().signal(eventId);
     if (!ms)
       throw std::runtime_error("No such signal");
-    QI_ASSERT(_currentSocket);
-    AnyFunction mc = AnyFunction::fromDynamicFunction(boost::bind(&forwardEvent, _1, _serviceId, _objectId, eventId, ms->parametersSignature(), _currentSocket, weakPtr(), signature));
+    const MessageSocketPtr socket = dispatchedCallSocket(this);
+    QI_ASSERT(socket);
+    AnyFunction mc = makeEventForwarder(_object, _serviceId, _objectId, eventId, ms->parametersSignature(), socket, weakPtr(), signature);
     qi::Future<SignalLink> linking = _object.connect(eventId, mc);
-    auto& linkEntry = _links[_currentSocket][remoteSignalLinkId];
-    linkEntry = RemoteSignalLink(linking, eventId);
+    {
+      boost::mutex::scoped_lock lock(_linksMutex);
+      _links[socket][remoteSignalLinkId] = RemoteSignalLink(linking, eventId);
+    }
     return linking.andThen([=](SignalLink linkId) mutable {
       qiLogDebug() << "SBO rl " << remoteSignalLinkId << " ll " << linkId;
       return linkId;
@@ -181,21 +354,26 @@ namespace qi {
 
   // Bound Method
   qi::Future<void> ServiceBoundObject::unregisterEvent(unsigned int objectId, unsigned int QI_UNUSED(event), SignalLink remoteSignalLinkId) {
-    ServiceSignalLinks&          sl = _links[_currentSocket];
-    ServiceSignalLinks::iterator it = sl.find(remoteSignalLinkId);
-
-    if (it == sl.end())
+    const MessageSocketPtr socket = dispatchedCallSocket(this);
+    qi::Future<SignalLink> localSignalLinkId;
     {
-      std::stringstream ss;
-      ss << "Unregister request failed for " << remoteSignalLinkId << " " << objectId;
-      qiLogError() << ss.str();
-      throw std::runtime_error(ss.str());
-    }
+      boost::mutex::scoped_lock lock(_linksMutex);
+      ServiceSignalLinks&          sl = _links[socket];
+      ServiceSignalLinks::iterator it = sl.find(remoteSignalLinkId);
 
-    auto localSignalLinkId = it->second.localSignalLinkId;
-    sl.erase(it);
-    if (sl.empty())
-      _links.erase(_currentSocket);
+      if (it == sl.end())
+      {
+        std::stringstream ss;
+        ss << "Unregister request failed for " << remoteSignalLinkId << " " << objectId;
+        qiLogError() << ss.str();
+        throw std::runtime_error(ss.str());
+      }
+
+      localSignalLinkId = it->second.localSignalLinkId;
+      sl.erase(it);
+      if (sl.empty())
+        _links.erase(socket);
+    }
     return localSignalLinkId.andThen([=](SignalLink link) {
       return _object.disconnect(link).async();
     }).unwrap();
@@ -227,8 +405,122 @@ namespace qi {
     value.destroy();
   }
 
+  // Returns the type to decode parameters of this signature with, or null if
+  // it must be left to Message::value, which reports unknown types.
+  static TypeInterface* parametersType(const Signature& signature)
+  {
+    const std::function<bool (const Signature&)> isKnown = [&](const Signature& sig) {
+      if (sig.type() == Signature::Type_Unknown)
+        return false;
+      for (const auto& child : sig.children())
+        if (!isKnown(child))
+          return false;
+      return true;
+    };
+    return isKnown(signature) ? TypeInterface::fromSignature(signature) : nullptr;
+  }
+
+  ServiceBoundObject::DispatchTable::EntriesPtr ServiceBoundObject::dispatchEntries(unsigned int function)
+  {
+    auto entries = _dispatchTable.entries();
+    if (!DispatchTable::find(*entries, function))
+    {
+      // Unknown functions, e.g. sent by a faulty peer, must not cause a
+      // rebuild each: only rebuild if the meta object has the function,
+      // that is if it changed since the table was built.
+      const bool special = function < Manageable::startId;
+      const qi::MetaObject& metaObject = special ? _self.metaObject() : _object.metaObject();
+      if (!metaObject.method(function) && !metaObject.signal(function))
+        return entries;
+      boost::mutex::scoped_lock lock(_dispatchTableMutex);
+      publishDispatchEntries();
+      entries = _dispatchTable.entries();
+    }
+    return entries;
+  }
+
+  void ServiceBoundObject::publishDispatchEntries()
+  {
+    std::map<unsigned int, DispatchEntry> entries;
+    // Special functions are on _self, and others on _object. Manageable
+    // functions are at the end of reserved range but dispatch to _object.
+    const auto addEntries = [&](const qi::MetaObject& metaObject, bool special) {
+      const auto entry = [&](unsigned int id) -> DispatchEntry* {
+        if ((id < Manageable::startId) != special)
+          return nullptr;
+        auto it = entries.find(id);
+        if (it == entries.end())
+        {
+          // Property accessors are insecure to call synchronously
+          // because users can customize them.
+          const bool isUserDefinedFunction = !special || id == 5 /* property */ || id == 6 /* setProperty */;
+          DispatchEntry entry{};
+          entry.special = special;
+          entry.callType = isUserDefinedFunction ? _callType : MetaCallType_Direct;
+          it = entries.emplace(id, entry).first;
+        }
+        return &it->second;
+      };
+
+      for (const auto& method : metaObject.methodMap())
+      {
+        if (DispatchEntry* e = entry(method.first))
+        {
+          e->isMethod = true;
+          e->methodParameters = method.second.parametersSignature();
+          e->methodParametersType = parametersType(e->methodParameters);
+          e->methodReturn = method.second.returnSignature();
+          if (!e->isPostable)
+          {
+            e->isPostable = true;
+            e->postParameters = e->methodParameters;
+            e->postParametersType = e->methodParametersType;
+          }
+        }
+      }
+      // Posts go to the signal rather than to the method with the same id.
+      for (const auto& signal : metaObject.signalMap())
+      {
+        if (DispatchEntry* e = entry(signal.first))
+        {
+          e->isPostable = true;
+          e->postParameters = signal.second.parametersSignature();
+          e->postParametersType = parametersType(e->postParameters);
+        }
+      }
+    };
+    addEntries(_self.metaObject(), true);
+    addEntries(_object.metaObject(), false);
+
+    DispatchTable::Entries table(entries.begin(), entries.end());
+    _dispatchTable.publish(std::move(table));
+  }
+
+  void ServiceBoundObject::setCallLimits(const CallAdmission::Limits& limits)
+  {
+    _admission = limits.enabled() ? std::make_shared<CallAdmission>(limits) : CallAdmissionPtr();
+  }
+
   void ServiceBoundObject::onMessage(const qi::Message &msg, MessageSocketPtr socket) {
-    boost::mutex::scoped_lock lock(_callMutex);
+    // Calls to child objects are limited by them.
+    if (!_admission || msg.type() != Message::Type_Call || msg.object() > _objectId)
+    {
+      dispatchMessage(msg, socket, CallAdmission::Slot());
+      return;
+    }
+    const bool admitted = _admission->admit(socket, msg.address(), track([=](CallAdmission::Slot slot) {
+      dispatchMessage(msg, socket, std::move(slot));
+    }, this));
+    if (!admitted)
+    {
+      qiLogVerbose() << "Rejecting call " << msg.address() << ": too many calls in progress";
+      serverResultAdapter(qi::makeFutureError<AnyReference>(CallAdmission::rejectedError), Signature(),
+                          _gethost(), socket, msg.address(), Signature(), CancelableKitWeak(_cancelables));
+    }
+  }
+
+  void ServiceBoundObject::dispatchMessage(const qi::Message &msg, MessageSocketPtr socket,
+                                           CallAdmission::Slot slot) {
     try {
       if (msg.version() > Message::Header::currentVersion())
       {
@@ -249,46 +541,39 @@ namespace qi {
         return;
       }
 
-      qi::AnyObject    obj;
-      unsigned int     funcId;
-      //choose between special function (on BoundObject) or normal calls
-      // Manageable functions are at the end of reserver range but dispatch to _object
-      const bool isSpecialFunction = msg.function() < Manageable::startId;
-      if (isSpecialFunction) {
-        obj = _self;
-      } else {
-        obj = _object;
+      const unsigned int funcId = msg.function();
+      // Holds the entry alive.
+      DispatchTable::EntriesPtr dispatchEntries;
+      const DispatchEntry* entry = nullptr;
+      if (msg.type() == qi::Message::Type_Call || msg.type() == qi::Message::Type_Post)
+      {
+        dispatchEntries = this->dispatchEntries(funcId);
+        entry = DispatchTable::find(*dispatchEntries, funcId);
       }
-      funcId = msg.function();
 
       qi::Signature sigparam;
+      qi::TypeInterface* paramType = nullptr;
       GenericFunctionParameters mfp;
 
       // Validate call target
       if (msg.type() == qi::Message::Type_Call) {
-        const qi::MetaMethod *mm = obj.metaObject().method(funcId);
-        if (!mm) {
+        if (!entry || !entry->isMethod) {
           std::stringstream ss;
           ss << "No such method " << msg.address();
           qiLogError() << ss.str();
           throw std::runtime_error(ss.str());
         }
-        sigparam = mm->parametersSignature();
+        sigparam = entry->methodParameters;
+        paramType = entry->methodParametersType;
       }
 
       else if (msg.type() == qi::Message::Type_Post) {
-        const qi::MetaSignal *ms = obj.metaObject().signal(funcId);
-        if (ms)
-          sigparam = ms->parametersSignature();
-        else {
-          const qi::MetaMethod *mm = obj.metaObject().method(funcId);
-          if (mm)
-            sigparam = mm->parametersSignature();
-          else {
-            qiLogError() << "No such signal/method on event message " << msg.address();
-            return;
-          }
+        if (!entry || !entry->isPostable) {
+          qiLogError() << "No such signal/method on event message " << msg.address();
+          return;
         }
+        sigparam = entry->postParameters;
+        paramType = entry->postParametersType;
       }
       else if (msg.type() == qi::Message::Type_Cancel)
       {
@@ -304,27 +589,47 @@ namespace qi {
         return;
       }
 
+      //choose between special function (on BoundObject) or normal calls
+      // Manageable functions are at the end of reserver range but dispatch to _object
+      const qi::AnyObject& obj = entry->special ? _self : _object;
+
       AnyReference value;
-      if (msg.flags() & Message::TypeFlag_DynamicPayload)
-        sigparam = "m";
-      // ReturnType flag appends a signature to the payload
-      Signature originalSignature;
-      bool hasReturnType = (msg.flags() & Message::TypeFlag_ReturnType) ? true : false;
-      if (hasReturnType)
+      const bool isDynamicPayload = (msg.flags() & Message::TypeFlag_DynamicPayload) ? true : false;
+      if (isDynamicPayload)
       {
-        originalSignature = sigparam;
-        sigparam = "(" + sigparam.toString() + "s)";
+        sigparam = "m";
+        paramType = qi::typeOf<AnyValue>();
       }
-      value = msg.value(sigparam, socket);
+      // ReturnType flag appends a signature to the payload, Deadline flag
+      // appends the time left before the deadline of the call
+      bool hasReturnType = (msg.flags() & Message::TypeFlag_ReturnType) ? true : false;
+      bool hasDeadline = msg.type() == Message::Type_Call && (msg.flags() & Message::TypeFlag_Deadline);
+      if (hasReturnType || hasDeadline)
+        value = msg.value("(" + sigparam.toString() + (hasReturnType ? "s" : "") + (hasDeadline ? "I" : "") + ")",
+                          socket);
+      else if (paramType)
+        value = msg.value(paramType, socket);
+      else
+        value = msg.value(sigparam, socket);
       std::string returnSignature;
-      if (hasReturnType)
+      boost::optional<SteadyClockTimePoint> deadline;
+      if (hasReturnType || hasDeadline)
       {
-        returnSignature = value[1].to<std::string>();
-        value[1].destroy();
+        std::size_t index = 1;
+        if (hasReturnType)
+        {
+          returnSignature = value[index].to<std::string>();
+          value[index].destroy();
+          ++index;
+        }
+        if (hasDeadline)
+        {
+          deadline = calldeadline::fromRemainingMilliseconds(value[index].to<qi::uint32_t>());
+          value[index].destroy();
+        }
         value = value[0];
-        sigparam = originalSignature;
       }
-      if (sigparam == "m")
+      if (isDynamicPayload)
       {
         // received dynamically typed argument pack, unwrap
         AnyValue* content = value.ptr<AnyValue>();
@@ -336,52 +641,71 @@ namespace qi {
         value = pContent;
       }
       mfp = value.asTupleValuePtr();
-      /* Because of 'global' _currentSocket, we cannot support parallel
-      * executions at this point.
-      * Both on self, and on obj which can use currentSocket() too.
+      /* Messages are dispatched concurrently: objects are either
+      * multi-threaded, or serialize their calls with a strand.
       *
-      * So put a lock, and rely on metaCall we invoke being asynchronous for// execution
-      * This is decided by _callType, set from BoundObject ctor argument, passed by Server, which
-      * uses its internal _defaultCallType, passed to its constructor, default
-      * to queued. When Server is instanciated by ObjectHost, it uses the default
-      * value.
+      * The socket of a call is only known by the thread dispatching it (see
+      * currentSocket()), for the duration of the synchronous part of
+      * metaCall. This is decided by _callType, set from BoundObject ctor
+      * argument, passed by Server, which uses its internal _defaultCallType,
+      * passed to its constructor, default to queued. When Server is
+      * instanciated by ObjectHost, it uses the default value.
       *
       * As a consequence, users of currentSocket() must set _callType to Direct.
-      * Calling currentSocket multiple times in a row should be avoided.
       */
       switch (msg.type())
       {
       case Message::Type_Call: {
-        boost::recursive_mutex::scoped_lock lock(_mutex);
-        _currentSocket = socket;
-
-        // Property accessors are insecure to call synchronously
-        // because users can customize them.
-        const bool isUserDefinedFunction =
-            !isSpecialFunction || funcId == 5 /* property */ || funcId == 6 /* setProperty */;
-        qi::MetaCallType callType = isUserDefinedFunction ? _callType : MetaCallType_Direct;
-
+        if (deadline && SteadyClock::now() >= *deadline)
+        {
+          // The caller does not wait for the result anymore.
+          ++calldeadline::counters().skippedCount;
+          serverResultAdapter(qi::makeFutureError<AnyReference>(calldeadline::exceededError), Signature(),
+                              _gethost(), socket, msg.address(), Signature(), CancelableKitWeak(_cancelables));
+          break;
+        }
         qi::Signature sig = returnSignature.empty() ? Signature() : Signature(returnSignature);
-        qi::Future<AnyReference> fut = obj.metaCall(funcId, mfp, callType, sig);
+        qi::Future<AnyReference> fut;
+        {
+          DispatchedCallScope dispatchedCall(this, socket);
+          // The remote calls made by the method share its deadline.
+          boost::optional<CallDeadlineScope> deadlineScope;
+          if (deadline)
+            deadlineScope.emplace(*deadline);
+          fut = obj.metaCall(funcId, mfp, entry->callType, sig);
+        }
         AtomicIntPtr cancelRequested = boost::make_shared<Atomic<int> >(0);
         {
           qiLogDebug() << this << " Registering future for " << socket.get() << ", message:" << msg.id();
           boost::mutex::scoped_lock futlock(_cancelables->guard);
           _cancelables->map[socket][msg.id()] = std::make_pair(fut, cancelRequested);
         }
-        Signature retSig;
-        const MetaMethod* mm = obj.metaObject().method(funcId);
-        if (mm)
-          retSig = mm->returnSignature();
-        _currentSocket.reset();
 
-        fut.connect(boost::bind<void>
-                    (&ServiceBoundObject::serverResultAdapter, _1, retSig, _gethost(), socket, msg.address(), sig,
-                     CancelableKitWeak(_cancelables), cancelRequested));
+        // The call is running until its reply is sent, which for a method
+        // returning a future is when that future is finished.
+        const auto methodReturn = entry->methodReturn;
+        const auto host = _gethost();
+        const auto address = msg.address();
+        const CancelableKitWeak kit(_cancelables);
+        fut.connect([=](const Future<AnyReference>& result) {
+          serverResultAdapter(result, methodReturn, host, socket, address, sig, kit, cancelRequested, slot);
+        });
+
+        if (deadline && !fut.isFinished())
+        {
+          const MessageId id = msg.id();
+          auto timer = qi::asyncAt(track([=] {
+            if (fut.isFinished())
+              return;
+            ++calldeadline::counters().canceledCount;
+            cancelCall(socket, Message(), id);
+          }, this), *deadline);
+          fut.connect([timer](const Future<AnyReference>&) mutable { timer.cancel(); });
+        }
       }
         break;
       case Message::Type_Post: {
-        if (obj == _self) // we need a sync call (see comment above), post does not provide it
+        if (entry->special) // we need a sync call (see comment above), post does not provide it
           obj.metaCall(funcId, mfp, MetaCallType_Direct);
         else
           obj.metaPost(funcId, mfp);
@@ -412,6 +736,18 @@ namespace qi {
   void ServiceBoundObject::cancelCall(MessageSocketPtr socket, const Message& cancelMessage, MessageId origMsgId)
   {
     qiLogDebug() << "Canceling call: " << origMsgId << " on client " << socket.get();
+    if (_admission)
+    {
+      // A call which did not start yet never will.
+      if (const auto address = _admission->cancelQueued(socket, origMsgId))
+      {
+        qi::Promise<AnyReference> canceled;
+        canceled.setCanceled();
+        serverResultAdapter(canceled.future(), Signature(), _gethost(), socket, *address, Signature(),
+                            CancelableKitWeak(_cancelables));
+        return;
+      }
+    }
     std::pair<Future<AnyReference>, AtomicIntPtr > fut;
     {
       boost::mutex::scoped_lock lock(_cancelables->guard);
@@ -489,15 +825,22 @@ namespace qi {
       boost::mutex::scoped_lock lock(_cancelables->guard);
       _cancelables->map.erase(client);
     }
-    BySocketServiceSignalLinks::iterator it = _links.find(client);
-    if (it != _links.end())
+    if (_admission)
+      _admission->dropQueued(client);
+    ServiceSignalLinks links;
     {
-      for (ServiceSignalLinks::iterator jt = it->second.begin(); jt != it->second.end(); ++jt)
+      boost::mutex::scoped_lock lock(_linksMutex);
+      BySocketServiceSignalLinks::iterator it = _links.find(client);
+      if (it != _links.end())
       {
-        _object.disconnect(jt->second.localSignalLinkId.value()).async()
-            .then([](Future<void> f) { if (f.hasError()) qiLogError() << f.error(); });
+        links = std::move(it->second);
+        _links.erase(it);
       }
-      _links.erase(it);
+    }
+    for (ServiceSignalLinks::iterator jt = links.begin(); jt != links.end(); ++jt)
+    {
+      _object.disconnect(jt->second.localSignalLinkId.value()).async()
+          .then([](Future<void> f) { if (f.hasError()) qiLogError() << f.error(); });
     }
     removeRemoteReferences(client);
   }
@@ -603,7 +946,8 @@ namespace qi {
                                                    MessageSocketPtr socket,
                                                    const qi::MessageAddress& replyaddr,
                                                    const Signature& forcedReturnSignature,
-                                                   CancelableKitWeak kit)
+                                                   CancelableKitWeak kit,
+                                                   CallAdmission::Slot /*slot*/)
   {
     QI_ASSERT_TRUE(val.isValid());
     _removeCachedFuture(kit, socket, replyaddr.messageId);
@@ -670,7 +1014,8 @@ namespace qi {
                                                const qi::MessageAddress& replyaddr,
                                                const Signature& forcedReturnSignature,
                                                CancelableKitWeak kit,
-                                               AtomicIntPtr cancelRequested)
+                                               AtomicIntPtr cancelRequested,
+                                               CallAdmission::Slot slot)
   {
     if(!socket->isConnected())
     {
@@ -693,7 +1038,7 @@ namespace qi {
         if (ao)
         {
           boost::function<void()> cb = boost::bind(&ServiceBoundObject::serverResultAdapterNext, val, targetSignature,
-                                                   host, socket, replyaddr, forcedReturnSignature, kit);
+                                                   host, socket, replyaddr, forcedReturnSignature, kit, slot);
           if (ao->call<bool>("isValid"))
           {
             ao->call<void>("_connect", cb);
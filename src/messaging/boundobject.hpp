@@ -17,7 +17,9 @@
 #include <qi/atomic.hpp>
 #include <qi/strand.hpp>
 
+#include "calladmission.hpp"
 #include "objecthost.hpp"
+#include "routingtable.hpp"
 
 using AtomicBoolptr = boost::shared_ptr<qi::Atomic<bool>>;
 using AtomicIntPtr = boost::shared_ptr<qi::Atomic<int>>;
@@ -98,21 +100,12 @@ namespace qi {
     std::vector<std::string> properties();
   public:
     /*
-    * Returns the last socket that sent a message to this object.
-    * Considering the volatility of this operation, Users of currentSocket()
-    * must set _callType to Direct, otherwise behavior is undefined. Calling
-    * currentSocket multiple times in a row in the same context should be
-    * avoided: call it once and use the return value, unless you know what
-    * you're doing.
+    * Returns the socket that sent the call this object is dispatching on the
+    * calling thread, or null outside of a call. Users of currentSocket()
+    * must set _callType to Direct, so that the method runs on the thread
+    * dispatching the call.
     */
-    inline qi::MessageSocketPtr currentSocket() const {
-#ifndef NDEBUG
-      if (_callType != MetaCallType_Direct)
-        qiLogWarning("qimessaging.boundobject") << " currentSocket() used but callType is not direct";
-#endif
-      boost::recursive_mutex::scoped_lock lock(_mutex);
-      return _currentSocket;
-    }
+    qi::MessageSocketPtr currentSocket() const;
 
     inline AnyObject object() { return _object;}
   public:
@@ -123,6 +116,10 @@ namespace qi {
     using MessageId = unsigned int;
     void cancelCall(MessageSocketPtr origSocket, const Message& cancelMessage, MessageId origMsgId);
 
+    // Limits the calls this object runs at the same time, instead of the
+    // limits of the environment. Must be called before the first call.
+    void setCallLimits(const CallAdmission::Limits& limits);
+
   private:
     using FutureMap = std::map<MessageId, std::pair<Future<AnyReference>, AtomicIntPtr>>;
     using CancelableMap = std::map<MessageSocketPtr, FutureMap>;
@@ -133,37 +130,72 @@ namespace qi {
 
     qi::AnyObject createServiceBoundObjectType(ServiceBoundObject *self, bool bindTerminate = false);
 
+    // Dispatches a message admitted by onMessage. Calls hold their slot
+    // until their reply is sent.
+    void dispatchMessage(const qi::Message &msg, MessageSocketPtr socket, CallAdmission::Slot slot);
+
+    // Null if calls are not limited.
+    CallAdmissionPtr _admission;
+
     inline boost::weak_ptr<ObjectHost> _gethost() { return _owner ? *_owner : weakPtr(); }
     static void _removeCachedFuture(CancelableKitWeak kit, MessageSocketPtr sock, MessageId id);
+    // The admission slot of the call, if any, is held until the reply is
+    // sent.
     static void serverResultAdapterNext(AnyReference val, Signature targetSignature,
                                         boost::weak_ptr<ObjectHost> host,
                                  MessageSocketPtr sock, const MessageAddress& replyAddr,
-                                 const Signature& forcedReturnSignature, CancelableKitWeak kit);
+                                 const Signature& forcedReturnSignature, CancelableKitWeak kit,
+                                 CallAdmission::Slot slot);
     static void serverResultAdapter(Future<AnyReference> future, const Signature& targetSignature,
                                     boost::weak_ptr<ObjectHost> host,
                                     MessageSocketPtr sock, const MessageAddress& replyAddr,
                                     const Signature& forcedReturnSignature, CancelableKitWeak kit,
-                                    AtomicIntPtr cancelRequested = AtomicIntPtr());
+                                    AtomicIntPtr cancelRequested = AtomicIntPtr(),
+                                    CallAdmission::Slot slot = CallAdmission::Slot());
 
   private:
     // remote link id -> local link id
     using ServiceSignalLinks = std::map<SignalLink, RemoteSignalLink>;
     using BySocketServiceSignalLinks = std::map<qi::MessageSocketPtr, ServiceSignalLinks>;
 
-    //Event handling (no lock needed)
+    //Event handling
     BySocketServiceSignalLinks  _links;
+    boost::mutex                _linksMutex;
+
+    // What incoming messages need to know about a function of the object (or
+    // of _self for special functions), computed once from the meta objects.
+    struct DispatchEntry
+    {
+      bool             special;
+      qi::MetaCallType callType;
+      // Set if the function is a method.
+      bool             isMethod;
+      qi::Signature    methodParameters;
+      qi::TypeInterface* methodParametersType;
+      qi::Signature    methodReturn;
+      // Set if the function can be the target of a post: a signal, else a method.
+      bool             isPostable;
+      qi::Signature    postParameters;
+      qi::TypeInterface* postParametersType;
+    };
+    using DispatchTable = RoutingTable<DispatchEntry>;
+
+    // Returns the dispatch entries, rebuilt if the function is not found but
+    // is in the meta objects: the table is built on the first message, and
+    // objects can get new functions afterwards.
+    DispatchTable::EntriesPtr dispatchEntries(unsigned int function);
+    void publishDispatchEntries();
+
+    DispatchTable _dispatchTable;
+    boost::mutex  _dispatchTableMutex;
 
-    boost::mutex _callMutex;
   private:
-    qi::MessageSocketPtr _currentSocket;
     unsigned int           _serviceId;
     unsigned int           _objectId;
     qi::AnyObject          _object;
     qi::AnyObject          _self;
     qi::MetaCallType       _callType;
     boost::optional<boost::weak_ptr<qi::ObjectHost>> _owner;
-    // prevents parallel onMessage on self execution and protects the current socket
-    mutable boost::recursive_mutex           _mutex;
     boost::function<void (MessageSocketPtr, std::string)> _onSocketDisconnectedCallback;
 
     static qi::Atomic<unsigned int> _nextId;
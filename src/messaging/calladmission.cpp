@@ -0,0 +1,218 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <qi/async.hpp>
+#include <qi/getenv.hpp>
+#include <qi/log.hpp>
+#include "calladmission.hpp"
+
+qiLogCategory("qimessaging.calladmission");
+
+namespace qi
+{
+  namespace
+  {
+    const auto gMaxCallsPerSocketEnvVar = "QI_MAX_CALLS_PER_SOCKET";
+    const auto gMaxCallsPerServiceEnvVar = "QI_MAX_CALLS_PER_SERVICE";
+    const auto gMaxQueuedCallsPerSocketEnvVar = "QI_MAX_QUEUED_CALLS_PER_SOCKET";
+
+    struct Counters
+    {
+      std::atomic<qi::uint64_t> startedCount{0};
+      std::atomic<qi::uint64_t> queuedCount{0};
+      std::atomic<qi::uint64_t> rejectedCount{0};
+      std::atomic<qi::uint64_t> droppedCount{0};
+      std::atomic<qi::uint64_t> canceledCount{0};
+      std::atomic<qi::uint64_t> runningCalls{0};
+      std::atomic<qi::uint64_t> waitingCalls{0};
+    };
+
+    Counters& counters()
+    {
+      static Counters counters;
+      return counters;
+    }
+  }
+
+  CallAdmissionStats callAdmissionStats()
+  {
+    const auto& c = counters();
+    CallAdmissionStats stats;
+    stats.startedCount = c.startedCount.load();
+    stats.queuedCount = c.queuedCount.load();
+    stats.rejectedCount = c.rejectedCount.load();
+    stats.droppedCount = c.droppedCount.load();
+    stats.canceledCount = c.canceledCount.load();
+    stats.runningCalls = c.runningCalls.load();
+    stats.waitingCalls = c.waitingCalls.load();
+    return stats;
+  }
+
+  const CallAdmission::Limits& CallAdmission::Limits::fromEnvironment()
+  {
+    static const Limits limits = [] {
+      Limits limits;
+      limits.maxCallsPerSocket = qi::os::getEnvDefault(gMaxCallsPerSocketEnvVar, 0u);
+      limits.maxCallsPerService = qi::os::getEnvDefault(gMaxCallsPerServiceEnvVar, 0u);
+      limits.maxQueuedCallsPerSocket = qi::os::getEnvDefault(gMaxQueuedCallsPerSocketEnvVar, 100u);
+      return limits;
+    }();
+    return limits;
+  }
+
+  const char* const CallAdmission::rejectedError = "Call rejected: too many calls in progress.";
+
+  CallAdmission::CallAdmission(const Limits& limits)
+    : _limits(limits)
+  {
+  }
+
+  bool CallAdmission::canStart(const SocketCalls& calls) const
+  {
+    return (_limits.maxCallsPerService == 0 || _running < _limits.maxCallsPerService)
+        && (_limits.maxCallsPerSocket == 0 || calls.running < _limits.maxCallsPerSocket);
+  }
+
+  CallAdmission::Slot CallAdmission::makeSlot(const MessageSocketPtr& socket)
+  {
+    std::weak_ptr<CallAdmission> weakSelf = shared_from_this();
+    return Slot(static_cast<void*>(nullptr), [weakSelf, socket](void*) {
+      if (auto self = weakSelf.lock())
+        self->release(socket);
+      --counters().runningCalls;
+    });
+  }
+
+  bool CallAdmission::admit(const MessageSocketPtr& socket, const MessageAddress& address, Start start)
+  {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      auto& calls = _sockets[socket];
+      // Calls of a socket start in order.
+      if (!calls.waiting.empty() || !canStart(calls))
+      {
+        if (calls.waiting.size() >= _limits.maxQueuedCallsPerSocket)
+        {
+          if (calls.running == 0 && calls.waiting.empty())
+            _sockets.erase(socket);
+          ++counters().rejectedCount;
+          return false;
+        }
+        if (calls.waiting.empty())
+          _turns.push_back(socket);
+        calls.waiting.push_back(WaitingCall{address, std::move(start)});
+        ++counters().queuedCount;
+        ++counters().waitingCalls;
+        return true;
+      }
+      ++calls.running;
+      ++_running;
+    }
+    ++counters().startedCount;
+    ++counters().runningCalls;
+    start(makeSlot(socket));
+    return true;
+  }
+
+  void CallAdmission::release(const MessageSocketPtr& socket)
+  {
+    std::vector<std::pair<Start, MessageSocketPtr>> ready;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      --_running;
+      auto it = _sockets.find(socket);
+      if (it != _sockets.end())
+      {
+        --it->second.running;
+        if (it->second.running == 0 && it->second.waiting.empty())
+          _sockets.erase(it);
+      }
+
+      // Each socket in turn starts one of its calls, until the limits are
+      // reached. Sockets at their own limit keep their turn.
+      std::size_t blocked = 0;
+      while (blocked < _turns.size())
+      {
+        auto next = _turns.front();
+        _turns.pop_front();
+        auto& calls = _sockets[next];
+        if (!canStart(calls))
+        {
+          _turns.push_back(next);
+          ++blocked;
+          continue;
+        }
+        blocked = 0;
+        ready.emplace_back(std::move(calls.waiting.front().start), next);
+        calls.waiting.pop_front();
+        ++calls.running;
+        ++_running;
+        if (!calls.waiting.empty())
+          _turns.push_back(next);
+      }
+    }
+
+    for (auto& call : ready)
+    {
+      --counters().waitingCalls;
+      ++counters().runningCalls;
+      auto slot = makeSlot(call.second);
+      qi::async([call, slot] { call.first(slot); });
+    }
+  }
+
+  boost::optional<MessageAddress> CallAdmission::cancelQueued(const MessageSocketPtr& socket,
+                                                              unsigned int messageId)
+  {
+    MessageAddress address;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      auto it = _sockets.find(socket);
+      if (it == _sockets.end())
+        return {};
+      auto& waiting = it->second.waiting;
+      const auto call = std::find_if(waiting.begin(), waiting.end(), [&](const WaitingCall& call) {
+        return call.address.messageId == messageId;
+      });
+      if (call == waiting.end())
+        return {};
+      address = call->address;
+      waiting.erase(call);
+      if (waiting.empty())
+      {
+        _turns.erase(std::remove(_turns.begin(), _turns.end(), socket), _turns.end());
+        if (it->second.running == 0)
+          _sockets.erase(it);
+      }
+    }
+    ++counters().canceledCount;
+    --counters().waitingCalls;
+    return address;
+  }
+
+  void CallAdmission::dropQueued(const MessageSocketPtr& socket)
+  {
+    std::deque<WaitingCall> dropped;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      auto it = _sockets.find(socket);
+      if (it == _sockets.end())
+        return;
+      std::swap(dropped, it->second.waiting);
+      if (it->second.running == 0)
+        _sockets.erase(it);
+      _turns.erase(std::remove(_turns.begin(), _turns.end(), socket), _turns.end());
+    }
+    if (dropped.empty())
+      return;
+    qiLogVerbose() << "Dropping " << dropped.size() << " waiting calls of a disconnected socket";
+    counters().droppedCount += dropped.size();
+    counters().waitingCalls -= dropped.size();
+  }
+}
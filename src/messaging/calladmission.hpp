@@ -0,0 +1,106 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_CALLADMISSION_HPP_
+#define _SRC_MESSAGING_CALLADMISSION_HPP_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+#include <qi/messaging/calladmission.hpp>
+#include "messagesocket.hpp"
+
+namespace qi
+{
+  /// Limits the number of calls a bound object runs at the same time, for
+  /// each socket and in total.
+  ///
+  /// Calls over the limits wait in a queue per socket. When a call finishes,
+  /// the queues are served in turn, one call at a time, so that a socket
+  /// sending a lot of calls does not delay the calls of the others. Waiting
+  /// calls are started from the event loop.
+  class CallAdmission : public std::enable_shared_from_this<CallAdmission>
+  {
+  public:
+    struct Limits
+    {
+      /// Maximum number of calls running at the same time for a socket, 0
+      /// for no limit.
+      unsigned int maxCallsPerSocket = 0;
+      /// Maximum number of calls running at the same time, 0 for no limit.
+      unsigned int maxCallsPerService = 0;
+      /// Maximum number of calls waiting for a socket: other calls are
+      /// rejected.
+      unsigned int maxQueuedCallsPerSocket = 0;
+
+      bool enabled() const
+      {
+        return maxCallsPerSocket != 0 || maxCallsPerService != 0;
+      }
+
+      /// The limits set with QI_MAX_CALLS_PER_SOCKET, QI_MAX_CALLS_PER_SERVICE
+      /// and QI_MAX_QUEUED_CALLS_PER_SOCKET.
+      static const Limits& fromEnvironment();
+    };
+
+    /// Held until the call is finished.
+    using Slot = std::shared_ptr<void>;
+    using Start = boost::function<void (Slot)>;
+
+    explicit CallAdmission(const Limits& limits);
+
+    CallAdmission(const CallAdmission&) = delete;
+    CallAdmission& operator=(const CallAdmission&) = delete;
+
+    /// Starts the call from the calling thread if the limits allow it, else
+    /// queues it. Returns false if the call is rejected because the queue of
+    /// the socket is full.
+    bool admit(const MessageSocketPtr& socket, const MessageAddress& address, Start start);
+
+    /// Removes the call of the socket with this message id if it did not
+    /// start. Returns its address, or an empty optional if it is not waiting.
+    boost::optional<MessageAddress> cancelQueued(const MessageSocketPtr& socket,
+                                                 unsigned int messageId);
+
+    /// Drops the calls of the socket which did not start.
+    void dropQueued(const MessageSocketPtr& socket);
+
+    /// The error of the rejected calls.
+    static const char* const rejectedError;
+
+  private:
+    struct WaitingCall
+    {
+      MessageAddress address;
+      Start start;
+    };
+
+    struct SocketCalls
+    {
+      unsigned int running = 0;
+      std::deque<WaitingCall> waiting;
+    };
+
+    bool canStart(const SocketCalls& calls) const;
+    Slot makeSlot(const MessageSocketPtr& socket);
+    void release(const MessageSocketPtr& socket);
+
+    const Limits _limits;
+
+    boost::mutex _mutex;
+    std::map<MessageSocketPtr, SocketCalls> _sockets;
+    // The sockets having calls waiting, in the order they are served.
+    std::deque<MessageSocketPtr> _turns;
+    unsigned int _running = 0;
+  };
+
+  using CallAdmissionPtr = std::shared_ptr<CallAdmission>;
+}
+
+#endif  // _SRC_MESSAGING_CALLADMISSION_HPP_
@@ -0,0 +1,94 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <limits>
+#include <boost/thread/tss.hpp>
+#include <qi/getenv.hpp>
+#include "calldeadline_p.hpp"
+
+namespace qi
+{
+  namespace
+  {
+    // The deadline of the innermost CallDeadlineScope of the current thread.
+    boost::optional<SteadyClockTimePoint>& scopeDeadline()
+    {
+      static boost::thread_specific_ptr<boost::optional<SteadyClockTimePoint>> deadline;
+      if (!deadline.get())
+        deadline.reset(new boost::optional<SteadyClockTimePoint>());
+      return *deadline;
+    }
+
+    Duration defaultTimeout()
+    {
+      static const Duration timeout = MilliSeconds(qi::os::getEnvDefault("QI_REMOTE_CALL_TIMEOUT_MS", 0u));
+      return timeout;
+    }
+  }
+
+  CallDeadlineScope::CallDeadlineScope(SteadyClockTimePoint deadline)
+  {
+    auto& current = scopeDeadline();
+    _previous = current;
+    if (!current || deadline < *current)
+      current = deadline;
+  }
+
+  CallDeadlineScope::CallDeadlineScope(Duration timeout)
+    : CallDeadlineScope(SteadyClock::now() + timeout)
+  {
+  }
+
+  CallDeadlineScope::~CallDeadlineScope()
+  {
+    scopeDeadline() = _previous;
+  }
+
+  boost::optional<SteadyClockTimePoint> currentCallDeadline()
+  {
+    if (const auto deadline = scopeDeadline())
+      return deadline;
+    const auto timeout = defaultTimeout();
+    if (timeout == Duration::zero())
+      return {};
+    return SteadyClock::now() + timeout;
+  }
+
+  CallDeadlineStats callDeadlineStats()
+  {
+    const auto& counters = calldeadline::counters();
+    CallDeadlineStats stats;
+    stats.callCount = counters.callCount.load();
+    stats.exceededCount = counters.exceededCount.load();
+    stats.skippedCount = counters.skippedCount.load();
+    stats.canceledCount = counters.canceledCount.load();
+    return stats;
+  }
+
+  namespace calldeadline
+  {
+    Counters& counters()
+    {
+      static Counters counters;
+      return counters;
+    }
+
+    const char* const exceededError = "Call deadline exceeded.";
+
+    qi::uint32_t remainingMilliseconds(SteadyClockTimePoint deadline)
+    {
+      const auto remaining =
+          boost::chrono::duration_cast<MilliSeconds>(deadline - SteadyClock::now()).count();
+      return static_cast<qi::uint32_t>(std::min<int64_t>(std::max<int64_t>(remaining, 0),
+                                                         std::numeric_limits<qi::uint32_t>::max()));
+    }
+
+    SteadyClockTimePoint fromRemainingMilliseconds(qi::uint32_t remaining)
+    {
+      return SteadyClock::now() + MilliSeconds(remaining);
+    }
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_CALLDEADLINE_P_HPP_
+#define _SRC_MESSAGING_CALLDEADLINE_P_HPP_
+
+#include <atomic>
+#include <qi/messaging/calldeadline.hpp>
+
+namespace qi
+{
+  namespace calldeadline
+  {
+    /// The counters behind callDeadlineStats().
+    struct Counters
+    {
+      std::atomic<qi::uint64_t> callCount{0};
+      std::atomic<qi::uint64_t> exceededCount{0};
+      std::atomic<qi::uint64_t> skippedCount{0};
+      std::atomic<qi::uint64_t> canceledCount{0};
+    };
+
+    Counters& counters();
+
+    /// The error of the calls whose deadline passed.
+    extern const char* const exceededError;
+
+    /// The time left before a deadline, as sent with a call flagged with
+    /// Message::TypeFlag_Deadline: clocks of different hosts are unrelated.
+    qi::uint32_t remainingMilliseconds(SteadyClockTimePoint deadline);
+
+    /// The deadline of a call received with `remaining` milliseconds left.
+    SteadyClockTimePoint fromRemainingMilliseconds(qi::uint32_t remaining);
+  }
+}
+
+#endif  // _SRC_MESSAGING_CALLDEADLINE_P_HPP_
@@ -0,0 +1,109 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <qi/async.hpp>
+#include <qi/log.hpp>
+#include "eventcoalescer.hpp"
+
+qiLogCategory("qimessaging.eventcoalescer");
+
+namespace qi
+{
+  EventCoalescer::EventCoalescer(const RemoteEventPolicy& policy, Send send)
+    : _policy(policy)
+    , _send(std::move(send))
+  {
+  }
+
+  GenericFunctionParameters EventCoalescer::parameters(const Values& values)
+  {
+    GenericFunctionParameters params;
+    params.reserve(values.size());
+    for (const auto& value : values)
+      params.push_back(value.asReference());
+    return params;
+  }
+
+  void EventCoalescer::push(const GenericFunctionParameters& params)
+  {
+    Values values;
+    values.reserve(params.size());
+    for (const auto& param : params)
+      values.emplace_back(param, true, true);
+
+    boost::mutex::scoped_lock lock(_mutex);
+    switch (_policy.mode)
+    {
+    case RemoteEventPolicy::Mode_Batch:
+      _pending.push_back(std::move(values));
+      if (_pending.size() >= std::max(_policy.maxBatchSize, 1u))
+        flushLocked();
+      else if (!_timerScheduled)
+        scheduleFlush(_policy.delay);
+      return;
+    case RemoteEventPolicy::Mode_Conflate:
+      _pending.clear();
+      _pending.push_back(std::move(values));
+      if (!_timerScheduled)
+        scheduleFlush(_policy.delay);
+      return;
+    case RemoteEventPolicy::Mode_RateLimit:
+    {
+      _pending.clear();
+      _pending.push_back(std::move(values));
+      if (_timerScheduled)
+        return;
+      const auto elapsed = SteadyClock::now() - _lastSend;
+      if (elapsed >= _policy.delay)
+        flushLocked();
+      else
+        scheduleFlush(_policy.delay - elapsed);
+      return;
+    }
+    case RemoteEventPolicy::Mode_Immediate:
+      _pending.push_back(std::move(values));
+      flushLocked();
+      return;
+    }
+  }
+
+  void EventCoalescer::flushLocked()
+  {
+    ++_generation;
+    _timerScheduled = false;
+    if (_pending.empty())
+      return;
+    std::vector<Values> pending;
+    std::swap(pending, _pending);
+    _lastSend = SteadyClock::now();
+    try
+    {
+      _send(pending);
+    }
+    catch (const std::exception& e)
+    {
+      qiLogWarning() << "Failed to send " << pending.size() << " event(s): " << e.what();
+    }
+  }
+
+  void EventCoalescer::scheduleFlush(Duration delay)
+  {
+    _timerScheduled = true;
+    const auto generation = _generation;
+    std::weak_ptr<EventCoalescer> weakSelf = shared_from_this();
+    qi::asyncDelay([weakSelf, generation] {
+      if (auto self = weakSelf.lock())
+        self->onTimer(generation);
+    }, delay);
+  }
+
+  void EventCoalescer::onTimer(unsigned int generation)
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if (generation == _generation)
+      flushLocked();
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_EVENTCOALESCER_HPP_
+#define _SRC_MESSAGING_EVENTCOALESCER_HPP_
+
+#include <memory>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <qi/anyfunction.hpp>
+#include <qi/anyvalue.hpp>
+#include <qi/clock.hpp>
+#include <qi/signal.hpp>
+
+namespace qi
+{
+  /// Applies a RemoteEventPolicy to the emissions of a signal forwarded to
+  /// one remote subscriber. Signals with the Mode_Immediate policy do not
+  /// need one.
+  ///
+  /// Emissions are copied when they are pushed, and handed to the send
+  /// function when the policy decides so: several of them at once in
+  /// Mode_Batch, one otherwise. The send function is called with an internal
+  /// lock held, so that emissions are sent in order. It must not push.
+  ///
+  /// Delayed sends are done from the event loop. Emissions which were not
+  /// sent yet are dropped when the coalescer is destroyed.
+  class EventCoalescer : public std::enable_shared_from_this<EventCoalescer>
+  {
+  public:
+    /// The arguments of one emission.
+    using Values = std::vector<AnyValue>;
+    using Send = boost::function<void (const std::vector<Values>&)>;
+
+    EventCoalescer(const RemoteEventPolicy& policy, Send send);
+
+    EventCoalescer(const EventCoalescer&) = delete;
+    EventCoalescer& operator=(const EventCoalescer&) = delete;
+
+    void push(const GenericFunctionParameters& params);
+
+    static GenericFunctionParameters parameters(const Values& values);
+
+  private:
+    void flushLocked();
+    void scheduleFlush(Duration delay);
+    void onTimer(unsigned int generation);
+
+    const RemoteEventPolicy _policy;
+    const Send _send;
+
+    boost::mutex _mutex;
+    std::vector<Values> _pending;
+    // Incremented at each flush: timers scheduled for an earlier generation
+    // have nothing to do.
+    unsigned int _generation = 0;
+    bool _timerScheduled = false;
+    SteadyClock::time_point _lastSend;
+  };
+
+  using EventCoalescerPtr = std::shared_ptr<EventCoalescer>;
+}
+
+#endif  // _SRC_MESSAGING_EVENTCOALESCER_HPP_
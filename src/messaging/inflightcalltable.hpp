@@ -0,0 +1,224 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_INFLIGHTCALLTABLE_HPP_
+#define _SRC_MESSAGING_INFLIGHTCALLTABLE_HPP_
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace qi
+{
+  /// Concurrent table of the calls in flight, keyed by message id.
+  ///
+  /// Message ids are consecutive, so they are spread over a fixed number of
+  /// shards by their low bits. Each shard is an open-addressing hash table
+  /// with linear probing, protected by its own mutex: concurrent calls
+  /// (consecutive ids) almost never contend, and no node is allocated per
+  /// call.
+  ///
+  /// Removal shifts the following entries back instead of leaving tombstones,
+  /// so that the probe sequences stay short however many calls went through
+  /// the table.
+  template <typename T>
+  class InflightCallTable
+  {
+  public:
+    using Key = unsigned int;
+    static const std::size_t shardCount = 16;
+
+    InflightCallTable() = default;
+    InflightCallTable(const InflightCallTable&) = delete;
+    InflightCallTable& operator=(const InflightCallTable&) = delete;
+
+    /// Adds the value if no value is set for this id.
+    /// Returns false if there was one, in which case it is left unchanged.
+    bool emplace(Key id, T value)
+    {
+      Shard& s = shard(id);
+      boost::mutex::scoped_lock lock(s.mutex);
+      if (s.find(id) != Shard::npos)
+        return false;
+      s.insert(id, std::move(value));
+      return true;
+    }
+
+    /// Sets the value for this id.
+    /// Returns false if there was a value, in which case it is replaced.
+    bool assign(Key id, T value)
+    {
+      Shard& s = shard(id);
+      boost::mutex::scoped_lock lock(s.mutex);
+      const auto index = s.find(id);
+      if (index != Shard::npos)
+      {
+        *s.slots[index].value = std::move(value);
+        return false;
+      }
+      s.insert(id, std::move(value));
+      return true;
+    }
+
+    /// Removes the value of this id and returns it, if there is one.
+    boost::optional<T> take(Key id)
+    {
+      Shard& s = shard(id);
+      boost::mutex::scoped_lock lock(s.mutex);
+      const auto index = s.find(id);
+      if (index == Shard::npos)
+        return {};
+      return s.erase(index);
+    }
+
+    /// Removes all the values and returns them with their ids, in no
+    /// particular order.
+    std::vector<std::pair<Key, T>> takeAll()
+    {
+      std::vector<std::pair<Key, T>> result;
+      for (auto& s : _shards)
+      {
+        boost::mutex::scoped_lock lock(s.mutex);
+        for (auto& slot : s.slots)
+        {
+          if (slot.value)
+            result.emplace_back(slot.key, std::move(*slot.value));
+        }
+        s.clear();
+      }
+      return result;
+    }
+
+    /// Number of values in the table. Only an estimate if the table is being
+    /// modified concurrently.
+    std::size_t size() const
+    {
+      std::size_t result = 0;
+      for (auto& s : _shards)
+      {
+        boost::mutex::scoped_lock lock(s.mutex);
+        result += s.count;
+      }
+      return result;
+    }
+
+    bool empty() const
+    {
+      return size() == 0;
+    }
+
+  private:
+    struct Slot
+    {
+      Key key = 0;
+      boost::optional<T> value;
+    };
+
+    struct Shard
+    {
+      static const std::size_t npos = static_cast<std::size_t>(-1);
+      static const std::size_t initialCapacity = 8;
+
+      mutable boost::mutex mutex;
+      std::vector<Slot> slots;
+      std::size_t count = 0;
+
+      // Ids of a shard share their low bits, the other ones are spread by the
+      // multiplication.
+      std::size_t home(Key id) const
+      {
+        return (static_cast<std::size_t>(id / shardCount) * 2654435761u) & (slots.size() - 1);
+      }
+
+      std::size_t next(std::size_t index) const
+      {
+        return (index + 1) & (slots.size() - 1);
+      }
+
+      std::size_t find(Key id) const
+      {
+        if (slots.empty())
+          return npos;
+        for (auto index = home(id); slots[index].value; index = next(index))
+        {
+          if (slots[index].key == id)
+            return index;
+        }
+        return npos;
+      }
+
+      // Precondition: find(id) == npos
+      void insert(Key id, T value)
+      {
+        // Keep the load factor at most 1/2.
+        if (2 * (count + 1) > slots.size())
+          grow();
+        auto index = home(id);
+        while (slots[index].value)
+          index = next(index);
+        slots[index].key = id;
+        slots[index].value = std::move(value);
+        ++count;
+      }
+
+      T erase(std::size_t index)
+      {
+        T value = std::move(*slots[index].value);
+        slots[index].value = boost::none;
+        --count;
+        // Move back the entries of the cluster that can fill the hole, so that
+        // the lookups do not stop at it.
+        auto hole = index;
+        for (auto current = next(hole); slots[current].value; current = next(current))
+        {
+          const auto homeIndex = home(slots[current].key);
+          // The entry can move if its home is not in (hole, current], taking
+          // the wrap-around into account.
+          const bool canMove = hole <= current
+              ? (homeIndex <= hole || homeIndex > current)
+              : (homeIndex <= hole && homeIndex > current);
+          if (canMove)
+          {
+            slots[hole] = std::move(slots[current]);
+            slots[current].value = boost::none;
+            hole = current;
+          }
+        }
+        return value;
+      }
+
+      void grow()
+      {
+        std::vector<Slot> old(slots.empty() ? initialCapacity : 2 * slots.size());
+        old.swap(slots);
+        count = 0;
+        for (auto& slot : old)
+        {
+          if (slot.value)
+            insert(slot.key, std::move(*slot.value));
+        }
+      }
+
+      void clear()
+      {
+        slots.clear();
+        count = 0;
+      }
+    };
+
+    Shard& shard(Key id)
+    {
+      return _shards[id % shardCount];
+    }
+
+    std::array<Shard, shardCount> _shards;
+  };
+}
+
+#endif  // _SRC_MESSAGING_INFLIGHTCALLTABLE_HPP_
@@ -282,6 +282,12 @@ namespace qi
       qiLogError() <<"fromBuffer: unknown type " << signature.toString();
       throw std::runtime_error("Could not construct type for " + signature.toString());
     }
+    return value(type, socket);
+  }
+
+  AnyReference Message::value(TypeInterface* type,
+                              const qi::MessageSocketPtr& socket) const
+  {
     qi::BufferReader br(_buffer);
     //TODO: not exception safe
     AnyReference res(type);
@@ -162,6 +162,22 @@ namespace qi {
      * NOT IMPLEMENTED
      */
     static const unsigned int TypeFlag_ReturnType = 2;
+    // If flag set, payload is compressed (see payloadcompression.hpp).
+    // Only sent to peers advertising the PayloadCompression capability.
+    static const unsigned int TypeFlag_Compressed = 4;
+    // If flag set, some sub-buffers of the payload are in shared memory
+    // segments (see sharedbuffers.hpp). Only sent to peers of the same host
+    // advertising the SharedMemoryBuffers capability.
+    static const unsigned int TypeFlag_SharedBuffers = 8;
+    // If flag set, the payload of a Type_Event message is a list of emissions
+    // of the signal, each one encoded as the payload of a single event would
+    // be. Only sent to peers advertising the EventBatching capability.
+    static const unsigned int TypeFlag_EventBatch = 16;
+    // If flag set, the payload of a Type_Call message ends with the time left
+    // before the deadline of the call, in milliseconds (uint32), after the
+    // return type if any. Only sent to peers advertising the CallDeadline
+    // capability.
+    static const unsigned int TypeFlag_Deadline = 32;
 
     QI_API static const char* typeToString(Type t);
     QI_API static const char* actionToString(unsigned int action, unsigned int service);
@@ -300,6 +316,9 @@ namespace qi {
     ///@return signature, set by setParameters() or setSignature()
     QI_API AnyReference value(const Signature &signature, const qi::MessageSocketPtr &socket) const;
 
+    /// Same as above, with the type of the signature, when it is already known.
+    QI_API AnyReference value(TypeInterface* type, const qi::MessageSocketPtr &socket) const;
+
     QI_API void setValue(const AutoAnyReference& value,
                   const Signature& signature,
                   boost::weak_ptr<ObjectHost> context = boost::weak_ptr<ObjectHost>{},
@@ -40,14 +40,11 @@ namespace qi {
 
   void MessageDispatcher::dispatch(const qi::Message& msg) {
     //remove the address from the messageSent map
-    if (msg.type() == qi::Message::Type_Reply)
+    if (msg.type() == qi::Message::Type_Reply
+        || msg.type() == qi::Message::Type_Error
+        || msg.type() == qi::Message::Type_Canceled)
     {
-      boost::mutex::scoped_lock sl(_messageSentMutex);
-      MessageSentMap::iterator it;
-      it = _messageSent.find(msg.id());
-      if (it != _messageSent.end())
-        _messageSent.erase(it);
-      else
+      if (!_messageSent.take(msg.id()))
         qiLogDebug() << "Message " << msg.id() <<  " is not in the messageSent map";
     }
 
@@ -120,36 +117,27 @@ namespace qi {
   {
     //we are deleting the Socket and want to timeout all pending request
     //or the cleanup timer ask us to remove pending request that timed out
-    while (true)
+    for (const auto& pending : _messageSent.takeAll())
     {
-      MessageAddress ma;
-      {
-        boost::mutex::scoped_lock l(_messageSentMutex);
-        MessageSentMap::iterator it = _messageSent.begin();
-        if (it == _messageSent.end())
-          break;
-        ma = it->second;
-        _messageSent.erase(it);
-      }
       //generate an error message for the caller.
-      qi::Message msg(qi::Message::Type_Error, ma);
+      qi::Message msg(qi::Message::Type_Error, pending.second);
       msg.setError("Endpoint disconnected, message dropped.");
       dispatch(msg);
     }
   }
 
+  void MessageDispatcher::forget(unsigned int id)
+  {
+    _messageSent.take(id);
+  }
+
   void MessageDispatcher::sent(const qi::Message& msg) {
     //store Call id, we can use them later to notify the client
     //if the call did not succeed. (network disconnection, message lost)
     if (msg.type() == qi::Message::Type_Call)
     {
-      boost::mutex::scoped_lock l(_messageSentMutex);
-      MessageSentMap::iterator it = _messageSent.find(msg.id());
-      if (it != _messageSent.end()) {
+      if (!_messageSent.emplace(msg.id(), msg.address()))
         qiLogInfo() << "Message ID conflict. A message with the same Id is already in flight" << msg.id();
-        return;
-      }
-      _messageSent[msg.id()] = msg.address();
     }
     return;
   }
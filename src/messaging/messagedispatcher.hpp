@@ -11,6 +11,7 @@
 #include <qi/signal.hpp>
 #include <boost/thread/mutex.hpp>
 #include "message.hpp"
+#include "inflightcalltable.hpp"
 
 namespace qi {
 
@@ -35,6 +36,8 @@ namespace qi {
     //internal: called by Socket to tell the class a message have been receive
     void dispatch(const qi::Message& msg);
     void cleanPendingMessages();
+    //internal: called when the caller gives up waiting for the reply to a call
+    void forget(unsigned int id);
 
     static const unsigned int ALL_OBJECTS;
     qi::SignalLink messagePendingConnect(unsigned int serviceId, unsigned int objectId, boost::function<void (const qi::Message&)> fun);
@@ -45,14 +48,13 @@ namespace qi {
     using OnMessageSignal = Signal<const qi::Message&>;
     // use shared-ptr on signal so that we may hold it without holding the map lock
     using SignalMap = std::map<Target, boost::shared_ptr<OnMessageSignal> >;
-    using MessageSentMap = std::map<unsigned int, MessageAddress>;
+    using MessageSentMap = InflightCallTable<MessageAddress>;
 
     ExecutionContext*      _execContext;
     SignalMap              _signalMap;
     boost::recursive_mutex _signalMapMutex;
 
     MessageSentMap         _messageSent;
-    boost::mutex           _messageSentMutex;
   };
 
 }
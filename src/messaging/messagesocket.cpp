@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
 #include <qi/log.hpp>
+#include <qi/os.hpp>
+#include <qi/messaging/sock/networkasiolocal.hpp>
 #include <qi/messaging/sock/option.hpp>
 #include "messagesocket.hpp"
 #include "tcpmessagesocket.hpp"
@@ -14,10 +18,26 @@ qiLogCategory(qi::sock::logCategory());
 
 namespace qi
 {
+  namespace
+  {
+    // Number of segments remembered by a socket above which those that were
+    // received are forgotten.
+    const std::size_t minSharedBufferSegmentsCheckSize = 256;
+
+    bool isSameHost(const Url& url)
+    {
+      const auto& host = url.host();
+      return url.protocol() == "unix" || boost::algorithm::starts_with(host, "127.")
+          || host == "::1" || host == "localhost";
+    }
+  }
+
   MessageSocket::~MessageSocket()
   {
     qiLogDebug() << "Destroying transport socket";
     _signalsStrand.join();
+    for (const auto& name : _sharedBufferSegments)
+      removeSharedBufferSegment(name);
   }
 
   bool MessageSocket::isConnected() const
@@ -25,8 +45,139 @@ namespace qi
     return status() == qi::MessageSocket::Status::Connected;
   }
 
+  PayloadCompressionStats MessageSocket::payloadCompressionStats() const
+  {
+    const auto& counters = _compressionCounters;
+    PayloadCompressionStats stats;
+    stats.compressedMessageCount = counters.compressedMessageCount.load(std::memory_order_relaxed);
+    stats.uncompressedByteCount = counters.uncompressedByteCount.load(std::memory_order_relaxed);
+    stats.compressedByteCount = counters.compressedByteCount.load(std::memory_order_relaxed);
+    stats.decompressedMessageCount = counters.decompressedMessageCount.load(std::memory_order_relaxed);
+    stats.compressionTime = NanoSeconds{counters.compressionNanoseconds.load(std::memory_order_relaxed)};
+    stats.decompressionTime = NanoSeconds{counters.decompressionNanoseconds.load(std::memory_order_relaxed)};
+    return stats;
+  }
+
+  boost::optional<Message> MessageSocket::compressPayloadForSending(const Message& msg)
+  {
+    static const auto threshold = getPayloadCompressionThresholdFromEnv();
+    // Capabilities are exchanged uncompressed, as they tell whether the remote
+    // end supports compression.
+    if (!_compressPayloads
+        || msg.type() == Message::Type_Capability
+        || msg.buffer().totalSize() < threshold
+        || (msg.flags() & Message::TypeFlag_Compressed)
+        || !sharedCapability<bool>(capabilityname::payloadCompression, false))
+      return {};
+    if (!_compressToLocalPeers && remoteIsOnSameMachine())
+      return {};
+
+    const auto start = SteadyClock::now();
+    auto compressed = compressPayload(msg);
+    const auto duration = boost::chrono::duration_cast<NanoSeconds>(SteadyClock::now() - start);
+
+    auto& counters = _compressionCounters;
+    counters.compressionNanoseconds.fetch_add(duration.count(), std::memory_order_relaxed);
+    if (compressed)
+    {
+      counters.compressedMessageCount.fetch_add(1, std::memory_order_relaxed);
+      counters.uncompressedByteCount.fetch_add(msg.buffer().totalSize(), std::memory_order_relaxed);
+      counters.compressedByteCount.fetch_add(compressed->buffer().size(), std::memory_order_relaxed);
+    }
+    return compressed;
+  }
+
+  boost::optional<Message> MessageSocket::decompressReceivedPayload(const Message& msg,
+                                                                    std::size_t maxPayloadSize)
+  {
+    const auto start = SteadyClock::now();
+    auto decompressed = decompressPayload(msg, maxPayloadSize);
+    const auto duration = boost::chrono::duration_cast<NanoSeconds>(SteadyClock::now() - start);
+
+    auto& counters = _compressionCounters;
+    counters.decompressionNanoseconds.fetch_add(duration.count(), std::memory_order_relaxed);
+    if (decompressed)
+      counters.decompressedMessageCount.fetch_add(1, std::memory_order_relaxed);
+    return decompressed;
+  }
+
+  boost::optional<Message> MessageSocket::shareBuffersForSending(const Message& msg)
+  {
+    static const auto threshold = getSharedBufferThresholdFromEnv();
+    const auto& subBuffers = msg.buffer().subBuffers();
+    const auto isBig = [&](const std::pair<std::size_t, Buffer>& sub) {
+      return sub.second.size() >= threshold;
+    };
+    if (std::none_of(subBuffers.begin(), subBuffers.end(), isBig)
+        || (msg.flags() & Message::TypeFlag_SharedBuffers)
+        || !sharedCapability<bool>(capabilityname::sharedMemoryBuffers, false)
+        || !remoteCanOpenSharedBuffers())
+      return {};
+    const auto remote = remoteEndpoint();
+    if (!remote || !isSameHost(*remote))
+      return {};
+
+    std::vector<std::string> segmentNames;
+    auto shared = shareBuffers(msg, threshold, segmentNames);
+    if (!segmentNames.empty())
+    {
+      std::lock_guard<std::mutex> lock(_sharedBufferSegmentsMutex);
+      _sharedBufferSegments.insert(_sharedBufferSegments.end(),
+                                   segmentNames.begin(), segmentNames.end());
+      if (_sharedBufferSegments.size() >= _sharedBufferSegmentsCheckSize)
+      {
+        // The received segments have been unlinked by the remote end. Checking
+        // again once the remaining ones have doubled keeps this amortized.
+        _sharedBufferSegments.erase(std::remove_if(_sharedBufferSegments.begin(),
+                                                   _sharedBufferSegments.end(),
+                                                   [](const std::string& name) {
+                                                     return !sharedBufferSegmentExists(name);
+                                                   }),
+                                    _sharedBufferSegments.end());
+        _sharedBufferSegmentsCheckSize =
+            std::max(minSharedBufferSegmentsCheckSize, 2 * _sharedBufferSegments.size());
+      }
+    }
+    return shared;
+  }
+
+  bool MessageSocket::remoteIsOnSameMachine() const
+  {
+    try
+    {
+      return remoteCapability<std::string>(capabilityname::machineId, std::string{})
+          == os::getMachineId();
+    }
+    catch (const std::exception& e)
+    {
+      qiLogDebug() << "Ill-formed machine id capability: " << e.what();
+      return false;
+    }
+  }
+
+  bool MessageSocket::remoteCanOpenSharedBuffers() const
+  {
+    try
+    {
+      return remoteCapability<qi::int64_t>(capabilityname::sharedMemoryBuffersUser, -1)
+          == getSharedBufferUserId();
+    }
+    catch (const std::exception& e)
+    {
+      qiLogDebug() << "Ill-formed shared memory buffers user capability: " << e.what();
+      return false;
+    }
+  }
+
   MessageSocketPtr makeMessageSocket(const std::string &protocol, qi::EventLoop *eventLoop)
   {
+#ifdef QI_SOCK_HAS_LOCAL_SOCKETS
+    if (protocol == "unix")
+    {
+      return boost::make_shared<TcpMessageSocket<sock::NetworkAsioLocal>>(
+            *asIoServicePtr(eventLoop), false);
+    }
+#endif
     return makeTcpMessageSocket(protocol, eventLoop);
   }
 }
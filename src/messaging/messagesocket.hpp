@@ -11,8 +11,13 @@
 # include <qi/eventloop.hpp>
 # include <qi/signal.hpp>
 # include <qi/binarycodec.hpp>
+# include <atomic>
+# include <deque>
+# include <mutex>
 # include <string>
 # include "messagedispatcher.hpp"
+# include "payloadcompression.hpp"
+# include "sharedbuffers.hpp"
 # include "streamcontext.hpp"
 
 namespace qi {
@@ -55,6 +60,8 @@ namespace qi
     explicit MessageSocket(qi::EventLoop* eventLoop = qi::getNetworkEventLoop())
       : _eventLoop(eventLoop)
       , _dispatcher{ &_signalsStrand }
+      , _compressPayloads(getPayloadCompressionFromEnv())
+      , _compressToLocalPeers(getPayloadCompressionToLocalPeersFromEnv())
       // connected is the only signal to be synchronous, because it will always be the first signal
       // emitted (so no other asynchronous signal emission will overlap with it) and it's not
       // emitted from the network event loop worker
@@ -94,11 +101,66 @@ namespace qi
       _dispatcher.messagePendingDisconnect(serviceId, objectId, linkId);
     }
 
+    /// The reply to this call, if any, is not waited for anymore.
+    void forgetSentMessage(unsigned int id) {
+      _dispatcher.forget(id);
+    }
+
+    /// Statistics on the compression of the payloads sent and received by
+    /// this socket.
+    PayloadCompressionStats payloadCompressionStats() const;
+
   protected:
+    /// Returns the message to send instead of `msg` if its payload must be
+    /// compressed, that is if compression is enabled (see
+    /// getPayloadCompressionFromEnv), if the remote end supports it and is not
+    /// on the same machine (see getPayloadCompressionToLocalPeersFromEnv), if
+    /// the payload is big enough and if compression makes it smaller.
+    boost::optional<Message> compressPayloadForSending(const Message& msg);
+
+    /// Returns `msg` with its payload decompressed, or an empty optional if
+    /// the payload is ill-formed.
+    /// Precondition: msg.flags() & Message::TypeFlag_Compressed
+    boost::optional<Message> decompressReceivedPayload(const Message& msg,
+                                                       std::size_t maxPayloadSize);
+
+    /// Returns the message to send instead of `msg` if its big sub-buffers
+    /// must go through shared memory, that is if the remote end is on the
+    /// same host and supports it.
+    boost::optional<Message> shareBuffersForSending(const Message& msg);
+
+    /// Returns true if the remote end advertised the machine id of this
+    /// process (see capabilityname::machineId).
+    bool remoteIsOnSameMachine() const;
+
+    /// Returns true if the remote end runs as the user owning the shared
+    /// memory segments of this process.
+    bool remoteCanOpenSharedBuffers() const;
+
     qi::EventLoop* _eventLoop;
     Strand _signalsStrand; // Must be declared before the MessageDispatcher and the signals.
     qi::MessageDispatcher _dispatcher;
 
+  private:
+    struct PayloadCompressionCounters
+    {
+      std::atomic<qi::uint64_t> compressedMessageCount{0};
+      std::atomic<qi::uint64_t> uncompressedByteCount{0};
+      std::atomic<qi::uint64_t> compressedByteCount{0};
+      std::atomic<qi::uint64_t> decompressedMessageCount{0};
+      std::atomic<qi::int64_t> compressionNanoseconds{0};
+      std::atomic<qi::int64_t> decompressionNanoseconds{0};
+    };
+    PayloadCompressionCounters _compressionCounters;
+    const bool _compressPayloads;
+    const bool _compressToLocalPeers;
+
+    // Shared memory segments sent and maybe not received yet. Those that were
+    // not received are removed with the socket.
+    std::mutex _sharedBufferSegmentsMutex;
+    std::deque<std::string> _sharedBufferSegments;
+    std::size_t _sharedBufferSegmentsCheckSize = 256;
+
   public:
     // C4251
     qi::Signal<>                   connected;
@@ -3,7 +3,11 @@
 **  See COPYING for the license
 */
 
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/thread/tss.hpp>
 #include <qi/actor.hpp>
+#include <qi/async.hpp>
 #include "objecthost.hpp"
 
 #include "boundobject.hpp"
@@ -24,38 +28,125 @@ ObjectHost::ObjectHost(unsigned int service)
    // so does clear() while iterating
    ObjectMap map;
    std::swap(map, _objectMap);
+   {
+     boost::unique_lock<boost::shared_mutex> lock(_hostedObjectsMutex);
+     _hostedObjects.clear();
+   }
    map.clear();
  }
 
 BoundAnyObject ObjectHost::recursiveFindObject(uint32_t objectId)
 {
-  boost::recursive_mutex::scoped_lock lock(_mutex);
-  auto it = _objectMap.find(objectId);
-  auto e = end(_objectMap);
-  if (it != e)
-  {
-    return it->second;
-  }
-  // Object was not found, so search in the children.
-  auto b = begin(_objectMap);
-  while (b != e)
+  std::vector<std::pair<BoundAnyObject, ObjectHost*>> children;
   {
-    BoundObject* obj{b->second.get()};
+    boost::shared_lock<boost::shared_mutex> lock(_hostedObjectsMutex);
+    const auto it = _hostedObjects.find(objectId);
+    if (it != _hostedObjects.end())
+    {
+      if (auto obj = it->second.object.lock())
+        return obj;
+    }
     // Children are BoundObjects. Unfortunately, BoundObject has no common
     // ancestors with ObjectHost. Nevertheless, some children can indeed
-    // be ObjectHost. There is no way to get this information but to
-    // perform a dynamic cast. The overhead should be negligible, as
-    // this case is rare.
-    if (auto* host = dynamic_cast<ObjectHost*>(obj))
+    // be ObjectHost: they were found by a dynamic cast when the object
+    // was added.
+    for (const auto& child : _hostedObjects)
+    {
+      if (!child.second.host)
+        continue;
+      if (auto childObject = child.second.object.lock())
+        children.emplace_back(std::move(childObject), child.second.host);
+    }
+  }
+  // Object was not found, so search in the children, out of the lock: the
+  // last reference to a child may be released here, which removes it.
+  for (const auto& child : children)
+  {
+    if (auto obj = child.second->recursiveFindObject(objectId))
+    {
+      return obj;
+    }
+  }
+  return {};
+}
+
+namespace
+{
+  /// Releases references to bound objects from a task of the event loop, so
+  /// that the last one, which destroys the object, is not released by the
+  /// thread which received a message for it.
+  ///
+  /// Each thread has its own batch of references: a task is posted when the
+  /// first reference of a batch is handed over, and the references handed
+  /// over until it runs join the batch. The mutex of a batch is only shared
+  /// by its thread and its task.
+  class BoundObjectReaper
+  {
+    struct Batch
+    {
+      boost::mutex mutex;
+      std::vector<BoundAnyObject> objects;
+      bool reapScheduled = false;
+    };
+    using BatchPtr = boost::shared_ptr<Batch>;
+
+  public:
+    void release(BoundAnyObject obj)
     {
-      if (auto obj = host->recursiveFindObject(objectId))
+      if (!_batch.get())
+        _batch.reset(new BatchPtr(boost::make_shared<Batch>()));
+      const BatchPtr batch = *_batch;
       {
-        return obj;
+        boost::mutex::scoped_lock lock(batch->mutex);
+        batch->objects.push_back(std::move(obj));
+        if (batch->reapScheduled)
+          return;
+        batch->reapScheduled = true;
+      }
+      qi::Future<void> scheduled;
+      try
+      {
+        scheduled = qi::async([batch] { reap(*batch); });
+      }
+      catch (const std::exception& e)
+      {
+        // No event loop, at shutdown for instance: the references must not
+        // stay pending forever.
+        qiLogVerbose() << "Cannot schedule the release of bound objects, releasing them now: "
+                       << e.what();
+        reap(*batch);
+        return;
+      }
+      // The task can also be dropped, by an event loop stopping.
+      scheduled.connect([batch](const qi::Future<void>& f) {
+        if (f.hasError() || f.isCanceled())
+          reap(*batch);
+      });
+    }
+
+  private:
+    static void reap(Batch& batch)
+    {
+      std::vector<BoundAnyObject> objects;
+      {
+        boost::mutex::scoped_lock lock(batch.mutex);
+        std::swap(objects, batch.objects);
+        batch.reapScheduled = false;
       }
+      // The objects may be destroyed here, out of the lock.
     }
-    ++b;
+
+    // A scheduled task holds the batch alive after its thread exits.
+    boost::thread_specific_ptr<BatchPtr> _batch;
+  };
+
+  // Leaked on purpose, so that references can still be released during
+  // static destruction.
+  BoundObjectReaper& boundObjectReaper()
+  {
+    static BoundObjectReaper* const reaper = new BoundObjectReaper;
+    return *reaper;
   }
-  return {};
 }
 
 void ObjectHost::onMessage(const qi::Message &msg, MessageSocketPtr socket)
@@ -71,12 +162,10 @@ void ObjectHost::onMessage(const qi::Message &msg, MessageSocketPtr socket)
 
   // Because of potential dependencies between the object's destruction
   // and the networking resources, we transfer the object's destruction
-  // responsability to another thread.
-  Promise<void> destructPromise;
-  Future<void> destructFuture = destructPromise.future();
-  qi::async([obj, destructFuture] { destructFuture.wait(); });
-  obj = {};
-  destructPromise.setValue(nullptr);
+  // responsability to another thread, if this reference is the last one.
+  // Otherwise, releasing it here is cheaper.
+  if (obj.use_count() == 1)
+    boundObjectReaper().release(std::move(obj));
 }
 
 unsigned int ObjectHost::addObject(BoundAnyObject obj, StreamContext* remoteRef, unsigned int id)
@@ -86,6 +175,10 @@ unsigned int ObjectHost::addObject(BoundAnyObject obj, StreamContext* remoteRef,
     id = nextId();
   QI_ASSERT(_objectMap.find(id) == _objectMap.end());
   _objectMap[id] = obj;
+  {
+    boost::unique_lock<boost::shared_mutex> hostedLock(_hostedObjectsMutex);
+    _hostedObjects[id] = HostedObject{obj, dynamic_cast<ObjectHost*>(obj.get())};
+  }
   _remoteReferences[remoteRef].push_back(id);
   return id;
 }
@@ -144,6 +237,10 @@ Future<void> ObjectHost::removeObject(unsigned int id, Future<void> fut)
     }
     const auto obj = it->second;
     _objectMap.erase(it);
+    {
+      boost::unique_lock<boost::shared_mutex> hostedLock(_hostedObjectsMutex);
+      _hostedObjects.erase(id);
+    }
     qiLogDebug() << this << " count " << obj.use_count();
     // Because of potential dependencies between the object's destruction
     // and the networking resources, we transfer the object's destruction
@@ -169,6 +266,8 @@ void ObjectHost::clear()
       sbo->_owner.reset();
   }
   _objectMap.clear();
+  boost::unique_lock<boost::shared_mutex> hostedLock(_hostedObjectsMutex);
+  _hostedObjects.clear();
 }
 
 }
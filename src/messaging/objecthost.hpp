@@ -10,6 +10,7 @@
 #include <map>
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <qi/atomic.hpp>
@@ -47,10 +48,25 @@ namespace qi
     /// destination of the call (the "service") does not know directly the called object, but instead one of its
     /// (ObjectHost) children knows it.
     BoundAnyObject recursiveFindObject(uint32_t objectId);
+
+    struct HostedObject
+    {
+      boost::weak_ptr<BoundObject> object;
+      // The object, if it is also a host. Only valid while the object is locked.
+      ObjectHost* host;
+    };
+
     using RemoteReferencesMap = std::map<StreamContext*, std::vector<unsigned int>>;
     boost::recursive_mutex    _mutex;
     unsigned int    _service;
     ObjectMap       _objectMap;
+    // The objects of _objectMap, with the host found when they were added,
+    // read by incoming messages. It does not own the objects, so that their
+    // destruction is still deferred by removeObject.
+    // Modified with both _mutex and _hostedObjectsMutex locked, read with
+    // only the latter shared, so that messages are not serialized.
+    std::map<unsigned int, HostedObject> _hostedObjects;
+    boost::shared_mutex _hostedObjectsMutex;
     RemoteReferencesMap _remoteReferences;
   };
 }
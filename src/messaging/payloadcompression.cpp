@@ -0,0 +1,312 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <array>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/lexical_cast.hpp>
+#include <qi/getenv.hpp>
+#include <qi/log.hpp>
+
+#include "payloadcompression.hpp"
+
+qiLogCategory("qimessaging.payloadcompression");
+
+namespace qi
+{
+  namespace
+  {
+    // Accepts 1/0, true/false, yes/no and on/off, whatever their case. Other
+    // values are ignored with a warning.
+    bool getFlagFromEnv(const char* name, bool defaultValue)
+    {
+      const auto value = boost::algorithm::to_lower_copy(os::getEnvDefault(name, std::string{}));
+      if (value.empty())
+        return defaultValue;
+      if (value == "1" || value == "true" || value == "yes" || value == "on")
+        return true;
+      if (value == "0" || value == "false" || value == "no" || value == "off")
+        return false;
+      qiLogWarning() << "Ignoring " << name << "=" << value << ": expected 0 or 1.";
+      return defaultValue;
+    }
+
+    // Parameters of the LZ4 block format.
+    const std::size_t minMatch = 4;
+    // The last bytes of a block are always literals, and a match cannot start
+    // too close to the end.
+    const std::size_t lastLiterals = 5;
+    const std::size_t matchFindLimit = 12;
+    const std::size_t maxOffset = 65535;
+    // A length field of 15 in a token means more length bytes follow.
+    const std::size_t tokenLengthMask = 15;
+
+    const unsigned hashLog = 12;
+
+    qi::uint32_t read32(const unsigned char* p)
+    {
+      qi::uint32_t value;
+      std::memcpy(&value, p, sizeof(value));
+      return value;
+    }
+
+    qi::uint32_t hashSequence(qi::uint32_t sequence)
+    {
+      return (sequence * 2654435761u) >> (32 - hashLog);
+    }
+
+    unsigned char* writeLength(unsigned char* op, std::size_t length)
+    {
+      while (length >= 255)
+      {
+        *op++ = 255;
+        length -= 255;
+      }
+      *op++ = static_cast<unsigned char>(length);
+      return op;
+    }
+
+    unsigned char* writeLiterals(unsigned char* op, unsigned char* token,
+                                 const unsigned char* literals, std::size_t count)
+    {
+      if (count >= tokenLengthMask)
+      {
+        *token = static_cast<unsigned char>(tokenLengthMask << 4);
+        op = writeLength(op, count - tokenLengthMask);
+      }
+      else
+        *token = static_cast<unsigned char>(count << 4);
+      std::memcpy(op, literals, count);
+      return op + count;
+    }
+
+    unsigned char* writeSequence(unsigned char* op, const unsigned char* literals,
+                                 std::size_t literalCount, std::size_t offset,
+                                 std::size_t matchLength)
+    {
+      unsigned char* const token = op++;
+      op = writeLiterals(op, token, literals, literalCount);
+      *op++ = static_cast<unsigned char>(offset & 0xff);
+      *op++ = static_cast<unsigned char>(offset >> 8);
+      const auto extraLength = matchLength - minMatch;
+      if (extraLength >= tokenLengthMask)
+      {
+        *token |= tokenLengthMask;
+        op = writeLength(op, extraLength - tokenLengthMask);
+      }
+      else
+        *token |= static_cast<unsigned char>(extraLength);
+      return op;
+    }
+
+    // Adds the length bytes following a token to `length`.
+    bool readLength(const unsigned char*& ip, const unsigned char* end, std::size_t& length)
+    {
+      unsigned char byte;
+      do
+      {
+        if (ip == end)
+          return false;
+        byte = *ip++;
+        length += byte;
+      }
+      while (byte == 255);
+      return true;
+    }
+
+    // Inlines the sub-buffers, the same way they are sent (see
+    // sock::appendBuffers).
+    std::vector<unsigned char> flatten(const Buffer& buffer)
+    {
+      std::vector<unsigned char> flat;
+      flat.reserve(buffer.totalSize());
+      const auto data = static_cast<const unsigned char*>(buffer.data());
+      std::size_t beginOffset = 0;
+      for (const auto& sub : buffer.subBuffers())
+      {
+        const auto endOffset = sub.first + sizeof(Buffer::size_type);
+        flat.insert(flat.end(), data + beginOffset, data + endOffset);
+        const auto subData = static_cast<const unsigned char*>(sub.second.data());
+        flat.insert(flat.end(), subData, subData + sub.second.size());
+        beginOffset = endOffset;
+      }
+      flat.insert(flat.end(), data + beginOffset, data + buffer.size());
+      return flat;
+    }
+  } // namespace
+
+  namespace detail
+  {
+    std::size_t lz4CompressBound(std::size_t size)
+    {
+      return size + size / 255 + 16;
+    }
+
+    std::size_t lz4Compress(const unsigned char* src, std::size_t size, unsigned char* dst)
+    {
+      unsigned char* op = dst;
+      std::size_t anchor = 0;
+      if (size > matchFindLimit)
+      {
+        // Positions of the last sequences of 4 bytes seen, by hash.
+        std::array<qi::uint32_t, 1u << hashLog> table;
+        table.fill(0);
+
+        const std::size_t matchLimit = size - lastLiterals;
+        const std::size_t lastMatchStart = size - matchFindLimit;
+        std::size_t ip = 0;
+        while (ip <= lastMatchStart)
+        {
+          const auto sequence = read32(src + ip);
+          auto& entry = table[hashSequence(sequence)];
+          const std::size_t ref = entry;
+          entry = static_cast<qi::uint32_t>(ip);
+          if (ref >= ip || ip - ref > maxOffset || read32(src + ref) != sequence)
+          {
+            // Move faster and faster through data that does not compress.
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+          }
+          std::size_t matchLength = minMatch;
+          while (ip + matchLength < matchLimit && src[ref + matchLength] == src[ip + matchLength])
+            ++matchLength;
+          op = writeSequence(op, src + anchor, ip - anchor, ip - ref, matchLength);
+          ip += matchLength;
+          anchor = ip;
+        }
+      }
+      // The last sequence only has literals.
+      unsigned char* const token = op++;
+      op = writeLiterals(op, token, src + anchor, size - anchor);
+      return static_cast<std::size_t>(op - dst);
+    }
+
+    bool lz4Decompress(const unsigned char* src, std::size_t size,
+                       unsigned char* dst, std::size_t dstSize)
+    {
+      const unsigned char* ip = src;
+      const unsigned char* const iend = src + size;
+      unsigned char* op = dst;
+      unsigned char* const oend = dst + dstSize;
+      while (ip != iend)
+      {
+        const unsigned char token = *ip++;
+
+        std::size_t literalCount = token >> 4;
+        if (literalCount == tokenLengthMask && !readLength(ip, iend, literalCount))
+          return false;
+        if (literalCount > static_cast<std::size_t>(iend - ip)
+            || literalCount > static_cast<std::size_t>(oend - op))
+          return false;
+        std::memcpy(op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+        if (ip == iend)
+          break;
+
+        if (iend - ip < 2)
+          return false;
+        const std::size_t offset = ip[0] | (static_cast<std::size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<std::size_t>(op - dst))
+          return false;
+
+        std::size_t matchLength = token & tokenLengthMask;
+        if (matchLength == tokenLengthMask && !readLength(ip, iend, matchLength))
+          return false;
+        matchLength += minMatch;
+        if (matchLength > static_cast<std::size_t>(oend - op))
+          return false;
+        const unsigned char* match = op - offset;
+        if (offset >= matchLength)
+        {
+          std::memcpy(op, match, matchLength);
+          op += matchLength;
+        }
+        else
+        {
+          // The match overlaps the bytes being written: it repeats a pattern.
+          for (std::size_t i = 0; i != matchLength; ++i)
+            *op++ = *match++;
+        }
+      }
+      return op == oend;
+    }
+  } // namespace detail
+
+  std::size_t getPayloadCompressionThresholdFromEnv(std::size_t defaultValue)
+  {
+    const auto threshold = os::getenv("QI_MESSAGE_COMPRESSION_THRESHOLD");
+    return threshold.empty() ? defaultValue : boost::lexical_cast<std::size_t>(threshold);
+  }
+
+  bool getPayloadCompressionFromEnv(bool defaultValue)
+  {
+    return getFlagFromEnv("QI_MESSAGE_COMPRESSION", defaultValue);
+  }
+
+  bool getPayloadCompressionToLocalPeersFromEnv(bool defaultValue)
+  {
+    return getFlagFromEnv("QI_MESSAGE_COMPRESSION_LOCAL", defaultValue);
+  }
+
+  boost::optional<Message> compressPayload(const Message& msg)
+  {
+    const Buffer& payload = msg.buffer();
+    std::vector<unsigned char> flat;
+    auto data = static_cast<const unsigned char*>(payload.data());
+    std::size_t size = payload.size();
+    if (!payload.subBuffers().empty())
+    {
+      flat = flatten(payload);
+      data = flat.data();
+      size = flat.size();
+    }
+    if (size > std::numeric_limits<qi::uint32_t>::max())
+      return {};
+
+    const qi::uint32_t originalSize = static_cast<qi::uint32_t>(size);
+    const auto maxCompressedSize = sizeof(originalSize) + detail::lz4CompressBound(size);
+    std::unique_ptr<unsigned char[]> compressed(new unsigned char[maxCompressedSize]);
+    std::memcpy(compressed.get(), &originalSize, sizeof(originalSize));
+    const auto compressedSize = sizeof(originalSize)
+        + detail::lz4Compress(data, size, compressed.get() + sizeof(originalSize));
+    if (compressedSize >= size)
+      return {};
+
+    Buffer buffer;
+    buffer.write(compressed.get(), compressedSize);
+    Message result(msg);
+    result.setBuffer(std::move(buffer));
+    result.addFlags(Message::TypeFlag_Compressed);
+    return result;
+  }
+
+  boost::optional<Message> decompressPayload(const Message& msg, std::size_t maxPayloadSize)
+  {
+    const Buffer& payload = msg.buffer();
+    qi::uint32_t originalSize = 0;
+    if (payload.size() < sizeof(originalSize))
+      return {};
+    const auto data = static_cast<const unsigned char*>(payload.data());
+    std::memcpy(&originalSize, data, sizeof(originalSize));
+    if (originalSize > maxPayloadSize)
+      return {};
+
+    Buffer buffer;
+    auto decompressed = static_cast<unsigned char*>(buffer.reserve(originalSize));
+    if (!detail::lz4Decompress(data + sizeof(originalSize), payload.size() - sizeof(originalSize),
+                               decompressed, originalSize))
+      return {};
+
+    Message result(msg);
+    result.setBuffer(std::move(buffer));
+    result.setFlags(static_cast<qi::uint8_t>(msg.flags() & ~Message::TypeFlag_Compressed));
+    return result;
+  }
+}
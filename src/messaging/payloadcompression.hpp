@@ -0,0 +1,99 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_PAYLOADCOMPRESSION_HPP_
+#define _SRC_MESSAGING_PAYLOADCOMPRESSION_HPP_
+
+#include <cstddef>
+#include <boost/optional.hpp>
+#include <qi/clock.hpp>
+#include <qi/types.hpp>
+#include "message.hpp"
+
+/// @file
+/// Compression of message payloads.
+///
+/// A compressed payload starts with the size of the original payload (32 bits,
+/// host order as the rest of the protocol), followed by the original payload
+/// compressed as a single LZ4 block. Compressed messages are flagged with
+/// Message::TypeFlag_Compressed, and are only sent to peers advertising the
+/// capability `capabilityname::payloadCompression`. Every socket decompresses
+/// the payloads it receives, but only the sockets of processes that enable it
+/// (see getPayloadCompressionFromEnv) compress the payloads they send.
+
+namespace qi
+{
+  /// Statistics on the payloads compressed and decompressed by a socket.
+  struct PayloadCompressionStats
+  {
+    /// Number of sent messages whose payload was compressed.
+    qi::uint64_t compressedMessageCount = 0;
+    /// Size of the payloads of these messages, before compression.
+    qi::uint64_t uncompressedByteCount = 0;
+    /// Size of the payloads of these messages, after compression.
+    qi::uint64_t compressedByteCount = 0;
+    /// Number of received messages whose payload was decompressed.
+    qi::uint64_t decompressedMessageCount = 0;
+    /// Time spent compressing, including the attempts that did not shrink the
+    /// payload.
+    NanoSeconds compressionTime{0};
+    /// Time spent decompressing.
+    NanoSeconds decompressionTime{0};
+
+    qi::uint64_t savedByteCount() const
+    {
+      return uncompressedByteCount - compressedByteCount;
+    }
+  };
+
+  /// Payloads smaller than this size are sent uncompressed.
+  /// Returns the value of QI_MESSAGE_COMPRESSION_THRESHOLD if set.
+  std::size_t getPayloadCompressionThresholdFromEnv(std::size_t defaultValue = 1024);
+
+  /// Whether payloads are compressed at all. Compression trades CPU time for
+  /// bandwidth, which only pays on slow links: it is disabled by default.
+  /// Returns the value of QI_MESSAGE_COMPRESSION (0 or 1) if set.
+  bool getPayloadCompressionFromEnv(bool defaultValue = false);
+
+  /// Whether payloads sent to peers of the same host are compressed. Local
+  /// transports are not limited by bandwidth, so compression only costs time.
+  /// Returns the value of QI_MESSAGE_COMPRESSION_LOCAL (0 or 1) if set.
+  bool getPayloadCompressionToLocalPeersFromEnv(bool defaultValue = false);
+
+  /// Returns a copy of the message with its payload compressed and the flag
+  /// Message::TypeFlag_Compressed set.
+  /// Returns an empty optional if compression does not make the payload
+  /// smaller.
+  /// Sub-buffers are inlined in the compressed payload, as they are on the
+  /// wire.
+  boost::optional<Message> compressPayload(const Message& msg);
+
+  /// Returns a copy of the message with its payload decompressed and the flag
+  /// Message::TypeFlag_Compressed cleared.
+  /// Returns an empty optional if the payload is ill-formed or if it
+  /// decompresses to more than `maxPayloadSize` bytes.
+  /// Precondition: msg.flags() & Message::TypeFlag_Compressed
+  boost::optional<Message> decompressPayload(const Message& msg, std::size_t maxPayloadSize);
+
+  namespace detail
+  {
+    /// Maximum size of the compressed form of `size` bytes.
+    std::size_t lz4CompressBound(std::size_t size);
+
+    /// Compresses `size` bytes from `src` as an LZ4 block into `dst`, which
+    /// must be at least `lz4CompressBound(size)` bytes long.
+    /// Returns the size of the block.
+    std::size_t lz4Compress(const unsigned char* src, std::size_t size, unsigned char* dst);
+
+    /// Decompresses the LZ4 block of `size` bytes from `src` into `dst`.
+    /// Returns false if the block is ill-formed or if it does not decompress
+    /// to exactly `dstSize` bytes. Never reads or writes out of bounds.
+    bool lz4Decompress(const unsigned char* src, std::size_t size,
+                       unsigned char* dst, std::size_t dstSize);
+  }
+}
+
+#endif  // _SRC_MESSAGING_PAYLOADCOMPRESSION_HPP_
@@ -10,9 +10,12 @@
 #endif
 
 #include "remoteobject_p.hpp"
+#include "calldeadline_p.hpp"
 #include "message.hpp"
 #include "messagesocket.hpp"
+#include <qi/async.hpp>
 #include <qi/log.hpp>
+#include <qi/messaging/calldeadline.hpp>
 #include <boost/thread/mutex.hpp>
 #include <qi/eventloop.hpp>
 
@@ -169,9 +172,9 @@ namespace qi {
           // Remove top-level tuple
           //sig = sig.substr(1, sig.length()-2);
           //TODO: Optimise
-          AnyReference value = msg.value((msg.flags()&Message::TypeFlag_DynamicPayload)? "m":sig, sock);
-
-          {
+          const qi::Signature valueSig =
+              (msg.flags() & Message::TypeFlag_DynamicPayload) ? qi::Signature("m") : sig;
+          auto triggerWith = [&](AnyReference value) {
             GenericFunctionParameters args;
             if (sig == "m")
               args = value.content().asTupleValuePtr();
@@ -179,8 +182,22 @@ namespace qi {
               args = value.asTupleValuePtr();
             qiLogDebug() << "Triggering local event listeners with args : " << args.size();
             sb->trigger(args);
+          };
+
+          if (msg.flags() & Message::TypeFlag_EventBatch)
+          {
+            // One emission per element, see ServiceBoundObject.
+            AnyReference batch = msg.value(qi::Signature("[" + valueSig.toString() + "]"), sock);
+            for (AnyReference value : batch.asListValuePtr())
+              triggerWith(value);
+            batch.destroy();
+          }
+          else
+          {
+            AnyReference value = msg.value(valueSig, sock);
+            triggerWith(value);
+            value.destroy();
           }
-          value.destroy();
         }
         catch (const std::exception& e)
         {
@@ -206,18 +223,17 @@ namespace qi {
     }
 
     qi::Promise<AnyReference> promise;
+    if (auto pending = _promises.take(msg.id()))
     {
-      auto syncPromises = _promises.synchronize();
-      auto it = syncPromises->find(msg.id());
-      if (it != syncPromises->end()) {
-        promise = (*syncPromises)[msg.id()];
-        syncPromises->erase(it);
-        qiLogDebug() << "Handling promise id:" << msg.id();
-      } else  {
-        qiLogError() << "no promise found for req id:" << msg.id()
-                     << "  obj: " << msg.service() << "  func: " << msg.function() << " type: " << Message::typeToString(msg.type());
-        return;
-      }
+      promise = *pending;
+      qiLogDebug() << "Handling promise id:" << msg.id();
+    }
+    else
+    {
+      // Replies to calls which failed at their deadline still come.
+      qiLogVerbose() << "no promise found for req id:" << msg.id()
+                   << "  obj: " << msg.service() << "  func: " << msg.function() << " type: " << Message::typeToString(msg.type());
+      return;
     }
 
     switch (msg.type()) {
@@ -299,6 +315,15 @@ namespace qi {
       }
     }
 
+    const boost::optional<SteadyClockTimePoint> deadline = currentCallDeadline();
+    if (deadline)
+      ++calldeadline::counters().callCount;
+    if (deadline && SteadyClock::now() >= *deadline)
+    {
+      ++calldeadline::counters().exceededCount;
+      return makeFutureError<AnyReference>(calldeadline::exceededError);
+    }
+
     qi::Promise<AnyReference> out;
     qi::Message msg;
     MessageSocketPtr sock;
@@ -312,14 +337,12 @@ namespace qi {
       {
         return makeFutureError<AnyReference>("Socket is not connected");
       }
-      auto syncPromises = _promises.synchronize();
-      if (syncPromises->find(msg.id()) != syncPromises->end())
+      qiLogDebug() << "Adding promise id:" << msg.id();
+      if (!_promises.assign(msg.id(), out))
       {
         qiLogError() << "There is already a pending promise with id "
                                    << msg.id();
       }
-      qiLogDebug() << "Adding promise id:" << msg.id();
-      (*syncPromises)[msg.id()] = out;
     }
     qi::Signature funcSig = mm->parametersSignature();
     try {
@@ -339,6 +362,11 @@ namespace qi {
       msg.addFlags(Message::TypeFlag_ReturnType);
       msg.setValue(returnSignature.toString(), Signature("s"));
     }
+    if (deadline && sock->remoteCapability(capabilityname::callDeadline, false))
+    {
+      msg.addFlags(Message::TypeFlag_Deadline);
+      msg.setValue(AnyReference::from(calldeadline::remainingMilliseconds(*deadline)), Signature("I"));
+    }
     msg.setType(qi::Message::Type_Call);
     msg.setService(_service);
     msg.setObject(_object);
@@ -363,13 +391,41 @@ namespace qi {
       }
       out.setError(ss.str());
       qiLogDebug() << "Removing promise id:" << msg.id();
-      _promises->erase(msg.id());
+      _promises.take(msg.id());
     }
     else
+    {
       out.setOnCancel(qi::bind(&RemoteObject::onFutureCancelled, this, msg.id()));
+      if (deadline)
+      {
+        const unsigned int id = msg.id();
+        auto timer = qi::asyncAt(track([=] { onCallDeadline(id); }, this), *deadline);
+        out.future().connect([timer](const Future<AnyReference>&) mutable { timer.cancel(); });
+      }
+    }
     return out.future();
   }
 
+  void RemoteObject::onCallDeadline(unsigned int originalMessageId)
+  {
+    auto pending = _promises.take(originalMessageId);
+    if (!pending) // the reply came first
+      return;
+    qiLogVerbose() << "Call " << originalMessageId << " on service " << _service << " exceeded its deadline";
+    ++calldeadline::counters().exceededCount;
+
+    MessageSocketPtr sock = *_socket;
+    if (sock)
+    {
+      sock->forgetSentMessage(originalMessageId);
+      // Remote ends knowing the deadline cancel the call by themselves.
+      if (!sock->sharedCapability<bool>(capabilityname::callDeadline, false)
+          && sock->sharedCapability<bool>(capabilityname::remoteCancelableCalls, false))
+        onFutureCancelled(originalMessageId);
+    }
+    pending->setError(calldeadline::exceededError);
+  }
+
   void RemoteObject::onFutureCancelled(unsigned int originalMessageId)
   {
     qiLogDebug() << "Cancel request for message " << originalMessageId;
@@ -573,14 +629,8 @@ namespace qi {
         if (!fromSignal)
           socket->disconnected.disconnectAsync(_linkDisconnected);
     }
-    std::map<int, qi::Promise<AnyReference> > promises;
-    {
-      auto syncPromises = _promises.synchronize();
-      promises = *syncPromises;
-      syncPromises->clear();
-    }
     // Nobody should be able to add anything to promises at this point.
-    for (auto& pair: promises)
+    for (auto& pair: _promises.takeAll())
     {
       qiLogVerbose() << "Reporting error for request " << pair.first << "(" << reason << ")";
       pair.second.setError(reason);
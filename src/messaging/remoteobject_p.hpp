@@ -13,6 +13,7 @@
 #include <qi/signal.hpp>
 
 #include "messagedispatcher.hpp"
+#include "inflightcalltable.hpp"
 #include "objecthost.hpp"
 
 #include <boost/thread/mutex.hpp>
@@ -62,6 +63,8 @@ namespace qi {
     virtual void metaPost(AnyObject context, unsigned int event, const GenericFunctionParameters& args);
     virtual qi::Future<AnyReference> metaCall(AnyObject context, unsigned int method, const GenericFunctionParameters& args, qi::MetaCallType callType, Signature returnSignature);
     void onFutureCancelled(unsigned int originalMessageId);
+    // Fails the call if it is still pending.
+    void onCallDeadline(unsigned int originalMessageId);
 
     //metaObject received
     void onMetaObject(qi::Future<qi::MetaObject> fut, qi::Promise<void> prom);
@@ -78,7 +81,7 @@ namespace qi {
     boost::synchronized_value<MessageSocketPtr>   _socket;
     unsigned int                                    _service;
     unsigned int                                    _object;
-    boost::synchronized_value<std::map<int, qi::Promise<AnyReference>>> _promises;
+    InflightCallTable<qi::Promise<AnyReference>>    _promises;
     qi::SignalLink                                  _linkMessageDispatcher;
     qi::SignalLink                                  _linkDisconnected;
     qi::AnyObject                                   _self;
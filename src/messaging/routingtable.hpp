@@ -0,0 +1,73 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_ROUTINGTABLE_HPP_
+#define _SRC_MESSAGING_ROUTINGTABLE_HPP_
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <qi/assert.hpp>
+
+namespace qi
+{
+  /// Flat table of entries indexed by an id (a service, an object or a
+  /// function), read on each incoming message without locking.
+  ///
+  /// The table is never modified once published. Writers keep their own
+  /// registry and mutex, and publish a new table after each change of the
+  /// registry. Readers get the current table with `entries()`, which holds it
+  /// alive, and search it with `find()`.
+  template <typename T>
+  class RoutingTable
+  {
+  public:
+    using Entry = std::pair<unsigned int, T>;
+    using Entries = std::vector<Entry>;
+    using EntriesPtr = std::shared_ptr<const Entries>;
+
+    RoutingTable()
+      : _entries(std::make_shared<const Entries>())
+    {
+    }
+
+    RoutingTable(const RoutingTable&) = delete;
+    RoutingTable& operator=(const RoutingTable&) = delete;
+
+    EntriesPtr entries() const
+    {
+      return std::atomic_load(&_entries);
+    }
+
+    /// Entries must be sorted by id, e.g. built from a std::map.
+    void publish(Entries entries)
+    {
+      QI_ASSERT(std::is_sorted(entries.begin(), entries.end(), lessId));
+      std::atomic_store(&_entries, EntriesPtr(std::make_shared<const Entries>(std::move(entries))));
+    }
+
+    /// Returns null if there is no entry for the id.
+    static const T* find(const Entries& entries, unsigned int id)
+    {
+      const auto it = std::lower_bound(entries.begin(), entries.end(), id,
+                                       [](const Entry& entry, unsigned int id) { return entry.first < id; });
+      if (it == entries.end() || it->first != id)
+        return nullptr;
+      return &it->second;
+    }
+
+  private:
+    static bool lessId(const Entry& a, const Entry& b)
+    {
+      return a.first < b.first;
+    }
+
+    EntriesPtr _entries;
+  };
+}
+
+#endif  // _SRC_MESSAGING_ROUTINGTABLE_HPP_
@@ -55,6 +55,7 @@ namespace qi {
         return false;
       }
       _boundObjects[id] = obj;
+      publishRoutingTable();
       return true;
     }
   }
@@ -72,11 +73,21 @@ namespace qi {
       }
       removedObject = it->second;
       _boundObjects.erase(idx);
+      publishRoutingTable();
     }
     removedObject.reset();
     return true;
   }
 
+  void Server::publishRoutingTable()
+  {
+    BoundObjectTable::Entries entries;
+    entries.reserve(_boundObjects.size());
+    for (const auto& boundObject : _boundObjects)
+      entries.emplace_back(boundObject.first, boundObject.second);
+    _routingTable.publish(std::move(entries));
+  }
+
   void Server::setAuthProviderFactory(AuthProviderFactoryPtr factory)
   {
     _authProviderFactory = factory;
@@ -299,11 +310,10 @@ namespace qi {
   void Server::onMessageReady(const qi::Message &msg, MessageSocketPtr socket) {
     qi::BoundAnyObject obj;
     {
-      boost::mutex::scoped_lock sl(_boundObjectsMutex);
-      BoundAnyObjectMap::iterator it;
-
-      it = _boundObjects.find(msg.service());
-      if (it == _boundObjects.end())
+      const auto entries = _routingTable.entries();
+      if (const auto boundObject = BoundObjectTable::find(*entries, msg.service()))
+        obj = boundObject->lock();
+      if (!obj)
       {
         // The message could be addressed to a bound object, inside a
         // remoteobject host, or to a remoteobject, using the same socket.
@@ -323,7 +333,6 @@ namespace qi {
         qiLogError() << "Can't find service: " << msg.service() << " on " << msg.address();
         return;
       }
-      obj            = it->second;
     }
     // We were called from the thread pool: synchronous call is ok
     //qi::getEventLoop()->post(boost::bind<void>(&BoundObject::onMessage, obj, msg, socket));
@@ -11,6 +11,7 @@
 #include <boost/noncopyable.hpp>
 #include "boundobject.hpp"
 #include "authprovider_p.hpp"
+#include "routingtable.hpp"
 
 namespace qi {
 
@@ -46,6 +47,8 @@ namespace qi {
 
   private:
     void setSocketObjectEndpoints();
+    // Must be called with _boundObjectsMutex locked.
+    void publishRoutingTable();
 
   private:
 
@@ -70,10 +73,14 @@ namespace qi {
   private:
     //bool: true if it's a socketobject
     using BoundAnyObjectMap = std::map<unsigned int, BoundAnyObject>;
+    using BoundObjectTable = RoutingTable<boost::weak_ptr<BoundObject>>;
 
     //ObjectList
     BoundAnyObjectMap                   _boundObjects;
     boost::mutex                        _boundObjectsMutex;
+    // Copy of _boundObjects read by incoming messages. It does not own the
+    // objects, so that they are still released by removeObject.
+    BoundObjectTable                    _routingTable;
 
     boost::mutex                        _stateMutex;
     AuthProviderFactoryPtr              _authProviderFactory;
@@ -0,0 +1,336 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <qi/log.hpp>
+#include <qi/os.hpp>
+
+#include "src/buffer_p.hpp"
+#include "sharedbuffers.hpp"
+
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+qiLogCategory("qimessaging.sharedbuffers");
+
+namespace qi
+{
+  namespace
+  {
+    using SizeField = Buffer::size_type;
+
+    // Only segments with this prefix are mapped (and unlinked) by receivers,
+    // so that a peer cannot make them remove other segments.
+    const char* const segmentNamePrefix = "/qi-buffer-";
+    const std::size_t maxSegmentNameLength = 255;
+
+    struct SegmentEntry
+    {
+      SizeField offset;
+      SizeField size;
+      std::string name;
+    };
+
+    void writeSizeField(Buffer& buffer, std::size_t value)
+    {
+      const SizeField field = static_cast<SizeField>(value);
+      buffer.write(&field, sizeof(field));
+    }
+
+    bool readSizeField(const unsigned char*& p, const unsigned char* end, SizeField& value)
+    {
+      if (static_cast<std::size_t>(end - p) < sizeof(value))
+        return false;
+      std::memcpy(&value, p, sizeof(value));
+      p += sizeof(value);
+      return true;
+    }
+
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+    std::string newSegmentName()
+    {
+      static std::atomic<qi::uint64_t> counter{0};
+      return segmentNamePrefix + boost::lexical_cast<std::string>(os::getpid()) + "-"
+          + boost::lexical_cast<std::string>(counter.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    // Copies the data of the buffer into a new segment.
+    // Returns the name of the segment, or an empty optional if it could not
+    // be created.
+    boost::optional<std::string> createSegment(const Buffer& buffer)
+    {
+      const auto name = newSegmentName();
+      // Only the user of this process can open the segment: peers are
+      // required to run as the same user (see getSharedBufferUserId).
+      const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+      if (fd < 0)
+      {
+        qiLogVerbose() << "Cannot create shared memory segment " << name << ": "
+                       << std::strerror(errno);
+        return {};
+      }
+      void* address = MAP_FAILED;
+      if (::ftruncate(fd, static_cast<off_t>(buffer.size())) == 0)
+        address = ::mmap(nullptr, buffer.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (address == MAP_FAILED)
+      {
+        qiLogVerbose() << "Cannot map shared memory segment " << name << ": "
+                       << std::strerror(errno);
+        ::shm_unlink(name.c_str());
+        return {};
+      }
+      std::memcpy(address, buffer.data(), buffer.size());
+      ::munmap(address, buffer.size());
+      return name;
+    }
+
+    // Maps `size` bytes of the segment as a read-only buffer, and unlinks the
+    // segment.
+    boost::optional<Buffer> mapSegment(const std::string& name, std::size_t size)
+    {
+      const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+      if (fd < 0)
+      {
+        qiLogWarning() << "Cannot open shared memory segment " << name << ": "
+                       << std::strerror(errno);
+        return {};
+      }
+      ::shm_unlink(name.c_str());
+      struct ::stat status;
+      void* address = MAP_FAILED;
+      if (::fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) >= size)
+        address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (address == MAP_FAILED)
+      {
+        qiLogWarning() << "Cannot map shared memory segment " << name;
+        return {};
+      }
+      const boost::shared_ptr<const void> mapping(address, [size](const void* p) {
+        ::munmap(const_cast<void*>(p), size);
+      });
+      return BufferPrivate::makeView(mapping, size);
+    }
+#else
+    boost::optional<std::string> createSegment(const Buffer&)
+    {
+      return {};
+    }
+
+    boost::optional<Buffer> mapSegment(const std::string& name, std::size_t)
+    {
+      qiLogWarning() << "Cannot open shared memory segment " << name
+                     << ": shared memory buffers are not supported on this platform";
+      return {};
+    }
+#endif
+
+    // Parses the table of segments at the end of the payload, whose size
+    // (table excluded) is set in `payloadSize`.
+    boost::optional<std::vector<SegmentEntry>> readSegmentTable(const Buffer& payload,
+                                                                std::size_t& payloadSize)
+    {
+      const auto begin = static_cast<const unsigned char*>(payload.data());
+      const auto end = begin + payload.size();
+      if (payload.size() < 2 * sizeof(SizeField))
+        return {};
+      SizeField count = 0;
+      SizeField tableSize = 0;
+      const unsigned char* p = end - 2 * sizeof(SizeField);
+      readSizeField(p, end, count);
+      readSizeField(p, end, tableSize);
+      if (tableSize < 2 * sizeof(SizeField) || tableSize > payload.size())
+        return {};
+
+      payloadSize = payload.size() - tableSize;
+      p = begin + payloadSize;
+      const auto entriesEnd = end - 2 * sizeof(SizeField);
+      std::vector<SegmentEntry> entries;
+      std::size_t minOffset = 0;
+      for (SizeField i = 0; i != count; ++i)
+      {
+        SegmentEntry entry;
+        SizeField nameLength = 0;
+        if (!readSizeField(p, entriesEnd, entry.offset)
+            || !readSizeField(p, entriesEnd, entry.size)
+            || !readSizeField(p, entriesEnd, nameLength)
+            || nameLength > maxSegmentNameLength
+            || nameLength > static_cast<std::size_t>(entriesEnd - p))
+          return {};
+        entry.name.assign(reinterpret_cast<const char*>(p), nameLength);
+        p += nameLength;
+
+        // The size field of the sub-buffer must be in the payload, after the
+        // previous one, and match the size of the segment.
+        if (entry.offset < minOffset || entry.offset + sizeof(SizeField) > payloadSize
+            || !boost::algorithm::starts_with(entry.name, segmentNamePrefix))
+          return {};
+        SizeField sizeField = 0;
+        const unsigned char* sizeFieldBegin = begin + entry.offset;
+        readSizeField(sizeFieldBegin, end, sizeField);
+        if (sizeField != entry.size)
+          return {};
+        minOffset = entry.offset + sizeof(SizeField);
+        entries.push_back(std::move(entry));
+      }
+      if (p != entriesEnd)
+        return {};
+      return entries;
+    }
+  } // namespace
+
+  qi::int64_t getSharedBufferUserId()
+  {
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+    return static_cast<qi::int64_t>(::geteuid());
+#else
+    return -1;
+#endif
+  }
+
+  std::size_t getSharedBufferThresholdFromEnv(std::size_t defaultValue)
+  {
+    const auto threshold = os::getenv("QI_SHARED_MEMORY_BUFFER_THRESHOLD");
+    return threshold.empty() ? defaultValue : boost::lexical_cast<std::size_t>(threshold);
+  }
+
+  boost::optional<Message> shareBuffers(const Message& msg, std::size_t threshold,
+                                        std::vector<std::string>& segmentNames)
+  {
+    const Buffer& payload = msg.buffer();
+    const auto& subBuffers = payload.subBuffers();
+    const auto isBig = [&](const std::pair<std::size_t, Buffer>& sub) {
+      return sub.second.size() >= threshold;
+    };
+    if (std::none_of(subBuffers.begin(), subBuffers.end(), isBig))
+      return {};
+
+    const auto data = static_cast<const unsigned char*>(payload.data());
+    Buffer result;
+    std::vector<SegmentEntry> entries;
+    // Offset in the payload as it is sent, that is with the remaining
+    // sub-buffers inlined (see sock::appendBuffers).
+    std::size_t sentOffset = 0;
+    std::size_t beginOffset = 0;
+    for (const auto& sub : subBuffers)
+    {
+      result.write(data + beginOffset, sub.first - beginOffset);
+      sentOffset += sub.first - beginOffset;
+      boost::optional<std::string> name;
+      if (isBig(sub))
+        name = createSegment(sub.second);
+      if (name)
+      {
+        writeSizeField(result, sub.second.size());
+        entries.push_back(SegmentEntry{static_cast<SizeField>(sentOffset),
+                                       static_cast<SizeField>(sub.second.size()), *name});
+        segmentNames.push_back(*name);
+        sentOffset += sizeof(SizeField);
+      }
+      else
+      {
+        result.addSubBuffer(sub.second);
+        sentOffset += sizeof(SizeField) + sub.second.size();
+      }
+      beginOffset = sub.first + sizeof(SizeField);
+    }
+    result.write(data + beginOffset, payload.size() - beginOffset);
+    if (entries.empty())
+      return {};
+
+    const auto tableBegin = result.size();
+    for (const auto& entry : entries)
+    {
+      writeSizeField(result, entry.offset);
+      writeSizeField(result, entry.size);
+      writeSizeField(result, entry.name.size());
+      result.write(entry.name.data(), entry.name.size());
+    }
+    writeSizeField(result, entries.size());
+    writeSizeField(result, result.size() + sizeof(SizeField) - tableBegin);
+
+    Message shared(msg);
+    shared.setBuffer(std::move(result));
+    shared.addFlags(Message::TypeFlag_SharedBuffers);
+    return shared;
+  }
+
+  boost::optional<Message> mapSharedBuffers(const Message& msg, std::size_t maxPayloadSize)
+  {
+    const Buffer& payload = msg.buffer();
+    std::size_t payloadSize = 0;
+    const auto entries = readSegmentTable(payload, payloadSize);
+    if (!entries)
+      return {};
+
+    std::size_t totalSize = payloadSize;
+    for (const auto& entry : *entries)
+    {
+      totalSize += entry.size;
+      if (totalSize > maxPayloadSize)
+        return {};
+    }
+
+    const auto data = static_cast<const unsigned char*>(payload.data());
+    Buffer result;
+    std::size_t beginOffset = 0;
+    for (auto entry = entries->begin(); entry != entries->end(); ++entry)
+    {
+      result.write(data + beginOffset, entry->offset - beginOffset);
+      const auto segment = mapSegment(entry->name, entry->size);
+      if (!segment)
+      {
+        // The next segments will never be mapped.
+        std::for_each(std::next(entry), entries->end(), [](const SegmentEntry& next) {
+          removeSharedBufferSegment(next.name);
+        });
+        return {};
+      }
+      result.addSubBuffer(*segment);
+      beginOffset = entry->offset + sizeof(SizeField);
+    }
+    result.write(data + beginOffset, payloadSize - beginOffset);
+
+    Message mapped(msg);
+    mapped.setBuffer(std::move(result));
+    mapped.setFlags(static_cast<qi::uint8_t>(msg.flags() & ~Message::TypeFlag_SharedBuffers));
+    return mapped;
+  }
+
+  void removeSharedBufferSegment(const std::string& name)
+  {
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+    ::shm_unlink(name.c_str());
+#else
+    (void)name;
+#endif
+  }
+
+  bool sharedBufferSegmentExists(const std::string& name)
+  {
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd >= 0)
+    {
+      ::close(fd);
+      return true;
+    }
+    return errno != ENOENT;
+#else
+    (void)name;
+    return false;
+#endif
+  }
+}
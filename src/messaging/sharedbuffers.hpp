@@ -0,0 +1,81 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_MESSAGING_SHAREDBUFFERS_HPP_
+#define _SRC_MESSAGING_SHAREDBUFFERS_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/optional.hpp>
+#include <qi/types.hpp>
+#include "message.hpp"
+
+/// @file
+/// Transfer of big sub-buffers through shared memory, between processes of
+/// the same host.
+///
+/// The sub-buffers of at least a threshold size are copied into POSIX shared
+/// memory segments instead of being sent inline. Their size fields stay in the
+/// payload, but their bytes do not. A table of the segments is appended to the
+/// payload: for each segment, its offset in the payload (the one of the size
+/// field), its size and its name (32 bits each, then the name bytes, host
+/// order as the rest of the protocol). It is followed by the number of
+/// segments and by the size of the table.
+///
+/// The receiver maps the segments and makes them the sub-buffers of the
+/// payload, without copying them. It unlinks the segments as soon as they are
+/// mapped, so they are freed with the last buffer reading them.
+///
+/// Such messages are flagged with Message::TypeFlag_SharedBuffers, and are only
+/// sent to peers of the same host advertising the capability
+/// `capabilityname::sharedMemoryBuffers`. The segments can only be opened by
+/// the user that created them, so the peer must also advertise the same user in
+/// `capabilityname::sharedMemoryBuffersUser`. Other peers get the sub-buffers
+/// inline.
+
+#if !defined(_WIN32) && !defined(ANDROID)
+# define QI_HAS_SHARED_MEMORY_BUFFERS 1
+#endif
+
+namespace qi
+{
+  /// Effective user id of this process, that owns the segments it creates.
+  /// Returns -1 if shared memory buffers are not supported on this platform.
+  qi::int64_t getSharedBufferUserId();
+
+  /// Sub-buffers smaller than this size are sent inline.
+  /// Returns the value of QI_SHARED_MEMORY_BUFFER_THRESHOLD if set.
+  std::size_t getSharedBufferThresholdFromEnv(std::size_t defaultValue = 256 * 1024);
+
+  /// Returns a copy of the message with its sub-buffers of at least
+  /// `threshold` bytes moved to shared memory segments, and the flag
+  /// Message::TypeFlag_SharedBuffers set. The names of the segments created
+  /// are appended to `segmentNames`.
+  /// Returns an empty optional if no sub-buffer was moved, in which case the
+  /// message must be sent as is.
+  boost::optional<Message> shareBuffers(const Message& msg, std::size_t threshold,
+                                        std::vector<std::string>& segmentNames);
+
+  /// Returns a copy of the message with the sub-buffers in shared memory
+  /// mapped, and the flag Message::TypeFlag_SharedBuffers cleared.
+  /// Returns an empty optional if the payload is ill-formed, if a segment
+  /// cannot be mapped or if the sub-buffers total more than `maxPayloadSize`
+  /// bytes.
+  /// Precondition: msg.flags() & Message::TypeFlag_SharedBuffers
+  boost::optional<Message> mapSharedBuffers(const Message& msg, std::size_t maxPayloadSize);
+
+  /// Removes a segment created by `shareBuffers`, if it still exists.
+  /// The segments are normally removed by the receiver, this is only needed
+  /// for the messages that were never received.
+  void removeSharedBufferSegment(const std::string& name);
+
+  /// Returns true if a segment created by `shareBuffers` has not been mapped
+  /// (hence unlinked) yet.
+  bool sharedBufferSegmentExists(const std::string& name);
+}
+
+#endif  // _SRC_MESSAGING_SHAREDBUFFERS_HPP_
@@ -5,6 +5,7 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include "sharedbuffers.hpp"
 #include "streamcontext.hpp"
 
 namespace qi
@@ -16,6 +17,12 @@ namespace qi
     char const * const messageFlags          = "MessageFlags";
     char const * const remoteCancelableCalls = "RemoteCancelableCalls";
     char const * const objectPtrUid          = "ObjectPtrUID";
+    char const * const payloadCompression    = "PayloadCompression";
+    char const * const machineId             = "MachineId";
+    char const * const sharedMemoryBuffers   = "SharedMemoryBuffers";
+    char const * const sharedMemoryBuffersUser = "SharedMemoryBuffersUser";
+    char const * const eventBatching         = "EventBatching";
+    char const * const callDeadline          = "CallDeadline";
   }
 
 
@@ -114,6 +121,16 @@ static void initCapabilities()
   , { capabilityname::metaObjectCache      , AnyValue::from(false) }
   , { capabilityname::remoteCancelableCalls, AnyValue::from(true)  }
   , { capabilityname::objectPtrUid         , AnyValue::from(true)  }
+  , { capabilityname::payloadCompression   , AnyValue::from(true)  }
+  , { capabilityname::machineId            , AnyValue::from(os::getMachineId()) }
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+  , { capabilityname::sharedMemoryBuffers  , AnyValue::from(true)  }
+  , { capabilityname::sharedMemoryBuffersUser, AnyValue::from(getSharedBufferUserId()) }
+#else
+  , { capabilityname::sharedMemoryBuffers  , AnyValue::from(false) }
+#endif
+  , { capabilityname::eventBatching        , AnyValue::from(true)  }
+  , { capabilityname::callDeadline         , AnyValue::from(true)  }
   };
 
   _defaultCapabilities = new CapabilityMap(defaultCaps);
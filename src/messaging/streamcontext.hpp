@@ -37,6 +37,31 @@ using CapabilityMap = std::map<std::string, AnyValue>;
 
     // Capability: Objects allow unique identification using Ptruid.
     QI_API extern char const * const objectPtrUid;
+
+    // Capability: remote end decompresses message payloads flagged with
+    // Message::TypeFlag_Compressed.
+    QI_API extern char const * const payloadCompression;
+
+    // Capability: machine id of the remote end (see qi::os::getMachineId).
+    // Remote ends advertising the id of this machine are on the same host,
+    // whatever the transport and the address they are reached through.
+    QI_API extern char const * const machineId;
+
+    // Capability: remote end maps the sub-buffers of messages flagged with
+    // Message::TypeFlag_SharedBuffers from shared memory segments.
+    QI_API extern char const * const sharedMemoryBuffers;
+
+    // Capability: effective user id of the remote end. Shared memory segments
+    // are only sent to remote ends running as the same user.
+    QI_API extern char const * const sharedMemoryBuffersUser;
+
+    // Capability: remote end unpacks the events flagged with
+    // Message::TypeFlag_EventBatch.
+    QI_API extern char const * const eventBatching;
+
+    // Capability: remote end applies the deadlines of the calls flagged with
+    // Message::TypeFlag_Deadline.
+    QI_API extern char const * const callDeadline;
   }
 
 /** Store contextual data associated to one point-to-point point transport.
@@ -6,6 +6,7 @@
 #include <qi/log.hpp>
 #include <qi/messaging/sock/networkasio.hpp>
 #include <qi/messaging/sock/option.hpp>
+#include <qi/messaging/sock/send.hpp>
 
 #if BOOST_OS_WINDOWS
 # include <Winsock2.h> // needed by mstcpip.h
@@ -143,6 +144,30 @@ namespace qi { namespace sock {
     return warnThreshold;
   }
 
+  std::size_t getReceiveBufferSizeFromEnv()
+  {
+    static const auto receiveBufferSize = [] {
+      const auto size = os::getenv("QI_MESSAGE_RECEIVE_BUFFER_SIZE");
+      return size.empty() ? std::size_t{64 * 1024} : boost::lexical_cast<std::size_t>(size);
+    }();
+    return receiveBufferSize;
+  }
+
+  SendBatchLimits getSendBatchLimitsFromEnv()
+  {
+    static const auto limits = [] {
+      SendBatchLimits limits;
+      const auto maxBytes = os::getenv("QI_MESSAGE_SEND_BATCH_MAX_BYTES");
+      if (!maxBytes.empty())
+        limits.maxByteCount = boost::lexical_cast<std::size_t>(maxBytes);
+      const auto maxBuffers = os::getenv("QI_MESSAGE_SEND_BATCH_MAX_BUFFERS");
+      if (!maxBuffers.empty())
+        limits.maxBufferCount = boost::lexical_cast<std::size_t>(maxBuffers);
+      return limits;
+    }();
+    return limits;
+  }
+
   void NetworkAsio::setSocketNativeOptions(
     boost::asio::ip::tcp::socket::native_handle_type socketNativeHandle, int timeoutInSeconds)
   {
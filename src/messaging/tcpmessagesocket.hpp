@@ -18,6 +18,7 @@
 #include <ka/macroregular.hpp>
 #include "messagedispatcher.hpp"
 #include "messagesocket.hpp"
+#include "src/eventloopshards_p.hpp"
 #include <qi/messaging/sock/disconnectedstate.hpp>
 #include <qi/messaging/sock/disconnectingstate.hpp>
 #include <qi/messaging/sock/connectingstate.hpp>
@@ -33,6 +34,7 @@
 namespace qi {
 
   boost::optional<Seconds> getTcpPingTimeout(Seconds defaultTimeout);
+  size_t getMaxPayloadFromEnv(size_t defaultValue = 50000000);
 
   template<typename N, typename S>
   class TcpMessageSocket;
@@ -198,8 +200,10 @@ namespace qi {
     /// If the socket is not null, we consider we are on server side.
     /// On server side, if SSL is enabled the connection only consist of the handshake.
     /// On client side (null socket), the connection is done by calling `connect(Url)`.
+    /// The socket keeps the assignment to its shard of the network event loop, if any, for
+    /// its lifetime.
     explicit TcpMessageSocket(sock::IoService<N>& io = N::defaultIoService(),
-      sock::SslEnabled ssl = {false}, SocketPtr = {});
+      sock::SslEnabled ssl = {false}, SocketPtr = {}, NetworkEventLoopShardPtr shard = {});
 
     virtual ~TcpMessageSocket();
 
@@ -268,6 +272,12 @@ namespace qi {
     const sock::SslEnabled _ssl;
     mutable boost::recursive_mutex _stateMutex;
     sock::IoService<N>& _ioService;
+    // Keeps the event loop of `_ioService` alive if it is a shard: must be
+    // declared before the state, which holds the socket.
+    const NetworkEventLoopShardPtr _shard;
+    // Maximum size of the payload of the messages received, once decompressed
+    // or mapped from shared memory.
+    const size_t _maxPayload;
 
     void enterDisconnectedState(const SocketPtr& socket = {},
       Promise<void> promiseDisconnected = Promise<void>{});
@@ -285,6 +295,12 @@ namespace qi {
     bool mustTreatAsServerAuthentication(const Message& msg) const;
     bool handleCapabilityMessage(const Message& msg);
     bool handleNormalMessage(const Message& msg);
+    // Handles a message whose payload is neither compressed nor shared.
+    bool handlePlainMessage(const Message& msg);
+    // Fails the message whose payload could not be read, without
+    // disconnecting: the caller of a call gets an error reply, and a reply
+    // is replaced by an error for the local caller.
+    bool handleUnreadablePayload(const Message& msg, const std::string& error);
     bool handleMessage(const Message& msg);
 
     ConnectedState& asConnected(State& s)
@@ -320,10 +336,12 @@ namespace qi {
 
   template<typename N, typename S>
   TcpMessageSocket<N, S>::TcpMessageSocket(sock::IoService<N>& io, sock::SslEnabled ssl,
-        SocketPtr socket)
+        SocketPtr socket, NetworkEventLoopShardPtr shard)
     : MessageSocket()
     , _ssl(ssl)
     , _ioService(io)
+    , _shard(std::move(shard))
+    , _maxPayload(getMaxPayloadFromEnv())
     , _state{DisconnectedState{}}
   {
     if (socket)
@@ -344,8 +362,6 @@ namespace qi {
     }
   }
 
-  size_t getMaxPayloadFromEnv(size_t defaultValue = 50000000);
-
   /// Start receiving messages. Also allows to send messages.
   ///
   /// The returned value indicates if the operation succeeded.
@@ -355,7 +371,6 @@ namespace qi {
   template<typename N, typename S>
   bool TcpMessageSocket<N, S>::ensureReading()
   {
-    static const auto maxPayload = getMaxPayloadFromEnv();
     {
       boost::recursive_mutex::scoped_lock lock(_stateMutex);
       if (getStatus() != Status::Connecting)
@@ -378,7 +393,7 @@ namespace qi {
         return false;
       }
       auto self = shared_from_this();
-      _state = ConnectedState(res.socket, _ssl, maxPayload, sock::HandleMessage<N, S>{self});
+      _state = ConnectedState(res.socket, _ssl, _maxPayload, sock::HandleMessage<N, S>{self});
       auto& connected = asConnected(_state);
       connected.complete().then(connected.ioServiceStranded(
         OnConnectedComplete{self, Future<void>{nullptr}}
@@ -440,8 +455,7 @@ namespace qi {
         }
         // Connecting was successful, so we enter the connected state (to be able
         // send and receive messages).
-        static const auto maxPayload = getMaxPayloadFromEnv();
-        _state = ConnectedState(res.socket, _ssl, maxPayload, sock::HandleMessage<N, S>{self});
+        _state = ConnectedState(res.socket, _ssl, _maxPayload, sock::HandleMessage<N, S>{self});
         auto& connected = asConnected(_state);
         connected.complete().then(connected.ioServiceStranded(
           OnConnectedComplete{self, connectedPromise.future()}
@@ -565,6 +579,57 @@ namespace qi {
 
   template<typename N, typename S>
   bool TcpMessageSocket<N, S>::handleMessage(const Message& msg)
+  {
+    if (msg.flags() & Message::TypeFlag_Compressed)
+    {
+      const auto decompressed = decompressReceivedPayload(msg, _maxPayload);
+      if (!decompressed)
+      {
+        QI_LOG_ERROR_SOCKET(this) << "Ill-formed compressed payload in message " << msg.id();
+        return handleUnreadablePayload(msg, "Ill-formed compressed payload.");
+      }
+      return handleMessage(*decompressed);
+    }
+    if (msg.flags() & Message::TypeFlag_SharedBuffers)
+    {
+      const auto mapped = mapSharedBuffers(msg, _maxPayload);
+      if (!mapped)
+      {
+        QI_LOG_ERROR_SOCKET(this) << "Cannot map the shared buffers of message " << msg.id();
+        return handleUnreadablePayload(msg, "Cannot map the shared buffers of the payload.");
+      }
+      return handlePlainMessage(*mapped);
+    }
+    return handlePlainMessage(msg);
+  }
+
+  template<typename N, typename S>
+  bool TcpMessageSocket<N, S>::handleUnreadablePayload(const Message& msg, const std::string& error)
+  {
+    switch (msg.type())
+    {
+    case Message::Type_Call:
+    {
+      Message reply(Message::Type_Error, msg.address());
+      reply.setError(error);
+      send(reply);
+      return true;
+    }
+    case Message::Type_Reply:
+    case Message::Type_Error:
+    {
+      Message replacement(Message::Type_Error, msg.address());
+      replacement.setError(error);
+      return handleNormalMessage(replacement);
+    }
+    default:
+      // Nobody waits for it: it is dropped.
+      return true;
+    }
+  }
+
+  template<typename N, typename S>
+  bool TcpMessageSocket<N, S>::handlePlainMessage(const Message& msg)
   {
     bool success = false;
     if (mustTreatAsServerAuthentication(msg) || msg.type() == Message::Type_Capability)
@@ -588,6 +653,10 @@ namespace qi {
   template<typename N, typename S>
   bool TcpMessageSocket<N, S>::send(const Message& msg)
   {
+    // Share and compress before locking, so that sending from other threads
+    // is not delayed meanwhile.
+    const auto shared = shareBuffersForSending(msg);
+    const auto compressed = compressPayloadForSending(shared ? *shared : msg);
     boost::recursive_mutex::scoped_lock lock(_stateMutex);
     if (getStatus() != Status::Connected)
     {
@@ -596,7 +665,7 @@ namespace qi {
     }
     // NOTE: Should we specify an `onSent` callback and stop sending if an error
     // occurred?
-    asConnected(_state).send(msg, _ssl);
+    asConnected(_state).send(compressed ? *compressed : shared ? *shared : msg, _ssl);
     return true;
   }
 
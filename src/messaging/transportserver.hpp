@@ -15,6 +15,7 @@
 # include <vector>
 # include <boost/asio/ip/tcp.hpp>
 # include <boost/asio/ssl/stream.hpp>
+# include <qi/messaging/sock/socketptr.hpp>
 
 
 namespace qi {
@@ -43,6 +44,35 @@ namespace qi {
 
   using TransportServerImplPtr = boost::shared_ptr<TransportServerImpl>;
 
+  /// Moves the connection of a socket just accepted to a new socket of
+  /// `eventLoop`, so that it is processed by this event loop. Returns the
+  /// accepted socket itself if the connection cannot be moved.
+  template<typename N>
+  sock::SocketWithContextPtr<N> moveAcceptedSocket(sock::SocketWithContextPtr<N> accepted,
+                                                   const sock::SslContextPtr<N>& sslContext,
+                                                   EventLoop* eventLoop)
+  {
+    auto& lowest = accepted->lowest_layer();
+    boost::system::error_code erc;
+    const auto protocol = lowest.local_endpoint(erc).protocol();
+    if (erc)
+      return accepted;
+    const auto handle = lowest.release(erc);
+    if (erc)
+      return accepted;
+
+    auto& io = *static_cast<sock::IoService<N>*>(eventLoop->nativeHandle());
+    auto moved = sock::makeSocketWithContextPtr<N>(io, sslContext);
+    moved->lowest_layer().assign(protocol, handle, erc);
+    if (erc)
+    {
+      // Give the connection back to the accepted socket.
+      lowest.assign(protocol, handle, erc);
+      return accepted;
+    }
+    return moved;
+  }
+
 
   class MessageSocket;
   using MessageSocketPtr = boost::shared_ptr<MessageSocket>;
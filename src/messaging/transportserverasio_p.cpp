@@ -23,6 +23,7 @@
 #include <qi/eventloop.hpp>
 
 #include "transportserverasio_p.hpp"
+#include "src/eventloopshards_p.hpp"
 
 qiLogCategory("qimessaging.transportserver");
 
@@ -85,7 +86,19 @@ namespace qi
     }
     else
     {
-        auto socket = boost::make_shared<qi::TcpMessageSocket<>>(*asIoServicePtr(context), _ssl, s);
+        EventLoop* eventLoop = context;
+        auto shard = NetworkEventLoopShard::assign();
+        if (shard)
+        {
+          auto moved = moveAcceptedSocket<sock::NetworkAsio>(s, _sslContext, shard->eventLoop());
+          if (moved != s)
+          {
+            s = moved;
+            eventLoop = shard->eventLoop();
+          }
+        }
+        auto socket = boost::make_shared<qi::TcpMessageSocket<>>(*asIoServicePtr(eventLoop), _ssl, s,
+                                                                 std::move(shard));
         qiLogDebug() << "New socket accepted: " << socket.get();
 
         self->newConnection(std::pair<MessageSocketPtr, Url>{
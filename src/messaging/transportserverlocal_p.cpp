@@ -0,0 +1,188 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+#include <cstdio>
+#include <sstream>
+#include <qi/log.hpp>
+#include <qi/eventloop.hpp>
+
+#include "messagesocket.hpp"
+#include "tcpmessagesocket.hpp"
+#include "transportserverasio_p.hpp"
+#include "transportserverlocal_p.hpp"
+
+#ifdef QI_SOCK_HAS_LOCAL_SOCKETS
+
+#include <sys/stat.h>
+
+qiLogCategory("qimessaging.transportserver");
+
+namespace qi
+{
+  namespace
+  {
+    // Does not follow symbolic links.
+    bool isSocketFile(const struct ::stat& status)
+    {
+      return S_ISSOCK(status.st_mode);
+    }
+
+    // A socket file that no process accepts connections on is stale.
+    // Connecting to a file which is not a socket is refused as well: check
+    // that it is a socket first.
+    bool isStaleSocketFile(boost::asio::io_service& io,
+                           const boost::asio::local::stream_protocol::endpoint& ep)
+    {
+      boost::asio::local::stream_protocol::socket probe(io);
+      boost::system::error_code erc;
+      probe.connect(ep, erc);
+      return erc == boost::asio::error::connection_refused;
+    }
+  }
+
+  TransportServerLocalPrivate::TransportServerLocalPrivate(TransportServer* self, EventLoop* ctx)
+    : TransportServerImpl(self, ctx)
+    , _acceptor(*asIoServicePtr(ctx))
+    , _live(true)
+    , _sslContext(sock::makeSslContextPtr<Network>(*asIoServicePtr(ctx),
+                                                   sock::SslContext<Network>::sslv23))
+    , _ownsSocketFile(false)
+  {
+  }
+
+  boost::shared_ptr<TransportServerLocalPrivate> TransportServerLocalPrivate::make(
+      TransportServer* self,
+      EventLoop* ctx)
+  {
+    return boost::shared_ptr<TransportServerLocalPrivate>{new TransportServerLocalPrivate(self, ctx)};
+  }
+
+  TransportServerLocalPrivate::~TransportServerLocalPrivate()
+  {
+    close();
+  }
+
+  qi::Future<void> TransportServerLocalPrivate::listen(const qi::Url& url)
+  {
+    _listenUrl = url;
+    const auto& path = url.host();
+    if (path.empty())
+    {
+      const char* s = "Listen error: no socket path.";
+      qiLogError() << s;
+      return qi::makeFutureError<void>(s);
+    }
+
+    boost::asio::local::stream_protocol::endpoint ep(path);
+    struct ::stat status;
+    if (::lstat(path.c_str(), &status) == 0)
+    {
+      if (!isSocketFile(status))
+      {
+        std::stringstream ss;
+        ss << "failed to listen on " << url.str() << ": the path exists and is not a socket";
+        qiLogError("qimessaging.server.listen") << ss.str();
+        return qi::makeFutureError<void>(ss.str());
+      }
+      if (isStaleSocketFile(*asIoServicePtr(context), ep))
+      {
+        qiLogVerbose() << "Removing stale socket file " << path;
+        std::remove(path.c_str());
+      }
+    }
+
+    boost::system::error_code erc;
+    _acceptor.open(ep.protocol(), erc);
+    if (!erc)
+      _acceptor.bind(ep, erc);
+    if (!erc)
+    {
+      _ownsSocketFile = true;
+      _acceptor.listen(boost::asio::socket_base::max_connections, erc);
+    }
+    if (erc)
+    {
+      std::stringstream ss;
+      ss << "failed to listen on " << url.str() << ": " << erc.message();
+      qiLogError("qimessaging.server.listen") << ss.str();
+      return qi::makeFutureError<void>(ss.str());
+    }
+
+    {
+      boost::mutex::scoped_lock l(_endpointsMutex);
+      _endpoints.push_back(_listenUrl);
+    }
+    qiLogInfo() << "TransportServer will listen on: " << _listenUrl.str();
+
+    accept();
+    _connectionPromise.setValue(0);
+    return _connectionPromise.future();
+  }
+
+  void TransportServerLocalPrivate::accept()
+  {
+    auto s = sock::makeSocketWithContextPtr<Network>(*asIoServicePtr(context), _sslContext);
+    auto self = shared_from_this();
+    _acceptor.async_accept(s->lowest_layer(),
+      [self, s](const boost::system::error_code& erc) {
+        self->onAccept(erc, s);
+      });
+  }
+
+  void TransportServerLocalPrivate::onAccept(const boost::system::error_code& erc,
+                                             sock::SocketWithContextPtr<Network> s)
+  {
+    boost::mutex::scoped_lock lock(_acceptCloseMutex);
+    if (!_live)
+      return;
+    if (erc)
+    {
+      qiLogDebug() << "accept error " << erc.message();
+      self->acceptError(erc.value());
+      if (erc == boost::asio::error::operation_aborted)
+        return;
+      if (TransportServerAsioPrivate::isFatalAcceptError(erc.value()))
+      {
+        qiLogError() << "fatal accept error on " << _listenUrl.str() << ": " << erc.message();
+        return;
+      }
+    }
+    else
+    {
+      EventLoop* eventLoop = context;
+      auto shard = NetworkEventLoopShard::assign();
+      if (shard)
+      {
+        auto moved = moveAcceptedSocket<Network>(s, _sslContext, shard->eventLoop());
+        if (moved != s)
+        {
+          s = moved;
+          eventLoop = shard->eventLoop();
+        }
+      }
+      auto socket = boost::make_shared<TcpMessageSocket<Network>>(*asIoServicePtr(eventLoop), false, s,
+                                                                  std::move(shard));
+      qiLogDebug() << "New local socket accepted: " << socket.get();
+      // Clients of local sockets are unnamed: they are reported with the url
+      // of the server.
+      self->newConnection(std::pair<MessageSocketPtr, Url>{socket, _listenUrl});
+    }
+    accept();
+  }
+
+  void TransportServerLocalPrivate::close()
+  {
+    boost::mutex::scoped_lock l(_acceptCloseMutex);
+    _live = false;
+    boost::system::error_code erc;
+    _acceptor.close(erc);
+    if (_ownsSocketFile)
+    {
+      std::remove(_listenUrl.host().c_str());
+      _ownsSocketFile = false;
+    }
+  }
+}
+
+#endif // QI_SOCK_HAS_LOCAL_SOCKETS
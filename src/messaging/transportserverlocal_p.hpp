@@ -0,0 +1,69 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_TRANSPORTSERVERLOCAL_P_HPP_
+#define _SRC_TRANSPORTSERVERLOCAL_P_HPP_
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <qi/url.hpp>
+#include <qi/messaging/sock/networkasiolocal.hpp>
+#include <qi/messaging/sock/socketptr.hpp>
+#include <qi/messaging/sock/sslcontextptr.hpp>
+#include "transportserver.hpp"
+
+#ifdef QI_SOCK_HAS_LOCAL_SOCKETS
+
+namespace qi
+{
+  /// Accepts connections on a local (unix domain) socket, for urls of the form
+  /// `unix:///path/to/socket`.
+  ///
+  /// The socket file is created when listening and removed when closing. A
+  /// socket file left behind by a dead process is replaced, but listening
+  /// fails if another process is accepting connections on it.
+  class TransportServerLocalPrivate:
+      public TransportServerImpl,
+      public boost::enable_shared_from_this<TransportServerLocalPrivate>
+  {
+    TransportServerLocalPrivate(TransportServer* self, EventLoop* ctx);
+
+  public:
+    static boost::shared_ptr<TransportServerLocalPrivate> make(
+        TransportServer* self,
+        EventLoop* ctx);
+
+    virtual ~TransportServerLocalPrivate();
+
+    qi::Future<void> listen(const qi::Url& listenUrl) override;
+    void close() override;
+
+  private:
+    using Network = sock::NetworkAsioLocal;
+
+    void accept();
+    void onAccept(const boost::system::error_code& erc,
+                  sock::SocketWithContextPtr<Network> s);
+
+    boost::asio::local::stream_protocol::acceptor _acceptor;
+    std::atomic<bool> _live;
+    sock::SslContextPtr<Network> _sslContext;
+    Url _listenUrl;
+    // Set once the socket file is created by this server.
+    bool _ownsSocketFile;
+
+    // The server must avoid being closed while accepting a connection (see
+    // TransportServerAsioPrivate).
+    boost::mutex _acceptCloseMutex;
+  };
+}
+
+#endif // QI_SOCK_HAS_LOCAL_SOCKETS
+
+#endif  // _SRC_TRANSPORTSERVERLOCAL_P_HPP_
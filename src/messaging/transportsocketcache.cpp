@@ -3,6 +3,7 @@
 **  See COPYING for the license
 */
 #include <algorithm>
+#include <iterator>
 #include <sstream>
 
 #include <boost/algorithm/string.hpp>
@@ -118,22 +119,57 @@ static UrlVector localhost_only(const UrlVector& input)
   return result;
 }
 
-Future<MessageSocketPtr> TransportSocketCache::socket(const ServiceInfo& servInfo, const std::string& url)
+static bool isLocalSocket(const Url& url)
+{
+  return url.protocol() == "unix";
+}
+
+template<typename Pred>
+static UrlVector filtered(const UrlVector& input, Pred pred)
+{
+  UrlVector result;
+  result.reserve(input.size());
+  std::copy_if(input.begin(), input.end(), std::back_inserter(result), pred);
+  return result;
+}
+
+Future<MessageSocketPtr> TransportSocketCache::socket(const ServiceInfo& servInfo, const std::string& protocol)
 {
   const std::string& machineId = servInfo.machineId();
   ConnectionAttemptPtr couple = boost::make_shared<ConnectionAttempt>();
   couple->relatedUrls = servInfo.endpoints();
   bool local = machineId == os::getMachineId();
+
+  UrlVector endpoints = servInfo.endpoints();
+  if (!protocol.empty())
+    endpoints = filtered(endpoints, [&](const Url& url) { return url.protocol() == protocol; });
+  // Local sockets cannot be reached from another machine.
+  if (!local)
+    endpoints = filtered(endpoints, [](const Url& url) { return !isLocalSocket(url); });
+
   UrlVector connectionCandidates;
 
-  // If the connection is local, we're mainly interested in localhost endpoint
+  // If the connection is local, we're mainly interested in local sockets, then
+  // in localhost endpoints.
   if (local)
-    connectionCandidates = localhost_only(servInfo.endpoints());
+  {
+    connectionCandidates = filtered(endpoints, isLocalSocket);
+    if (connectionCandidates.empty())
+      connectionCandidates = localhost_only(endpoints);
+  }
 
   // If the connection isn't local or if the service doesn't expose local endpoints,
   // try and connect to whatever is available.
   if (connectionCandidates.size() == 0)
-    connectionCandidates = servInfo.endpoints();
+    connectionCandidates = endpoints;
+
+  if (connectionCandidates.empty())
+  {
+    std::stringstream ss;
+    ss << "No " << (protocol.empty() ? "" : protocol + " ")
+       << "endpoint available to connect to machine " << machineId;
+    return makeFutureError<MessageSocketPtr>(ss.str());
+  }
 
   couple->endpoint = MessageSocketPtr();
   couple->state = State_Pending;
@@ -45,12 +45,13 @@ namespace qi
     void close();
 
     /// Get the socket for the given ServiceInfo.
-    /// The original url of the service directory is always preferred to the
-    /// other endpoints, and other endpoints will not be tried if the services
-    /// are running on another machine.
+    /// If the service runs on this machine, its local socket (`unix://`)
+    /// endpoints are preferred, then its localhost endpoints. Local socket
+    /// and localhost endpoints are not tried if the service runs on another
+    /// machine.
     /// @param servInfo A service info retrieved from a service directory.
-    /// @param sdUrl The endpoint of the service directory on which the service info came from.
-    Future<MessageSocketPtr> socket(const ServiceInfo& servInfo, const std::string& sdUrl);
+    /// @param protocol If not empty, only the endpoints of this protocol are tried.
+    Future<MessageSocketPtr> socket(const ServiceInfo& servInfo, const std::string& protocol);
     void insert(const std::string& machineId, const Url& url, MessageSocketPtr socket);
 
     /// The returned future is set when the socket has been disconnected and
@@ -10,6 +10,11 @@ qiLogCategory("qi.url");
 
 namespace qi {
 
+  namespace
+  {
+    const char* const localSocketScheme = "unix";
+  }
+
   class UrlPrivate {
   public:
     UrlPrivate();
@@ -259,7 +264,7 @@ namespace qi {
       url += protocol + "://";
     if(components & HOST)
       url += host;
-    if(components & PORT)
+    if(components & PORT && protocol != localSocketScheme)
       url += std::string(":") + boost::lexical_cast<std::string>(port);
   }
 
@@ -296,6 +301,19 @@ namespace qi {
       place = 0;
 
     _url = _url.substr(place);
+
+    // The address of a local socket is a path, that may contain ':'. There is
+    // no port: consider it is given, so that the url is valid.
+    if (_scheme == localSocketScheme) {
+      if (!_url.empty())
+        components |= HOST;
+      components |= PORT;
+      port = 0;
+      host = _url;
+      protocol = _scheme;
+      return components;
+    }
+
     place = _url.find(":");
     _host = _url.substr(0, place);
     if (!_host.empty())
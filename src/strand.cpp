@@ -11,12 +11,16 @@
 #include <qi/future.hpp>
 #include <qi/getenv.hpp>
 
+#include "tasknodepool_p.hpp"
+
 qiLogCategory("qi.strand");
 
 namespace qi {
 
 namespace
 {
+  static const auto dyingStrandMessage = "the strand is dying";
+
   // Executes the callback immediately. This function returns a Future for consistency with the
   // async functions and simplicity of use. The future will be in error if the callback throws
   // an exception.
@@ -42,13 +46,38 @@ enum class StrandPrivate::State
 struct StrandPrivate::Callback
 {
   uint32_t id;
-  State state;
+  std::atomic<State> state;
   boost::function<void()> callback;
   qi::Promise<void> promise;
   qi::Future<void> asyncFuture;
   ExecutionOptions executionOptions;
 };
 
+struct StrandPrivate::Node
+{
+  Node* next = nullptr;
+  // Set for the posted callbacks.
+  boost::function<void()> callback;
+  // Set for the others.
+  boost::shared_ptr<Callback> job;
+
+  static void* operator new(std::size_t size)
+  {
+    return detail::allocateTaskNode(size);
+  }
+
+  static void operator delete(void* node, std::size_t size)
+  {
+    detail::deallocateTaskNode(node, size);
+  }
+};
+
+StrandPrivate::~StrandPrivate()
+{
+  // Jobs enqueued while the strand was being joined.
+  failPendingJobs();
+}
+
 boost::shared_ptr<StrandPrivate::Callback> StrandPrivate::createCallback(boost::function<void()> cb, ExecutionOptions options)
 {
   ++_aliveCount;
@@ -91,76 +120,161 @@ Future<void> StrandPrivate::deferImpl(boost::function<void()> cb, qi::Duration d
 
 void StrandPrivate::enqueue(boost::shared_ptr<Callback> cbStruct, ExecutionOptions options)
 {
-  const bool shouldschedule = [&]()
-  {
-    boost::recursive_mutex::scoped_lock lock(_mutex);
-    qiLogDebug() << "Enqueueing job id " << cbStruct->id;
-
-    auto scheduleCallback = [&] {
-      _queue.push_back(cbStruct);
-      cbStruct->state = State::Scheduled;
-    };
+  qiLogDebug() << "Enqueueing job id " << cbStruct->id;
 
-    // the callback may have been canceled
-    if (cbStruct->state == State::None)
-    {
-      if (_dying)
-      {
-        cbStruct->promise.setError("the strand is dying");
-        qiLogDebug() << "Strand is dying on job id " << cbStruct->id;
-        return false;
-      }
-
-      qiLogDebug() << "Strand callback state is None on job id " << cbStruct->id;
-      scheduleCallback();
-    }
-    else
+  // the callback may have been canceled
+  State state = State::None;
+  if (_dying.load())
+  {
+    qiLogDebug() << "Strand is dying on job id " << cbStruct->id;
+    if (claim(*cbStruct, State::None))
     {
-      QI_ASSERT(cbStruct->state == State::Canceled);
-      if (options.onCancelRequested == CancelOption::NeverSkipExecution)
-      {
-        qiLogDebug() << "Job was canceled but is specified as never skipped - will execute";
-        scheduleCallback();
-      }
-      else
-      {
-        qiLogDebug() << "Job was canceled, dropping";
-        return false;
-      }
+      --_aliveCount;
+      cbStruct->promise.setError(dyingStrandMessage);
     }
-    // if process was not scheduled yet, do it, there is work to do
-    if (!_processing)
+    return;
+  }
+
+  if (!cbStruct->state.compare_exchange_strong(state, State::Scheduled))
+  {
+    QI_ASSERT(state == State::Canceled);
+    if (options.onCancelRequested != CancelOption::NeverSkipExecution)
     {
-      qiLogDebug() << "Schedule process on job id " << cbStruct->id;
-      _processing = true;
-      return true;
+      qiLogDebug() << "Job was canceled, dropping";
+      return;
     }
+    qiLogDebug() << "Job was canceled but is specified as never skipped - will execute";
+  }
 
-    return false;
-  }();
+  Node* node = new Node;
+  node->job = std::move(cbStruct);
+  push(node, options);
+}
+
+void StrandPrivate::postImpl(boost::function<void()> callback, ExecutionOptions options)
+{
+  if (_dying.load())
+  {
+    qiLogDebug() << "Strand is dying, dropping posted job";
+    return;
+  }
+  ++_aliveCount;
+  Node* node = new Node;
+  node->callback = std::move(callback);
+  push(node, options);
+}
 
-  if (shouldschedule)
+void StrandPrivate::push(Node* node, ExecutionOptions options)
+{
+  node->next = _incoming.load(std::memory_order_relaxed);
+  while (!_incoming.compare_exchange_weak(node->next, node))
+  {
+  }
+
+  // if process was not scheduled yet, do it, there is work to do
+  if (!_processing.load() && !_processing.exchange(true))
   {
     qiLogDebug() << "StrandPrivate::process was not scheduled, doing it";
-    _executor.async(boost::bind(&StrandPrivate::process, shared_from_this()), options);
+    auto self = shared_from_this();
+    _executor.post([self] { self->process(); }, options);
   }
 }
 
-void StrandPrivate::stopProcess(boost::recursive_mutex::scoped_lock& lock,
-                                bool finished)
+StrandPrivate::Node* StrandPrivate::takeNext()
 {
-  // if we still have work
-  if (!finished && !_dying)
+  if (!_pending)
   {
-    qiLogDebug() << "Strand quantum expired, rescheduling";
-    lock.unlock();
-    _executor.async(boost::bind(&StrandPrivate::process, shared_from_this()));
+    // Take all the jobs pushed so far at once, and put them back in order.
+    Node* node = _incoming.exchange(nullptr);
+    while (node)
+    {
+      Node* const next = node->next;
+      node->next = _pending;
+      _pending = node;
+      node = next;
+    }
+    if (!_pending)
+      return nullptr;
   }
-  else
+  Node* const node = _pending;
+  _pending = node->next;
+  return node;
+}
+
+void StrandPrivate::run(Node& node)
+{
+  if (!node.job)
+  {
+    --_aliveCount;
+    try
+    {
+      node.callback();
+    }
+    catch (const std::exception& e)
+    {
+      qiLogDebug() << "Posted job has thrown in strand: " << e.what();
+    }
+    catch (...)
+    {
+      qiLogDebug() << "Posted job has thrown in strand";
+    }
+    return;
+  }
+
+  Callback& cbStruct = *node.job;
+  if (!claim(cbStruct, State::Scheduled))
+  {
+    // Job was canceled, cancel() already has done --_aliveCount
+    qiLogDebug() << "Abandoning job id " << cbStruct.id
+      << ", state: " << static_cast<int>(cbStruct.state.load());
+    return;
+  }
+  --_aliveCount;
+
+  qiLogDebug() << "Executing job id " << cbStruct.id;
+  try {
+    cbStruct.callback();
+    cbStruct.promise.setValue(0);
+  }
+  catch (std::exception& e) {
+    cbStruct.promise.setError(e.what());
+  }
+  catch (...) {
+    cbStruct.promise.setError("callback has thrown in strand");
+  }
+  qiLogDebug() << "Finished job id " << cbStruct.id;
+}
+
+bool StrandPrivate::claim(Callback& cbStruct, State expected)
+{
+  State state = expected;
+  if (cbStruct.state.compare_exchange_strong(state, State::Running))
+    return true;
+  // cancel() has let the job be, it is still ours to finish.
+  if (state == State::Canceled
+      && cbStruct.executionOptions.onCancelRequested == CancelOption::NeverSkipExecution)
   {
-    _processing = false;
-    _processFinished.notify_all();
+    cbStruct.state = State::Running;
+    return true;
   }
+  return false;
+}
+
+void StrandPrivate::stopProcess()
+{
+  boost::recursive_mutex::scoped_lock lock(_mutex);
+  _processing = false;
+  _processFinished.notify_all();
+}
+
+bool StrandPrivate::tryStopProcess()
+{
+  stopProcess();
+  // A job pushed before _processing was cleared did not schedule a process,
+  // take it back unless another process was scheduled in the meantime.
+  if (_dying.load() || !_incoming.load())
+    return true;
+  return _processing.exchange(true);
 }
 
 void StrandPrivate::process()
@@ -176,106 +290,94 @@ void StrandPrivate::process()
 
   do
   {
-    boost::shared_ptr<Callback> cbStruct;
+    if (_dying.load())
     {
-      boost::recursive_mutex::scoped_lock lock(_mutex);
-      if (_dying)
-      {
-        qiLogDebug() << this << " strand is dying, stopping process";
-        break;
-      }
-
-      QI_ASSERT(_processing);
-      if (_queue.empty())
-      {
-        qiLogDebug() << "Queue empty, stopping";
-        stopProcess(lock, true);
-        _processingThread = 0;
-        return;
-      }
-      cbStruct = _queue.front();
-      _queue.pop_front();
-      if (cbStruct->state == State::Scheduled
-      || (cbStruct->state == State::Canceled && cbStruct->executionOptions.onCancelRequested == CancelOption::NeverSkipExecution))
-      {
-        --_aliveCount;
-        cbStruct->state = State::Running;
-      }
-      else
-      {
-        // Job was canceled, cancel() already has done --_aliveCount
-        qiLogDebug() << "Abandoning job id " << cbStruct->id
-          << ", state: " << static_cast<int>(cbStruct->state);
-        continue;
-      }
-    }
-    qiLogDebug() << "Executing job id " << cbStruct->id;
-    try {
-      cbStruct->callback();
-      cbStruct->promise.setValue(0);
-    }
-    catch (std::exception& e) {
-      cbStruct->promise.setError(e.what());
+      qiLogDebug() << this << " strand is dying, stopping process";
+      break;
     }
-    catch (...) {
-      cbStruct->promise.setError("callback has thrown in strand");
+
+    QI_ASSERT(_processing);
+    std::unique_ptr<Node> node(takeNext());
+    if (!node)
+    {
+      qiLogDebug() << "Queue empty, stopping";
+      _processingThread = 0;
+      if (tryStopProcess())
+        return;
+      _processingThread = qi::os::gettid();
+      continue;
     }
-    qiLogDebug() << "Finished job id " << cbStruct->id;
+    run(*node);
   } while (qi::SteadyClock::now() - start < qi::MicroSeconds(QI_STRAND_QUANTUM_US));
 
   _processingThread = 0;
 
+  // if we still have work
+  if (!_dying.load())
   {
-    boost::recursive_mutex::scoped_lock lock(_mutex);
-    stopProcess(lock, false);
+    qiLogDebug() << "Strand quantum expired, rescheduling";
+    auto self = shared_from_this();
+    _executor.post([self] { self->process(); });
+  }
+  else
+  {
+    stopProcess();
   }
 }
 
 void StrandPrivate::cancel(boost::shared_ptr<Callback> cbStruct)
 {
-  boost::recursive_mutex::scoped_lock lock(_mutex);
+  const bool neverSkip =
+    cbStruct->executionOptions.onCancelRequested == CancelOption::NeverSkipExecution;
+  State state = cbStruct->state.load();
+  while (true)
+  {
+    switch (state)
+    {
+      case State::None:
+        if (!cbStruct->state.compare_exchange_weak(state, State::Canceled))
+          continue;
+        qiLogDebug() << "Not scheduled yet, canceling future";
+        cbStruct->asyncFuture.cancel();
+        if (!neverSkip)
+        {
+          --_aliveCount;
+          cbStruct->promise.setCanceled();
+        }
+        return;
+      case State::Scheduled:
+        if (!cbStruct->state.compare_exchange_weak(state, State::Canceled))
+          continue;
+        // The job stays in the queue, the strand drops it when it gets to it.
+        qiLogDebug() << "Was scheduled, marking it canceled";
+        if (!neverSkip)
+        {
+          --_aliveCount;
+          cbStruct->promise.setCanceled();
+        }
+        return;
+      default:
+        qiLogDebug() << "State is " << static_cast<int>(state)
+          << ", too late for canceling";
+        return;
+    }
+  }
+}
 
-  switch (cbStruct->state)
+void StrandPrivate::failPendingJobs()
+{
+  while (Node* rawNode = takeNext())
   {
-    case State::None:
-      qiLogDebug() << "Not scheduled yet, canceling future";
-      cbStruct->asyncFuture.cancel();
-      cbStruct->state = State::Canceled;
-      if(cbStruct->executionOptions.onCancelRequested != CancelOption::NeverSkipExecution)
-      {
-        --_aliveCount;
-        cbStruct->promise.setCanceled();
-      }
-      break;
-    case State::Scheduled:
-      qiLogDebug() << "Was scheduled, removing it from queue";
-      if (cbStruct->executionOptions.onCancelRequested != CancelOption::NeverSkipExecution)
-      {
-        bool erased = false;
-        for (Queue::iterator iter = _queue.begin(); iter != _queue.end(); ++iter)
-          if ((*iter)->id == cbStruct->id)
-          {
-            _queue.erase(iter);
-            erased = true;
-            break;
-          }
-        // state was scheduled, so the callback must be there
-        QI_ASSERT(erased);
-        // Silence compile warning unused erased
-        (void)erased;
-
-        --_aliveCount;
-        cbStruct->promise.setCanceled();
-      }
-      else
-      {
-        cbStruct->state = State::Canceled;
-      }
-      break;
-    default:
-      qiLogDebug() << "State is " << static_cast<int>(cbStruct->state)
-        << ", too late for canceling";
-      break;
+    std::unique_ptr<Node> node(rawNode);
+    if (node->job)
+    {
+      // Canceled jobs that must never be skipped are still counted, and their
+      // promise is still to be set.
+      if (!claim(*node->job, State::Scheduled))
+        continue;
+      node->job->promise.setError(dyingStrandMessage);
+    }
+    --_aliveCount;
   }
 }
 
@@ -304,11 +406,6 @@ Strand::~Strand()
   }
 }
 
-namespace
-{
-  static const auto dyingStrandMessage = "the strand is dying";
-}
-
 void Strand::join()
 {
   if (!_p)
@@ -337,16 +434,7 @@ void Strand::join()
     boost::atomic_exchange(&prv, _p);
 
     prv->_processFinished.wait(lock, [&]{ return !prv->_processing; });
-    while (!prv->_queue.empty())
-    {
-      auto task = std::move(prv->_queue.front());
-      prv->_queue.pop_front();
-      if (task->state == StrandPrivate::State::Canceled)
-        continue;
-      QI_ASSERT(task->state == StrandPrivate::State::Scheduled);
-      task->promise.setError(dyingStrandMessage);
-      --prv->_aliveCount;
-    }
+    prv->failPendingJobs();
 
     qiLogVerbose() << this << " joined, remaining tasks: " << prv->_aliveCount;
   }
@@ -407,7 +495,7 @@ void Strand::postImpl(boost::function<void()> callback, ExecutionOptions options
 {
   auto prv = boost::atomic_load(&_p);
   if (prv)
-    prv->enqueue(prv->createCallback(std::move(callback), options), options);
+    prv->postImpl(std::move(callback), options);
 }
 
 Future<void> Strand::defer(const boost::function<void ()>& cb, MicroSeconds delay, ExecutionOptions options)
@@ -0,0 +1,166 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <boost/thread/tss.hpp>
+
+#include "tasknodepool_p.hpp"
+
+namespace qi
+{
+  namespace
+  {
+    // Free nodes store the next free node in their first bytes.
+    struct FreeNode
+    {
+      FreeNode* next;
+    };
+
+    // Nodes move between the threads by batches of this size.
+    const std::size_t batchSize = 32;
+    // A thread keeps at most this number of free nodes.
+    const std::size_t maxThreadNodeCount = 2 * batchSize;
+    // Above this number of batches, freed nodes are given back to the system.
+    const std::size_t maxSharedBatchCount = 1024;
+
+    struct Batch
+    {
+      FreeNode* head;
+      std::size_t count;
+    };
+
+    void deleteNodes(FreeNode* head)
+    {
+      while (head)
+      {
+        FreeNode* next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+
+    struct ThreadNodes
+    {
+      FreeNode* head = nullptr;
+      std::size_t count = 0;
+    };
+
+    void releaseThreadNodes(ThreadNodes* nodes);
+
+    struct TaskNodePool
+    {
+      std::mutex sharedMutex;
+      std::vector<Batch> shared;
+      boost::thread_specific_ptr<ThreadNodes> threadNodes;
+
+      TaskNodePool()
+        : threadNodes(&releaseThreadNodes)
+      {
+      }
+
+      ThreadNodes& localNodes()
+      {
+        ThreadNodes* nodes = threadNodes.get();
+        if (!nodes)
+        {
+          nodes = new ThreadNodes;
+          threadNodes.reset(nodes);
+        }
+        return *nodes;
+      }
+
+      void putBatch(Batch batch)
+      {
+        {
+          std::lock_guard<std::mutex> lock(sharedMutex);
+          if (shared.size() < maxSharedBatchCount)
+          {
+            shared.push_back(batch);
+            return;
+          }
+        }
+        deleteNodes(batch.head);
+      }
+
+      bool takeBatch(Batch& batch)
+      {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (shared.empty())
+          return false;
+        batch = shared.back();
+        shared.pop_back();
+        return true;
+      }
+    };
+
+    // Leaked on purpose, so that tasks can still be freed during static
+    // destruction.
+    TaskNodePool& taskNodePool()
+    {
+      static TaskNodePool* const pool = new TaskNodePool;
+      return *pool;
+    }
+
+    // Called at thread exit: the nodes of the thread go to the shared list.
+    void releaseThreadNodes(ThreadNodes* nodes)
+    {
+      if (nodes->head)
+        taskNodePool().putBatch(Batch{nodes->head, nodes->count});
+      delete nodes;
+    }
+  } // namespace
+
+  namespace detail
+  {
+    void* allocateTaskNode(std::size_t size)
+    {
+      if (size > taskNodeSize)
+        return ::operator new(size);
+
+      auto& pool = taskNodePool();
+      ThreadNodes& nodes = pool.localNodes();
+      if (!nodes.head)
+      {
+        Batch batch;
+        if (!pool.takeBatch(batch))
+          return ::operator new(taskNodeSize);
+        nodes.head = batch.head;
+        nodes.count = batch.count;
+      }
+      FreeNode* node = nodes.head;
+      nodes.head = node->next;
+      --nodes.count;
+      return node;
+    }
+
+    void deallocateTaskNode(void* node, std::size_t size)
+    {
+      if (size > taskNodeSize)
+      {
+        ::operator delete(node);
+        return;
+      }
+
+      auto& pool = taskNodePool();
+      ThreadNodes& nodes = pool.localNodes();
+      FreeNode* freeNode = new (node) FreeNode{nodes.head};
+      nodes.head = freeNode;
+      ++nodes.count;
+      if (nodes.count == maxThreadNodeCount)
+      {
+        // Give the oldest half to the other threads.
+        FreeNode* last = nodes.head;
+        for (std::size_t i = 1; i != maxThreadNodeCount - batchSize; ++i)
+          last = last->next;
+        pool.putBatch(Batch{last->next, batchSize});
+        last->next = nullptr;
+        nodes.count -= batchSize;
+      }
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_TASKNODEPOOL_P_HPP_
+#define _SRC_TASKNODEPOOL_P_HPP_
+
+#include <cstddef>
+
+namespace qi
+{
+  namespace detail
+  {
+    /// Size of the nodes of the pool. Bigger nodes are allocated directly.
+    const std::size_t taskNodeSize = 256;
+
+    /// Allocates the memory of a task posted to an event loop, such as the
+    /// operation queued by an io_service.
+    ///
+    /// Nodes of up to `taskNodeSize` bytes are reused: freed nodes are kept in
+    /// a per-thread free list, linked through their own memory, and moved by
+    /// batches to and from a shared list. Tasks are usually allocated by one
+    /// thread and freed by another, so batches keep the shared list lock out
+    /// of most of the allocations.
+    void* allocateTaskNode(std::size_t size);
+
+    /// Gives back a node returned by `allocateTaskNode`, `size` being the one
+    /// it was allocated with.
+    void deallocateTaskNode(void* node, std::size_t size);
+
+    /// Allocator using the task node pool, to associate with asio handlers.
+    template<typename T>
+    struct TaskNodeAllocator
+    {
+      using value_type = T;
+
+      TaskNodeAllocator() = default;
+
+      template<typename U>
+      TaskNodeAllocator(const TaskNodeAllocator<U>&)
+      {
+      }
+
+      T* allocate(std::size_t n)
+      {
+        return static_cast<T*>(allocateTaskNode(n * sizeof(T)));
+      }
+
+      void deallocate(T* p, std::size_t n)
+      {
+        deallocateTaskNode(p, n * sizeof(T));
+      }
+
+      template<typename U>
+      struct rebind
+      {
+        using other = TaskNodeAllocator<U>;
+      };
+
+      template<typename U>
+      friend bool operator==(const TaskNodeAllocator&, const TaskNodeAllocator<U>&)
+      {
+        return true;
+      }
+
+      template<typename U>
+      friend bool operator!=(const TaskNodeAllocator&, const TaskNodeAllocator<U>&)
+      {
+        return false;
+      }
+    };
+  }
+}
+
+#endif  // _SRC_TASKNODEPOOL_P_HPP_
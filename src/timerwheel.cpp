@@ -0,0 +1,289 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <boost/asio/error.hpp>
+#include <qi/getenv.hpp>
+
+#include "timerwheel_p.hpp"
+
+namespace qi
+{
+  namespace
+  {
+    const auto gTimerWheelTickEnvVar = "QI_EVENTLOOP_TIMER_WHEEL_TICK_US";
+    const auto gPreciseDelayEnvVar = "QI_EVENTLOOP_PRECISE_DELAY_US";
+
+    const TimerWheel::Tick slotMask = TimerWheel::slotCount - 1;
+    // Timers further than that are put at the end of the last level, and
+    // cascaded again until they get in range.
+    const TimerWheel::Tick wheelRange = TimerWheel::Tick(1) << (TimerWheel::levelBits * TimerWheel::levelCount);
+  }
+
+  const TimerWheel::Index TimerWheel::npos;
+
+  std::array<TimerWheel::Index, TimerWheel::levelCount * TimerWheel::slotCount> TimerWheel::makeEmptySlots()
+  {
+    std::array<Index, levelCount * slotCount> slots;
+    slots.fill(npos);
+    return slots;
+  }
+
+  TimerWheel::Handle TimerWheel::add(Tick tick, Handler handler)
+  {
+    const Index index = allocateNode();
+    Node& node = _nodes[index];
+    node.handler = std::move(handler);
+    node.tick = tick;
+    link(index);
+    ++_size;
+    return (static_cast<Handle>(node.generation) << 32) | index;
+  }
+
+  bool TimerWheel::remove(Handle handle, Handler& handler)
+  {
+    const Index index = static_cast<Index>(handle);
+    if (index >= _nodes.size())
+      return false;
+    Node& node = _nodes[index];
+    if (node.generation != static_cast<std::uint32_t>(handle >> 32) || node.slot == npos)
+      return false;
+    unlink(index);
+    handler = std::move(node.handler);
+    freeNode(index);
+    --_size;
+    return true;
+  }
+
+  void TimerWheel::advance(Tick now, std::vector<Handler>& expired)
+  {
+    while (_size != 0 && _current <= now)
+    {
+      // With the first levels empty, nothing happens until the next cascade
+      // of the first level holding timers.
+      unsigned int emptyLevels = 0;
+      while (_levelSizes[emptyLevels] == 0)
+        ++emptyLevels;
+      const unsigned int shift = levelBits * emptyLevels;
+      if (emptyLevels != 0 && (_current & ((Tick(1) << shift) - 1)) != 0)
+      {
+        _current = std::min(now + 1, ((_current >> shift) + 1) << shift);
+        continue;
+      }
+
+      const Index slot = static_cast<Index>(_current & slotMask);
+      if (slot == 0)
+      {
+        for (unsigned int level = 1; level < levelCount; ++level)
+        {
+          cascade(level);
+          if (((_current >> (levelBits * level)) & slotMask) != 0)
+            break;
+        }
+      }
+
+      Index index = _slots[slot];
+      _slots[slot] = npos;
+      ++_current;
+      while (index != npos)
+      {
+        Node& node = _nodes[index];
+        const Index next = node.next;
+        --_levelSizes[0];
+        --_size;
+        expired.push_back(std::move(node.handler));
+        freeNode(index);
+        index = next;
+      }
+    }
+
+    // Nothing left to expire: jump straight to `now`.
+    if (_size == 0 && _current <= now)
+      _current = now + 1;
+  }
+
+  boost::optional<TimerWheel::Tick> TimerWheel::nextTick() const
+  {
+    if (_size == 0)
+      return {};
+
+    for (unsigned int level = 0; level < levelCount; ++level)
+    {
+      if (_levelSizes[level] == 0)
+        continue;
+
+      const unsigned int shift = levelBits * level;
+      const Tick block = _current >> shift;
+      const Tick current = block & slotMask;
+      // The current slot of an upper level is only cascaded if we are at its
+      // beginning, otherwise it holds the timers of the next round.
+      const bool atBlockStart = (_current & ((Tick(1) << shift) - 1)) == 0;
+      for (Tick slot = atBlockStart ? current : current + 1; slot < slotCount; ++slot)
+      {
+        if (_slots[level * slotCount + slot] != npos)
+          return (block - current + slot) << shift;
+      }
+      // The remaining timers of this level are processed after the next
+      // cascade of the upper level.
+      return ((_current >> (shift + levelBits)) + 1) << (shift + levelBits);
+    }
+    return {};
+  }
+
+  TimerWheel::Index TimerWheel::allocateNode()
+  {
+    if (_freeNodes != npos)
+    {
+      const Index index = _freeNodes;
+      _freeNodes = _nodes[index].next;
+      return index;
+    }
+    _nodes.push_back(Node{Handler{}, 0, npos, npos, npos, 0});
+    return static_cast<Index>(_nodes.size() - 1);
+  }
+
+  void TimerWheel::freeNode(Index index)
+  {
+    Node& node = _nodes[index];
+    node.handler.clear();
+    node.slot = npos;
+    node.prev = npos;
+    ++node.generation;
+    node.next = _freeNodes;
+    _freeNodes = index;
+  }
+
+  void TimerWheel::link(Index index)
+  {
+    Node& node = _nodes[index];
+    Tick tick = std::max(node.tick, _current);
+    const Tick delta = tick - _current;
+    unsigned int level = 0;
+    while (level + 1 < levelCount && delta >= (Tick(1) << (levelBits * (level + 1))))
+      ++level;
+    if (delta >= wheelRange)
+      tick = _current + wheelRange - 1;
+
+    const Index slot = static_cast<Index>(level * slotCount + ((tick >> (levelBits * level)) & slotMask));
+    node.slot = slot;
+    node.prev = npos;
+    node.next = _slots[slot];
+    if (node.next != npos)
+      _nodes[node.next].prev = index;
+    _slots[slot] = index;
+    ++_levelSizes[level];
+  }
+
+  void TimerWheel::unlink(Index index)
+  {
+    Node& node = _nodes[index];
+    if (node.prev != npos)
+      _nodes[node.prev].next = node.next;
+    else
+      _slots[node.slot] = node.next;
+    if (node.next != npos)
+      _nodes[node.next].prev = node.prev;
+    --_levelSizes[node.slot / slotCount];
+    node.slot = npos;
+  }
+
+  void TimerWheel::cascade(unsigned int level)
+  {
+    const Index slot = static_cast<Index>(level * slotCount + ((_current >> (levelBits * level)) & slotMask));
+    Index index = _slots[slot];
+    _slots[slot] = npos;
+    while (index != npos)
+    {
+      const Index next = _nodes[index].next;
+      --_levelSizes[level];
+      link(index);
+      index = next;
+    }
+  }
+
+  TimerWheelScheduler::TimerWheelScheduler(boost::asio::io_service& io, qi::Duration tick,
+                                           qi::Duration preciseDelay, Dispatch dispatch)
+    : _origin(qi::SteadyClock::now())
+    , _tick(tick)
+    , _preciseDelay(std::max(preciseDelay, tick))
+    , _dispatch(std::move(dispatch))
+    , _state(std::make_shared<State>())
+    , _timer(io)
+  {
+  }
+
+  void TimerWheelScheduler::Canceler::operator()() const
+  {
+    const auto state = _state.lock();
+    if (!state)
+      return;
+    Handler handler;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (!state->wheel.remove(_handle, handler))
+        return;
+    }
+    handler(boost::asio::error::operation_aborted);
+  }
+
+  TimerWheelScheduler::Canceler TimerWheelScheduler::add(qi::SteadyClockTimePoint deadline, Handler handler)
+  {
+    const auto tick = toTick(deadline, true);
+    TimerWheel::Handle handle;
+    {
+      std::lock_guard<std::mutex> lock(_state->mutex);
+      handle = _state->wheel.add(tick, std::move(handler));
+      if (!_armedTick || tick < *_armedTick)
+        arm(tick);
+    }
+
+    return Canceler(_state, handle);
+  }
+
+  TimerWheel::Tick TimerWheelScheduler::toTick(qi::SteadyClockTimePoint timepoint, bool roundUp) const
+  {
+    const auto elapsed = (timepoint - _origin).count();
+    if (elapsed <= 0)
+      return 0;
+    const auto tick = static_cast<TimerWheel::Tick>(elapsed / _tick.count());
+    return (roundUp && elapsed % _tick.count() != 0) ? tick + 1 : tick;
+  }
+
+  void TimerWheelScheduler::arm(TimerWheel::Tick tick)
+  {
+    _armedTick = tick;
+    _timer.expires_at(_origin + _tick * static_cast<qi::Duration::rep>(tick));
+    _timer.async_wait([this](const boost::system::error_code& erc) { onWakeUp(erc); });
+  }
+
+  void TimerWheelScheduler::onWakeUp(const boost::system::error_code& erc)
+  {
+    // The timer was armed again in the meantime.
+    if (erc == boost::asio::error::operation_aborted)
+      return;
+
+    std::vector<Handler> expired;
+    {
+      std::lock_guard<std::mutex> lock(_state->mutex);
+      _armedTick = boost::none;
+      _state->wheel.advance(toTick(qi::SteadyClock::now(), false), expired);
+      if (const auto next = _state->wheel.nextTick())
+        arm(*next);
+    }
+    for (auto& handler : expired)
+      _dispatch(handler);
+  }
+
+  std::unique_ptr<TimerWheelScheduler> makeTimerWheelScheduler(
+    boost::asio::io_service& io, TimerWheelScheduler::Dispatch dispatch)
+  {
+    const auto tickUs = qi::os::getEnvDefault(gTimerWheelTickEnvVar, 0u);
+    if (tickUs == 0)
+      return {};
+    const auto preciseDelayUs = qi::os::getEnvDefault(gPreciseDelayEnvVar, 1000u);
+    return std::unique_ptr<TimerWheelScheduler>(new TimerWheelScheduler(
+      io, qi::MicroSeconds(tickUs), qi::MicroSeconds(preciseDelayUs), std::move(dispatch)));
+  }
+}
@@ -0,0 +1,190 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef _SRC_TIMERWHEEL_P_HPP_
+#define _SRC_TIMERWHEEL_P_HPP_
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio/basic_waitable_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/system/error_code.hpp>
+#include <qi/clock.hpp>
+
+namespace qi
+{
+  /// Hierarchical timer wheel, counting time in ticks.
+  ///
+  /// Each level has 64 slots: the first one holds the timers expiring in the
+  /// next 64 ticks, one slot per tick, the second one the timers expiring in
+  /// the next 64^2 ticks, one slot per 64 ticks, and so on. When the first
+  /// level wraps, the next slot of the second level is cascaded into it, and
+  /// so on. Adding and removing a timer are O(1), and the timers of a tick
+  /// expire all at once.
+  ///
+  /// Timers are stored in a deque of nodes, linked by index, and identified
+  /// by their index and a generation, so that removing a timer which already
+  /// expired is harmless.
+  ///
+  /// This class is not thread-safe.
+  class TimerWheel
+  {
+  public:
+    using Tick = std::uint64_t;
+    using Handle = std::uint64_t;
+    using Handler = boost::function<void (const boost::system::error_code&)>;
+
+    static const unsigned int levelBits = 6;
+    static const unsigned int slotCount = 1u << levelBits;
+    static const unsigned int levelCount = 5;
+
+    /// Adds a timer expiring at `tick`. A tick already processed means the
+    /// next one.
+    Handle add(Tick tick, Handler handler);
+
+    /// Removes the timer if it has not expired yet, and gives back its handler.
+    bool remove(Handle handle, Handler& handler);
+
+    /// Processes the ticks up to `now` included, appending the handlers of the
+    /// expired timers to `expired`.
+    void advance(Tick now, std::vector<Handler>& expired);
+
+    /// The next tick at which `advance` may have something to do, if there is
+    /// any timer.
+    boost::optional<Tick> nextTick() const;
+
+    std::size_t size() const
+    {
+      return _size;
+    }
+
+    bool empty() const
+    {
+      return _size == 0;
+    }
+
+  private:
+    using Index = std::uint32_t;
+    static const Index npos = static_cast<Index>(-1);
+
+    struct Node
+    {
+      Handler handler;
+      Tick tick;
+      Index prev;
+      Index next;
+      Index slot;
+      std::uint32_t generation;
+    };
+
+    Index allocateNode();
+    void freeNode(Index index);
+    void link(Index index);
+    void unlink(Index index);
+    void cascade(unsigned int level);
+
+    // Unlike a vector, does not copy the handlers when growing.
+    std::deque<Node> _nodes;
+    Index _freeNodes = npos;
+    std::array<Index, levelCount * slotCount> _slots = makeEmptySlots();
+    std::array<std::size_t, levelCount> _levelSizes{};
+    std::size_t _size = 0;
+    // The next tick to process.
+    Tick _current = 0;
+
+    static std::array<Index, levelCount * slotCount> makeEmptySlots();
+  };
+
+  /// Runs timer handlers from a timer wheel, driven by a single timer of an
+  /// io service.
+  ///
+  /// The io service must not run the handlers of the scheduler once it is
+  /// destroyed, that is, the owner must stop the io service first.
+  class TimerWheelScheduler
+  {
+    struct State
+    {
+      std::mutex mutex;
+      TimerWheel wheel;
+    };
+
+  public:
+    using Handler = TimerWheel::Handler;
+    /// Runs the handler of an expired timer, called from the io service.
+    using Dispatch = boost::function<void (Handler&)>;
+
+    /// Cancels a timer: removes it and calls its handler with an
+    /// `operation_aborted` error, unless it already expired. Remains safe to
+    /// call after the destruction of the scheduler, it then does nothing.
+    class Canceler
+    {
+    public:
+      Canceler(std::weak_ptr<State> state, TimerWheel::Handle handle)
+        : _state(std::move(state))
+        , _handle(handle)
+      {
+      }
+
+      void operator()() const;
+
+    private:
+      std::weak_ptr<State> _state;
+      TimerWheel::Handle _handle;
+    };
+
+    /// @param tick The precision of the timers.
+    /// @param preciseDelay Delays shorter than this one, or than a tick, should
+    ///   rather use an asio timer, see `handles`.
+    TimerWheelScheduler(boost::asio::io_service& io, qi::Duration tick,
+                        qi::Duration preciseDelay, Dispatch dispatch);
+
+    TimerWheelScheduler(const TimerWheelScheduler&) = delete;
+    TimerWheelScheduler& operator=(const TimerWheelScheduler&) = delete;
+
+    /// Whether a delay is long enough to be handled by the wheel. Deadlines
+    /// are rounded up to the next tick, so delays shorter than a tick are
+    /// never handled: they could be more than doubled.
+    bool handles(qi::Duration delay) const
+    {
+      return delay >= _preciseDelay;
+    }
+
+    /// Calls `handler` once `deadline` is reached, unless it is canceled
+    /// before.
+    Canceler add(qi::SteadyClockTimePoint deadline, Handler handler);
+
+  private:
+    using Timer = boost::asio::basic_waitable_timer<qi::SteadyClock>;
+
+    TimerWheel::Tick toTick(qi::SteadyClockTimePoint timepoint, bool roundUp) const;
+    void arm(TimerWheel::Tick tick);
+    void onWakeUp(const boost::system::error_code& erc);
+
+    const qi::SteadyClockTimePoint _origin;
+    const qi::Duration _tick;
+    const qi::Duration _preciseDelay;
+    const Dispatch _dispatch;
+    const std::shared_ptr<State> _state;
+    // Protected by the mutex of the state.
+    Timer _timer;
+    boost::optional<TimerWheel::Tick> _armedTick;
+  };
+
+  /// Creates the timer wheel scheduler of an event loop, as configured by the
+  /// QI_EVENTLOOP_TIMER_WHEEL_TICK_US (0 by default, which disables the wheel)
+  /// and QI_EVENTLOOP_PRECISE_DELAY_US (1000 by default) environment
+  /// variables. Returns null if the wheel is disabled.
+  std::unique_ptr<TimerWheelScheduler> makeTimerWheelScheduler(
+    boost::asio::io_service& io, TimerWheelScheduler::Dispatch dispatch);
+}
+
+#endif  // _SRC_TIMERWHEEL_P_HPP_
@@ -18,6 +18,13 @@
 #include <ka/scoped.hpp>
 #include <vector>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
 
 qiLogCategory("qitype.binarycoder");
 
@@ -409,6 +416,243 @@ namespace qi {
 
   namespace detail {
 
+    /// Access to the elements of a list stored as a std::vector of integers or
+    /// floating point numbers. As these elements are contiguous and each one is
+    /// serialized as its raw bytes, they can be copied in one block instead of
+    /// being visited one by one, without changing the format.
+    struct ContiguousListAccess
+    {
+      TypeInterface* type;
+      std::size_t elementSize;
+      /// Returns the address of the first element and the number of elements.
+      std::pair<const void*, std::size_t> (*elements)(AnyReference& list);
+      /// Appends `count` elements and returns the address of the first one.
+      void* (*append)(AnyReference& list, std::size_t count);
+    };
+
+    template<typename T>
+    struct ContiguousListAccessImpl
+    {
+      static std::pair<const void*, std::size_t> elements(AnyReference& list)
+      {
+        const auto& v = *list.ptr<std::vector<T>>(false);
+        return {v.data(), v.size()};
+      }
+
+      static void* append(AnyReference& list, std::size_t count)
+      {
+        auto& v = *list.ptr<std::vector<T>>(false);
+        const auto size = v.size();
+        v.resize(size + count);
+        return v.data() + size;
+      }
+
+      static ContiguousListAccess make()
+      {
+        return {typeOf<std::vector<T>>(), sizeof(T), &elements, &append};
+      }
+    };
+
+    /// Returns null if the elements of a list of this type cannot be copied in one block.
+    static const ContiguousListAccess* contiguousListAccess(TypeInterface* listType)
+    {
+      const auto elementKind = static_cast<ListTypeInterface*>(listType)->elementType()->kind();
+      if (elementKind != TypeKind_Int && elementKind != TypeKind_Float)
+        return nullptr;
+
+      // std::vector<bool> is not contiguous and is therefore not listed.
+      static const std::vector<ContiguousListAccess> accesses{
+        ContiguousListAccessImpl<char>::make(),
+        ContiguousListAccessImpl<signed char>::make(),
+        ContiguousListAccessImpl<unsigned char>::make(),
+        ContiguousListAccessImpl<short>::make(),
+        ContiguousListAccessImpl<unsigned short>::make(),
+        ContiguousListAccessImpl<int>::make(),
+        ContiguousListAccessImpl<unsigned int>::make(),
+        ContiguousListAccessImpl<long>::make(),
+        ContiguousListAccessImpl<unsigned long>::make(),
+        ContiguousListAccessImpl<long long>::make(),
+        ContiguousListAccessImpl<unsigned long long>::make(),
+        ContiguousListAccessImpl<float>::make(),
+        ContiguousListAccessImpl<double>::make()
+      };
+      for (const auto& access : accesses)
+      {
+        if (access.type == listType)
+          return &access;
+      }
+      for (const auto& access : accesses)
+      {
+        if (access.type->info() == listType->info())
+          return &access;
+      }
+      return nullptr;
+    }
+
+    /// What the codec derives from a type to (de)serialize its values.
+    /// It is computed once per type (see `codecPlan`) instead of once per
+    /// value, as deriving signatures requires to walk the type and to parse
+    /// the resulting string.
+    struct CodecPlan
+    {
+      /// For lists, the signature of the elements. For maps, the signature of
+      /// the values.
+      Signature elementSignature;
+      /// For maps, the signature of the keys.
+      Signature keySignature;
+      /// For tuples, the signature of the tuple, without annotations.
+      Signature tupleSignature;
+      /// For tuples, the types of the members.
+      std::vector<TypeInterface*> memberTypes;
+      /// For lists whose elements can be copied in one block, the access to
+      /// these elements. Null otherwise.
+      const ContiguousListAccess* contiguousList = nullptr;
+    };
+
+    static CodecPlan* makeCodecPlan(TypeInterface* type)
+    {
+      auto plan = new CodecPlan;
+      switch (type->kind())
+      {
+      case TypeKind_List:
+      case TypeKind_VarArgs:
+        plan->elementSignature = static_cast<ListTypeInterface*>(type)->elementType()->signature();
+        plan->contiguousList = contiguousListAccess(type);
+        break;
+      case TypeKind_Map:
+      {
+        MapTypeInterface* mapType = static_cast<MapTypeInterface*>(type);
+        plan->keySignature = mapType->keyType()->signature();
+        plan->elementSignature = mapType->elementType()->signature();
+        break;
+      }
+      case TypeKind_Tuple:
+        plan->memberTypes = static_cast<StructTypeInterface*>(type)->memberTypes();
+        plan->tupleSignature = qi::makeTupleSignature(plan->memberTypes);
+        break;
+      default:
+        break;
+      }
+      return plan;
+    }
+
+    /// Cache of the codec plans, indexed by type.
+    ///
+    /// Plans are keyed by the address of their type, which another type may
+    /// reuse once the module defining the first one is unloaded: the cache is
+    /// then cleared (see `detail::clearCodecPlanCache`).
+    ///
+    /// Lookups do not lock: the slots of a table are only written once, under
+    /// the mutex, the plan before the type, and clearing replaces the table
+    /// instead of modifying it. Tables and plans are never freed, as lookups
+    /// may still be using them. If the table is full, the plans go to an
+    /// overflow map protected by the mutex.
+    class CodecPlanCache
+    {
+    public:
+      CodecPlanCache()
+        : _table(new Table)
+      {
+      }
+
+      const CodecPlan& get(TypeInterface* type)
+      {
+        const Table& table = *_table.load(std::memory_order_acquire);
+        std::size_t index = slotIndex(type);
+        for (std::size_t probe = 0; probe != slotCount; ++probe, index = nextSlotIndex(index))
+        {
+          TypeInterface* slotType = table.slots[index].type.load(std::memory_order_acquire);
+          if (slotType == type)
+            return *table.slots[index].plan.load(std::memory_order_relaxed);
+          if (!slotType)
+            break;
+        }
+        return insert(type);
+      }
+
+      void clear()
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _table.store(new Table, std::memory_order_release);
+        _overflow.clear();
+      }
+
+    private:
+      static const std::size_t slotCount = 4096;
+
+      struct Slot
+      {
+        std::atomic<TypeInterface*> type;
+        std::atomic<const CodecPlan*> plan;
+      };
+
+      struct Table
+      {
+        std::array<Slot, slotCount> slots;
+
+        Table()
+        {
+          for (auto& slot : slots)
+          {
+            slot.type.store(nullptr, std::memory_order_relaxed);
+            slot.plan.store(nullptr, std::memory_order_relaxed);
+          }
+        }
+      };
+
+      static std::size_t slotIndex(TypeInterface* type)
+      {
+        // Fibonacci hashing of the address, whose low bits are mostly zeros.
+        const auto address = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(type));
+        return static_cast<std::size_t>((address * UINT64_C(11400714819323198485)) >> 52) & (slotCount - 1);
+      }
+
+      static std::size_t nextSlotIndex(std::size_t index)
+      {
+        return (index + 1) & (slotCount - 1);
+      }
+
+      const CodecPlan& insert(TypeInterface* type)
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Table& table = *_table.load(std::memory_order_relaxed);
+        std::size_t index = slotIndex(type);
+        for (std::size_t probe = 0; probe != slotCount; ++probe, index = nextSlotIndex(index))
+        {
+          TypeInterface* slotType = table.slots[index].type.load(std::memory_order_relaxed);
+          if (slotType == type)
+            return *table.slots[index].plan.load(std::memory_order_relaxed);
+          if (!slotType)
+          {
+            const CodecPlan* plan = makeCodecPlan(type);
+            table.slots[index].plan.store(plan, std::memory_order_relaxed);
+            table.slots[index].type.store(type, std::memory_order_release);
+            return *plan;
+          }
+        }
+        auto& plan = _overflow[type];
+        if (!plan)
+          plan = makeCodecPlan(type);
+        return *plan;
+      }
+
+      std::atomic<Table*> _table;
+      std::mutex _mutex;
+      std::unordered_map<TypeInterface*, const CodecPlan*> _overflow;
+    };
+
+    static CodecPlanCache& codecPlanCache()
+    {
+      // Leaked on purpose, as types are.
+      static CodecPlanCache* const cache = new CodecPlanCache;
+      return *cache;
+    }
+
+    static const CodecPlan& codecPlan(TypeInterface* type)
+    {
+      return codecPlanCache().get(type);
+    }
+
     class SerializeTypeVisitor
     {
     public:
@@ -472,9 +716,18 @@ namespace qi {
 
       void visitList(AnyIterator it, AnyIterator end)
       {
-        out.beginList(value.size(), static_cast<ListTypeInterface*>(value.type())->elementType()->signature());
-        for (; it != end; ++it)
-          serialize(*it, out, serializeObjectCb, streamContext);
+        const CodecPlan& plan = codecPlan(value.type());
+        out.beginList(value.size(), plan.elementSignature);
+        if (const auto access = plan.contiguousList)
+        {
+          const auto elements = access->elements(value);
+          out.write(static_cast<const uint8_t*>(elements.first), elements.second * access->elementSize);
+        }
+        else
+        {
+          for (; it != end; ++it)
+            serialize(*it, out, serializeObjectCb, streamContext);
+        }
         out.endList();
       }
 
@@ -485,8 +738,8 @@ namespace qi {
 
       void visitMap(AnyIterator it, AnyIterator end)
       {
-        MapTypeInterface* type = static_cast<MapTypeInterface*>(value.type());
-        out.beginMap(value.size(), type->keyType()->signature(), type->elementType()->signature());
+        const CodecPlan& plan = codecPlan(value.type());
+        out.beginMap(value.size(), plan.keySignature, plan.elementSignature);
         for(; it != end; ++it)
         {
           AnyReference v = *it;
@@ -544,7 +797,7 @@ namespace qi {
 
       void visitTuple(const std::string &name, const AnyReferenceVector& vals, const std::vector<std::string>& annotations)
       {
-        out.beginTuple(qi::makeTupleSignature(vals));
+        out.beginTuple(codecPlan(value.type()).tupleSignature);
         for (unsigned i=0; i<vals.size(); ++i)
           serialize(vals[i], out, serializeObjectCb, streamContext);
         out.endTuple();
@@ -689,6 +942,20 @@ namespace qi {
         in.read(sz);
         if (in.status() != BinaryDecoder::Status::Ok)
           return;
+        if (const auto access = codecPlan(result.type()).contiguousList)
+        {
+          const void* data = nullptr;
+          if (sz <= std::numeric_limits<std::size_t>::max() / access->elementSize)
+            data = in.readRaw(sz * access->elementSize);
+          if (!data)
+          {
+            in.setStatus(BinaryDecoder::Status::ReadPastEnd);
+            return;
+          }
+          if (sz != 0)
+            std::memcpy(access->append(result, sz), data, sz * access->elementSize);
+          return;
+        }
         for (unsigned i = 0; i < sz; ++i)
         {
           AnyReference v = deserialize(elementType, in, context, streamContext);
@@ -770,7 +1037,7 @@ namespace qi {
 
       void visitTuple(const std::string &, const AnyReferenceVector&, const std::vector<std::string>&)
       {
-        std::vector<TypeInterface*> types = result.membersType();
+        const std::vector<TypeInterface*>& types = codecPlan(result.type()).memberTypes;
         AnyReferenceVector   vals;
         vals.resize(types.size());
         for (unsigned i = 0; i<types.size(); ++i)
@@ -819,6 +1086,12 @@ namespace qi {
 
       void visitRaw(AnyReference)
       {
+        // Buffers share the data of sub-buffers instead of copying it.
+        if (Buffer* buffer = result.ptr<Buffer>())
+        {
+          in.read(*buffer);
+          return;
+        }
         Buffer b;
         in.read(b);
         result.setRaw((char*)b.data(), b.size());
@@ -882,6 +1155,11 @@ namespace qi {
       }
     }
 
+    void clearCodecPlanCache()
+    {
+      codecPlanCache().clear();
+    }
+
   } // namespace detail
 
   void encodeBinary(qi::Buffer *buf, const qi::AutoAnyReference &gvp, SerializeObjectCallback onObject, StreamContext* sctx) {
@@ -168,6 +168,14 @@ namespace qi {
     //last arguments specified, or VS2010 segfault with an internal error...
     encodeBinary(&buffer(), AnyReference::from(v), SerializeObjectCallback());
   }
+
+  namespace detail
+  {
+    /// Forgets what the binary codec computed per type. It must be called when
+    /// types may have been destroyed, as when a module is unloaded, since new
+    /// types may then get their addresses.
+    QI_API void clearCodecPlanCache();
+  }
 }
 
 
@@ -2,8 +2,10 @@
 **  Copyright (C) 2012 Aldebaran Robotics
 **  See COPYING for the license
 */
+#include <algorithm>
 #include <atomic>
 #include <map>
+#include <memory>
 #include <numeric>
 
 #include <boost/thread/recursive_mutex.hpp>
@@ -44,6 +46,7 @@ namespace qi {
       subscriber = it->second;
       // Remove from map (but SignalSubscriber object still good)
       subscriberMap.erase(it);
+      publishSubscribers();
       if (subscriberMap.empty() && onSubscribers)
         onSubscribersToCall = onSubscribers;
       // Ensure no call on subscriber occurs once this function returns
@@ -55,6 +58,15 @@ namespace qi {
     return callingOnSubscribers.andThen([](void*) { return true; });
   }
 
+  void SignalBasePrivate::publishSubscribers()
+  {
+    auto snapshot = std::make_shared<std::vector<SignalSubscriber>>();
+    snapshot->reserve(subscriberMap.size());
+    for (const auto& subscriber : subscriberMap)
+      snapshot->push_back(subscriber.second);
+    std::atomic_store(&subscribers, std::move(snapshot));
+  }
+
   Future<bool> SignalBasePrivate::disconnectAll()
   {
     return disconnectAllStep(true);
@@ -125,7 +137,6 @@ namespace qi {
   void SignalBase::setCallType(MetaCallType callType)
   {
     QI_ASSERT(_p);
-    boost::recursive_mutex::scoped_lock lock(_p->mutex);
     _p->defaultCallType = callType;
   }
 
@@ -139,32 +150,49 @@ namespace qi {
       qi::AutoAnyReference p7,
       qi::AutoAnyReference p8)
   {
-    qi::AutoAnyReference* vals[8]= {&p1, &p2, &p3, &p4, &p5, &p6, &p7, &p8};
+    qi::AutoAnyReference* vals[SignalArgumentsCheck::maxArgumentCount] = {&p1, &p2, &p3, &p4, &p5, &p6, &p7, &p8};
+    SignalArgumentsCheck check;
+    check.count = 0;
+    for (auto val : vals)
+      if (val->isValid())
+        check.types[check.count++] = val->type();
+
     std::vector<qi::AnyReference> params;
-    for (unsigned i = 0; i < 8; ++i)
-      if (vals[i]->isValid())
-        params.push_back(*vals[i]);
-    qi::Signature signature = qi::makeTupleSignature(params);
+    params.reserve(check.count);
+    for (auto val : vals)
+      if (val->isValid())
+        params.push_back(*val);
 
-    auto mct = [&] () {
-      QI_ASSERT(_p);
+    // Without resolving dynamic values, the signature of the arguments only
+    // depends on their types: it is only computed for new ones.
+    QI_ASSERT(_p);
+    auto lastCheck = std::atomic_load(&_p->lastArgumentsCheck);
+    if (!lastCheck || lastCheck->count != check.count ||
+        !std::equal(check.types.begin(), check.types.begin() + check.count, lastCheck->types.begin()))
+    {
+      const qi::Signature signature = qi::makeTupleSignature(params);
       boost::recursive_mutex::scoped_lock lock(_p->mutex);
-      if (signature != _p->signature)
-      {
+      check.matches = (signature == _p->signature);
+      if (!check.matches)
         qiLogError() << "Dropping emit: signature mismatch: "
                      << signature.toString() << " " << _p->signature.toString();
-        return MetaCallType_Auto;
-      }
-      return _p->defaultCallType;
-    }();
+      lastCheck = std::make_shared<const SignalArgumentsCheck>(check);
+      std::atomic_store(&_p->lastArgumentsCheck, lastCheck);
+    }
+    else if (!lastCheck->matches)
+    {
+      qiLogError() << "Dropping emit: signature mismatch: "
+                   << qi::makeTupleSignature(params).toString() << " " << signature().toString();
+    }
 
-    trigger(params, mct);
+    trigger(params, lastCheck->matches ? _p->defaultCallType.load() : MetaCallType_Auto);
   }
 
   void SignalBase::trigger(const GenericFunctionParameters& params, MetaCallType callType)
   {
     QI_ASSERT(_p);
     SignalBase::Trigger trigger;
+    if (_p->hasTriggerOverride)
     {
       boost::recursive_mutex::scoped_lock lock(_p->mutex);
       trigger = _p->triggerOverride;
@@ -180,6 +208,7 @@ namespace qi {
     QI_ASSERT(_p);
     boost::recursive_mutex::scoped_lock lock(_p->mutex);
     _p->triggerOverride = t;
+    _p->hasTriggerOverride = static_cast<bool>(t);
   }
 
   void SignalBase::setOnSubscribers(OnSubscribers onSubscribers)
@@ -189,24 +218,34 @@ namespace qi {
     _p->onSubscribers = onSubscribers;
   }
 
+  void SignalBase::setRemoteEventPolicy(const RemoteEventPolicy& policy)
+  {
+    QI_ASSERT(_p);
+    boost::recursive_mutex::scoped_lock lock(_p->mutex);
+    _p->remoteEventPolicy = policy;
+  }
+
+  RemoteEventPolicy SignalBase::remoteEventPolicy() const
+  {
+    QI_ASSERT(_p);
+    boost::recursive_mutex::scoped_lock lock(_p->mutex);
+    return _p->remoteEventPolicy;
+  }
+
   void SignalBase::callSubscribers(const GenericFunctionParameters& params, MetaCallType callType)
   {
     MetaCallType mct = callType;
     QI_ASSERT(_p);
 
-    SignalSubscriberMap copy;
-    {
-      boost::recursive_mutex::scoped_lock lock(_p->mutex);
-      if (mct == qi::MetaCallType_Auto)
-        mct = _p->defaultCallType;
+    if (mct == qi::MetaCallType_Auto)
+      mct = _p->defaultCallType;
 
-      copy = _p->subscriberMap;
-    }
-    qiLogDebug() << this << " Invoking signal subscribers: " << copy.size();
-    for (auto& i: copy)
+    // Holds the subscriptions alive.
+    const SignalSubscriberSnapshot subscribers = std::atomic_load(&_p->subscribers);
+    qiLogDebug() << this << " Invoking signal subscribers: " << subscribers->size();
+    for (auto& s: *subscribers)
     {
       qiLogDebug() << this << " Invoking signal subscriber";
-      SignalSubscriber s = i.second; // holds the subscription alive
       s.call(params, mct);
     }
     qiLogDebug() << this << " done invoking signal subscribers";
@@ -249,6 +288,31 @@ namespace qi {
     }
   }
 
+  namespace
+  {
+    /// A call of a subscriber queued in an execution context, with a copy of
+    /// the arguments.
+    struct QueuedCall
+    {
+      QueuedCall(const SignalSubscriber& subscriber, const GenericFunctionParameters& args)
+        : subscriber(subscriber)
+        , args(args.copy())
+      {
+      }
+
+      ~QueuedCall()
+      {
+        args.destroy(); // see GenericFunctionParameters::copy() for details
+      }
+
+      QueuedCall(const QueuedCall&) = delete;
+      QueuedCall& operator=(const QueuedCall&) = delete;
+
+      SignalSubscriber subscriber;
+      GenericFunctionParameters args;
+    };
+  }
+
   void SignalSubscriber::call(const GenericFunctionParameters& args, MetaCallType callType)
   {
     // this is held alive by caller
@@ -276,14 +340,12 @@ namespace qi {
             throw std::runtime_error("Event loop was destroyed");
         }
 
-        auto subscriberCopy = *this;
-        std::shared_ptr<GenericFunctionParameters> argsCopy{ new auto(args.copy()), [](GenericFunctionParameters* object) {
-          object->destroy(); // see GenericFunctionParameters::copy() for details
-          delete object;
-        } };
-
-        executionContext->post([subscriberCopy, argsCopy] () mutable{
-          subscriberCopy.callImpl(*argsCopy);
+        // The subscriber and the arguments share one allocation, and the
+        // callback only captures a pointer to it, small enough not to be
+        // allocated by boost::function.
+        auto call = std::make_shared<QueuedCall>(*this, args);
+        executionContext->post([call] {
+          call->subscriber.callImpl(call->args);
         });
 
       }
@@ -399,6 +461,7 @@ namespace qi {
     subscriberInMap = src;
     subscriberInMap._p->linkId = res;
     subscriberInMap._p->source = this->_p;
+    _p->publishSubscribers();
     Future<void> callingOnSubscribers{nullptr};
     if (first && _p->onSubscribers)
     {
@@ -439,6 +502,7 @@ namespace qi {
       return;
 
     _p->subscriberMap.erase(it->second);
+    _p->publishSubscribers();
     _p->trackMap.erase(it);
   }
 
@@ -508,6 +572,7 @@ namespace qi {
   {
     boost::recursive_mutex::scoped_lock lock(_p->mutex);
     _p->signature = s;
+    std::atomic_store(&_p->lastArgumentsCheck, std::shared_ptr<const SignalArgumentsCheck>());
   }
 
 
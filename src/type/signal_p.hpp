@@ -7,6 +7,10 @@
 #ifndef _SRC_SIGNAL_P_HPP_
 #define _SRC_SIGNAL_P_HPP_
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include <qi/signal.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/recursive_mutex.hpp>
@@ -15,13 +19,28 @@ namespace qi {
 
   using SignalSubscriberMap = std::map<SignalLink, SignalSubscriber>;
   using TrackMap = std::map<int, SignalLink>;
+  /// Never modified once published, see `SignalBasePrivate::subscribers`.
+  using SignalSubscriberSnapshot = std::shared_ptr<std::vector<SignalSubscriber>>;
+
+  /// The types of the arguments of an emit, and whether they match the
+  /// signature of the signal.
+  struct SignalArgumentsCheck
+  {
+    static const std::size_t maxArgumentCount = 8;
+
+    std::array<TypeInterface*, maxArgumentCount> types;
+    std::size_t count;
+    bool matches;
+  };
 
   class SignalBasePrivate
   {
   public:
     SignalBasePrivate()
       : execContext(nullptr)
+      , subscribers(std::make_shared<std::vector<SignalSubscriber>>())
       , defaultCallType(MetaCallType_Auto)
+      , hasTriggerOverride(false)
     {}
 
     ~SignalBasePrivate();
@@ -32,15 +51,27 @@ namespace qi {
     friend class SignalBase;
     Future<bool> disconnectAllStep(bool overallSuccess);
 
+    /// Publishes a new snapshot of the subscriber map. Must be called with
+    /// the mutex locked, after each change of the map.
+    void publishSubscribers();
+
     SignalBase::OnSubscribers      onSubscribers;
     ExecutionContext*              execContext;
     SignalSubscriberMap            subscriberMap;
+    // Copy of the subscriber map read by emits without locking the mutex,
+    // swapped atomically (std::atomic_load / std::atomic_store).
+    SignalSubscriberSnapshot       subscribers;
     TrackMap                       trackMap;
     qi::Atomic<int>                trackId;
     qi::Signature                  signature;
+    // Check of the last argument types emitted, reset when the signature
+    // changes. Accessed atomically, as `subscribers`.
+    std::shared_ptr<const SignalArgumentsCheck> lastArgumentsCheck;
     boost::recursive_mutex         mutex;
-    MetaCallType                   defaultCallType;
+    std::atomic<MetaCallType>      defaultCallType;
     SignalBase::Trigger            triggerOverride;
+    std::atomic<bool>              hasTriggerOverride;
+    RemoteEventPolicy              remoteEventPolicy;
   };
 
 }
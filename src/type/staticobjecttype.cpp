@@ -201,6 +201,13 @@ qi::Future<SignalLink> StaticObjectTypeBase::connect(void* instance, AnyObject c
   return qi::Future<SignalLink>(link);
 }
 
+SignalBase* StaticObjectTypeBase::signal(void* instance, AnyObject context, unsigned int id)
+{
+  if (id >= Manageable::startId && id < Manageable::endId)
+    instance = static_cast<Manageable*>(context.asGenericObject());
+  return getSignal(_data, instance, id);
+}
+
 qi::Future<void> StaticObjectTypeBase::disconnect(void* instance, AnyObject context, SignalLink linkId)
 {
   qiLogDebug() << "Disconnect " << linkId;
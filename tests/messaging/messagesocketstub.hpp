@@ -0,0 +1,57 @@
+#pragma once
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#ifndef QI_TEST_MESSAGESOCKETSTUB_HPP
+#define QI_TEST_MESSAGESOCKETSTUB_HPP
+
+#include <atomic>
+#include <boost/thread/mutex.hpp>
+#include <qi/os.hpp>
+#include "src/messaging/messagesocket.hpp"
+
+// Keeps the last message sent, without any network.
+class MessageSocketStub : public qi::MessageSocket
+{
+public:
+  qi::FutureSync<void> connect(const qi::Url&) override { return qi::Future<void>{nullptr}; }
+  qi::FutureSync<void> disconnect() override { return qi::Future<void>{nullptr}; }
+  bool ensureReading() override { return true; }
+  Status status() const override { return Status::Connected; }
+  boost::optional<qi::Url> remoteEndpoint() const override { return {}; }
+  qi::Url url() const override { return {}; }
+
+  bool send(const qi::Message& msg) override
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      lastSent = msg;
+    }
+    ++sentCount;
+    return true;
+  }
+
+  qi::Message last()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    return lastSent;
+  }
+
+  std::atomic<int> sentCount{0};
+
+private:
+  boost::mutex mutex;
+  qi::Message lastSent;
+};
+
+/// Waits until `socket` sent `count` messages, for 5 seconds at most.
+inline bool waitForSentCount(MessageSocketStub& socket, int count)
+{
+  for (int i = 0; i != 500 && socket.sentCount.load() < count; ++i)
+    qi::os::msleep(10);
+  return socket.sentCount.load() >= count;
+}
+
+#endif // QI_TEST_MESSAGESOCKETSTUB_HPP
@@ -25,6 +25,16 @@ namespace mock
           defaultAsyncReadSocket<qi::sock::SocketWithContext<N>>;
   N::_anyAsyncReaderNextLayer N::_async_read_next_layer = defaultAsyncReadNextLayer;
 
+  template <>
+  N::_anyAsyncReaderSocket<N::ssl_socket_type>
+      N::SocketFunctions<N::ssl_socket_type>::_async_read_some_socket =
+          defaultAsyncReadSocket<N::ssl_socket_type>;
+  template <>
+  N::_anyAsyncReaderSocket<qi::sock::SocketWithContext<N>>
+      N::SocketFunctions<qi::sock::SocketWithContext<N>>::_async_read_some_socket =
+          defaultAsyncReadSocket<qi::sock::SocketWithContext<N>>;
+  N::_anyAsyncReaderNextLayer N::_async_read_some_next_layer = defaultAsyncReadNextLayer;
+
   template <>
   N::_anyAsyncWriterSocket<N::ssl_socket_type>
       N::SocketFunctions<N::ssl_socket_type>::_async_write_socket =
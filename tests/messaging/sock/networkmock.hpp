@@ -283,6 +283,7 @@ namespace mock
     struct SocketFunctions
     {
       static _anyAsyncReaderSocket<NetSslSocket> _async_read_socket;
+      static _anyAsyncReaderSocket<NetSslSocket> _async_read_some_socket;
       static _anyAsyncWriterSocket<NetSslSocket> _async_write_socket;
     };
 
@@ -292,10 +293,17 @@ namespace mock
       SocketFunctions<NetSslSocket>::_async_read_socket(s, b, h);
     }
 
-    template<typename NetSslSocket, typename NetTransferHandler>
-    static void async_write(NetSslSocket& s, const std::vector<_const_buffer_sequence>& b, NetTransferHandler h)
+    template<typename NetTransferHandler, typename NetSslSocket>
+    static void async_read_some(NetSslSocket& s, _mutable_buffer_sequence b, NetTransferHandler h)
     {
-      SocketFunctions<NetSslSocket>::_async_write_socket(s, b, h);
+      SocketFunctions<NetSslSocket>::_async_read_some_socket(s, b, h);
+    }
+
+    template<typename NetSslSocket, typename ConstBufferSequence, typename NetTransferHandler>
+    static void async_write(NetSslSocket& s, const ConstBufferSequence& b, NetTransferHandler h)
+    {
+      SocketFunctions<NetSslSocket>::_async_write_socket(
+        s, std::vector<_const_buffer_sequence>(b.begin(), b.end()), h);
     }
 
     using _anyAsyncReaderNextLayer = std::function<void (ssl_socket_type::next_layer_type&, _mutable_buffer_sequence, _anyTransferHandler)>;
@@ -307,13 +315,21 @@ namespace mock
       _async_read_next_layer(s, b, h);
     }
 
+    static _anyAsyncReaderNextLayer _async_read_some_next_layer;
+
+    template<typename NetTransferHandler>
+    static void async_read_some(ssl_socket_type::next_layer_type& s, _mutable_buffer_sequence b, NetTransferHandler h)
+    {
+      _async_read_some_next_layer(s, b, h);
+    }
+
     using _anyAsyncWriterNextLayer = std::function<void (ssl_socket_type::next_layer_type&, const std::vector<_const_buffer_sequence>&, _anyTransferHandler)>;
     static _anyAsyncWriterNextLayer _async_write_next_layer;
 
-    template<typename NetTransferHandler>
-    static void async_write(ssl_socket_type::next_layer_type& s, const std::vector<_const_buffer_sequence>& b, NetTransferHandler h)
+    template<typename ConstBufferSequence, typename NetTransferHandler>
+    static void async_write(ssl_socket_type::next_layer_type& s, const ConstBufferSequence& b, NetTransferHandler h)
     {
-      _async_write_next_layer(s, b, h);
+      _async_write_next_layer(s, std::vector<_const_buffer_sequence>(b.begin(), b.end()), h);
     }
   };
 
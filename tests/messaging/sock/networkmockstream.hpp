@@ -0,0 +1,143 @@
+#pragma once
+#ifndef _QI_TESTS_MESSAGING_NETWORKMOCKSTREAM_HPP
+#define _QI_TESTS_MESSAGING_NETWORKMOCKSTREAM_HPP
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <ka/functional.hpp>
+#include <ka/scoped.hpp>
+#include <qi/buffer.hpp>
+#include <qi/messaging/sock/receive.hpp>
+#include "src/messaging/message.hpp"
+#include "networkmock.hpp"
+
+/// @file
+/// Contains mock streams of messages on top of the network mock, used by the
+/// socket tests and benchmarks.
+
+namespace mock
+{
+  /// Serves the bytes of a sequence of messages to the read operations of the
+  /// network mock, and counts these operations (each one would be a system
+  /// call on a real socket).
+  ///
+  /// Reads are completed one by one by `run()`, to avoid unbounded recursion.
+  /// Once all bytes have been served, reads fail with a `shutdown` error.
+  struct MessageStream
+  {
+    std::vector<unsigned char> _bytes;
+    std::size_t _offset = 0u;
+    int _readCount = 0;
+    std::function<void ()> _pendingRead;
+
+    void append(qi::Message::Header header, const std::vector<unsigned char>& payload)
+    {
+      header.size = static_cast<qi::uint32_t>(payload.size());
+      auto p = reinterpret_cast<const unsigned char*>(&header);
+      _bytes.insert(_bytes.end(), p, p + sizeof(header));
+      _bytes.insert(_bytes.end(), payload.begin(), payload.end());
+    }
+
+    /// If `fill` is true, the read only succeeds if the whole buffer can be
+    /// filled (like `async_read`). Otherwise, the buffer is filled with as much
+    /// data as available (like `async_read_some`).
+    void read(N::_mutable_buffer_sequence buf, N::_anyTransferHandler h, bool fill)
+    {
+      ++_readCount;
+      _pendingRead = [=] {
+        const std::size_t wanted = buf.end - buf.begin;
+        const std::size_t n = std::min(wanted, _bytes.size() - _offset);
+        if (n == 0u || (fill && n < wanted))
+        {
+          h(qi::sock::shutdown<N::error_code_type>(), 0u);
+          return;
+        }
+        std::copy(_bytes.begin() + _offset, _bytes.begin() + _offset + n, buf.begin);
+        _offset += n;
+        h(N::error_code_type{}, n);
+      };
+    }
+
+    void run()
+    {
+      while (_pendingRead)
+      {
+        auto read = std::move(_pendingRead);
+        _pendingRead = nullptr;
+        read();
+      }
+    }
+  };
+
+  /// Procedure that counts its invocations before calling the wrapped procedure.
+  template<typename Proc>
+  struct CountInvocations
+  {
+    Proc _proc;
+    int* _count;
+    template<typename... Args>
+    void operator()(Args&&... args)
+    {
+      ++*_count;
+      _proc(std::forward<Args>(args)...);
+    }
+  };
+
+  /// Transformation<Procedure>
+  struct CountInvocationsTransfo
+  {
+    int* _count;
+    template<typename Proc>
+    CountInvocations<Proc> operator()(Proc proc) const
+    {
+      return {std::move(proc), _count};
+    }
+  };
+
+  struct ReceiveStats
+  {
+    int readCount;
+    int handlerCount;
+    /// Buffers of the received messages, in order.
+    std::vector<qi::Buffer> payloads;
+  };
+
+  /// Receives all the messages of the stream with a receive buffer of the
+  /// given size (0 means unbuffered reception).
+  inline ReceiveStats receiveAll(MessageStream& stream, std::size_t receiveBufferSize)
+  {
+    using namespace qi;
+    using namespace qi::sock;
+    auto readNextLayer = [&](S::next_layer_type&, N::_mutable_buffer_sequence buf, N::_anyTransferHandler h) {
+      stream.read(buf, h, true);
+    };
+    auto readSomeNextLayer = [&](S::next_layer_type&, N::_mutable_buffer_sequence buf, N::_anyTransferHandler h) {
+      stream.read(buf, h, false);
+    };
+    auto _0 = ka::scoped_set_and_restore(N::_async_read_next_layer, readNextLayer);
+    auto _1 = ka::scoped_set_and_restore(N::_async_read_some_next_layer, readSomeNextLayer);
+
+    SslContext<N> context;
+    auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+    const size_t maxPayload = 100000000;
+    ReceiveStats stats{0, 0, {}};
+    ReceiveMessageContinuous<N> receive{receiveBufferSize};
+    receive(socket, SslEnabled{false}, maxPayload,
+      [&](ErrorCode<N> e, const Message* msg) {
+        if (e)
+        {
+          return false;
+        }
+        stats.payloads.push_back(msg->buffer());
+        return true;
+      },
+      ka::id_transfo_t{},
+      CountInvocationsTransfo{&stats.handlerCount}
+    );
+    stream.run();
+    stats.readCount = stream._readCount;
+    return stats;
+  }
+} // namespace mock
+
+#endif // _QI_TESTS_MESSAGING_NETWORKMOCKSTREAM_HPP
@@ -13,6 +13,7 @@
 #include "src/messaging/tcpmessagesocket.hpp"
 #include "networkcommon.hpp"
 #include "networkmock.hpp"
+#include "networkmockstream.hpp"
 #include <qi/messaging/sock/receive.hpp>
 #include <qi/messaging/sock/accept.hpp>
 
@@ -525,3 +526,117 @@ TEST(NetReceiveMessage, Asio)
 
   close<N>(clientSideSocket);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+/// NetReceiveMessageBuffered tests:
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  void expectPayloads(const std::vector<std::vector<unsigned char>>& expected,
+    const std::vector<qi::Buffer>& payloads)
+  {
+    ASSERT_EQ(expected.size(), payloads.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+      ASSERT_EQ(expected[i].size(), payloads[i].size());
+      EXPECT_TRUE(std::equal(expected[i].begin(), expected[i].end(),
+        static_cast<const unsigned char*>(payloads[i].data())));
+    }
+  }
+}
+
+TEST(NetReceiveMessageBuffered, ReceivesMessagesOfVariousSizes)
+{
+  const std::size_t receiveBufferSize = 4096;
+  const std::vector<std::size_t> sizes{0, 1, 10, 4000, 4068, 4069, 5000, 100000, 3, 0, 65536, 12};
+  mock::MessageStream stream;
+  std::vector<std::vector<unsigned char>> payloads;
+  for (std::size_t i = 0; i < sizes.size(); ++i)
+  {
+    std::vector<unsigned char> payload(sizes[i]);
+    std::iota(payload.begin(), payload.end(), static_cast<unsigned char>(i));
+    stream.append(qi::Message::Header{}, payload);
+    payloads.push_back(std::move(payload));
+  }
+  // The payloads are checked once all messages have been received: the ones
+  // sliced from the receive buffer must not be overwritten by the next reads.
+  const auto stats = mock::receiveAll(stream, receiveBufferSize);
+  expectPayloads(payloads, stats.payloads);
+  ASSERT_EQ(stream._bytes.size(), stream._offset);
+}
+
+TEST(NetReceiveMessageBuffered, PayloadsAreNotCopied)
+{
+  const std::size_t receiveBufferSize = 4096;
+  mock::MessageStream stream;
+  std::vector<std::vector<unsigned char>> payloads;
+  for (std::size_t i = 0; i < 3; ++i)
+  {
+    payloads.emplace_back(100u, static_cast<unsigned char>(i));
+    stream.append(qi::Message::Header{}, payloads.back());
+  }
+  const auto stats = mock::receiveAll(stream, receiveBufferSize);
+  expectPayloads(payloads, stats.payloads);
+
+  // The messages were received by a single read, and their payloads refer to
+  // the receive buffer, after their header.
+  ASSERT_EQ(2, stats.readCount);
+  const auto data = [&](std::size_t i) {
+    return static_cast<const unsigned char*>(stats.payloads[i].data());
+  };
+  const auto messageSize = sizeof(qi::Message::Header) + 100u;
+  ASSERT_EQ(data(0) + messageSize, data(1));
+  ASSERT_EQ(data(1) + messageSize, data(2));
+}
+
+TEST(NetReceiveMessageBuffered, FailsOnBadMessageCookie)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+
+  mock::MessageStream stream;
+  Message::Header header;
+  ++header.magic; // make it wrong
+  stream.append(header, std::vector<unsigned char>(10u));
+  auto _ = ka::scoped_set_and_restore(N::_async_read_some_next_layer,
+    [&](mock::S::next_layer_type&, N::_mutable_buffer_sequence buf, N::_anyTransferHandler h) {
+      stream.read(buf, h, false);
+    });
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  const size_t maxPayload = 10000;
+  ErrorCode<N> error;
+  ReceiveMessageContinuous<N> receive{1024u};
+  receive(socket, SslEnabled{false}, maxPayload, [&](ErrorCode<N> e, const Message*) {
+    error = e;
+    return false;
+  });
+  stream.run();
+  ASSERT_EQ(fault<ErrorCode<N>>(), error);
+}
+
+TEST(NetReceiveMessageBuffered, FailsOnPayloadTooBig)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+
+  mock::MessageStream stream;
+  const size_t maxPayload = 100;
+  stream.append(Message::Header{}, std::vector<unsigned char>(maxPayload + 1));
+  auto _ = ka::scoped_set_and_restore(N::_async_read_some_next_layer,
+    [&](mock::S::next_layer_type&, N::_mutable_buffer_sequence buf, N::_anyTransferHandler h) {
+      stream.read(buf, h, false);
+    });
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  ErrorCode<N> error;
+  ReceiveMessageContinuous<N> receive{1024u};
+  receive(socket, SslEnabled{false}, maxPayload, [&](ErrorCode<N> e, const Message*) {
+    error = e;
+    return false;
+  });
+  stream.run();
+  ASSERT_EQ(messageSize<ErrorCode<N>>(), error);
+}
@@ -0,0 +1,80 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <qi/perf/dataperfsuite.hpp>
+#include "networkmockstream.hpp"
+
+namespace po = boost::program_options;
+
+// Reports the number of reads (that is, system calls on a real socket) and of
+// network handler invocations per received message, with and without a
+// receive buffer, on the network mock.
+int main(int argc, char* argv[])
+{
+  po::options_description desc;
+  desc.add_options()
+    ("help,h", "Print this help.");
+  desc.add(qi::detail::getPerfOptions());
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  qi::DataPerfSuite out("qi", "test_receive_benchmark", qi::DataPerfSuite::OutputData_Period,
+                        vm["output"].as<std::string>());
+  const std::size_t receiveBufferSize = 65536;
+  for (std::size_t payloadSize : {0u, 16u, 256u, 4096u, 100000u})
+  {
+    // Enough messages for stable ratios, with a few MB of traffic at most.
+    const int messageCount = payloadSize > receiveBufferSize ? 20 : 1000;
+    mock::MessageStream stream;
+    for (int i = 0; i < messageCount; ++i)
+    {
+      stream.append(qi::Message::Header{},
+                    std::vector<unsigned char>(payloadSize, static_cast<unsigned char>(i)));
+    }
+    mock::MessageStream bufferedStream = stream;
+
+    qi::DataPerf dp;
+    dp.start("Receive_Unbuffered", messageCount, static_cast<unsigned long>(payloadSize),
+             std::to_string(payloadSize));
+    const auto unbuffered = mock::receiveAll(stream, 0u);
+    dp.stop();
+    out << dp;
+
+    dp.start("Receive_Buffered", messageCount, static_cast<unsigned long>(payloadSize),
+             std::to_string(payloadSize));
+    const auto buffered = mock::receiveAll(bufferedStream, receiveBufferSize);
+    dp.stop();
+    out << dp;
+
+    if (static_cast<int>(unbuffered.payloads.size()) != messageCount
+        || static_cast<int>(buffered.payloads.size()) != messageCount)
+    {
+      std::cerr << "Some messages were not received." << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << std::fixed << std::setprecision(3)
+              << "payload " << payloadSize << " bytes, per message:"
+              << " unbuffered: " << double(unbuffered.readCount) / messageCount << " reads, "
+              << double(unbuffered.handlerCount) / messageCount << " handlers;"
+              << " buffered: " << double(buffered.readCount) / messageCount << " reads, "
+              << double(buffered.handlerCount) / messageCount << " handlers" << std::endl;
+  }
+  out.close();
+  return EXIT_SUCCESS;
+}
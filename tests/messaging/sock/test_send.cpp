@@ -1,6 +1,9 @@
 #include <thread>
 #include <future>
 #include <mutex>
+#include <numeric>
+#include <iostream>
+#include <functional>
 #include <boost/shared_ptr.hpp>
 #include <boost/optional.hpp>
 #include <gtest/gtest.h>
@@ -228,7 +231,7 @@ TYPED_TEST(NetSendMessageEnqueue, MultipleSendsFromMultipleThreads)
   );
   SslContext<N> context;
   auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
-  using I = std::list<Message>::const_iterator;
+  using I = typename SendMessageEnqueue::ReadableMessage;
   std::atomic<unsigned> sentCount{0u};
   Promise<void> promiseEnoughSent;
   SendMessageEnqueue send{socket};
@@ -286,7 +289,7 @@ TEST(NetSendMessageEnqueue, MultipleSendsFromMultipleThreadsAsio)
 
   SslContext<N> context{ Method<SslContext<N>>::sslv23 };
   auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
-  using I = std::list<Message>::const_iterator;
+  using I = SendMessageEnqueue<N, SslSocketPtr<N>>::ReadableMessage;
   const unsigned sendThreadCount = 100u;
   const unsigned perSendThreadMessageCount = 100u;
   const unsigned maxSentCount = sendThreadCount * perSendThreadMessageCount;
@@ -329,3 +332,172 @@ TEST(NetSendMessageEnqueue, MultipleSendsFromMultipleThreadsAsio)
   // Allow detached thread to finish.
   for (auto& t: sendThreads) t.join();
 }
+
+namespace
+{
+  // Stores the write continuations instead of calling them, so that the test
+  // controls when the writes complete.
+  struct PendingWrites
+  {
+    using N = mock::Network;
+    std::vector<std::size_t> bufferCounts;
+    std::vector<N::_anyTransferHandler> continuations;
+
+    void operator()(qi::sock::SslSocket<N>::next_layer_type&,
+      const std::vector<N::_const_buffer_sequence>& buffers, N::_anyTransferHandler writeCont)
+    {
+      bufferCounts.push_back(buffers.size());
+      continuations.push_back(writeCont);
+    }
+
+    // Completes the oldest pending write.
+    void completeOne()
+    {
+      auto writeCont = continuations.front();
+      continuations.erase(continuations.begin());
+      writeCont(qi::sock::success<qi::sock::ErrorCode<N>>(), 0u);
+    }
+  };
+} // namespace
+
+TEST(NetSendMessageEnqueue, GathersEnqueuedMessagesInOneWrite)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  using SendMessageEnqueue = SendMessageEnqueue<N, SslSocketPtr<N>>;
+  using I = SendMessageEnqueue::ReadableMessage;
+  PendingWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  SendMessageEnqueue send{socket};
+  std::vector<unsigned int> sentIds;
+  auto onSent = [&](ErrorCode<N> erc, I msg) {
+    EXPECT_EQ(success<ErrorCode<N>>(), erc);
+    sentIds.push_back(msg->id());
+    return true;
+  };
+  const unsigned int messageCount = 10u;
+  for (unsigned int id = 0u; id != messageCount; ++id)
+  {
+    Message msg;
+    msg.setId(id);
+    send(std::move(msg), SslEnabled{false}, onSent);
+  }
+  // The first message is written alone, the others are enqueued meanwhile.
+  ASSERT_EQ(1u, writes.continuations.size());
+  ASSERT_EQ(2u, writes.bufferCounts.back());
+  writes.completeOne();
+  ASSERT_EQ(std::vector<unsigned int>{0u}, sentIds);
+
+  // The enqueued messages are written at once (a header and a data buffer per message).
+  ASSERT_EQ(1u, writes.continuations.size());
+  ASSERT_EQ(2u * (messageCount - 1u), writes.bufferCounts.back());
+  writes.completeOne();
+  ASSERT_TRUE(writes.continuations.empty());
+  std::vector<unsigned int> expectedIds(messageCount);
+  std::iota(expectedIds.begin(), expectedIds.end(), 0u);
+  ASSERT_EQ(expectedIds, sentIds);
+}
+
+TEST(NetSendMessageEnqueue, GatheringRespectsLimits)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  using SendMessageEnqueue = SendMessageEnqueue<N, SslSocketPtr<N>>;
+  using I = SendMessageEnqueue::ReadableMessage;
+  PendingWrites writes;
+  auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+  SslContext<N> context;
+  auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+  const std::size_t dataSize = 1000u;
+  // Room for 3 messages of `dataSize` bytes, or 2 messages considering buffers.
+  const SendBatchLimits limits{3u * (sizeof(Message::Header) + dataSize), 4u};
+  SendMessageEnqueue send{socket, limits};
+  unsigned int sentCount = 0u;
+  auto onSent = [&](ErrorCode<N>, I) {
+    ++sentCount;
+    return true;
+  };
+  const std::vector<char> data(dataSize, 'a');
+  for (int i = 0; i != 7; ++i)
+  {
+    Buffer buffer;
+    buffer.write(data.data(), data.size());
+    Message msg;
+    msg.setBuffer(std::move(buffer));
+    send(std::move(msg), SslEnabled{false}, onSent);
+  }
+  while (!writes.continuations.empty())
+  {
+    writes.completeOne();
+  }
+  ASSERT_EQ(7u, sentCount);
+  const std::vector<std::size_t> expectedBufferCounts{2u, 4u, 4u, 4u};
+  ASSERT_EQ(expectedBufferCounts, writes.bufferCounts);
+
+  // A message that exceeds the limits alone is still written.
+  writes.bufferCounts.clear();
+  const std::vector<char> bigData(2 * limits.maxByteCount, 'b');
+  Buffer bigBuffer;
+  bigBuffer.write(bigData.data(), bigData.size());
+  Message bigMsg;
+  bigMsg.setBuffer(std::move(bigBuffer));
+  send(std::move(bigMsg), SslEnabled{false}, onSent);
+  writes.completeOne();
+  ASSERT_EQ(8u, sentCount);
+  ASSERT_EQ(std::vector<std::size_t>{2u}, writes.bufferCounts);
+}
+
+// Compares the number of writes needed to send a burst of messages, depending
+// on the limits.
+TEST(NetSendMessageEnqueue, BenchmarkWritesPerMessage)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = mock::Network;
+  using SendMessageEnqueue = SendMessageEnqueue<N, SslSocketPtr<N>>;
+  using I = SendMessageEnqueue::ReadableMessage;
+  const unsigned int burstSize = 100u;
+  const unsigned int burstCount = 100u;
+  const unsigned int messageCount = burstSize * burstCount;
+
+  auto writeCount = [&](SendBatchLimits limits) {
+    PendingWrites writes;
+    auto scopedWrite = ka::scoped_set_and_restore(N::_async_write_next_layer, std::ref(writes));
+    SslContext<N> context;
+    auto socket = makeSslSocketPtr<N>(N::defaultIoService(), context);
+    SendMessageEnqueue send{socket, limits};
+    unsigned int sentCount = 0u;
+    auto onSent = [&](ErrorCode<N>, I) {
+      ++sentCount;
+      return true;
+    };
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0u; i != burstCount; ++i)
+    {
+      for (unsigned int j = 0u; j != burstSize; ++j)
+      {
+        send(Message{}, SslEnabled{false}, onSent);
+      }
+      while (!writes.continuations.empty())
+      {
+        writes.completeOne();
+      }
+    }
+    const auto duration = std::chrono::steady_clock::now() - start;
+    EXPECT_EQ(messageCount, sentCount);
+    std::cout << "limits{" << limits.maxByteCount << ", " << limits.maxBufferCount << "}: "
+              << writes.bufferCounts.size() << " writes for " << messageCount << " messages ("
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / messageCount
+              << " ns/msg)" << std::endl;
+    return writes.bufferCounts.size();
+  };
+
+  const auto unbatchedWriteCount = writeCount(SendBatchLimits{0u});
+  const auto batchedWriteCount = writeCount(SendBatchLimits{});
+  ASSERT_EQ(messageCount, unbatchedWriteCount);
+  ASSERT_LT(batchedWriteCount, unbatchedWriteCount / 10u);
+}
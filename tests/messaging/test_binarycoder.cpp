@@ -6,7 +6,13 @@
 */
 
 #include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <list>
 #include <map>
+#include <numeric>
+#include <thread>
 #include <qi/buffer.hpp>
 #include <qi/binarycodec.hpp>
 #include <qi/session.hpp>
@@ -369,6 +375,109 @@ TEST(TestBind, serializeVectorStrings)
   EXPECT_EQ(vs[2], vs2[2]);
 }
 
+template<typename T>
+struct TestBindScalarVector : testing::Test
+{
+};
+
+using scalarTypes = testing::Types<char, signed char, unsigned char, short, unsigned short,
+  int, unsigned int, long, unsigned long, long long, unsigned long long, float, double>;
+
+TYPED_TEST_CASE(TestBindScalarVector, scalarTypes);
+
+// Vectors of scalars are copied in one block, lists of scalars element by
+// element: the result must be the same.
+TYPED_TEST(TestBindScalarVector, serializesLikeElementByElement)
+{
+  using T = TypeParam;
+  std::vector<T> v(1000);
+  for (std::size_t i = 0; i != v.size(); ++i)
+    v[i] = static_cast<T>(i * 7 + 3);
+  const std::list<T> l(v.begin(), v.end());
+
+  qi::Buffer vectorBuf;
+  qi::encodeBinary(&vectorBuf, v);
+  qi::Buffer listBuf;
+  qi::encodeBinary(&listBuf, l);
+  ASSERT_EQ(listBuf, vectorBuf);
+
+  qi::BufferReader vectorReader(vectorBuf);
+  std::vector<T> v1;
+  qi::decodeBinary(&vectorReader, &v1);
+  EXPECT_EQ(v, v1);
+
+  qi::BufferReader listReader(vectorBuf);
+  std::list<T> l1;
+  qi::decodeBinary(&listReader, &l1);
+  EXPECT_EQ(l, l1);
+}
+
+TYPED_TEST(TestBindScalarVector, serializesEmpty)
+{
+  using T = TypeParam;
+  qi::Buffer buf;
+  qi::encodeBinary(&buf, std::vector<T>{});
+  qi::BufferReader bufr(buf);
+  std::vector<T> v;
+  qi::decodeBinary(&bufr, &v);
+  EXPECT_TRUE(v.empty());
+}
+
+TEST(TestBind, deserializeTruncatedVectorOfScalarsFails)
+{
+  qi::Buffer buf;
+  const qi::uint32_t size = 100;
+  buf.write(&size, sizeof(size));
+  const std::vector<float> v(size - 1, 1.f);
+  buf.write(v.data(), v.size() * sizeof(float));
+
+  qi::BufferReader bufr(buf);
+  std::vector<float> v1;
+  EXPECT_ANY_THROW(qi::decodeBinary(&bufr, &v1));
+}
+
+namespace
+{
+  template<typename C>
+  void benchmarkSerialization(const char* name, const C& value)
+  {
+    using Clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    const int iterationCount = 10;
+    Clock::duration encodeDuration{};
+    Clock::duration decodeDuration{};
+    C result;
+    for (int i = 0; i != iterationCount; ++i)
+    {
+      qi::Buffer buf;
+      auto start = Clock::now();
+      qi::encodeBinary(&buf, value);
+      encodeDuration += Clock::now() - start;
+
+      qi::BufferReader bufr(buf);
+      result.clear();
+      start = Clock::now();
+      qi::decodeBinary(&bufr, &result);
+      decodeDuration += Clock::now() - start;
+    }
+    EXPECT_EQ(value, result);
+    std::cout << name << " of " << value.size() << " floats: encode "
+              << duration_cast<microseconds>(encodeDuration).count() / iterationCount << " us, decode "
+              << duration_cast<microseconds>(decodeDuration).count() / iterationCount << " us" << std::endl;
+  }
+}
+
+// Compares the serialization of vectors of scalars, copied in one block, with
+// the serialization of lists of scalars, visited element by element.
+TEST(TestBind, BenchmarkSerializeListOfScalars)
+{
+  std::vector<float> v(100000);
+  std::iota(v.begin(), v.end(), 0.f);
+  benchmarkSerialization("vector", v);
+  benchmarkSerialization("list", std::list<float>(v.begin(), v.end()));
+}
+
 TEST(TestBind, serializeBuffer)
 {
   qi::Buffer buf;
@@ -540,6 +649,78 @@ TEST(TestBind, SerializeCustomComplex)
   ASSERT_EQ(comp, compout);
 }
 
+namespace
+{
+  Complex makeComplex()
+  {
+    Complex comp;
+    comp.foo = 1.5;
+    comp.points.push_back(point(1, 2));
+    comp.points.push_back(point(3, 4));
+    comp.baz = "testbaz";
+    comp.stuff.push_back(std::vector<int>{1, 2});
+    comp.stuff.push_back(std::vector<int>{1, 2, 3});
+    return comp;
+  }
+}
+
+// The codec caches what it derives from types: concurrent uses of the same
+// types must give the same result.
+TEST(TestBind, SerializeCustomComplexFromMultipleThreads)
+{
+  const Complex comp = makeComplex();
+  qi::Buffer expected;
+  qi::encodeBinary(&expected, comp);
+
+  std::vector<std::thread> threads;
+  std::atomic<int> failureCount{0};
+  for (int i = 0; i != 8; ++i)
+  {
+    threads.emplace_back([&] {
+      for (int j = 0; j != 1000; ++j)
+      {
+        qi::Buffer buf;
+        qi::encodeBinary(&buf, comp);
+        qi::BufferReader bufr(buf);
+        Complex compout;
+        qi::decodeBinary(&bufr, &compout);
+        if (!(buf == expected) || !(comp == compout))
+          ++failureCount;
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  ASSERT_EQ(0, failureCount.load());
+}
+
+TEST(TestBind, BenchmarkSerializeCustomComplex)
+{
+  using Clock = std::chrono::steady_clock;
+  const Complex comp = makeComplex();
+  const int iterationCount = 100000;
+  Clock::duration encodeDuration{};
+  Clock::duration decodeDuration{};
+  for (int i = 0; i != iterationCount; ++i)
+  {
+    qi::Buffer buf;
+    auto start = Clock::now();
+    qi::encodeBinary(&buf, comp);
+    encodeDuration += Clock::now() - start;
+
+    qi::BufferReader bufr(buf);
+    Complex compout;
+    start = Clock::now();
+    qi::decodeBinary(&bufr, &compout);
+    decodeDuration += Clock::now() - start;
+  }
+  using std::chrono::duration_cast;
+  using std::chrono::nanoseconds;
+  std::cout << "Complex struct: encode "
+            << duration_cast<nanoseconds>(encodeDuration).count() / iterationCount << " ns, decode "
+            << duration_cast<nanoseconds>(decodeDuration).count() / iterationCount << " ns" << std::endl;
+}
+
 //compilation of weird case. C++ typesystem Hell.
 TEST(TestBind, TestShPtr) {
   boost::shared_ptr<int> sh1;
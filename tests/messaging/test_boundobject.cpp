@@ -0,0 +1,553 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <gtest/gtest.h>
+#include <qi/anyobject.hpp>
+#include <qi/messaging/calldeadline.hpp>
+#include <qi/os.hpp>
+#include <qi/type/dynamicobjectbuilder.hpp>
+#include "src/messaging/boundobject.hpp"
+#include "src/messaging/messagesocket.hpp"
+#include "messagesocketstub.hpp"
+
+namespace
+{
+  int add(int a, int b)
+  {
+    return a + b;
+  }
+
+  const int clientCount = 16;
+
+  // Counts the calls to meet(). Tests reset it before calling meet().
+  struct Meeting
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    int count = 0;
+  };
+
+  Meeting& meeting()
+  {
+    static Meeting meeting;
+    return meeting;
+  }
+
+  // Returns true once clientCount calls are running at the same time, false
+  // if they did not after a while.
+  bool meet()
+  {
+    auto& m = meeting();
+    std::unique_lock<std::mutex> lock(m.mutex);
+    if (++m.count == clientCount)
+      m.condition.notify_all();
+    return m.condition.wait_for(lock, std::chrono::seconds(5), [&m] { return m.count >= clientCount; });
+  }
+
+  // Stands for a stateless method waiting for some resource.
+  int work(int value)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return value;
+  }
+
+  // Milliseconds left before the deadline of the call, -1 without deadline.
+  int remainingTime()
+  {
+    const auto deadline = qi::currentCallDeadline();
+    if (!deadline)
+      return -1;
+    return static_cast<int>(
+        boost::chrono::duration_cast<qi::MilliSeconds>(*deadline - qi::SteadyClock::now()).count());
+  }
+
+  // Lets a test hold a call running.
+  struct Gate
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool entered = false;
+    bool open = false;
+  };
+
+  Gate& gate()
+  {
+    static Gate gate;
+    return gate;
+  }
+
+  int hold()
+  {
+    auto& g = gate();
+    std::unique_lock<std::mutex> lock(g.mutex);
+    g.entered = true;
+    g.condition.notify_all();
+    g.condition.wait_for(lock, std::chrono::seconds(5), [&g] { return g.open; });
+    return 0;
+  }
+
+  // The values recorded, in the order of the calls.
+  std::vector<int>& recorded()
+  {
+    static std::vector<int> values;
+    return values;
+  }
+
+  int record(int value)
+  {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    recorded().push_back(value);
+    return value;
+  }
+
+  // The result of the calls to later(), set by the test.
+  qi::Promise<int>& laterResult()
+  {
+    static qi::Promise<int> promise;
+    return promise;
+  }
+
+  qi::Future<int> later()
+  {
+    return laterResult().future();
+  }
+
+  const unsigned int serviceId = 42;
+
+  qi::AnyObject makeAdder()
+  {
+    qi::DynamicObjectBuilder builder;
+    builder.setThreadingModel(qi::ObjectThreadingModel_MultiThread);
+    builder.advertiseMethod("add", &add);
+    builder.advertiseMethod("meet", &meet);
+    builder.advertiseMethod("work", &work);
+    builder.advertiseMethod("remainingTime", &remainingTime);
+    builder.advertiseMethod("hold", &hold);
+    builder.advertiseMethod("record", &record);
+    builder.advertiseMethod("later", &later);
+    return builder.object();
+  }
+
+  qi::Message makeCall(unsigned int id, unsigned int objectId, unsigned int function,
+                       const std::vector<qi::AnyReference>& values)
+  {
+    qi::Message msg(qi::Message::Type_Call, qi::MessageAddress(id, serviceId, objectId, function));
+    msg.setValues(values);
+    return msg;
+  }
+
+  qi::Message makeCall(unsigned int id, unsigned int objectId, unsigned int function, int a, int b)
+  {
+    return makeCall(id, objectId, function, {qi::AnyReference::from(a), qi::AnyReference::from(b)});
+  }
+
+  struct BoundAdder
+  {
+    explicit BoundAdder(unsigned int objectId = qi::Message::GenericObject_Main,
+                        qi::MetaCallType callType = qi::MetaCallType_Direct)
+      : socket(boost::make_shared<MessageSocketStub>())
+      , object(makeAdder())
+      , bound(boost::make_shared<qi::ServiceBoundObject>(serviceId, objectId, object, callType))
+      , addId(static_cast<unsigned int>(object.metaObject().methodId("add::(ii)")))
+    {
+    }
+
+    boost::shared_ptr<MessageSocketStub> socket;
+    qi::AnyObject object;
+    boost::shared_ptr<qi::ServiceBoundObject> bound;
+    unsigned int addId;
+  };
+}
+
+TEST(ServiceBoundObject, CallsAreDispatchedToTheirMethod)
+{
+  BoundAdder adder;
+  adder.bound->onMessage(makeCall(1, qi::Message::GenericObject_Main, adder.addId, 40, 2), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  auto reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Reply, reply.type());
+  EXPECT_EQ(1u, reply.id());
+  auto value = reply.value("i", adder.socket);
+  EXPECT_EQ(42, value.to<int>());
+  value.destroy();
+
+  adder.bound->onMessage(makeCall(2, qi::Message::GenericObject_Main, adder.addId + 1000, 40, 2), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 2));
+  reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Error, reply.type());
+  EXPECT_EQ(2u, reply.id());
+}
+
+TEST(ServiceBoundObject, CallsAreDispatchedToChildObjects)
+{
+  BoundAdder adder;
+  const unsigned int childId = 7;
+  BoundAdder child(childId);
+  adder.bound->addObject(child.bound, adder.socket.get(), childId);
+
+  adder.bound->onMessage(makeCall(1, childId, child.addId, 1, 2), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  auto reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Reply, reply.type());
+  auto value = reply.value("i", adder.socket);
+  EXPECT_EQ(3, value.to<int>());
+  value.destroy();
+}
+
+TEST(ServiceBoundObject, RemovedChildObjectsAreNotCalled)
+{
+  BoundAdder adder;
+  const unsigned int childId = 7;
+  BoundAdder child(childId);
+  adder.bound->addObject(child.bound, adder.socket.get(), childId);
+  adder.bound->onMessage(makeCall(1, childId, child.addId, 1, 2), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+
+  adder.bound->removeObject(childId);
+  adder.bound->onMessage(makeCall(2, childId, child.addId, 1, 2), adder.socket);
+  qi::os::msleep(50);
+  EXPECT_EQ(1, adder.socket->sentCount.load());
+}
+
+namespace
+{
+  // Removes itself from its host when it gets a message, and records the
+  // thread destroying it.
+  class SelfRemovingObject : public qi::BoundObject
+  {
+  public:
+    SelfRemovingObject(boost::weak_ptr<qi::ServiceBoundObject> host, unsigned int id,
+                       qi::Promise<std::thread::id> destroyed)
+      : _host(host)
+      , _id(id)
+      , _destroyed(destroyed)
+    {
+    }
+
+    ~SelfRemovingObject()
+    {
+      _destroyed.setValue(std::this_thread::get_id());
+    }
+
+    void onMessage(const qi::Message&, qi::MessageSocketPtr) override
+    {
+      if (auto host = _host.lock())
+        host->removeObject(_id);
+    }
+
+    void onSocketDisconnected(qi::MessageSocketPtr, std::string) override {}
+
+  private:
+    boost::weak_ptr<qi::ServiceBoundObject> _host;
+    unsigned int _id;
+    qi::Promise<std::thread::id> _destroyed;
+  };
+}
+
+TEST(ServiceBoundObject, ObjectsAreNotDestroyedByTheReceivingThread)
+{
+  BoundAdder adder;
+  const unsigned int childId = 7;
+  qi::Promise<std::thread::id> destroyed;
+  adder.bound->addObject(boost::make_shared<SelfRemovingObject>(adder.bound, childId, destroyed),
+                         adder.socket.get(), childId);
+
+  // The last reference is released while the message is handled.
+  adder.bound->onMessage(makeCall(1, childId, 0, 1, 2), adder.socket);
+  auto destroyedThread = destroyed.future();
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, destroyedThread.wait(5000));
+  EXPECT_NE(std::this_thread::get_id(), destroyedThread.value());
+}
+
+namespace
+{
+  qi::Message makeCallWithDeadline(unsigned int id, unsigned int function,
+                                   std::vector<qi::AnyReference> values, qi::uint32_t remainingMs)
+  {
+    values.push_back(qi::AnyReference::from(remainingMs));
+    auto msg = makeCall(id, qi::Message::GenericObject_Main, function, values);
+    msg.addFlags(qi::Message::TypeFlag_Deadline);
+    return msg;
+  }
+}
+
+TEST(ServiceBoundObject, CallsPastTheirDeadlineAreNotStarted)
+{
+  BoundAdder adder;
+  const auto skippedBefore = qi::callDeadlineStats().skippedCount;
+  adder.bound->onMessage(makeCallWithDeadline(1, adder.addId,
+                                              {qi::AnyReference::from(40), qi::AnyReference::from(2)}, 0),
+                         adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  const auto reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Error, reply.type());
+  EXPECT_EQ(1u, reply.id());
+  EXPECT_EQ(skippedBefore + 1, qi::callDeadlineStats().skippedCount);
+}
+
+TEST(ServiceBoundObject, CallsRunWithTheDeadlineOfTheirCaller)
+{
+  BoundAdder adder;
+  const auto remainingTimeId =
+      static_cast<unsigned int>(adder.object.metaObject().methodId("remainingTime::()"));
+  adder.bound->onMessage(makeCallWithDeadline(1, remainingTimeId, {}, 5000), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  auto value = adder.socket->last().value("i", adder.socket);
+  EXPECT_GT(value.to<int>(), 4000);
+  EXPECT_LE(value.to<int>(), 5000);
+  value.destroy();
+
+  adder.bound->onMessage(makeCall(2, qi::Message::GenericObject_Main, remainingTimeId, {}), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 2));
+  value = adder.socket->last().value("i", adder.socket);
+  EXPECT_EQ(-1, value.to<int>());
+  value.destroy();
+}
+
+namespace
+{
+  void closeGate()
+  {
+    auto& g = gate();
+    std::lock_guard<std::mutex> lock(g.mutex);
+    g.entered = false;
+    g.open = false;
+  }
+
+  void waitForHeldCall()
+  {
+    auto& g = gate();
+    std::unique_lock<std::mutex> lock(g.mutex);
+    g.condition.wait_for(lock, std::chrono::seconds(5), [&g] { return g.entered; });
+  }
+
+  void openGate()
+  {
+    auto& g = gate();
+    {
+      std::lock_guard<std::mutex> lock(g.mutex);
+      g.open = true;
+    }
+    g.condition.notify_all();
+  }
+
+  // Calls hold() from another thread, and returns once it runs.
+  std::thread holdCall(BoundAdder& adder, const boost::shared_ptr<MessageSocketStub>& socket)
+  {
+    const auto holdId = static_cast<unsigned int>(adder.object.metaObject().methodId("hold::()"));
+    closeGate();
+    std::thread thread([&adder, socket, holdId] {
+      adder.bound->onMessage(makeCall(1, qi::Message::GenericObject_Main, holdId, {}), socket);
+    });
+    waitForHeldCall();
+    return thread;
+  }
+
+  void releaseHeldCall(std::thread& thread)
+  {
+    openGate();
+    thread.join();
+  }
+}
+
+TEST(ServiceBoundObject, CallsStillRunningAtTheirDeadlineAreCanceled)
+{
+  // Queued, so that the call is still running when onMessage returns.
+  BoundAdder adder(qi::Message::GenericObject_Main, qi::MetaCallType_Queued);
+  const auto holdId = static_cast<unsigned int>(adder.object.metaObject().methodId("hold::()"));
+  const auto canceledBefore = qi::callDeadlineStats().canceledCount;
+  closeGate();
+  adder.bound->onMessage(makeCallWithDeadline(1, holdId, {}, 100), adder.socket);
+  waitForHeldCall();
+
+  for (int i = 0; i != 500 && qi::callDeadlineStats().canceledCount == canceledBefore; ++i)
+    qi::os::msleep(10);
+  EXPECT_EQ(canceledBefore + 1, qi::callDeadlineStats().canceledCount);
+
+  // The method cannot be interrupted: the caller gets a reply once it returns.
+  openGate();
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  EXPECT_EQ(1u, adder.socket->last().id());
+}
+
+TEST(ServiceBoundObject, CallsOverTheLimitsWaitThenAreRejected)
+{
+  BoundAdder adder;
+  qi::CallAdmission::Limits limits;
+  limits.maxCallsPerSocket = 1;
+  limits.maxQueuedCallsPerSocket = 1;
+  adder.bound->setCallLimits(limits);
+  const auto statsBefore = qi::callAdmissionStats();
+
+  auto held = holdCall(adder, adder.socket);
+  adder.bound->onMessage(makeCall(2, qi::Message::GenericObject_Main, adder.addId, 40, 2), adder.socket);
+  adder.bound->onMessage(makeCall(3, qi::Message::GenericObject_Main, adder.addId, 40, 2), adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  auto reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Error, reply.type());
+  EXPECT_EQ(3u, reply.id());
+
+  releaseHeldCall(held);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 3));
+  reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Reply, reply.type());
+  EXPECT_EQ(2u, reply.id());
+
+  const auto stats = qi::callAdmissionStats();
+  EXPECT_EQ(statsBefore.startedCount + 1, stats.startedCount);
+  EXPECT_EQ(statsBefore.queuedCount + 1, stats.queuedCount);
+  EXPECT_EQ(statsBefore.rejectedCount + 1, stats.rejectedCount);
+}
+
+TEST(ServiceBoundObject, WaitingCallsOfEachSocketStartInTurn)
+{
+  BoundAdder adder;
+  qi::CallAdmission::Limits limits;
+  limits.maxCallsPerService = 1;
+  limits.maxQueuedCallsPerSocket = 10;
+  adder.bound->setCallLimits(limits);
+  const auto recordId = static_cast<unsigned int>(adder.object.metaObject().methodId("record::(i)"));
+  auto other = boost::make_shared<MessageSocketStub>();
+  recorded().clear();
+
+  auto held = holdCall(adder, other);
+  for (int i = 0; i != 3; ++i)
+    adder.bound->onMessage(makeCall(i + 2, qi::Message::GenericObject_Main, recordId,
+                                    {qi::AnyReference::from(i)}), adder.socket);
+  adder.bound->onMessage(makeCall(2, qi::Message::GenericObject_Main, recordId,
+                                  {qi::AnyReference::from(10)}), other);
+  releaseHeldCall(held);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 3));
+  ASSERT_TRUE(waitForSentCount(*other, 2));
+  EXPECT_EQ((std::vector<int>{0, 10, 1, 2}), recorded());
+}
+
+TEST(ServiceBoundObject, CallsReturningAFutureRunUntilItIsSet)
+{
+  BoundAdder adder;
+  qi::CallAdmission::Limits limits;
+  limits.maxCallsPerSocket = 1;
+  limits.maxQueuedCallsPerSocket = 10;
+  adder.bound->setCallLimits(limits);
+  const auto laterId = static_cast<unsigned int>(adder.object.metaObject().methodId("later::()"));
+  laterResult() = qi::Promise<int>();
+
+  adder.bound->onMessage(makeCall(1, qi::Message::GenericObject_Main, laterId, {}), adder.socket);
+  adder.bound->onMessage(makeCall(2, qi::Message::GenericObject_Main, adder.addId, 40, 2), adder.socket);
+  qi::os::msleep(50);
+  EXPECT_EQ(0, adder.socket->sentCount.load());
+
+  laterResult().setValue(12);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 2));
+  const auto reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Reply, reply.type());
+  EXPECT_EQ(2u, reply.id());
+}
+
+TEST(ServiceBoundObject, WaitingCallsCanBeCanceled)
+{
+  BoundAdder adder;
+  qi::CallAdmission::Limits limits;
+  limits.maxCallsPerSocket = 1;
+  limits.maxQueuedCallsPerSocket = 10;
+  adder.bound->setCallLimits(limits);
+  const auto statsBefore = qi::callAdmissionStats();
+
+  auto held = holdCall(adder, adder.socket);
+  adder.bound->onMessage(makeCall(2, qi::Message::GenericObject_Main, adder.addId, 40, 2), adder.socket);
+  qi::Message cancel(qi::Message::Type_Cancel,
+                     qi::MessageAddress(3, serviceId, qi::Message::GenericObject_Main, 0));
+  cancel.setValue(qi::AnyReference::from(2u), "I");
+  adder.bound->onMessage(cancel, adder.socket);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 1));
+  const auto reply = adder.socket->last();
+  EXPECT_EQ(qi::Message::Type_Canceled, reply.type());
+  EXPECT_EQ(2u, reply.id());
+  EXPECT_EQ(statsBefore.canceledCount + 1, qi::callAdmissionStats().canceledCount);
+
+  // The canceled call does not run once the held one is finished.
+  releaseHeldCall(held);
+  ASSERT_TRUE(waitForSentCount(*adder.socket, 2));
+  qi::os::msleep(50);
+  EXPECT_EQ(2, adder.socket->sentCount.load());
+  EXPECT_EQ(1u, adder.socket->last().id());
+}
+
+TEST(ServiceBoundObject, CallsFromSeveralClientsRunConcurrently)
+{
+  BoundAdder adder;
+  const auto meetId = static_cast<unsigned int>(adder.object.metaObject().methodId("meet::()"));
+  {
+    std::lock_guard<std::mutex> lock(meeting().mutex);
+    meeting().count = 0;
+  }
+  std::vector<boost::shared_ptr<MessageSocketStub>> clients;
+  std::vector<std::thread> threads;
+  for (int i = 0; i != clientCount; ++i)
+  {
+    auto client = boost::make_shared<MessageSocketStub>();
+    clients.push_back(client);
+    threads.emplace_back([&adder, client, meetId] {
+      adder.bound->onMessage(makeCall(1, qi::Message::GenericObject_Main, meetId, {}), client);
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  for (const auto& client : clients)
+  {
+    ASSERT_TRUE(waitForSentCount(*client, 1));
+    auto value = client->last().value("b", client);
+    EXPECT_TRUE(value.to<bool>());
+    value.destroy();
+  }
+}
+
+namespace
+{
+  // Returns the number of calls per second.
+  double measureParallelCalls(BoundAdder& adder, int clients, int callsPerClient)
+  {
+    using Clock = std::chrono::steady_clock;
+    const auto workId = static_cast<unsigned int>(adder.object.metaObject().methodId("work::(i)"));
+    std::vector<std::thread> threads;
+    const auto start = Clock::now();
+    for (int i = 0; i != clients; ++i)
+    {
+      threads.emplace_back([&adder, workId, callsPerClient] {
+        auto client = boost::make_shared<MessageSocketStub>();
+        for (int call = 0; call != callsPerClient; ++call)
+          adder.bound->onMessage(makeCall(call + 1, qi::Message::GenericObject_Main, workId,
+                                          {qi::AnyReference::from(call)}), client);
+        waitForSentCount(*client, callsPerClient);
+      });
+    }
+    for (auto& thread : threads)
+      thread.join();
+    const auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(Clock::now() - start);
+    return clients * callsPerClient / duration.count();
+  }
+}
+
+// Direct calls of a stateless method from one client, then from several
+// clients in parallel.
+TEST(ServiceBoundObject, BenchmarkParallelCalls)
+{
+  BoundAdder adder;
+  const int callsPerClient = 200;
+  const double oneClient = measureParallelCalls(adder, 1, callsPerClient);
+  const double severalClients = measureParallelCalls(adder, clientCount, callsPerClient);
+  std::cout << "1 client: " << static_cast<int>(oneClient) << " calls/s, "
+            << clientCount << " clients: " << static_cast<int>(severalClients) << " calls/s ("
+            << severalClients / oneClient << "x)" << std::endl;
+}
@@ -0,0 +1,146 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/program_options.hpp>
+#include <qi/anyobject.hpp>
+#include <qi/perf/dataperfsuite.hpp>
+#include <qi/type/dynamicobjectbuilder.hpp>
+#include "src/messaging/boundobject.hpp"
+#include "messagesocketstub.hpp"
+
+namespace po = boost::program_options;
+
+namespace
+{
+  int add(int a, int b)
+  {
+    return a + b;
+  }
+
+  const unsigned int serviceId = 42;
+
+  qi::AnyObject makeAdder()
+  {
+    qi::DynamicObjectBuilder builder;
+    builder.setThreadingModel(qi::ObjectThreadingModel_MultiThread);
+    builder.advertiseMethod("add", &add);
+    return builder.object();
+  }
+
+  qi::Message makeCall(unsigned int id, unsigned int objectId, unsigned int function, int a, int b)
+  {
+    qi::Message msg(qi::Message::Type_Call, qi::MessageAddress(id, serviceId, objectId, function));
+    msg.setValues({qi::AnyReference::from(a), qi::AnyReference::from(b)});
+    return msg;
+  }
+
+  struct BoundAdder
+  {
+    explicit BoundAdder(unsigned int objectId = qi::Message::GenericObject_Main)
+      : socket(boost::make_shared<MessageSocketStub>())
+      , object(makeAdder())
+      , bound(boost::make_shared<qi::ServiceBoundObject>(serviceId, objectId, object,
+                                                         qi::MetaCallType_Direct))
+      , addId(static_cast<unsigned int>(object.metaObject().methodId("add::(ii)")))
+    {
+    }
+
+    boost::shared_ptr<MessageSocketStub> socket;
+    qi::AnyObject object;
+    boost::shared_ptr<qi::ServiceBoundObject> bound;
+    unsigned int addId;
+  };
+
+  // Dispatch of direct calls, from the reception of the message to the
+  // sending of the reply, without network.
+  bool measureDispatch(qi::DataPerfSuite& out, const std::string& name, BoundAdder& adder,
+                       unsigned int objectId, unsigned int addId)
+  {
+    const int count = 100 * 1000;
+    std::vector<qi::Message> messages;
+    messages.reserve(count);
+    for (int i = 0; i != count; ++i)
+      messages.push_back(makeCall(i + 1, objectId, addId, i, 1));
+
+    const int sentBefore = adder.socket->sentCount.load();
+    qi::DataPerf dp;
+    dp.start(name, count);
+    for (const auto& msg : messages)
+      adder.bound->onMessage(msg, adder.socket);
+    dp.stop();
+    out << dp;
+    return waitForSentCount(*adder.socket, sentBefore + count);
+  }
+
+  // Adds child objects one by one, each of them getting a call right after it
+  // was added, as objects returned by calls are.
+  bool measureAddThenCall(qi::DataPerfSuite& out, int childCount)
+  {
+    BoundAdder adder;
+    std::vector<BoundAdder> children;
+    children.reserve(childCount);
+    for (int i = 0; i != childCount; ++i)
+      children.emplace_back(static_cast<unsigned int>(i + 2));
+
+    qi::DataPerf dp;
+    dp.start("AddObject_ThenCall", childCount, 0, std::to_string(childCount));
+    for (int i = 0; i != childCount; ++i)
+    {
+      const auto childId = static_cast<unsigned int>(i + 2);
+      adder.bound->addObject(children[i].bound, adder.socket.get(), childId);
+      adder.bound->onMessage(makeCall(childId, childId, children[i].addId, 1, 2), adder.socket);
+    }
+    dp.stop();
+    out << dp;
+    return waitForSentCount(*adder.socket, childCount);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  po::options_description desc;
+  desc.add_options()
+    ("help,h", "Print this help.");
+  desc.add(qi::detail::getPerfOptions());
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  qi::DataPerfSuite out("qi", "test_boundobject_benchmark", qi::DataPerfSuite::OutputData_Period,
+                        vm["output"].as<std::string>());
+  bool replied = true;
+  {
+    BoundAdder adder;
+    replied &= measureDispatch(out, "Dispatch_Service", adder, qi::Message::GenericObject_Main,
+                               adder.addId);
+
+    const unsigned int childId = 7;
+    BoundAdder child(childId);
+    adder.bound->addObject(child.bound, adder.socket.get(), childId);
+    replied &= measureDispatch(out, "Dispatch_ChildObject", adder, childId, child.addId);
+  }
+  for (int childCount : {1000, 10000})
+    replied &= measureAddThenCall(out, childCount);
+  out.close();
+
+  if (!replied)
+  {
+    std::cerr << "Some calls got no reply." << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -2,7 +2,12 @@
 ** Copyright (C) 2012 Aldebaran Robotics
 */
 
+#include <atomic>
+#include <chrono>
+#include <iostream>
 #include <map>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 #include <qi/application.hpp>
 #include <qi/anyobject.hpp>
@@ -67,3 +72,66 @@ TEST(Test, Recurse)
   oclient1.reset();
   oclient2.reset();
 }
+
+namespace
+{
+  int increment(int value)
+  {
+    return value + 1;
+  }
+}
+
+// Many threads calling the same proxy, as a gateway does: all the calls go
+// through the table of the calls in flight of the same remote object and of
+// the same socket.
+TEST(Test, BenchmarkConcurrentCallsOnOneProxy)
+{
+  using Clock = std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  TestSessionPair p;
+  qi::DynamicObjectBuilder ob;
+  ob.advertiseMethod("increment", &increment);
+  ASSERT_TRUE(p.server()->registerService("Counter", ob.object()).hasValue(2000));
+  qi::AnyObject proxy = p.client()->service("Counter").value();
+
+  const int threadCount = 32;
+  int callsPerThread = 2000;
+  if (getenv("VALGRIND"))
+    callsPerThread = 20;
+  // Each thread keeps some calls in flight.
+  const std::size_t callsInFlight = 16;
+
+  std::atomic<int> errorCount{0};
+  std::vector<std::thread> threads;
+  const auto start = Clock::now();
+  for (int t = 0; t != threadCount; ++t)
+  {
+    threads.emplace_back([&] {
+      std::vector<qi::Future<int>> calls;
+      for (int i = 0; i != callsPerThread; ++i)
+      {
+        calls.push_back(proxy.async<int>("increment", i));
+        if (calls.size() == callsInFlight || i + 1 == callsPerThread)
+        {
+          for (auto& call : calls)
+          {
+            if (call.hasError())
+              ++errorCount;
+          }
+          calls.clear();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  const auto duration = Clock::now() - start;
+
+  EXPECT_EQ(0, errorCount.load());
+  const auto callCount = threadCount * callsPerThread;
+  std::cout << threadCount << " threads, " << callCount << " calls: "
+            << callCount * 1000000. / duration_cast<microseconds>(duration).count()
+            << " calls/s" << std::endl;
+}
@@ -2,7 +2,9 @@
 ** Copyright (C) 2012 Aldebaran Robotics
 */
 
+#include <algorithm>
 #include <map>
+#include <vector>
 #include <gtest/gtest.h>
 #include <qi/application.hpp>
 #include <qi/anyobject.hpp>
@@ -143,3 +145,64 @@ TEST(TestSignal, TwoLongPost)
   ASSERT_EQ(42, verifA);
   ASSERT_EQ(43, verifB);
 }
+
+TEST(TestSignal, BatchedEmissionsAreAllReceived)
+{
+  qi::DynamicObjectBuilder gob;
+  qi::Signal<int> sig;
+  sig.setRemoteEventPolicy(qi::RemoteEventPolicy::batch(10, qi::MilliSeconds(20)));
+  gob.advertiseSignal("sig", &sig);
+  qi::AnyObject op = gob.object();
+
+  TestSessionPair p;
+  p.server()->registerService("MyService", op);
+  qi::AnyObject clientOp = p.client()->service("MyService").value();
+
+  const int count = 25;
+  boost::mutex mutex;
+  std::vector<int> received;
+  qi::Promise<void> allReceived;
+  clientOp.connect("sig", [&](int value) {
+    boost::mutex::scoped_lock lock(mutex);
+    received.push_back(value);
+    if (received.size() == count)
+      allReceived.setValue(nullptr);
+  });
+
+  for (int i = 0; i != count; ++i)
+    sig(i);
+  // The last 5 values are sent once the delay expires.
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, allReceived.future().wait(2000));
+
+  boost::mutex::scoped_lock lock(mutex);
+  std::sort(received.begin(), received.end());
+  for (int i = 0; i != count; ++i)
+    EXPECT_EQ(i, received[i]);
+}
+
+TEST(TestSignal, ConflatedEmissionsEndWithTheLastValue)
+{
+  qi::DynamicObjectBuilder gob;
+  qi::Signal<int> sig;
+  sig.setRemoteEventPolicy(qi::RemoteEventPolicy::conflate(qi::MilliSeconds(50)));
+  gob.advertiseSignal("sig", &sig);
+  qi::AnyObject op = gob.object();
+
+  TestSessionPair p;
+  p.server()->registerService("MyService", op);
+  qi::AnyObject clientOp = p.client()->service("MyService").value();
+
+  const int count = 100;
+  qi::Atomic<int> receivedCount(0);
+  qi::Promise<void> lastReceived;
+  clientOp.connect("sig", [&](int value) {
+    ++receivedCount;
+    if (value == count - 1)
+      lastReceived.setValue(nullptr);
+  });
+
+  for (int i = 0; i != count; ++i)
+    sig(i);
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, lastReceived.future().wait(2000));
+  EXPECT_LT(receivedCount.load(), count);
+}
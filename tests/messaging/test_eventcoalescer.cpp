@@ -0,0 +1,119 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <gtest/gtest.h>
+#include <qi/future.hpp>
+#include "src/messaging/eventcoalescer.hpp"
+
+namespace
+{
+  using Batches = std::vector<std::vector<int>>;
+
+  // Records the batches sent by a coalescer, and is set once `expected` of
+  // them were sent.
+  struct SentBatches
+  {
+    explicit SentBatches(std::size_t expected)
+      : expected(expected)
+    {
+    }
+
+    void send(const std::vector<qi::EventCoalescer::Values>& emissions)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      std::vector<int> batch;
+      for (const auto& values : emissions)
+        batch.push_back(values.at(0).to<int>());
+      batches.push_back(batch);
+      if (batches.size() == expected)
+        done.setValue(nullptr);
+    }
+
+    Batches get()
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      return batches;
+    }
+
+    const std::size_t expected;
+    boost::mutex mutex;
+    Batches batches;
+    qi::Promise<void> done;
+  };
+
+  qi::EventCoalescerPtr makeCoalescer(const qi::RemoteEventPolicy& policy, SentBatches& sent)
+  {
+    return std::make_shared<qi::EventCoalescer>(policy,
+        [&sent](const std::vector<qi::EventCoalescer::Values>& emissions) { sent.send(emissions); });
+  }
+
+  void push(qi::EventCoalescer& coalescer, int value)
+  {
+    qi::GenericFunctionParameters params;
+    params.push_back(qi::AnyReference::from(value));
+    coalescer.push(params);
+  }
+
+  const qi::MilliSeconds timeout{5000};
+}
+
+TEST(TestEventCoalescer, BatchIsSentWhenFullOrAfterTheDelay)
+{
+  SentBatches sent(3);
+  auto coalescer = makeCoalescer(qi::RemoteEventPolicy::batch(3, qi::MilliSeconds(50)), sent);
+  for (int i = 0; i != 7; ++i)
+    push(*coalescer, i);
+  // The two full batches are sent by the emitting thread.
+  EXPECT_EQ((Batches{{0, 1, 2}, {3, 4, 5}}), sent.get());
+
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, sent.done.future().wait(timeout));
+  EXPECT_EQ((Batches{{0, 1, 2}, {3, 4, 5}, {6}}), sent.get());
+}
+
+TEST(TestEventCoalescer, ConflateSendsTheLastValue)
+{
+  SentBatches sent(1);
+  auto coalescer = makeCoalescer(qi::RemoteEventPolicy::conflate(qi::MilliSeconds(50)), sent);
+  for (int i = 0; i != 100; ++i)
+    push(*coalescer, i);
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, sent.done.future().wait(timeout));
+  EXPECT_EQ((Batches{{99}}), sent.get());
+}
+
+TEST(TestEventCoalescer, RateLimitSendsTheFirstValueRightAway)
+{
+  SentBatches sent(2);
+  auto coalescer = makeCoalescer(qi::RemoteEventPolicy::rateLimit(10.0), sent);
+  push(*coalescer, 1);
+  EXPECT_EQ((Batches{{1}}), sent.get());
+  push(*coalescer, 2);
+  push(*coalescer, 3);
+  EXPECT_EQ((Batches{{1}}), sent.get());
+
+  // The last value of the period is sent at its end.
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, sent.done.future().wait(timeout));
+  EXPECT_EQ((Batches{{1}, {3}}), sent.get());
+}
+
+TEST(TestEventCoalescer, RateLimitMustBePositive)
+{
+  EXPECT_THROW(qi::RemoteEventPolicy::rateLimit(0.0), std::invalid_argument);
+  EXPECT_THROW(qi::RemoteEventPolicy::rateLimit(-1.0), std::invalid_argument);
+  EXPECT_THROW(qi::RemoteEventPolicy::rateLimit(std::nan("")), std::invalid_argument);
+}
+
+TEST(TestEventCoalescer, PendingValuesAreDroppedOnDestruction)
+{
+  SentBatches sent(1);
+  auto coalescer = makeCoalescer(qi::RemoteEventPolicy::conflate(qi::MilliSeconds(20)), sent);
+  push(*coalescer, 1);
+  coalescer.reset();
+  EXPECT_EQ(qi::FutureState_Running, sent.done.future().wait(qi::MilliSeconds(100)));
+  EXPECT_TRUE(sent.get().empty());
+}
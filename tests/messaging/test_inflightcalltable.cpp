@@ -0,0 +1,119 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "src/messaging/inflightcalltable.hpp"
+
+using Table = qi::InflightCallTable<std::string>;
+
+TEST(TestInflightCallTable, TakeReturnsTheValueOnce)
+{
+  Table table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_TRUE(table.emplace(42, "foo"));
+  EXPECT_EQ(1u, table.size());
+
+  const auto value = table.take(42);
+  ASSERT_TRUE(value);
+  EXPECT_EQ("foo", *value);
+  EXPECT_FALSE(table.take(42));
+  EXPECT_TRUE(table.empty());
+}
+
+TEST(TestInflightCallTable, EmplaceKeepsTheExistingValue)
+{
+  Table table;
+  EXPECT_TRUE(table.emplace(1, "foo"));
+  EXPECT_FALSE(table.emplace(1, "bar"));
+  EXPECT_EQ("foo", *table.take(1));
+}
+
+TEST(TestInflightCallTable, AssignReplacesTheExistingValue)
+{
+  Table table;
+  EXPECT_TRUE(table.assign(1, "foo"));
+  EXPECT_FALSE(table.assign(1, "bar"));
+  EXPECT_EQ(1u, table.size());
+  EXPECT_EQ("bar", *table.take(1));
+}
+
+TEST(TestInflightCallTable, TakeAllEmptiesTheTable)
+{
+  Table table;
+  for (unsigned int id = 0; id != 100; ++id)
+    table.emplace(id, std::to_string(id));
+
+  auto all = table.takeAll();
+  EXPECT_TRUE(table.empty());
+  ASSERT_EQ(100u, all.size());
+  std::sort(all.begin(), all.end());
+  for (unsigned int id = 0; id != 100; ++id)
+  {
+    EXPECT_EQ(id, all[id].first);
+    EXPECT_EQ(std::to_string(id), all[id].second);
+  }
+}
+
+// Compares the table with a map on random operations, so that removals
+// happen in the middle of clusters and across the end of the slots.
+TEST(TestInflightCallTable, BehavesLikeAMap)
+{
+  Table table;
+  std::map<unsigned int, std::string> reference;
+  std::mt19937 generator(42);
+  // Few ids, so that they collide.
+  std::uniform_int_distribution<unsigned int> ids(0, 300);
+  for (int i = 0; i != 100000; ++i)
+  {
+    const auto id = ids(generator);
+    const auto value = std::to_string(i);
+    if (generator() % 2)
+    {
+      EXPECT_EQ(reference.emplace(id, value).second, table.emplace(id, value));
+    }
+    else
+    {
+      const auto it = reference.find(id);
+      const auto taken = table.take(id);
+      ASSERT_EQ(it != reference.end(), static_cast<bool>(taken));
+      if (taken)
+      {
+        EXPECT_EQ(it->second, *taken);
+        reference.erase(it);
+      }
+    }
+    ASSERT_EQ(reference.size(), table.size());
+  }
+}
+
+TEST(TestInflightCallTable, ConcurrentCallsAreAllFound)
+{
+  Table table;
+  const unsigned int threadCount = 8;
+  const unsigned int idCount = 10000;
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t != threadCount; ++t)
+  {
+    threads.emplace_back([&table, t] {
+      for (unsigned int i = 0; i != idCount; ++i)
+      {
+        // Interleave the ids of the threads, as consecutive calls would.
+        const auto id = i * threadCount + t;
+        EXPECT_TRUE(table.emplace(id, "call"));
+        if (i % 2)
+          EXPECT_TRUE(table.take(id - threadCount));
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_EQ(threadCount * idCount / 2, table.size());
+}
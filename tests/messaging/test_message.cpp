@@ -1,8 +1,12 @@
 #include <string>
 #include <algorithm>
+#include <random>
 #include <gtest/gtest.h>
 #include <qi/application.hpp>
+#include <qi/os.hpp>
 #include "src/messaging/message.hpp"
+#include "src/messaging/payloadcompression.hpp"
+#include "src/messaging/sharedbuffers.hpp"
 
 namespace qi
 {
@@ -60,3 +64,296 @@ TEST(TestMessage, CopiesAreDistinct)
   ASSERT_NE(buf.totalSize(), bb.totalSize());
 
 }
+
+namespace
+{
+  qi::Message makeMessageWithPayload(const std::string& payload)
+  {
+    using namespace qi;
+    Message msg(Message::Type_Call, MessageAddress{509, 2, 3, 105});
+    Buffer buf;
+    buf.write(payload.data(), payload.size());
+    msg.setBuffer(std::move(buf));
+    return msg;
+  }
+
+  std::string payloadOf(const qi::Message& msg)
+  {
+    const auto data = static_cast<const char*>(msg.buffer().data());
+    return std::string(data, data + msg.buffer().size());
+  }
+
+  std::string repetitiveText(std::size_t size)
+  {
+    static const std::string sentence = "The quick brown fox jumps over the lazy dog. ";
+    std::string text;
+    while (text.size() < size)
+      text += sentence + std::to_string(text.size() % 7);
+    text.resize(size);
+    return text;
+  }
+} // namespace
+
+TEST(TestPayloadCompression, CompressedMessageDecompressesToOriginal)
+{
+  using namespace qi;
+  const auto payload = repetitiveText(10000);
+  auto msg = makeMessageWithPayload(payload);
+  msg.addFlags(Message::TypeFlag_DynamicPayload);
+
+  const auto compressed = compressPayload(msg);
+  ASSERT_TRUE(compressed);
+  EXPECT_LT(compressed->buffer().size(), payload.size() / 4);
+  EXPECT_EQ(compressed->buffer().size(), compressed->header().size);
+  EXPECT_EQ(Message::TypeFlag_DynamicPayload | Message::TypeFlag_Compressed, compressed->flags());
+  EXPECT_EQ(msg.address(), compressed->address());
+
+  const auto decompressed = decompressPayload(*compressed, payload.size());
+  ASSERT_TRUE(decompressed);
+  EXPECT_EQ(msg, *decompressed);
+  EXPECT_EQ(payload, payloadOf(*decompressed));
+}
+
+TEST(TestPayloadCompression, IncompressiblePayloadIsNotCompressed)
+{
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::string payload(10000, '\0');
+  for (auto& c : payload)
+    c = static_cast<char>(dist(gen));
+  EXPECT_FALSE(qi::compressPayload(makeMessageWithPayload(payload)));
+}
+
+TEST(TestPayloadCompression, SubBuffersAreInlined)
+{
+  using namespace qi;
+  const auto text = repetitiveText(5000);
+  Buffer sub;
+  sub.write(text.data(), text.size());
+
+  Buffer buf;
+  const int before = 12;
+  const int after = 34;
+  buf.write(&before, sizeof(before));
+  buf.addSubBuffer(sub);
+  buf.write(&after, sizeof(after));
+  Message msg(Message::Type_Reply, MessageAddress{509, 2, 3, 105});
+  msg.setBuffer(buf);
+
+  Buffer flat;
+  const Buffer::size_type subSize = text.size();
+  flat.write(&before, sizeof(before));
+  flat.write(&subSize, sizeof(subSize));
+  flat.write(text.data(), text.size());
+  flat.write(&after, sizeof(after));
+
+  const auto compressed = compressPayload(msg);
+  ASSERT_TRUE(compressed);
+  const auto decompressed = decompressPayload(*compressed, flat.size());
+  ASSERT_TRUE(decompressed);
+  EXPECT_TRUE(decompressed->buffer().subBuffers().empty());
+  EXPECT_EQ(flat, decompressed->buffer());
+}
+
+TEST(TestPayloadCompression, IllFormedPayloadsAreRejected)
+{
+  using namespace qi;
+  const auto payload = repetitiveText(10000);
+  const auto compressed = compressPayload(makeMessageWithPayload(payload));
+  ASSERT_TRUE(compressed);
+  const auto compressedPayload = payloadOf(*compressed);
+
+  // Too big once decompressed.
+  EXPECT_FALSE(decompressPayload(*compressed, payload.size() - 1));
+
+  // Truncated.
+  for (std::size_t size = 0; size < compressedPayload.size(); size += 7)
+  {
+    auto truncated = makeMessageWithPayload(compressedPayload.substr(0, size));
+    truncated.addFlags(Message::TypeFlag_Compressed);
+    EXPECT_FALSE(decompressPayload(truncated, payload.size()));
+  }
+
+  // Garbage must not make decompression read or write out of bounds.
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (int i = 0; i != 100; ++i)
+  {
+    auto garbage = compressedPayload;
+    for (std::size_t j = sizeof(qi::uint32_t); j < garbage.size(); j += 1 + dist(gen) % 64)
+      garbage[j] = static_cast<char>(dist(gen));
+    auto msg = makeMessageWithPayload(garbage);
+    msg.addFlags(Message::TypeFlag_Compressed);
+    const auto decompressed = decompressPayload(msg, payload.size());
+    if (decompressed)
+      EXPECT_EQ(payload.size(), decompressed->buffer().size());
+  }
+}
+
+TEST(TestPayloadCompression, Lz4BlockRoundTrip)
+{
+  using namespace qi::detail;
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> smallAlphabet('a', 'c');
+  for (std::size_t size : {0, 1, 12, 13, 15, 16, 100, 270, 4096, 70000, 300000})
+  {
+    // Long runs, overlapping matches and matches further than 64 KiB.
+    std::vector<unsigned char> src(size);
+    for (std::size_t i = 0; i != size; ++i)
+      src[i] = (i / 1000) % 2 ? 'x' : static_cast<unsigned char>(smallAlphabet(gen));
+
+    std::vector<unsigned char> compressed(lz4CompressBound(size));
+    const auto compressedSize = lz4Compress(src.data(), size, compressed.data());
+    ASSERT_LE(compressedSize, compressed.size());
+
+    std::vector<unsigned char> decompressed(size);
+    ASSERT_TRUE(lz4Decompress(compressed.data(), compressedSize, decompressed.data(), size));
+    EXPECT_EQ(src, decompressed);
+    if (size != 0)
+    {
+      EXPECT_FALSE(lz4Decompress(compressed.data(), compressedSize, decompressed.data(), size - 1));
+    }
+  }
+}
+
+TEST(TestPayloadCompression, EnvironmentFlagsAcceptBooleanWords)
+{
+  using namespace qi;
+  const auto previous = os::getenv("QI_MESSAGE_COMPRESSION");
+  for (const char* value : {"1", "true", "TRUE", "yes", "on"})
+  {
+    os::setenv("QI_MESSAGE_COMPRESSION", value);
+    EXPECT_TRUE(getPayloadCompressionFromEnv(false)) << value;
+  }
+  for (const char* value : {"0", "false", "False", "no", "off"})
+  {
+    os::setenv("QI_MESSAGE_COMPRESSION", value);
+    EXPECT_FALSE(getPayloadCompressionFromEnv(true)) << value;
+  }
+  // Other values are ignored.
+  os::setenv("QI_MESSAGE_COMPRESSION", "maybe");
+  EXPECT_TRUE(getPayloadCompressionFromEnv(true));
+  EXPECT_FALSE(getPayloadCompressionFromEnv(false));
+  os::setenv("QI_MESSAGE_COMPRESSION", previous.c_str());
+}
+
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+namespace
+{
+  // The message as the remote end receives it: sub-buffers are inlined.
+  qi::Message received(const qi::Message& sent)
+  {
+    using namespace qi;
+    const Buffer& payload = sent.buffer();
+    const auto data = static_cast<const char*>(payload.data());
+    Buffer flat;
+    std::size_t beginOffset = 0;
+    for (const auto& sub : payload.subBuffers())
+    {
+      const auto endOffset = sub.first + sizeof(Buffer::size_type);
+      flat.write(data + beginOffset, endOffset - beginOffset);
+      flat.write(sub.second.data(), sub.second.size());
+      beginOffset = endOffset;
+    }
+    flat.write(data + beginOffset, payload.size() - beginOffset);
+    Message msg(sent);
+    msg.setBuffer(std::move(flat));
+    return msg;
+  }
+
+  qi::Message makeMessageWithSubBuffers(const std::string& small, const std::string& big)
+  {
+    using namespace qi;
+    Buffer smallBuffer;
+    smallBuffer.write(small.data(), small.size());
+    Buffer bigBuffer;
+    bigBuffer.write(big.data(), big.size());
+
+    Buffer buf;
+    const int before = 12;
+    const int middle = 34;
+    const int after = 56;
+    buf.write(&before, sizeof(before));
+    buf.addSubBuffer(smallBuffer);
+    buf.write(&middle, sizeof(middle));
+    buf.addSubBuffer(bigBuffer);
+    buf.write(&after, sizeof(after));
+    Message msg(Message::Type_Call, MessageAddress{509, 2, 3, 105});
+    msg.setBuffer(std::move(buf));
+    return msg;
+  }
+} // namespace
+
+TEST(TestSharedBuffers, BigSubBuffersAreMappedFromSharedMemory)
+{
+  using namespace qi;
+  const auto small = repetitiveText(100);
+  const auto big = repetitiveText(1024 * 1024);
+  const auto msg = makeMessageWithSubBuffers(small, big);
+
+  std::vector<std::string> segmentNames;
+  const auto shared = shareBuffers(msg, 4096, segmentNames);
+  ASSERT_TRUE(shared);
+  ASSERT_EQ(1u, segmentNames.size());
+  EXPECT_EQ(Message::TypeFlag_SharedBuffers, shared->flags());
+  EXPECT_EQ(shared->buffer().totalSize(), shared->header().size);
+  EXPECT_LT(shared->buffer().totalSize(), 1024u);
+
+  const auto mapped = mapSharedBuffers(received(*shared), msg.buffer().totalSize());
+  ASSERT_TRUE(mapped);
+  EXPECT_EQ(0u, mapped->flags());
+  const auto& subBuffers = mapped->buffer().subBuffers();
+  ASSERT_EQ(1u, subBuffers.size());
+  const auto& mappedBig = subBuffers.front().second;
+  ASSERT_EQ(big.size(), mappedBig.size());
+  EXPECT_EQ(big, std::string(static_cast<const char*>(mappedBig.data()), mappedBig.size()));
+  EXPECT_EQ(payloadOf(received(msg)), payloadOf(received(*mapped)));
+
+  // The segment is removed once mapped.
+  EXPECT_FALSE(mapSharedBuffers(received(*shared), msg.buffer().totalSize()));
+}
+
+TEST(TestSharedBuffers, SmallSubBuffersAreSentInline)
+{
+  using namespace qi;
+  std::vector<std::string> segmentNames;
+  EXPECT_FALSE(shareBuffers(makeMessageWithSubBuffers("small", "not so big"), 4096, segmentNames));
+  EXPECT_TRUE(segmentNames.empty());
+}
+
+TEST(TestSharedBuffers, IllFormedPayloadsAreRejected)
+{
+  using namespace qi;
+  const auto msg = makeMessageWithSubBuffers(repetitiveText(100), repetitiveText(100000));
+  std::vector<std::string> segmentNames;
+  const auto shared = shareBuffers(msg, 4096, segmentNames);
+  ASSERT_TRUE(shared);
+  const auto sharedPayload = payloadOf(received(*shared));
+  const auto cleanup = [&] {
+    for (const auto& name : segmentNames)
+      removeSharedBufferSegment(name);
+  };
+
+  // Too big once mapped.
+  EXPECT_FALSE(mapSharedBuffers(received(*shared), msg.buffer().totalSize() - 1));
+
+  // Truncated.
+  for (std::size_t size = 0; size < sharedPayload.size(); ++size)
+  {
+    auto truncated = makeMessageWithPayload(sharedPayload.substr(0, size));
+    truncated.addFlags(Message::TypeFlag_SharedBuffers);
+    EXPECT_FALSE(mapSharedBuffers(truncated, msg.buffer().totalSize()));
+  }
+
+  // Segments not created by libqi are not mapped.
+  auto renamed = sharedPayload;
+  const auto prefixPosition = renamed.find("/qi-buffer-");
+  ASSERT_NE(std::string::npos, prefixPosition);
+  renamed[prefixPosition + 1] = 'x';
+  auto renamedMsg = makeMessageWithPayload(renamed);
+  renamedMsg.addFlags(Message::TypeFlag_SharedBuffers);
+  EXPECT_FALSE(mapSharedBuffers(renamedMsg, msg.buffer().totalSize()));
+
+  cleanup();
+}
+#endif // QI_HAS_SHARED_MEMORY_BUFFERS
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <qi/jsoncodec.hpp>
 #include <qi/log.hpp>
+#include <qi/messaging/calldeadline.hpp>
 #include "../../src/messaging/remoteobject_p.hpp"
 #include "../../src/messaging/server.hpp"
 
@@ -131,3 +132,33 @@ TEST_F(RemoteObject, CallingAVoidMethodSendsACallMessage)
   EXPECT_EQ(methodId, message.address().functionId);
 }
 
+
+TEST_F(RemoteObject, CallsFailWhenTheirDeadlinePasses)
+{
+  const unsigned int serviceId = 24u;
+  const unsigned int methodId = 42u;
+
+  qi::MetaObjectBuilder mob;
+  auto mmb = makeMetaMethodBuilder();
+  mob.addMethod(mmb, static_cast<int>(methodId)); // KLUDGE: meta object have int for method indexes!
+
+  qi::RemoteObject remoteObject{serviceId};
+  remoteObject.setMetaObject(mob.metaObject());
+  remoteObject.setTransportSocket(clientSocket);
+
+  auto futureMessage = nextClientToServerMessage(); // get ready to receive messages
+
+  // The server never replies.
+  const auto exceededBefore = qi::callDeadlineStats().exceededCount;
+  auto dynamicObject = static_cast<qi::DynamicObject*>(&remoteObject);
+  qi::Future<qi::AnyReference> result;
+  {
+    qi::CallDeadlineScope deadline{qi::MilliSeconds{usualTimeoutMs / 2}};
+    result = dynamicObject->metaCall(qi::AnyObject{}, methodId, qi::GenericFunctionParameters{});
+  }
+  ASSERT_EQ(std::future_status::ready, futureMessage.wait_for(usualTimeout));
+
+  ASSERT_EQ(qi::FutureState_FinishedWithError, result.wait(qi::MilliSeconds{usualTimeoutMs * 2}));
+  EXPECT_EQ("Call deadline exceeded.", result.error());
+  EXPECT_EQ(exceededBefore + 1, qi::callDeadlineStats().exceededCount);
+}
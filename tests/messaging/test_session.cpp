@@ -5,6 +5,8 @@
  ** Copyright (C) 2010, 2012 Aldebaran Robotics
  */
 
+#include <chrono>
+#include <iostream>
 #include <vector>
 #include <string>
 #include <future>
@@ -15,6 +17,7 @@
 #include <qi/session.hpp>
 #include <qi/anyobject.hpp>
 #include <qi/type/dynamicobjectbuilder.hpp>
+#include <qi/messaging/sock/networkasiolocal.hpp>
 #include <qi/os.hpp>
 #include <qi/application.hpp>
 #include <qi/signalspy.hpp>
@@ -628,3 +631,64 @@ TEST(TestSession, WaitForServiceCanceled)
   future.cancel();
   ASSERT_TRUE(finishesAsCanceled(future));
 }
+
+#ifdef QI_SOCK_HAS_LOCAL_SOCKETS
+namespace
+{
+  std::string echo(const std::string& msg)
+  {
+    return msg;
+  }
+}
+
+// Compares the latency and the throughput of calls to a service of the same
+// host, over TCP and over a local socket.
+TEST(TestSession, BenchmarkTcpVersusLocalSocket)
+{
+  using Clock = std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  Session server;
+  const Url localUrl{"unix://" + os::mktmpdir("qi-bench") + "/session.sock"};
+  ASSERT_TRUE(finishesWithValue(server.listenStandalone(
+    std::vector<Url>{ test::defaultListenUrl(), localUrl })));
+  DynamicObjectBuilder ob;
+  ob.advertiseMethod("echo", &echo);
+  ASSERT_TRUE(finishesWithValue(server.registerService("Echo", ob.object())));
+
+  for (const std::string protocol : { "tcp", "unix" })
+  {
+    Session client;
+    ASSERT_TRUE(finishesWithValue(client.connect(test::url(server))));
+    AnyObject service = client.service("Echo", protocol).value();
+
+    for (const std::size_t size : { 100u, 4u * 1024u, 1024u * 1024u })
+    {
+      const std::string payload(size, 'a');
+      const int callCount = size < 1024u * 1024u ? 2000 : 50;
+
+      const auto latencyStart = Clock::now();
+      for (int i = 0; i != callCount; ++i)
+        ASSERT_EQ(size, service.call<std::string>("echo", payload).size());
+      const auto latency = (Clock::now() - latencyStart) / callCount;
+
+      std::vector<Future<std::string>> calls;
+      calls.reserve(callCount);
+      const auto throughputStart = Clock::now();
+      for (int i = 0; i != callCount; ++i)
+        calls.push_back(service.async<std::string>("echo", payload));
+      for (auto& call : calls)
+        ASSERT_EQ(size, call.value().size());
+      const auto throughputDuration = Clock::now() - throughputStart;
+      // Payloads go back and forth.
+      const double megabytesPerSecond = 2. * size * callCount
+          / duration_cast<microseconds>(throughputDuration).count();
+
+      std::cout << protocol << ", " << size << " bytes: latency "
+                << duration_cast<microseconds>(latency).count() << " us, throughput "
+                << megabytesPerSecond << " MB/s" << std::endl;
+    }
+  }
+}
+#endif
@@ -6,7 +6,11 @@
 #include "sock/networkcommon.hpp"
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <qi/os.hpp>
 #include <qi/messaging/sock/accept.hpp>
+#include <qi/messaging/sock/networkasiolocal.hpp>
 #include "src/messaging/tcpmessagesocket.hpp"
 #include "src/messaging/transportserver.hpp"
 #include "tests/qi/testutils/testutils.hpp"
@@ -389,6 +393,211 @@ TYPED_TEST(NetMessageSocket, ReceiveOneMessageAsio)
   ASSERT_EQ(FutureState_FinishedWithValue, promiseReceivedMessage.future().wait(defaultTimeout));
 }
 
+namespace
+{
+  qi::Message makeCompressibleMessage(const qi::MessageAddress& address)
+  {
+    using namespace qi;
+    Message msg{Message::Type_Call, address};
+    Buffer buf;
+    std::string text;
+    while (text.size() < 100000)
+      text += "Compress me, compress me not. " + std::to_string(text.size() % 13);
+    buf.write(text.data(), text.size());
+    msg.setBuffer(std::move(buf));
+    return msg;
+  }
+
+  void sendCapabilities(const qi::MessageSocketPtr& socket)
+  {
+    using namespace qi;
+    Message msg;
+    msg.setType(Message::Type_Capability);
+    msg.setService(Message::Service_Server);
+    msg.setValue(socket->localCapabilities(), typeOf<CapabilityMap>()->signature());
+    socket->send(msg);
+  }
+
+  // Sets an environment variable read by the sockets created in its scope.
+  class ScopedEnv
+  {
+  public:
+    ScopedEnv(const char* name, const char* value)
+      : _name(name)
+      , _previous(qi::os::getenv(name))
+    {
+      qi::os::setenv(name, value);
+    }
+
+    ~ScopedEnv()
+    {
+      qi::os::setenv(_name, _previous.c_str());
+    }
+
+  private:
+    const char* const _name;
+    const std::string _previous;
+  };
+} // namespace
+
+TYPED_TEST(NetMessageSocket, PayloadIsCompressedOnlyIfRemoteEndSupportsIt)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  // The peers of these tests are on the same host.
+  const ScopedEnv compression("QI_MESSAGE_COMPRESSION", "true");
+  const ScopedEnv localCompression("QI_MESSAGE_COMPRESSION_LOCAL", "1");
+
+  // Start a server and get the server side socket.
+  TransportServer server;
+  const auto listenRes = this->listen(server);
+  auto& promiseServerSideSocket = listenRes.promiseConnectedSocket;
+  const auto url = listenRes.url;
+
+  const MessageAddress address{1234, 5, 9876, 107};
+  const auto msgSent = makeCompressibleMessage(address);
+
+  std::atomic<int> receivedCount{0};
+  Promise<void> promiseReceivedMessages;
+  auto clientSideSocket = makeMessageSocket(this->scheme());
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  clientSideSocket->messageReady.connect([&](const Message& msgReceived) mutable {
+    if (!messageEqual(msgReceived, msgSent)) throw std::runtime_error("messages are not equal.");
+    if (msgReceived.flags() & Message::TypeFlag_Compressed) throw std::runtime_error("message is still compressed.");
+    if (++receivedCount == 2) promiseReceivedMessages.setValue(0);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue, clientSideSocket->connect(url).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+
+  // The server does not know yet that the client supports compression.
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+  ASSERT_TRUE(test::verifyBeforeDuration([&]{ return receivedCount == 1; }, defaultTimeout));
+  EXPECT_EQ(0u, serverSideSocket->payloadCompressionStats().compressedMessageCount);
+
+  sendCapabilities(clientSideSocket);
+  ASSERT_TRUE(test::verifyBeforeDuration(
+      [&]{ return serverSideSocket->hasReceivedRemoteCapabilities(); }, defaultTimeout));
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseReceivedMessages.future().wait(defaultTimeout));
+
+  const auto serverStats = serverSideSocket->payloadCompressionStats();
+  EXPECT_EQ(1u, serverStats.compressedMessageCount);
+  EXPECT_EQ(msgSent.buffer().size(), serverStats.uncompressedByteCount);
+  EXPECT_LT(serverStats.compressedByteCount, serverStats.uncompressedByteCount / 4);
+  EXPECT_EQ(1u, clientSideSocket->payloadCompressionStats().decompressedMessageCount);
+}
+
+TYPED_TEST(NetMessageSocket, PayloadIsNotCompressedForPeersOfTheSameHost)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  const ScopedEnv compression("QI_MESSAGE_COMPRESSION", "1");
+
+  // Start a server and get the server side socket.
+  TransportServer server;
+  const auto listenRes = this->listen(server);
+  auto& promiseServerSideSocket = listenRes.promiseConnectedSocket;
+  const auto url = listenRes.url;
+
+  const auto msgSent = makeCompressibleMessage(MessageAddress{1234, 5, 9876, 107});
+  Promise<void> promiseReceivedMessage;
+  auto clientSideSocket = makeMessageSocket(this->scheme());
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  clientSideSocket->messageReady.connect([=](const Message&) mutable {
+    promiseReceivedMessage.setValue(0);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue, clientSideSocket->connect(url).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+  sendCapabilities(clientSideSocket);
+  ASSERT_TRUE(test::verifyBeforeDuration(
+      [&]{ return serverSideSocket->hasReceivedRemoteCapabilities(); }, defaultTimeout));
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseReceivedMessage.future().wait(defaultTimeout));
+
+  EXPECT_EQ(0u, serverSideSocket->payloadCompressionStats().compressedMessageCount);
+}
+
+TYPED_TEST(NetMessageSocket, PayloadIsNotCompressedByDefault)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  const ScopedEnv compression("QI_MESSAGE_COMPRESSION", "");
+  const ScopedEnv localCompression("QI_MESSAGE_COMPRESSION_LOCAL", "1");
+
+  // Start a server and get the server side socket.
+  TransportServer server;
+  const auto listenRes = this->listen(server);
+  auto& promiseServerSideSocket = listenRes.promiseConnectedSocket;
+  const auto url = listenRes.url;
+
+  const auto msgSent = makeCompressibleMessage(MessageAddress{1234, 5, 9876, 107});
+  Promise<void> promiseReceivedMessage;
+  auto clientSideSocket = makeMessageSocket(this->scheme());
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  clientSideSocket->messageReady.connect([=](const Message&) mutable {
+    promiseReceivedMessage.setValue(0);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue, clientSideSocket->connect(url).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+  sendCapabilities(clientSideSocket);
+  ASSERT_TRUE(test::verifyBeforeDuration(
+      [&]{ return serverSideSocket->hasReceivedRemoteCapabilities(); }, defaultTimeout));
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseReceivedMessage.future().wait(defaultTimeout));
+
+  EXPECT_EQ(0u, serverSideSocket->payloadCompressionStats().compressedMessageCount);
+}
+
+TYPED_TEST(NetMessageSocket, IllFormedCompressedCallGetsAnErrorReply)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  // Start a server and get the server side socket.
+  TransportServer server;
+  const auto listenRes = this->listen(server);
+  auto& promiseServerSideSocket = listenRes.promiseConnectedSocket;
+  const auto url = listenRes.url;
+
+  auto clientSideSocket = makeMessageSocket(this->scheme());
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  ASSERT_EQ(FutureState_FinishedWithValue, clientSideSocket->connect(url).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  Promise<Message> promiseReply;
+  serverSideSocket->messageReady.connect([=](const Message& msg) mutable {
+    promiseReply.setValue(msg);
+  });
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+
+  Message call{Message::Type_Call, MessageAddress{1234, 5, 9876, 107}};
+  Buffer garbage;
+  const std::string text = "This is not a compressed payload.";
+  garbage.write(text.data(), text.size());
+  call.setBuffer(std::move(garbage));
+  call.addFlags(Message::TypeFlag_Compressed);
+  ASSERT_TRUE(serverSideSocket->send(call));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseReply.future().wait(defaultTimeout));
+  const auto reply = promiseReply.future().value();
+  EXPECT_EQ(Message::Type_Error, reply.type());
+  EXPECT_EQ(call.id(), reply.id());
+  EXPECT_TRUE(clientSideSocket->isConnected());
+}
+
 TYPED_TEST(NetMessageSocketAsio, ReceiveManyMessages)
 {
   using namespace qi;
@@ -739,3 +948,240 @@ TEST(NetMessageSocketAsio, DistantCrashWhileConnected)
   Future<void> fut = socket->disconnect();
   ASSERT_EQ(FutureState_FinishedWithValue, fut.wait(defaultTimeout));
 }
+
+// What the server does with the connections it accepts when the network event
+// loop has shards (QI_NETWORK_EVENTLOOP_SHARDS).
+TEST(NetMessageSocketAsio, AcceptedSocketMovedToAShardIsRunByIt)
+{
+  using namespace qi;
+  using namespace qi::sock;
+  using N = NetworkAsio;
+  namespace ip = boost::asio::ip;
+
+  auto& io = *asIoServicePtr(getNetworkEventLoop());
+  ip::tcp::acceptor acceptor(io, ip::tcp::endpoint(ip::address_v4::loopback(), 0));
+  const Url url{"tcp://127.0.0.1:" + std::to_string(acceptor.local_endpoint().port())};
+  const auto sslContext = makeSslContextPtr<N>(io, SslContext<N>::sslv23);
+  const auto accepted = makeSocketWithContextPtr<N>(io, sslContext);
+  Promise<void> promiseAccepted;
+  acceptor.async_accept(accepted->lowest_layer(),
+                        [=](const boost::system::error_code& erc) mutable {
+    if (erc)
+      promiseAccepted.setError(erc.message());
+    else
+      promiseAccepted.setValue(nullptr);
+  });
+
+  auto clientSideSocket = makeMessageSocket("tcp");
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  ASSERT_EQ(FutureState_FinishedWithValue, clientSideSocket->connect(url).wait(defaultTimeout));
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseAccepted.future().wait(defaultTimeout));
+
+  EventLoop shard{"TestEventLoopShard", 1, false};
+  const auto moved = moveAcceptedSocket<N>(accepted, sslContext, &shard);
+  ASSERT_NE(accepted, moved);
+  EXPECT_FALSE(accepted->lowest_layer().is_open());
+
+  // The socket is destroyed before the event loop of its shard.
+  Promise<bool> promiseReceivedInShard;
+  {
+    auto serverSideSocket = boost::make_shared<TcpMessageSocket<N>>(
+      *asIoServicePtr(&shard), SslEnabled{false}, moved);
+    serverSideSocket->messageReady.connect([&](const Message&) mutable {
+      promiseReceivedInShard.setValue(shard.isInThisContext());
+    });
+    ASSERT_TRUE(serverSideSocket->ensureReading());
+    ASSERT_TRUE(clientSideSocket->send(makeMessage(MessageAddress{1234, 5, 9876, 107})));
+    ASSERT_EQ(FutureState_FinishedWithValue,
+              promiseReceivedInShard.future().wait(defaultTimeout));
+    EXPECT_TRUE(promiseReceivedInShard.future().value());
+    EXPECT_EQ(FutureState_FinishedWithValue,
+              serverSideSocket->disconnect().wait(defaultTimeout));
+  }
+}
+
+#ifdef QI_SOCK_HAS_LOCAL_SOCKETS
+namespace
+{
+  qi::Url localSocketUrl(const std::string& name)
+  {
+    return qi::Url{"unix://" + qi::os::mktmpdir("qi-local-socket") + "/" + name};
+  }
+} // namespace
+
+TEST(NetMessageSocketUnix, ReceiveOneMessage)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  TransportServer server;
+  Promise<MessageSocketPtr> promiseServerSideSocket;
+  server.newConnection.connect([=](const std::pair<MessageSocketPtr, Url>& p) mutable {
+    promiseServerSideSocket.setValue(p.first);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            server.listen(localSocketUrl("receive.sock")).wait(defaultTimeout));
+  const auto url = server.endpoints().front();
+  EXPECT_EQ("unix", url.protocol());
+
+  auto msgSent = makeMessage(MessageAddress{1234, 5, 9876, 107});
+  Promise<void> promiseReceivedMessage;
+  auto clientSideSocket = makeMessageSocket(url.protocol());
+  ASSERT_TRUE(clientSideSocket);
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  clientSideSocket->messageReady.connect([&](const Message& msgReceived) mutable {
+    if (!messageEqual(msgReceived, msgSent)) throw std::runtime_error("messages are not equal.");
+    promiseReceivedMessage.setValue(0);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue, clientSideSocket->connect(url).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseReceivedMessage.future().wait(defaultTimeout));
+}
+
+TEST(NetMessageSocketUnix, ConnectToMissingSocketFails)
+{
+  using namespace qi;
+
+  auto socket = makeMessageSocket("unix");
+  ASSERT_TRUE(socket);
+  const auto _ = ka::scoped([=]{ socket->disconnect().wait(defaultTimeout); });
+  Future<void> fut = socket->connect(localSocketUrl("missing.sock"));
+  ASSERT_EQ(FutureState_FinishedWithError, fut.wait(defaultTimeout));
+}
+
+TEST(NetMessageSocketUnix, SocketFileIsRemovedOnClose)
+{
+  using namespace qi;
+
+  const auto url = localSocketUrl("close.sock");
+  {
+    TransportServer server;
+    ASSERT_EQ(FutureState_FinishedWithValue, server.listen(url).wait(defaultTimeout));
+    ASSERT_TRUE(boost::filesystem::exists(url.host()));
+  }
+  ASSERT_FALSE(boost::filesystem::exists(url.host()));
+}
+
+TEST(NetMessageSocketUnix, ListenOnAFileWhichIsNotASocketFails)
+{
+  using namespace qi;
+
+  const auto url = localSocketUrl("not-a-socket");
+  {
+    boost::filesystem::ofstream file(url.host());
+    file << "data";
+  }
+  {
+    TransportServer server;
+    ASSERT_EQ(FutureState_FinishedWithError, server.listen(url).wait(defaultTimeout));
+  }
+  EXPECT_TRUE(boost::filesystem::is_regular_file(url.host()));
+}
+
+#ifdef QI_HAS_SHARED_MEMORY_BUFFERS
+TEST(NetMessageSocketUnix, BigSubBuffersGoThroughSharedMemory)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  TransportServer server;
+  Promise<MessageSocketPtr> promiseServerSideSocket;
+  server.newConnection.connect([=](const std::pair<MessageSocketPtr, Url>& p) mutable {
+    promiseServerSideSocket.setValue(p.first);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            server.listen(localSocketUrl("shared.sock")).wait(defaultTimeout));
+
+  const std::string frame(4 * 1024 * 1024, 'f');
+  Buffer frameBuffer;
+  frameBuffer.write(frame.data(), frame.size());
+  Buffer payload;
+  payload.addSubBuffer(frameBuffer);
+  Message msgSent{Message::Type_Post, MessageAddress{1234, 5, 9876, 107}};
+  msgSent.setBuffer(payload);
+
+  Promise<Message> promiseReceivedMessage;
+  auto clientSideSocket = makeMessageSocket("unix");
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  clientSideSocket->messageReady.connect([=](const Message& msgReceived) mutable {
+    promiseReceivedMessage.setValue(msgReceived);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            clientSideSocket->connect(server.endpoints().front()).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+  sendCapabilities(clientSideSocket);
+  ASSERT_TRUE(test::verifyBeforeDuration(
+      [&]{ return serverSideSocket->hasReceivedRemoteCapabilities(); }, defaultTimeout));
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+
+  auto futureReceived = promiseReceivedMessage.future();
+  ASSERT_EQ(FutureState_FinishedWithValue, futureReceived.wait(defaultTimeout));
+  const auto msgReceived = futureReceived.value();
+  EXPECT_EQ(0u, msgReceived.flags() & Message::TypeFlag_SharedBuffers);
+  // The frame is mapped, not copied into the payload.
+  const auto& subBuffers = msgReceived.buffer().subBuffers();
+  ASSERT_EQ(1u, subBuffers.size());
+  const auto& frameReceived = subBuffers.front().second;
+  ASSERT_EQ(frame.size(), frameReceived.size());
+  EXPECT_EQ(frame, std::string(static_cast<const char*>(frameReceived.data()), frameReceived.size()));
+}
+
+TEST(NetMessageSocketUnix, BigSubBuffersAreSentInlineToAnotherUser)
+{
+  using namespace qi;
+  using namespace qi::sock;
+
+  TransportServer server;
+  Promise<MessageSocketPtr> promiseServerSideSocket;
+  server.newConnection.connect([=](const std::pair<MessageSocketPtr, Url>& p) mutable {
+    promiseServerSideSocket.setValue(p.first);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            server.listen(localSocketUrl("shared-other-user.sock")).wait(defaultTimeout));
+
+  const std::string frame(4 * 1024 * 1024, 'f');
+  Buffer frameBuffer;
+  frameBuffer.write(frame.data(), frame.size());
+  Buffer payload;
+  payload.addSubBuffer(frameBuffer);
+  Message msgSent{Message::Type_Post, MessageAddress{1234, 5, 9876, 107}};
+  msgSent.setBuffer(payload);
+
+  Promise<Message> promiseReceivedMessage;
+  auto clientSideSocket = makeMessageSocket("unix");
+  const auto _ = ka::scoped([=]{ clientSideSocket->disconnect().wait(defaultTimeout); });
+  clientSideSocket->messageReady.connect([=](const Message& msgReceived) mutable {
+    promiseReceivedMessage.setValue(msgReceived);
+  });
+  ASSERT_EQ(FutureState_FinishedWithValue,
+            clientSideSocket->connect(server.endpoints().front()).wait(defaultTimeout));
+
+  ASSERT_EQ(FutureState_FinishedWithValue, promiseServerSideSocket.future().wait(defaultTimeout));
+  auto serverSideSocket = promiseServerSideSocket.future().value();
+  ASSERT_TRUE(serverSideSocket->ensureReading());
+  // The segments of the server could not be opened by this user.
+  clientSideSocket->advertiseCapability(capabilityname::sharedMemoryBuffersUser,
+                                        AnyValue::from(getSharedBufferUserId() + 1));
+  sendCapabilities(clientSideSocket);
+  ASSERT_TRUE(test::verifyBeforeDuration(
+      [&]{ return serverSideSocket->hasReceivedRemoteCapabilities(); }, defaultTimeout));
+  ASSERT_TRUE(serverSideSocket->send(msgSent));
+
+  auto futureReceived = promiseReceivedMessage.future();
+  ASSERT_EQ(FutureState_FinishedWithValue, futureReceived.wait(defaultTimeout));
+  const auto msgReceived = futureReceived.value();
+  EXPECT_EQ(0u, msgReceived.flags() & Message::TypeFlag_SharedBuffers);
+  // The frame came inline, in the payload.
+  EXPECT_TRUE(msgReceived.buffer().subBuffers().empty());
+  EXPECT_EQ(msgSent.buffer().totalSize(), msgReceived.buffer().size());
+}
+#endif // QI_HAS_SHARED_MEMORY_BUFFERS
+#endif // QI_SOCK_HAS_LOCAL_SOCKETS
@@ -154,6 +154,28 @@ TEST(TestURL, ValidUrl)
   EXPECT_EQ("tcp://example.com:5", url.str());
 }
 
+TEST(TestURL, LocalSocketUrl)
+{
+  qi::Url url("unix:///tmp/qi.sock");
+
+  EXPECT_EQ("unix", url.protocol());
+  EXPECT_EQ("/tmp/qi.sock", url.host());
+  EXPECT_TRUE(url.hasPort());
+  EXPECT_TRUE(url.isValid());
+  EXPECT_EQ("unix:///tmp/qi.sock", url.str());
+
+  url = "unix:///tmp/dir:with:colons/qi.sock";
+
+  EXPECT_EQ("/tmp/dir:with:colons/qi.sock", url.host());
+  EXPECT_TRUE(url.isValid());
+  EXPECT_EQ("unix:///tmp/dir:with:colons/qi.sock", url.str());
+
+  url = "unix://";
+
+  EXPECT_FALSE(url.hasHost());
+  EXPECT_FALSE(url.isValid());
+}
+
 TEST(TestURL, CopyUrl)
 {
   qi::Url url("tcp://example.com:5");
@@ -6,10 +6,12 @@
  */
 
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <numeric> // std::iota
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -142,3 +144,224 @@ TEST(TestBuffer, TestAssignmentsAreDistinct)
   *asIntPtr(b0.data()) = 1234;
   ASSERT_EQ(993, *asIntPtr(b1.data()));
 }
+
+TEST(TestBuffer, TestCopiesShareDataUntilModified)
+{
+  using namespace qi;
+  std::vector<char> v(10000, 'a');
+  Buffer b0;
+  b0.write(v.data(), v.size());
+  const Buffer b1(b0);
+  const Buffer& cb0 = b0;
+  // The copy does not duplicate the data.
+  ASSERT_EQ(cb0.data(), b1.data());
+
+  // Writing in one copy gives it its own data.
+  const char c = 'b';
+  b0.write(&c, 1);
+  ASSERT_NE(cb0.data(), b1.data());
+  ASSERT_EQ(v.size() + 1, b0.size());
+  ASSERT_EQ(v.size(), b1.size());
+  ASSERT_EQ('b', static_cast<const char*>(cb0.data())[v.size()]);
+  ASSERT_TRUE(std::equal(v.begin(), v.end(), static_cast<const char*>(b1.data())));
+}
+
+TEST(TestBuffer, TestDataIsNotCopiedOnceCopiesAreDestroyed)
+{
+  using namespace qi;
+  std::vector<char> v(10000, 'a');
+  Buffer b0;
+  b0.write(v.data(), v.size());
+  const Buffer& cb0 = b0;
+  const void* const data = cb0.data();
+
+  Buffer b1(b0);
+  std::size_t count = 0;
+  std::thread reader([&] {
+    const Buffer local(std::move(b1));
+    const auto bytes = static_cast<const char*>(local.data());
+    count = std::count(bytes, bytes + local.size(), 'a');
+  });
+  reader.join();
+  ASSERT_EQ(v.size(), count);
+
+  // The last copy is gone: the data is modified in place.
+  static_cast<char*>(b0.data())[0] = 'b';
+  ASSERT_EQ(data, cb0.data());
+}
+
+TEST(TestBuffer, TestWriteInCopyOfBigBuffer)
+{
+  using namespace qi;
+  // Grow the buffer so that it has more bytes available than used.
+  std::vector<char> v(5000, 'a');
+  Buffer b0;
+  b0.write(v.data(), v.size());
+  Buffer b1(b0);
+  std::vector<char> w(5000, 'b');
+  b1.write(w.data(), w.size());
+  ASSERT_EQ(v.size() + w.size(), b1.size());
+  const auto data = static_cast<const char*>(b1.read((size_t)0, b1.size()));
+  ASSERT_TRUE(std::equal(v.begin(), v.end(), data));
+  ASSERT_TRUE(std::equal(w.begin(), w.end(), data + v.size()));
+  ASSERT_EQ(v.size(), b0.size());
+}
+
+TEST(TestBuffer, TestClearCopyDoesNotAffectOriginal)
+{
+  using namespace qi;
+  const std::string str("A dummy string");
+  Buffer b0;
+  b0.write(str.c_str(), str.size());
+  b0.addSubBuffer(b0);
+  Buffer b1(b0);
+  b1.clear();
+  ASSERT_EQ(0u, b1.totalSize());
+  ASSERT_EQ(str.size() + sizeof(Buffer::size_type), b0.size());
+  ASSERT_EQ(1u, b0.subBuffers().size());
+}
+
+TEST(TestBuffer, TestSubBuffersAreNotDuplicated)
+{
+  using namespace qi;
+  std::vector<char> v(10000, 'a');
+  Buffer sub;
+  sub.write(v.data(), v.size());
+  Buffer b;
+  const auto offset = b.addSubBuffer(sub);
+  const Buffer& cb = b;
+  const Buffer& csub = sub;
+  ASSERT_EQ(csub.data(), cb.subBuffer(offset).data());
+
+  // Copying the parent buffer does not duplicate its sub-buffers either.
+  const Buffer copy(b);
+  ASSERT_EQ(csub.data(), copy.subBuffer(offset).data());
+}
+
+TEST(TestBuffer, TestEmptyBuffersAreEqual)
+{
+  using namespace qi;
+  const Buffer empty;
+  ASSERT_EQ(0u, empty.totalSize());
+  ASSERT_NE(nullptr, empty.data());
+
+  const char c = 'a';
+  Buffer cleared;
+  cleared.write(&c, 1);
+  cleared.clear();
+  ASSERT_EQ(empty, cleared);
+  ASSERT_EQ(cleared, empty);
+
+  Buffer moved;
+  moved.write(&c, 1);
+  const Buffer other(std::move(moved));
+  ASSERT_EQ(empty, moved);
+  ASSERT_EQ(1u, other.size());
+}
+
+TEST(TestBuffer, TestSliceSharesData)
+{
+  using namespace qi;
+  std::vector<char> v(10000);
+  std::iota(v.begin(), v.end(), 0);
+  Buffer b;
+  b.write(v.data(), v.size());
+  const Buffer& cb = b;
+
+  const Buffer slice = cb.slice(100, 5000);
+  ASSERT_EQ(5000u, slice.size());
+  ASSERT_EQ(static_cast<const char*>(cb.data()) + 100, slice.data());
+
+  // Writing in the buffer does not modify the slice.
+  const char c = 'b';
+  b.write(&c, 1);
+  ASSERT_NE(static_cast<const char*>(cb.data()) + 100, slice.data());
+  ASSERT_TRUE(std::equal(v.begin() + 100, v.begin() + 5100, static_cast<const char*>(slice.data())));
+
+  // Nor does writing in the slice modify the buffer.
+  Buffer mutableSlice = slice;
+  mutableSlice.write(&c, 1);
+  ASSERT_EQ(5001u, mutableSlice.size());
+  ASSERT_EQ(5000u, slice.size());
+  ASSERT_EQ(v[5100], static_cast<const char*>(cb.data())[5100]);
+}
+
+TEST(TestBuffer, TestSliceOutlivesBuffer)
+{
+  using namespace qi;
+  const std::string str("A dummy string");
+  Buffer slice;
+  {
+    Buffer b;
+    b.write(str.c_str(), str.size());
+    slice = b.slice(2, 5);
+  }
+  ASSERT_EQ("dummy", std::string(static_cast<const char*>(slice.data()), slice.size()));
+}
+
+TEST(TestBuffer, TestSliceOutOfBuffer)
+{
+  using namespace qi;
+  Buffer b;
+  b.write("abc", 3);
+  ASSERT_EQ(0u, b.slice(3, 0).size());
+  ASSERT_THROW(b.slice(2, 2), std::runtime_error);
+  ASSERT_THROW(b.slice(4, 0), std::runtime_error);
+}
+
+namespace
+{
+  // Writes `size` bytes in a new buffer and destroys it.
+  void writeBuffer(const std::vector<char>& data, std::size_t size)
+  {
+    qi::Buffer buffer;
+    buffer.write(data.data(), size);
+  }
+}
+
+TEST(TestBufferPool, ReusesFreedBlocks)
+{
+  using namespace qi;
+  setBufferPoolEnabled(true);
+  const std::vector<char> data(10000, 'a');
+  writeBuffer(data, data.size());
+  const auto stats = bufferPoolStats();
+  writeBuffer(data, data.size());
+  const auto newStats = bufferPoolStats();
+  ASSERT_EQ(stats.hitCount + 1, newStats.hitCount);
+  ASSERT_EQ(stats.missCount, newStats.missCount);
+  ASSERT_EQ(stats.pooledBytes, newStats.pooledBytes);
+  ASSERT_GE(newStats.pooledBytesHighWater, newStats.pooledBytes);
+  ASSERT_GT(newStats.hitRate(), 0.);
+  setBufferPoolEnabled(false);
+}
+
+TEST(TestBufferPool, RespectsMaxPooledBytes)
+{
+  using namespace qi;
+  setBufferPoolEnabled(true);
+  setBufferPoolMaxPooledBytes(bufferPoolStats().pooledBytes);
+  const std::vector<char> data(200000, 'a');
+  const auto stats = bufferPoolStats();
+  writeBuffer(data, data.size());
+  // The block could not be kept.
+  ASSERT_EQ(stats.pooledBytes, bufferPoolStats().pooledBytes);
+  setBufferPoolMaxPooledBytes(32 * 1024 * 1024);
+  setBufferPoolEnabled(false);
+}
+
+TEST(TestBufferPool, CanBeDisabled)
+{
+  using namespace qi;
+  setBufferPoolEnabled(true);
+  ASSERT_TRUE(isBufferPoolEnabled());
+  setBufferPoolEnabled(false);
+  ASSERT_FALSE(isBufferPoolEnabled());
+  const std::vector<char> data(10000, 'a');
+  const auto stats = bufferPoolStats();
+  writeBuffer(data, data.size());
+  writeBuffer(data, data.size());
+  const auto newStats = bufferPoolStats();
+  ASSERT_EQ(stats.hitCount, newStats.hitCount);
+  ASSERT_EQ(stats.missCount, newStats.missCount);
+}
@@ -0,0 +1,133 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/program_options.hpp>
+#include <qi/buffer.hpp>
+#include <qi/perf/dataperfsuite.hpp>
+
+namespace po = boost::program_options;
+
+namespace
+{
+  const int hopCount = 5;
+
+  // Forwards `original` through `hopCount` hops, each of them copying the
+  // bytes of the previous one into a new buffer, as done before buffers were
+  // copy-on-write.
+  void forwardByDeepCopy(const qi::Buffer& original)
+  {
+    qi::Buffer previous = original;
+    for (int i = 0; i != hopCount; ++i)
+    {
+      qi::Buffer copy;
+      copy.write(static_cast<const qi::Buffer&>(previous).data(), previous.size());
+      previous = std::move(copy);
+    }
+  }
+
+  // Forwards `original` through `hopCount` hops, each of them copying the
+  // previous buffer.
+  void forwardByCopy(const qi::Buffer& original)
+  {
+    qi::Buffer previous = original;
+    for (int i = 0; i != hopCount; ++i)
+    {
+      qi::Buffer copy(previous);
+      previous = std::move(copy);
+    }
+  }
+
+  // Forwards `original` through `hopCount` hops, each of them slicing the
+  // payload out of the previous buffer, past a header of 28 bytes.
+  void forwardBySlice(const qi::Buffer& original)
+  {
+    qi::Buffer previous = original;
+    for (int i = 0; i != hopCount; ++i)
+    {
+      qi::Buffer slice = previous.slice(28u, previous.size() - 28u);
+      previous = std::move(slice);
+    }
+  }
+
+  template<typename F>
+  void measure(qi::DataPerfSuite& out, const std::string& name, std::size_t size, F forward)
+  {
+    qi::Buffer original;
+    std::memset(original.reserve(size), 'a', size);
+    qi::DataPerf dp;
+    dp.start(name, hopCount, static_cast<unsigned long>(size), std::to_string(size));
+    forward(original);
+    dp.stop();
+    out << dp;
+  }
+
+  // Allocates buffers of 1 KiB to 64 KiB in turn, with or without the pool,
+  // and reports the memory the pool keeps.
+  void measureAllocations(qi::DataPerfSuite& out, bool poolEnabled)
+  {
+    const int iterationCount = 100000;
+    const std::size_t maxSize = 64u * 1024u;
+    const std::vector<char> data(maxSize, 'a');
+    qi::setBufferPoolEnabled(poolEnabled);
+    const auto stats = qi::bufferPoolStats();
+    qi::DataPerf dp;
+    dp.start(poolEnabled ? "Buffer_AllocatePooled" : "Buffer_Allocate", iterationCount);
+    std::size_t size = 1024u;
+    for (int i = 0; i != iterationCount; ++i)
+    {
+      qi::Buffer buffer;
+      buffer.write(data.data(), size);
+      size = size == maxSize ? 1024u : size * 2u;
+    }
+    dp.stop();
+    out << dp;
+    auto delta = qi::bufferPoolStats();
+    delta.hitCount -= stats.hitCount;
+    delta.missCount -= stats.missCount;
+    std::cout << "pool " << (poolEnabled ? "enabled" : "disabled") << ": hit rate "
+              << delta.hitRate() << ", pooled bytes high water "
+              << delta.pooledBytesHighWater << std::endl;
+    qi::setBufferPoolEnabled(false);
+  }
+}
+
+// Measures the cost of forwarding a buffer through several hops, as done when
+// a message goes through several hops, for payload sizes from 1 KiB to 64 MiB,
+// then the cost of allocating buffers with and without the buffer pool.
+int main(int argc, char* argv[])
+{
+  po::options_description desc;
+  desc.add_options()
+    ("help,h", "Print this help.");
+  desc.add(qi::detail::getPerfOptions());
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  qi::DataPerfSuite out("qi", "test_buffer_benchmark", qi::DataPerfSuite::OutputData_Period,
+                        vm["output"].as<std::string>());
+  for (std::size_t size = 1024u; size <= 64u * 1024u * 1024u; size *= 4u)
+  {
+    measure(out, "Buffer_DeepCopy", size, forwardByDeepCopy);
+    measure(out, "Buffer_Copy", size, forwardByCopy);
+    measure(out, "Buffer_Slice", size, forwardBySlice);
+  }
+  measureAllocations(out, false);
+  measureAllocations(out, true);
+  out.close();
+  return EXIT_SUCCESS;
+}
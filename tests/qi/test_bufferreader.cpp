@@ -8,6 +8,7 @@
 #include <gtest/gtest.h>
 #include <qi/buffer.hpp>
 #include <stdexcept>
+#include <string>
 
 TEST(TestBufferReader, TestSubBuffer)
 {
@@ -82,3 +83,20 @@ TEST(TestBufferReader, TestPeekSeek)
 
   ASSERT_STREQ("bla", str);
 }
+
+TEST(TestBufferReader, TestReadSlice)
+{
+  qi::Buffer buffer;
+  const std::string str("A dummy string");
+  buffer.write(str.c_str(), str.size());
+  const qi::Buffer& cbuffer = buffer;
+
+  qi::BufferReader reader(buffer);
+  ASSERT_TRUE(reader.seek(2));
+  const qi::Buffer slice = reader.readSlice(5);
+  ASSERT_EQ(7u, reader.position());
+  ASSERT_EQ(static_cast<const char*>(cbuffer.data()) + 2, slice.data());
+  ASSERT_EQ("dummy", std::string(static_cast<const char*>(slice.data()), slice.size()));
+  ASSERT_THROW(reader.readSlice(str.size()), std::runtime_error);
+  ASSERT_EQ(7u, reader.position());
+}
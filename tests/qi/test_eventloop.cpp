@@ -1,7 +1,11 @@
+#include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <vector>
 #include <gtest/gtest.h>
 #include <qi/eventloop.hpp>
+#include <qi/os.hpp>
 #include "test_future.hpp"
 
 int ping(int v)
@@ -110,3 +114,175 @@ TEST(EventLoop, asyncFast)
     f.wait();
   }
 }
+
+namespace
+{
+  // Sets the scheduler of the event loops created in its scope.
+  class ScopedEventLoopScheduler
+  {
+  public:
+    explicit ScopedEventLoopScheduler(const std::string& scheduler)
+      : _previous(qi::os::getenv(envVar))
+    {
+      qi::os::setenv(envVar, scheduler.c_str());
+    }
+
+    ~ScopedEventLoopScheduler()
+    {
+      qi::os::setenv(envVar, _previous.c_str());
+    }
+
+  private:
+    static const char* const envVar;
+    const std::string _previous;
+  };
+
+  const char* const ScopedEventLoopScheduler::envVar = "QI_EVENTLOOP_SCHEDULER";
+}
+
+TEST(EventLoopWorkStealing, AsyncCallsFinish)
+{
+  ScopedEventLoopScheduler scheduler{"workstealing"};
+  qi::EventLoop loop{ gEventLoopName, 2 };
+
+  EXPECT_EQ(42, loop.async(get42).value(1000));
+  auto error = loop.async([]{ throw std::runtime_error("Voluntary Fail"); });
+  ASSERT_EQ(qi::FutureState_FinishedWithError, error.wait(1000));
+  EXPECT_EQ("Voluntary Fail", error.error());
+}
+
+TEST(EventLoopWorkStealing, DelayedCallsCanBeCanceled)
+{
+  ScopedEventLoopScheduler scheduler{"workstealing"};
+  qi::EventLoop loop{ gEventLoopName, 2 };
+
+  const auto beginTime = qi::SteadyClock::now();
+  auto callTime = beginTime;
+  auto f = loop.asyncDelay([&]{ callTime = qi::SteadyClock::now(); }, qi::MilliSeconds{ 20 });
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, f.wait(1000));
+  EXPECT_TRUE(callTime - beginTime >= qi::MilliSeconds{ 20 });
+
+  auto canceled = loop.asyncDelay([]{}, qi::Seconds{ 10 });
+  canceled.cancel();
+  EXPECT_EQ(qi::FutureState_Canceled, canceled.wait(1000));
+
+  EXPECT_EQ(qi::FutureState_FinishedWithValue,
+            loop.asyncAt([]{}, qi::SteadyClock::now() + qi::MilliSeconds{ 1 }).wait(1000));
+}
+
+TEST(EventLoopWorkStealing, IsInThisContextOnlyInWorkers)
+{
+  ScopedEventLoopScheduler scheduler{"workstealing"};
+  qi::EventLoop loop{ gEventLoopName, 2 };
+  qi::EventLoop other{ gEventLoopName, 1 };
+
+  EXPECT_FALSE(loop.isInThisContext());
+  EXPECT_TRUE(loop.async([&]{ return loop.isInThisContext(); }).value(1000));
+  EXPECT_FALSE(other.async([&]{ return loop.isInThisContext(); }).value(1000));
+}
+
+TEST(EventLoopWorkStealing, TasksPostedFromWorkersAreAllRun)
+{
+  ScopedEventLoopScheduler scheduler{"workstealing"};
+  qi::EventLoop loop{ gEventLoopName, 4 };
+
+  const int taskCount = 10000;
+  std::atomic<int> remaining{ taskCount };
+  qi::Promise<void> done;
+  loop.post([&] {
+    for (int i = 0; i != taskCount; ++i)
+      loop.post([&] {
+        if (--remaining == 0)
+          done.setValue(0);
+      });
+  });
+  EXPECT_EQ(qi::FutureState_FinishedWithValue, done.future().wait(10000));
+}
+
+TEST(EventLoopWorkStealing, SpawnsWorkersWhenBlocked)
+{
+  ScopedEventLoopScheduler scheduler{"workstealing"};
+  qi::EventLoop loop{ gEventLoopName, 1 };
+
+  // The only worker waits for a task it posted: it must be run by a new one.
+  auto f = loop.async([&] {
+    return loop.async(get42).value();
+  });
+  EXPECT_EQ(qi::FutureState_FinishedWithValue, f.wait(5000));
+}
+
+TEST(EventLoop, StatsReportThreadsSpawnedUnderLoad)
+{
+  qi::EventLoop loop{ gEventLoopName, 1 };
+  EXPECT_EQ(1, loop.stats().minThreadCount);
+
+  // Tasks wait for each other: they can only all run on new threads.
+  // They capture their state by copy, as they end after the test.
+  const int taskCount = 4;
+  auto started = std::make_shared<std::atomic<int>>(0);
+  qi::Promise<void> allStarted;
+  for (int i = 0; i != taskCount; ++i)
+  {
+    loop.post([=]() mutable {
+      if (++*started == taskCount)
+        allStarted.setValue(0);
+      allStarted.future().wait();
+    });
+  }
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, allStarted.future().wait(20000));
+
+  const auto stats = loop.stats();
+  EXPECT_GE(stats.threadCount, taskCount);
+  EXPECT_GE(stats.spawnedThreadCount, static_cast<qi::uint64_t>(taskCount - 1));
+  EXPECT_GE(stats.maxThreadCount, stats.threadCount);
+}
+
+TEST(EventLoop, StatsReportThreadsRetiredOnceIdle)
+{
+  qi::EventLoop loop{ gEventLoopName, 1 };
+
+  // Load the loop as above, so that it spawns threads, then let them go idle.
+  const int taskCount = 4;
+  auto started = std::make_shared<std::atomic<int>>(0);
+  qi::Promise<void> allStarted;
+  qi::Promise<void> release;
+  for (int i = 0; i != taskCount; ++i)
+  {
+    loop.post([=]() mutable {
+      if (++*started == taskCount)
+        allStarted.setValue(0);
+      release.future().wait();
+    });
+  }
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, allStarted.future().wait(20000));
+  const auto loaded = loop.stats();
+  ASSERT_GE(loaded.threadCount, taskCount);
+  release.setValue(0);
+
+  // A thread is retired after QI_EVENTLOOP_IDLE_RETIRE_MS (5 seconds by default).
+  for (int i = 0; i != 300 && loop.stats().retiredThreadCount == loaded.retiredThreadCount; ++i)
+    qi::os::msleep(100);
+  const auto idle = loop.stats();
+  EXPECT_GT(idle.retiredThreadCount, loaded.retiredThreadCount);
+  EXPECT_LT(idle.threadCount, loaded.threadCount);
+  EXPECT_GE(idle.threadCount, idle.minThreadCount);
+}
+
+TEST(EventLoopShardPolicy, RoundRobinTakesShardsInTurn)
+{
+  const std::vector<qi::EventLoopShardStats> shards{
+    {"shard0", 5, 5}, {"shard1", 0, 0}, {"shard2", 1, 1}};
+  auto policy = qi::roundRobinShardPolicy();
+  EXPECT_EQ(0u, policy(shards));
+  EXPECT_EQ(1u, policy(shards));
+  EXPECT_EQ(2u, policy(shards));
+  EXPECT_EQ(0u, policy(shards));
+}
+
+TEST(EventLoopShardPolicy, LeastLoadedTakesShardWithFewestConnections)
+{
+  auto policy = qi::leastLoadedShardPolicy();
+  EXPECT_EQ(1u, policy({{"shard0", 5, 5}, {"shard1", 0, 3}, {"shard2", 1, 1}}));
+  // On a tie, the shard which had the fewest connections.
+  EXPECT_EQ(2u, policy({{"shard0", 0, 5}, {"shard1", 1, 3}, {"shard2", 0, 1}}));
+}
@@ -0,0 +1,189 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <qi/eventloop.hpp>
+#include <qi/future.hpp>
+#include <qi/os.hpp>
+
+namespace
+{
+  std::atomic<long> allocationCount{0};
+}
+
+// Counts the allocations of the process, for the allocations per post.
+void* operator new(std::size_t size)
+{
+  ++allocationCount;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace
+{
+  const auto schedulerEnvVar = "QI_EVENTLOOP_SCHEDULER";
+
+  // Posts `spawnerCount` tasks, each of them posting its share of
+  // `taskCount` tiny tasks from inside the loop (fan-out). The last tiny task
+  // of each share reports it (fan-in), and the function returns when all the
+  // shares are done.
+  void fanOutFanIn(qi::EventLoop& loop, int spawnerCount, int taskCount)
+  {
+    const int tasksPerSpawner = taskCount / spawnerCount;
+    std::unique_ptr<std::atomic<int>[]> remainingTasks(new std::atomic<int>[spawnerCount]);
+    std::atomic<int> remainingSpawners{spawnerCount};
+    qi::Promise<void> done;
+    for (int s = 0; s != spawnerCount; ++s)
+    {
+      auto& remaining = remainingTasks[s];
+      remaining = tasksPerSpawner;
+      loop.post([&] {
+        for (int i = 0; i != tasksPerSpawner; ++i)
+        {
+          loop.post([&] {
+            if (--remaining == 0 && --remainingSpawners == 0)
+              done.setValue(0);
+          });
+        }
+      });
+    }
+    done.future().wait();
+  }
+}
+
+// Compares the schedulers of the event loop on 10 million tiny tasks, across
+// numbers of threads.
+TEST(EventLoop, BenchmarkFanOutFanInAcrossThreadCounts)
+{
+  using Clock = std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  const int taskCount = 10 * 1000 * 1000;
+  const int spawnerCount = 64;
+  const std::string previousScheduler = qi::os::getenv(schedulerEnvVar);
+  for (const std::string scheduler : { "asio", "workstealing" })
+  {
+    qi::os::setenv(schedulerEnvVar, scheduler.c_str());
+    for (int threadCount = 1; threadCount <= 64; threadCount *= 2)
+    {
+      qi::EventLoop loop{"BenchmarkEventLoop", threadCount, false};
+      const auto start = Clock::now();
+      fanOutFanIn(loop, spawnerCount, taskCount);
+      const auto duration = Clock::now() - start;
+      std::cout << scheduler << ", " << threadCount << " threads: "
+                << duration_cast<milliseconds>(duration).count() << " ms, "
+                << taskCount / (duration_cast<milliseconds>(duration).count() + 1) << " tasks/ms"
+                << std::endl;
+    }
+  }
+  qi::os::setenv(schedulerEnvVar, previousScheduler.c_str());
+}
+
+namespace
+{
+  // Posts or asyncs `taskCount` copies of `task`, and returns the number of
+  // allocations per task, measured once they have all run.
+  template<typename Task>
+  double allocationsPerTask(qi::EventLoop& loop, bool useAsync, Task task, int taskCount)
+  {
+    const long before = allocationCount.load();
+    for (int i = 0; i != taskCount; ++i)
+    {
+      if (useAsync)
+        loop.async(task);
+      else
+        loop.post(task);
+    }
+    loop.async([]{}).wait();
+    return static_cast<double>(allocationCount.load() - before) / taskCount;
+  }
+}
+
+// Reports the allocations done to post a task, depending on the size of the
+// callback: a small one fits the small buffer of boost::function, a big one
+// does not.
+TEST(EventLoop, BenchmarkAllocationsPerPost)
+{
+  struct Payload
+  {
+    char data[40];
+  };
+
+  const int taskCount = 100 * 1000;
+  const std::string previousScheduler = qi::os::getenv(schedulerEnvVar);
+  for (const std::string scheduler : { "asio", "workstealing" })
+  {
+    qi::os::setenv(schedulerEnvVar, scheduler.c_str());
+    qi::EventLoop loop{"BenchmarkEventLoop", 1, false};
+    std::atomic<int> counter{0};
+    Payload payload{};
+    const auto smallTask = [&counter] { ++counter; };
+    const auto bigTask = [&counter, payload] { counter += payload.data[0] + 1; };
+    // Warm up the pools of the loop.
+    allocationsPerTask(loop, false, smallTask, taskCount);
+    for (const bool useAsync : { false, true })
+    {
+      std::cout << scheduler << ", " << (useAsync ? "async" : "post") << ": "
+                << allocationsPerTask(loop, useAsync, smallTask, taskCount)
+                << " allocations/task (small callback), "
+                << allocationsPerTask(loop, useAsync, bigTask, taskCount)
+                << " allocations/task (big callback)" << std::endl;
+    }
+  }
+  qi::os::setenv(schedulerEnvVar, previousScheduler.c_str());
+}
+
+// Arms then cancels one million delayed calls, as call deadlines mostly are,
+// with the timer wheel and with an asio timer per call.
+TEST(EventLoop, BenchmarkArmedThenCanceledTimers)
+{
+  using Clock = std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  const auto timerWheelTickEnvVar = "QI_EVENTLOOP_TIMER_WHEEL_TICK_US";
+  const int timerCount = 1000 * 1000;
+  const std::string previousTick = qi::os::getenv(timerWheelTickEnvVar);
+  for (const std::string tick : { "1000", "0" })
+  {
+    qi::os::setenv(timerWheelTickEnvVar, tick.c_str());
+    qi::EventLoop loop{"BenchmarkEventLoop", 1, false};
+    std::vector<qi::Future<void>> futures;
+    futures.reserve(timerCount);
+    const auto start = Clock::now();
+    for (int i = 0; i != timerCount; ++i)
+      futures.push_back(loop.asyncDelay([]{}, qi::Seconds(10)));
+    const auto armed = Clock::now();
+    for (auto& future : futures)
+      future.cancel();
+    for (auto& future : futures)
+      ASSERT_EQ(qi::FutureState_Canceled, future.wait());
+    const auto canceled = Clock::now();
+    std::cout << (tick == "0" ? "asio timers" : "timer wheel") << ": armed in "
+              << duration_cast<milliseconds>(armed - start).count() << " ms, canceled in "
+              << duration_cast<milliseconds>(canceled - armed).count() << " ms" << std::endl;
+  }
+  qi::os::setenv(timerWheelTickEnvVar, previousTick.c_str());
+}
@@ -0,0 +1,88 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <qi/future.hpp>
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  // Runs `iteration` `count` times and prints the mean duration of one.
+  template<typename F>
+  void measure(const char* name, int count, F iteration)
+  {
+    const auto start = Clock::now();
+    for (int i = 0; i != count; ++i)
+      iteration(i);
+    const auto duration = Clock::now() - start;
+    std::cout << name << ": "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / count
+              << " ns" << std::endl;
+  }
+}
+
+// Measures the shared state of futures alone: continuations are synchronous
+// so that the event loop is not involved.
+TEST(Future, BenchmarkCreateSetThenWait)
+{
+  const int count = 1000 * 1000;
+
+  measure("create, set, value", count, [](int i) {
+    qi::Promise<int> promise;
+    promise.setValue(i);
+    ASSERT_EQ(i, promise.future().value());
+  });
+
+  measure("create, then, set, value", count, [](int i) {
+    qi::Promise<int> promise;
+    auto future = promise.future().then(qi::FutureCallbackType_Sync,
+                                        [](qi::Future<int> f) { return f.value() + 1; });
+    promise.setValue(i);
+    ASSERT_EQ(i + 1, future.value());
+  });
+
+  measure("create, set, then, value", count, [](int i) {
+    qi::Promise<int> promise;
+    promise.setValue(i);
+    auto future = promise.future().then(qi::FutureCallbackType_Sync,
+                                        [](qi::Future<int> f) { return f.value() + 1; });
+    ASSERT_EQ(i + 1, future.value());
+  });
+
+  const int chainLength = 10;
+  measure("chain of 10 continuations", count / chainLength, [=](int i) {
+    qi::Promise<int> promise;
+    auto future = promise.future();
+    for (int c = 0; c != chainLength; ++c)
+      future = future.andThen(qi::FutureCallbackType_Sync, [](int v) { return v + 1; });
+    promise.setValue(i);
+    ASSERT_EQ(i + chainLength, future.value());
+  });
+}
+
+// Measures a thread waiting for the futures set by another one, in turn.
+TEST(Future, BenchmarkWaitAcrossThreads)
+{
+  const int count = 100 * 1000;
+  std::vector<qi::Promise<int>> promises(count);
+  std::vector<qi::Promise<void>> ready(count);
+  std::thread setter([&] {
+    for (int i = 0; i != count; ++i)
+    {
+      ready[i].future().wait();
+      promises[i].setValue(i);
+    }
+  });
+  measure("set by another thread, wait", count, [&](int i) {
+    ready[i].setValue(0);
+    ASSERT_EQ(qi::FutureState_FinishedWithValue, promises[i].future().wait());
+  });
+  setter.join();
+}
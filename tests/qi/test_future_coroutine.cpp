@@ -0,0 +1,145 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <qi/coroutine.hpp>
+
+#if QI_HAS_COROUTINES
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <gtest/gtest.h>
+#include <qi/future.hpp>
+#include <qi/strand.hpp>
+
+namespace
+{
+  qi::Future<int> addAwaited(qi::Future<int> a, qi::Future<int> b)
+  {
+    const int x = co_await a;
+    const int y = co_await b;
+    co_return x + y;
+  }
+
+  qi::Future<void> awaitVoid(qi::Future<void> f, bool& done)
+  {
+    co_await f;
+    done = true;
+  }
+
+  qi::Future<bool> awaitOnStrand(qi::Strand& strand, qi::Future<int> f)
+  {
+    co_await qi::resumeOn(strand);
+    co_await f;
+    co_return strand.isInThisContext();
+  }
+
+  qi::Future<int> throwAfterAwait(qi::Future<int> f)
+  {
+    co_await f;
+    throw std::runtime_error("coroutine error");
+  }
+}
+
+TEST(FutureCoroutine, AwaitsReadyAndPendingFutures)
+{
+  qi::Promise<int> pending;
+  auto sum = addAwaited(qi::Future<int>(40), pending.future());
+  EXPECT_TRUE(sum.isRunning());
+  pending.setValue(2);
+  EXPECT_EQ(42, sum.value(5000));
+
+  qi::Promise<void> promise;
+  bool done = false;
+  auto f = awaitVoid(promise.future(), done);
+  EXPECT_FALSE(done);
+  promise.setValue(nullptr);
+  EXPECT_EQ(qi::FutureState_FinishedWithValue, f.wait(5000));
+  EXPECT_TRUE(done);
+}
+
+TEST(FutureCoroutine, ResumesOnItsExecutionContext)
+{
+  qi::Strand strand;
+  qi::Promise<int> promise;
+  auto onStrand = awaitOnStrand(strand, promise.future());
+  // Set from a thread which is not in the strand.
+  qi::async([=]() mutable { promise.setValue(1); });
+  EXPECT_TRUE(onStrand.value(5000));
+}
+
+TEST(FutureCoroutine, ErrorsArePropagated)
+{
+  qi::Promise<int> failing;
+  auto sum = addAwaited(failing.future(), qi::Future<int>(1));
+  failing.setError("awaited error");
+  EXPECT_EQ("awaited error", sum.error(5000));
+
+  auto thrown = throwAfterAwait(qi::Future<int>(1));
+  EXPECT_EQ("coroutine error", thrown.error(5000));
+}
+
+TEST(FutureCoroutine, CancelIsForwardedToTheAwaitedPromise)
+{
+  std::atomic<bool> cancelRequested{false};
+  qi::Promise<int> awaited([&](qi::Promise<int> p) {
+    cancelRequested = true;
+    p.setCanceled();
+  });
+  auto sum = addAwaited(awaited.future(), qi::Future<int>(1));
+  sum.cancel();
+  EXPECT_TRUE(cancelRequested);
+  EXPECT_EQ(qi::FutureState_Canceled, sum.wait(5000));
+}
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  const int pipelineLength = 10;
+
+  // One step of the pipeline: an asynchronous call on the event loop.
+  qi::Future<int> step(int v)
+  {
+    return qi::async([v] { return v + 1; });
+  }
+
+  qi::Future<int> pipelineWithThen(int v)
+  {
+    auto f = step(v);
+    for (int i = 1; i != pipelineLength; ++i)
+      f = f.andThen([](int v) { return step(v); }).unwrap();
+    return f;
+  }
+
+  qi::Future<int> pipelineWithCoroutine(int v)
+  {
+    for (int i = 0; i != pipelineLength; ++i)
+      v = co_await step(v);
+    co_return v;
+  }
+
+  template<typename Pipeline>
+  void measurePipeline(const char* name, int count, Pipeline pipeline)
+  {
+    const auto start = Clock::now();
+    for (int i = 0; i != count; ++i)
+      ASSERT_EQ(i + pipelineLength, pipeline(i).value());
+    const auto duration = Clock::now() - start;
+    std::cout << name << ": "
+              << std::chrono::duration_cast<std::chrono::microseconds>(duration).count() / count
+              << " us per pipeline of " << pipelineLength << " steps" << std::endl;
+  }
+}
+
+TEST(FutureCoroutine, BenchmarkThenChainVersusCoroutine)
+{
+  const int count = 10 * 1000;
+  measurePipeline("then() chain", count, &pipelineWithThen);
+  measurePipeline("coroutine", count, &pipelineWithCoroutine);
+}
+
+#endif  // QI_HAS_COROUTINES
@@ -17,6 +17,8 @@
 #include <qi/testutils/testutils.hpp>
 #include <gtest/gtest.h>
 #include <thread>
+#include <vector>
+#include <iostream>
 
 qiLogCategory("test");
 
@@ -687,3 +689,73 @@ TEST(TestStrand, LastStrandedThenContinuationCalledWhenCanceled)
   EXPECT_EQ(expectedSequence, executionSequence);
   EXPECT_TRUE(canceledAsExpected);
 }
+
+TEST(TestStrand, CanceledNeverSkippedJobIsFinishedWhenJoined)
+{
+  qi::Strand strand;
+  qi::Promise<void> blockerStarted;
+  qi::Promise<void> unblock;
+  strand.defer([&] {
+    blockerStarted.setValue(nullptr);
+    unblock.future().wait();
+  });
+  ASSERT_EQ(qi::FutureState_FinishedWithValue, blockerStarted.future().wait(qi::Seconds(5)));
+
+  // The job is queued behind the blocker, cancel() lets it be.
+  auto job = strand.defer([]{}, qi::MicroSeconds::zero(),
+                          qi::ExecutionOptions{ qi::CancelOption::NeverSkipExecution });
+  job.cancel();
+
+  std::thread joiner([&] { strand.join(); });
+  // Let the strand be dying before the blocker returns, so that the job is
+  // failed by join() rather than run.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  unblock.setValue(nullptr);
+  joiner.join();
+  EXPECT_NE(qi::FutureState_Running, job.wait(qi::Seconds(5)));
+}
+
+TEST(TestStrand, BenchmarkContention)
+{
+  using Clock = std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  const int jobCountPerThread = 20 * 1000;
+  // Posted jobs only, then half the jobs posted and the other half with a
+  // future.
+  for (const bool mixed : {false, true})
+  {
+    std::cout << (mixed ? "mixed post/async:" : "post only:") << std::endl;
+    for (int threadCount = 1; threadCount <= 16; threadCount *= 2)
+    {
+      qi::Strand strand;
+      int counter = 0;
+      const auto start = Clock::now();
+      std::vector<std::thread> threads;
+      for (int t = 0; t != threadCount; ++t)
+      {
+        threads.emplace_back([&] {
+          for (int i = 0; i != jobCountPerThread; ++i)
+          {
+            if (mixed && i % 2 == 0)
+              strand.async([&] { ++counter; });
+            else
+              strand.post([&] { ++counter; });
+          }
+        });
+      }
+      for (auto& thread : threads)
+        thread.join();
+      strand.async([]{}).wait();
+      const auto duration = Clock::now() - start;
+
+      const int jobCount = threadCount * jobCountPerThread;
+      EXPECT_EQ(jobCount, counter);
+      std::cout << "  " << threadCount << " threads: "
+                << duration_cast<milliseconds>(duration).count() << " ms, "
+                << jobCount / (duration_cast<milliseconds>(duration).count() + 1) << " jobs/ms"
+                << std::endl;
+    }
+  }
+}
@@ -0,0 +1,190 @@
+/*
+**  Copyright (C) 2018 Softbank Robotics Europe
+**  See COPYING for the license
+*/
+
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <gtest/gtest.h>
+#include <qi/clock.hpp>
+#include "../../src/timerwheel_p.hpp"
+
+using Tick = qi::TimerWheel::Tick;
+
+namespace
+{
+  // Returns a handler recording the error it is called with in `results`.
+  qi::TimerWheel::Handler recordIn(std::map<int, boost::system::error_code>& results, int id)
+  {
+    return [&results, id](const boost::system::error_code& erc) { results[id] = erc; };
+  }
+
+  void runAll(std::vector<qi::TimerWheel::Handler>& handlers)
+  {
+    for (auto& handler : handlers)
+      handler(boost::system::error_code());
+    handlers.clear();
+  }
+}
+
+TEST(TestTimerWheel, TimerExpiresAtItsTick)
+{
+  qi::TimerWheel wheel;
+  std::map<int, boost::system::error_code> results;
+  std::vector<qi::TimerWheel::Handler> expired;
+  wheel.add(10, recordIn(results, 1));
+  EXPECT_EQ(Tick{10}, *wheel.nextTick());
+
+  wheel.advance(9, expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.advance(10, expired);
+  ASSERT_EQ(1u, expired.size());
+  runAll(expired);
+  EXPECT_EQ(1u, results.count(1));
+  EXPECT_TRUE(wheel.empty());
+  EXPECT_FALSE(wheel.nextTick());
+}
+
+TEST(TestTimerWheel, PastTickExpiresOnNextAdvance)
+{
+  qi::TimerWheel wheel;
+  std::vector<qi::TimerWheel::Handler> expired;
+  wheel.advance(100, expired);
+  wheel.add(50, [](const boost::system::error_code&) {});
+  EXPECT_EQ(Tick{101}, *wheel.nextTick());
+  wheel.advance(101, expired);
+  EXPECT_EQ(1u, expired.size());
+}
+
+TEST(TestTimerWheel, RemovedTimerDoesNotExpire)
+{
+  qi::TimerWheel wheel;
+  std::map<int, boost::system::error_code> results;
+  std::vector<qi::TimerWheel::Handler> expired;
+  const auto first = wheel.add(5000, recordIn(results, 1));
+  wheel.add(5000, recordIn(results, 2));
+
+  qi::TimerWheel::Handler handler;
+  EXPECT_TRUE(wheel.remove(first, handler));
+  EXPECT_TRUE(handler);
+  EXPECT_FALSE(wheel.remove(first, handler));
+  EXPECT_EQ(1u, wheel.size());
+
+  // The node of the removed timer is reused, its handle must not match.
+  const auto third = wheel.add(6000, recordIn(results, 3));
+  EXPECT_FALSE(wheel.remove(first, handler));
+
+  wheel.advance(6000, expired);
+  runAll(expired);
+  EXPECT_EQ(0u, results.count(1));
+  EXPECT_EQ(1u, results.count(2));
+  EXPECT_EQ(1u, results.count(3));
+  EXPECT_FALSE(wheel.remove(third, handler));
+}
+
+// Compares the wheel with a multimap on random timers spanning all the levels
+// and beyond, advancing by random steps or straight to the next tick.
+TEST(TestTimerWheel, TimersExpireInOrderAcrossLevels)
+{
+  qi::TimerWheel wheel;
+  std::multimap<Tick, int> reference;
+  std::map<int, qi::TimerWheel::Handle> handles;
+  std::map<int, boost::system::error_code> results;
+  std::vector<qi::TimerWheel::Handler> expired;
+  std::mt19937_64 generator(42);
+  Tick now = 0;
+  int nextId = 0;
+  for (int i = 0; i != 20000; ++i)
+  {
+    switch (generator() % 4)
+    {
+    case 0:
+    {
+      // Delays of any magnitude, up to twice the range of the wheel.
+      const Tick delay = generator() % (Tick(1) << (generator() % 32));
+      const int id = nextId++;
+      handles[id] = wheel.add(now + 1 + delay, recordIn(results, id));
+      reference.emplace(now + 1 + delay, id);
+      break;
+    }
+    case 1:
+    {
+      if (reference.empty())
+        break;
+      auto it = reference.begin();
+      std::advance(it, generator() % reference.size());
+      qi::TimerWheel::Handler handler;
+      ASSERT_TRUE(wheel.remove(handles[it->second], handler));
+      reference.erase(it);
+      break;
+    }
+    default:
+    {
+      const auto next = wheel.nextTick();
+      ASSERT_EQ(!reference.empty(), static_cast<bool>(next));
+      if (!next)
+        break;
+      // The wheel never asks to wake up after a timer expires.
+      ASSERT_LE(*next, reference.begin()->first);
+      now = (generator() % 2) ? *next : now + generator() % 100;
+      wheel.advance(now, expired);
+      runAll(expired);
+      while (!reference.empty() && reference.begin()->first <= now)
+      {
+        ASSERT_EQ(1u, results.erase(reference.begin()->second));
+        reference.erase(reference.begin());
+      }
+      ASSERT_TRUE(results.empty());
+      break;
+    }
+    }
+    ASSERT_EQ(reference.size(), wheel.size());
+  }
+}
+
+TEST(TestTimerWheelScheduler, CallsOrCancelsTimers)
+{
+  boost::asio::io_service io;
+  qi::TimerWheelScheduler scheduler(io, qi::MilliSeconds(1), qi::MilliSeconds(1),
+                                    [](qi::TimerWheel::Handler& handler) {
+                                      handler(boost::system::error_code());
+                                    });
+  std::map<int, boost::system::error_code> results;
+  std::map<int, qi::SteadyClockTimePoint> calledAt;
+  const auto start = qi::SteadyClock::now();
+  const auto deadline = start + qi::MilliSeconds(20);
+  scheduler.add(deadline, [&](const boost::system::error_code& erc) {
+    results[1] = erc;
+    calledAt[1] = qi::SteadyClock::now();
+  });
+  auto cancel = scheduler.add(deadline, recordIn(results, 2));
+  cancel();
+  ASSERT_EQ(1u, results.count(2));
+  EXPECT_EQ(boost::asio::error::operation_aborted, results[2]);
+  cancel();
+
+  io.run();
+  ASSERT_EQ(1u, results.count(1));
+  EXPECT_FALSE(results[1]);
+  EXPECT_GE(calledAt[1], deadline);
+}
+
+TEST(TestTimerWheelScheduler, DelaysShorterThanATickAreNotHandled)
+{
+  boost::asio::io_service io;
+  const auto dispatch = [](qi::TimerWheel::Handler& handler) {
+    handler(boost::system::error_code());
+  };
+  qi::TimerWheelScheduler scheduler(io, qi::MilliSeconds(10), qi::MilliSeconds(1), dispatch);
+  EXPECT_FALSE(scheduler.handles(qi::MicroSeconds(500)));
+  EXPECT_FALSE(scheduler.handles(qi::MilliSeconds(5)));
+  EXPECT_TRUE(scheduler.handles(qi::MilliSeconds(10)));
+  EXPECT_TRUE(scheduler.handles(qi::Seconds(10)));
+
+  qi::TimerWheelScheduler preciseScheduler(io, qi::MilliSeconds(1), qi::MilliSeconds(20), dispatch);
+  EXPECT_FALSE(preciseScheduler.handles(qi::MilliSeconds(10)));
+  EXPECT_TRUE(preciseScheduler.handles(qi::MilliSeconds(20)));
+}
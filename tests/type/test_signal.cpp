@@ -14,7 +14,10 @@
 #include <qi/application.hpp>
 #include <qi/type/objecttypebuilder.hpp>
 #include <qi/type/dynamicobjectbuilder.hpp>
+#include <atomic>
+#include <chrono>
 #include <future>
+#include <iostream>
 
 qiLogCategory("test");
 
@@ -493,6 +496,32 @@ TEST(TestSignal, WithExecutionContext)
   ASSERT_TRUE(prom.future().value());
 }
 
+// Emits a sensor-like signal to direct subscribers, as a 1 kHz stream would,
+// and reports the emits per millisecond, depending on the subscriber count.
+TEST(TestSignal, BenchmarkEmitThroughput)
+{
+  using Clock = std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  const int emitCount = 200 * 1000;
+  for (const int subscriberCount : { 1, 4, 16 })
+  {
+    qi::Signal<int, double> signal;
+    std::atomic<long> calls{0};
+    for (int i = 0; i != subscriberCount; ++i)
+      signal.connect([&calls](int, double) { ++calls; }).setCallType(qi::MetaCallType_Direct);
+
+    const auto start = Clock::now();
+    for (int i = 0; i != emitCount; ++i)
+      signal(i, 0.5);
+    const auto duration = duration_cast<milliseconds>(Clock::now() - start).count();
+    EXPECT_EQ(static_cast<long>(emitCount) * subscriberCount, calls.load());
+    std::cout << subscriberCount << " subscribers: " << emitCount / (duration + 1)
+              << " emits/ms" << std::endl;
+  }
+}
+
 // ===========================================================
 // Signal Spy
 // -----------------------------------------------------------